@@ -0,0 +1,141 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace MBMS_RT::Bench {
+  /**
+   * Collects latency samples (microseconds) and byte counts from several threads.
+   */
+  class LatencyRecorder {
+    public:
+      void record(std::chrono::microseconds latency, uint64_t bytes) {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        _samples.push_back(static_cast<uint32_t>(std::min<int64_t>(latency.count(), UINT32_MAX)));
+        _bytes += bytes;
+      };
+      void record_error() {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        _errors++;
+      };
+
+      struct Summary {
+        uint64_t count = 0;
+        uint64_t errors = 0;
+        uint64_t bytes = 0;
+        double p50_ms = 0;
+        double p99_ms = 0;
+        double p999_ms = 0;
+        double max_ms = 0;
+      };
+
+      Summary summary() const {
+        std::vector<uint32_t> samples;
+        Summary s;
+        {
+          const std::lock_guard<std::mutex> lock(_mutex);
+          samples = _samples;
+          s.errors = _errors;
+          s.bytes = _bytes;
+        }
+        s.count = samples.size();
+        if (!samples.empty()) {
+          std::sort(samples.begin(), samples.end());
+          auto at = [&samples](double q) {
+            auto idx = static_cast<size_t>(q * (samples.size() - 1) + 0.5);
+            return samples[idx] / 1000.0;
+          };
+          s.p50_ms = at(0.5);
+          s.p99_ms = at(0.99);
+          s.p999_ms = at(0.999);
+          s.max_ms = samples.back() / 1000.0;
+        }
+        return s;
+      };
+
+    private:
+      mutable std::mutex _mutex;
+      std::vector<uint32_t> _samples;
+      uint64_t _errors = 0;
+      uint64_t _bytes = 0;
+  };
+
+  /**
+   * CPU time and memory of a process, read from /proc. pid 0 is the calling process.
+   */
+  struct ProcessUsage {
+    double cpu_seconds = 0;   /**< user + system */
+    uint64_t rss_kb = 0;      /**< VmRSS */
+    uint64_t peak_rss_kb = 0; /**< VmHWM */
+
+    static ProcessUsage of(pid_t pid = 0) {
+      ProcessUsage usage;
+      std::string proc = pid == 0 ? "/proc/self" : "/proc/" + std::to_string(pid);
+      if (pid == 0) {
+        struct rusage ru = {};
+        getrusage(RUSAGE_SELF, &ru);
+        usage.cpu_seconds = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+          ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+      } else {
+        std::ifstream stat(proc + "/stat");
+        std::string content((std::istreambuf_iterator<char>(stat)), std::istreambuf_iterator<char>());
+        // the command name can contain spaces, fields are counted from the closing parenthesis (field 2)
+        auto pos = content.rfind(')');
+        if (pos != std::string::npos) {
+          std::istringstream fields(content.substr(pos + 2));
+          std::string field;
+          unsigned long utime = 0;
+          unsigned long stime = 0;
+          for (int i = 3; i <= 15 && fields >> field; i++) {
+            if (i == 14) utime = std::stoul(field);
+            if (i == 15) stime = std::stoul(field);
+          }
+          usage.cpu_seconds = static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+        }
+      }
+      std::ifstream status(proc + "/status");
+      std::string line;
+      while (std::getline(status, line)) {
+        if (line.rfind("VmRSS:", 0) == 0) {
+          usage.rss_kb = std::stoull(line.substr(6));
+        } else if (line.rfind("VmHWM:", 0) == 0) {
+          usage.peak_rss_kb = std::stoull(line.substr(6));
+        }
+      }
+      return usage;
+    };
+  };
+
+  inline void print_summary(const std::string& name, const LatencyRecorder::Summary& s, double seconds) {
+    printf("%-10s %10lu req %8.1f req/s %9.2f MB/s  p50 %8.3f ms  p99 %8.3f ms  p999 %8.3f ms  max %8.3f ms  "
+        "errors %lu\n", name.c_str(), static_cast<unsigned long>(s.count), s.count / seconds,
+        s.bytes / seconds / 1e6, s.p50_ms, s.p99_ms, s.p999_ms, s.max_ms, static_cast<unsigned long>(s.errors));
+  }
+}
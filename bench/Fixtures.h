@@ -0,0 +1,70 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#pragma once
+
+#include <cstdio>
+#include <ctime>
+#include <string>
+
+namespace MBMS_RT::Bench {
+  /**
+   * A live Low-Latency HLS media playlist as the CDN serves it: fMP4 segments of 2 s with program date-times,
+   * parts of the newest segments, a discontinuity every 500 segments, a preload hint and rendition reports.
+   *
+   * @param segments number of listed segments
+   * @param parts_segments number of newest segments that also list their parts (four per segment)
+   */
+  inline auto hls_media_playlist(unsigned segments, unsigned parts_segments = 3) -> std::string {
+    std::string out;
+    out.reserve(segments * 200 + parts_segments * 400 + 512);
+    out += "#EXTM3U\n#EXT-X-VERSION:9\n#EXT-X-TARGETDURATION:2\n#EXT-X-PART-INF:PART-TARGET=0.5\n"
+           "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=1.5,CAN-SKIP-UNTIL=12.0\n"
+           "#EXT-X-MEDIA-SEQUENCE:100000\n#EXT-X-DISCONTINUITY-SEQUENCE:3\n"
+           "#EXT-X-KEY:METHOD=SAMPLE-AES,URI=\"skd://key-1\",KEYFORMAT=\"com.apple.streamingkeydelivery\"\n"
+           "#EXT-X-MAP:URI=\"init-video-1080p.mp4\"\n";
+    char line[256];
+    time_t start = 1700000000;
+    for (unsigned i = 0; i < segments; i++) {
+      auto seq = 100000 + i;
+      if (i > 0 && i % 500 == 0) {
+        out += "#EXT-X-DISCONTINUITY\n";
+      }
+      time_t t = start + 2 * i;
+      struct tm tm = {};
+      gmtime_r(&t, &tm);
+      strftime(line, sizeof(line), "#EXT-X-PROGRAM-DATE-TIME:%Y-%m-%dT%H:%M:%S.000Z\n", &tm);
+      out += line;
+      if (i + parts_segments >= segments) {
+        for (unsigned p = 0; p < 4; p++) {
+          snprintf(line, sizeof(line), "#EXT-X-PART:DURATION=0.50000,URI=\"video-1080p-%u.%u.m4s\"%s\n", seq, p,
+                   p == 0 ? ",INDEPENDENT=YES" : "");
+          out += line;
+        }
+      }
+      snprintf(line, sizeof(line), "#EXTINF:2.00000,\nvideo-1080p-%u.m4s\n", seq);
+      out += line;
+    }
+    auto next = 100000 + segments;
+    snprintf(line, sizeof(line), "#EXT-X-PART:DURATION=0.50000,URI=\"video-1080p-%u.0.m4s\",INDEPENDENT=YES\n"
+             "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"video-1080p-%u.1.m4s\"\n"
+             "#EXT-X-RENDITION-REPORT:URI=\"../720p/index.m3u8\",LAST-MSN=%u,LAST-PART=0\n", next, next, next);
+    out += line;
+    return out;
+  }
+}
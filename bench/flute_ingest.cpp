@@ -0,0 +1,542 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+// FLUTE ingestion benchmark: a LibFlute transmitter sends a synthetic session (or the files of a directory) over
+// loopback multicast, through a relay that drops and reorders packets. By default the packets are received by a
+// ContentStream in-process, the same way a stream of a local service (mw.local_service) is received, and stored
+// in the cache. With --send-only, a running mw receives them instead.
+
+#include <argp.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <libconfig.h++>
+#include <boost/asio.hpp>
+
+#include "spdlog/spdlog.h"
+
+#include "File.h"
+#include "Transmitter.h"
+#include "CacheManagement.h"
+#include "ContentStream.h"
+#include "BenchStats.h"
+
+static char doc[] = "5G-MAG-RT MBMS Middleware FLUTE ingestion benchmark";  // NOLINT
+
+static struct argp_option options[] = {  // NOLINT
+    {"bitrate", 'b', "KBPS", 0, "Transmission rate in kbit/s (default: 20000)", 0},
+    {"object-size", 's', "KB", 0, "Size of the synthetic objects (default: 500)", 0},
+    {"files", 'f', "DIR", 0, "Send the files in DIR (e.g. recorded segments) in a loop instead of synthetic objects", 0},
+    {"loss", 'x', "PERCENT", 0, "Packet loss rate (default: 0)", 0},
+    {"burst", 'B', "N", 0, "Mean length of a loss burst in packets (default: 1)", 0},
+    {"reorder", 'o', "PERCENT", 0, "Share of packets that are delivered late (default: 0)", 0},
+    {"reorder-depth", 'O', "N", 0, "Late packets are overtaken by up to N packets (default: 8)", 0},
+    {"mtu", 'm', "BYTES", 0, "MTU of the FLUTE session (default: 1500)", 0},
+    {"address", 'a', "ADDR:PORT", 0, "Multicast destination (default: 238.1.1.95:40085)", 0},
+    {"interface", 'i', "IF", 0, "Address of the interface to send and receive on (default: 127.0.0.1)", 0},
+    {"tsi", 'T', "TSI", 0, "TSI of the FLUTE session (default: 1)", 0},
+    {"duration", 'd', "SECS", 0, "Measurement duration (default: 30)", 0},
+    {"warmup", 'w', "SECS", 0, "Time before measuring starts (default: 5)", 0},
+    {"threads", 't', "N", 0, "io threads for the receiving side (default: 2)", 0},
+    {"seed", 'S', "N", 0, "Seed for the loss and reordering pattern (default: 1)", 0},
+    {"config", 'c', "FILE", 0, "mw configuration file for cache and reassembly settings", 0},
+    {"send-only", 'e', nullptr, 0, "Only send, for a running mw configured with a local service", 0},
+    {"server-pid", 'p', "PID", 0, "Process to report CPU and memory usage for (default: this process)", 0},
+    {"log-level", 'l', "LEVEL", 0, "Log verbosity: 0 = trace ... 6 = none. Default: 3.", 0},
+    {nullptr, 0, nullptr, 0, nullptr, 0}};
+
+/**
+ * Holds all options passed on the command line
+ */
+struct bench_arguments {
+  unsigned bitrate = 20000;
+  unsigned object_size = 500;
+  const char* files = nullptr;
+  double loss = 0;
+  unsigned burst = 1;
+  double reorder = 0;
+  unsigned reorder_depth = 8;
+  unsigned short mtu = 1500;
+  std::string mcast_address = "238.1.1.95";
+  unsigned short mcast_port = 40085;
+  std::string iface = "127.0.0.1";
+  unsigned long long tsi = 1;
+  unsigned duration = 30;
+  unsigned warmup = 5;
+  unsigned threads = 2;
+  unsigned seed = 1;
+  const char* config_file = nullptr;
+  bool send_only = false;
+  pid_t server_pid = 0;
+  unsigned log_level = 3;
+};
+
+static auto parse_opt(int key, char *arg, struct argp_state *state) -> error_t {
+  auto arguments = static_cast<struct bench_arguments *>(state->input);
+  auto number = [arg]() { return static_cast<unsigned>(strtoul(arg, nullptr, 10)); };
+  switch (key) {
+    case 'b': arguments->bitrate = std::max(1U, number()); break;
+    case 's': arguments->object_size = std::max(1U, number()); break;
+    case 'f': arguments->files = arg; break;
+    case 'x': arguments->loss = strtod(arg, nullptr) / 100.0; break;
+    case 'B': arguments->burst = std::max(1U, number()); break;
+    case 'o': arguments->reorder = strtod(arg, nullptr) / 100.0; break;
+    case 'O': arguments->reorder_depth = std::max(1U, number()); break;
+    case 'm': arguments->mtu = static_cast<unsigned short>(number()); break;
+    case 'a': {
+      std::string address(arg);
+      auto colon = address.find(':');
+      if (colon == std::string::npos) {
+        argp_error(state, "address must be ADDR:PORT");
+      }
+      arguments->mcast_address = address.substr(0, colon);
+      arguments->mcast_port = static_cast<unsigned short>(strtoul(address.c_str() + colon + 1, nullptr, 10));
+      break;
+    }
+    case 'i': arguments->iface = arg; break;
+    case 'T': arguments->tsi = strtoull(arg, nullptr, 10); break;
+    case 'd': arguments->duration = number(); break;
+    case 'w': arguments->warmup = number(); break;
+    case 't': arguments->threads = std::max(1U, number()); break;
+    case 'S': arguments->seed = number(); break;
+    case 'c': arguments->config_file = arg; break;
+    case 'e': arguments->send_only = true; break;
+    case 'p': arguments->server_pid = static_cast<pid_t>(strtol(arg, nullptr, 10)); break;
+    case 'l': arguments->log_level = number(); break;
+    default:
+      return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
+
+static struct argp argp = {options, parse_opt, nullptr, doc, nullptr, nullptr, nullptr};
+
+namespace {
+  /**
+   * Matches the time an object has been sent completely with the time it has been received, for every object
+   * sent while measuring.
+   */
+  class Tracker {
+    public:
+      void sent(const std::string& location, size_t length) {
+        auto now = std::chrono::steady_clock::now();
+        const std::lock_guard<std::mutex> lock(_mutex);
+        if (!_measuring) return;
+        _sent_objects++;
+        _sent_bytes += length;
+        auto& times = _objects[location];
+        times.sent = now;
+        complete(location, times);
+      };
+
+      void received(const std::string& location, size_t length) {
+        auto now = std::chrono::steady_clock::now();
+        const std::lock_guard<std::mutex> lock(_mutex);
+        if (_measuring) {
+          _received_objects++;
+          _received_bytes += length;
+        } else if (_objects.find(location) == _objects.end()) {
+          return;
+        }
+        auto& times = _objects[location];
+        times.received = now;
+        complete(location, times);
+      };
+
+      /**
+       * After measuring, objects that are still on their way are matched but not counted.
+       */
+      void set_measuring(bool measuring) {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        _measuring = measuring;
+      };
+
+      /**
+       * Objects sent while measuring that have not been received
+       */
+      uint64_t missing() const {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        uint64_t missing = 0;
+        for (const auto& object : _objects) {
+          if (object.second.sent != std::chrono::steady_clock::time_point{}) missing++;
+        }
+        return missing;
+      };
+
+      uint64_t sent_objects() const { return _sent_objects; };
+      uint64_t sent_bytes() const { return _sent_bytes; };
+      uint64_t received_objects() const { return _received_objects; };
+      uint64_t received_bytes() const { return _received_bytes; };
+      const MBMS_RT::Bench::LatencyRecorder& latency() const { return _latency; };
+
+    private:
+      struct Times {
+        std::chrono::steady_clock::time_point sent;
+        std::chrono::steady_clock::time_point received;
+      };
+
+      void complete(const std::string& location, const Times& times) {
+        if (times.sent == std::chrono::steady_clock::time_point{} ||
+            times.received == std::chrono::steady_clock::time_point{}) {
+          return;
+        }
+        // the receiver can complete an object before the transmitter reports it as sent
+        _latency.record(std::max(std::chrono::microseconds(0), std::chrono::duration_cast<std::chrono::microseconds>(
+                times.received - times.sent)), 0);
+        _objects.erase(location);
+      };
+
+      mutable std::mutex _mutex;
+      bool _measuring = false;
+      std::map<std::string, Times> _objects;
+      std::atomic<uint64_t> _sent_objects = {0};
+      std::atomic<uint64_t> _sent_bytes = {0};
+      std::atomic<uint64_t> _received_objects = {0};
+      std::atomic<uint64_t> _received_bytes = {0};
+      MBMS_RT::Bench::LatencyRecorder _latency;
+  };
+
+  /**
+   * Forwards the packets of the transmitter to the multicast group, dropping (Gilbert model: a loss starts a burst
+   * of mean length `burst`) and delaying some of them.
+   */
+  class Relay {
+    public:
+      Relay(boost::asio::io_service& io, const bench_arguments& args)
+        : _socket(io, boost::asio::ip::udp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0))
+        , _destination(boost::asio::ip::address::from_string(args.mcast_address), args.mcast_port)
+        , _rng(args.seed)
+        , _loss(args.loss)
+        , _burst(args.burst)
+        , _reorder(args.reorder)
+        , _reorder_depth(args.reorder_depth)
+      {
+        _socket.set_option(boost::asio::ip::multicast::outbound_interface(
+              boost::asio::ip::address::from_string(args.iface).to_v4()));
+        _socket.set_option(boost::asio::ip::multicast::enable_loopback(true));
+        receive();
+      };
+
+      unsigned short port() const { return _socket.local_endpoint().port(); };
+      uint64_t packets() const { return _packets; };
+      uint64_t dropped() const { return _dropped; };
+      uint64_t reordered() const { return _reordered; };
+
+    private:
+      struct Held {
+        unsigned release_after;
+        std::vector<char> data;
+      };
+
+      void receive() {
+        _socket.async_receive(boost::asio::buffer(_buffer), [this](const boost::system::error_code& ec, size_t length) {
+          if (ec) return;
+          forward(length);
+          receive();
+        });
+      };
+
+      void forward(size_t length) {
+        _packets++;
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        if (_in_burst) {
+          _in_burst = uniform(_rng) >= 1.0 / _burst;
+        } else if (_loss > 0) {
+          _in_burst = uniform(_rng) < _loss / _burst;
+        }
+        if (_in_burst) {
+          _dropped++;
+          return;
+        }
+        if (_reorder > 0 && uniform(_rng) < _reorder) {
+          _reordered++;
+          std::uniform_int_distribution<unsigned> depth(1, _reorder_depth);
+          _held.push_back({depth(_rng), std::vector<char>(_buffer.begin(), _buffer.begin() + length)});
+          return;
+        }
+        send(_buffer.data(), length);
+        for (auto it = _held.begin(); it != _held.end();) {
+          if (--it->release_after == 0) {
+            send(it->data.data(), it->data.size());
+            it = _held.erase(it);
+          } else {
+            ++it;
+          }
+        }
+      };
+
+      void send(const char* data, size_t length) {
+        boost::system::error_code ec;
+        _socket.send_to(boost::asio::buffer(data, length), _destination, 0, ec);
+        if (ec) {
+          spdlog::warn("Relay: cannot send to {}: {}", _destination.address().to_string(), ec.message());
+        }
+      };
+
+      boost::asio::ip::udp::socket _socket;
+      boost::asio::ip::udp::endpoint _destination;
+      std::array<char, 65536> _buffer = {};
+      std::mt19937 _rng;
+      double _loss;
+      unsigned _burst;
+      double _reorder;
+      unsigned _reorder_depth;
+      bool _in_burst = false;
+      std::deque<Held> _held;
+      std::atomic<uint64_t> _packets = {0};
+      std::atomic<uint64_t> _dropped = {0};
+      std::atomic<uint64_t> _reordered = {0};
+  };
+
+  /**
+   * Sends objects in a loop, keeping two of them queued at the transmitter so it always has data to send at the
+   * configured rate.
+   */
+  class Sender {
+    public:
+      Sender(boost::asio::io_service& io, const bench_arguments& args, unsigned short relay_port, Tracker& tracker)
+        : _io(io)
+        , _transmitter("127.0.0.1", static_cast<short>(relay_port), args.tsi, args.mtu, args.bitrate, io)
+        , _tracker(tracker)
+      {
+        if (args.files != nullptr) {
+          for (const auto& entry : std::filesystem::directory_iterator(args.files)) {
+            if (!entry.is_regular_file()) continue;
+            std::ifstream file(entry.path(), std::ios::binary);
+            _objects.push_back({entry.path().filename().string(),
+                std::vector<char>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>())});
+          }
+          std::sort(_objects.begin(), _objects.end(), [](const Object& a, const Object& b) { return a.name < b.name; });
+        }
+        if (_objects.empty()) {
+          // null TS packets
+          std::vector<char> payload(std::max(188U, args.object_size * 1024 / 188 * 188));
+          for (size_t i = 0; i < payload.size(); i += 188) {
+            payload[i] = 0x47;
+            payload[i + 1] = 0x1f;
+            payload[i + 2] = static_cast<char>(0xff);
+            payload[i + 3] = 0x10;
+          }
+          _objects.push_back({"segment.ts", std::move(payload)});
+        }
+        _transmitter.register_completion_callback([this](uint32_t toi) {
+          // the transmitter is not reentrant, the next object is queued from a separate handler
+          _io.post([this, toi]() {
+            auto it = _in_flight.find(toi);
+            if (it != _in_flight.end()) {
+              _tracker.sent(it->second.first, it->second.second);
+              _in_flight.erase(it);
+            }
+            if (!_stopped) send_next();
+          });
+        });
+      };
+
+      void start() {
+        _io.post([this]() {
+          send_next();
+          send_next();
+        });
+      };
+      void stop() { _io.post([this]() { _stopped = true; }); };
+
+    private:
+      struct Object {
+        std::string name;
+        std::vector<char> data;
+      };
+
+      void send_next() {
+        auto& object = _objects[_next % _objects.size()];
+        // a new location for every object, so the receiver does not see repetitions of the same file
+        auto location = "bench/" + std::to_string(_next) + "/" + object.name;
+        _next++;
+        auto toi = _transmitter.send(location, "application/octet-stream", time(nullptr) + 60,
+            object.data.data(), object.data.size());
+        _in_flight[toi] = {location, object.data.size()};
+      };
+
+      boost::asio::io_service& _io;
+      LibFlute::Transmitter _transmitter;
+      Tracker& _tracker;
+      std::vector<Object> _objects;
+      std::map<uint32_t, std::pair<std::string, size_t>> _in_flight;
+      uint64_t _next = 0;
+      bool _stopped = false;
+  };
+
+  /**
+   * A basic content stream that reports the objects it receives to the tracker before they are cached
+   */
+  class BenchStream : public MBMS_RT::ContentStream {
+    public:
+      BenchStream(const bench_arguments& args, boost::asio::io_service& io, MBMS_RT::CacheManagement& cache,
+          const libconfig::Config& cfg, Tracker& tracker)
+        : ContentStream("bench", args.iface, io, cache, MBMS_RT::DeliveryProtocol::HLS, cfg)
+        , _tracker(tracker)
+      {
+        auto sdp = "v=0\n"
+          "o=- 0 0 IN IP4 " + args.iface + "\n"
+          "s=bench\n"
+          "c=IN IP4 " + args.mcast_address + "/255\n"
+          "t=0 0\n"
+          "m=application " + std::to_string(args.mcast_port) + " FLUTE/UDP 0\n"
+          "a=flute-tsi:" + std::to_string(args.tsi) + "\n";
+        configure_5gbc_delivery_from_sdp(sdp);
+      };
+
+      void flute_file_received(std::shared_ptr<LibFlute::File> file) override {
+        _tracker.received(file->meta().content_location, file->length());
+        ContentStream::flute_file_received(std::move(file));
+      };
+
+    private:
+      Tracker& _tracker;
+  };
+
+  auto run_io(boost::asio::io_service& io, unsigned threads) -> std::vector<std::thread> {
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; i++) {
+      pool.emplace_back([&io]() { io.run(); });
+    }
+    return pool;
+  }
+}
+
+/**
+ *  Main entry point for the benchmark.
+ *
+ * @param argc  Command line agument count
+ * @param argv  Command line arguments
+ * @return 0 on success, 1 on failure
+ */
+auto main(int argc, char **argv) -> int {
+  bench_arguments arguments;
+  argp_parse(&argp, argc, argv, 0, nullptr, &arguments);
+  spdlog::set_level(static_cast<spdlog::level::level_enum>(arguments.log_level));
+
+  libconfig::Config cfg;
+  if (arguments.config_file != nullptr) {
+    try {
+      cfg.readFile(arguments.config_file);
+    } catch (const std::exception& ex) {
+      spdlog::error("Cannot read config file at {}", arguments.config_file);
+      return 1;
+    }
+  }
+
+  Tracker tracker;
+
+  // receiving side, as set up by the middleware for a stream of a local service
+  boost::asio::io_service mw_io;
+  auto mw_work = std::make_unique<boost::asio::io_service::work>(mw_io);
+  std::unique_ptr<MBMS_RT::CacheManagement> cache;
+  std::shared_ptr<BenchStream> stream;
+  std::unique_ptr<boost::asio::steady_timer> tick;
+  std::function<void(const boost::system::error_code&)> tick_handler;
+  if (!arguments.send_only) {
+    cache = std::make_unique<MBMS_RT::CacheManagement>(cfg, mw_io);
+    stream = std::make_shared<BenchStream>(arguments, mw_io, *cache, cfg, tracker);
+    stream->start();
+    tick = std::make_unique<boost::asio::steady_timer>(mw_io);
+    tick_handler = [&](const boost::system::error_code& ec) {
+      if (ec) return;
+      cache->check_file_expiry_and_cache_size();
+      tick->expires_from_now(std::chrono::seconds(1));
+      tick->async_wait(tick_handler);
+    };
+    tick_handler({});
+  }
+  auto mw_threads = run_io(mw_io, arguments.threads);
+
+  boost::asio::io_service sender_io;
+  auto sender_work = std::make_unique<boost::asio::io_service::work>(sender_io);
+  Relay relay(sender_io, arguments);
+  Sender sender(sender_io, arguments, relay.port(), tracker);
+  sender.start();
+  auto sender_threads = run_io(sender_io, 1);
+
+  printf("FLUTE session TSI %llu to %s:%u via %s at %u kbit/s, %.2f%% loss (bursts of %u), %.2f%% reordered, "
+      "%u s warmup, %u s measurement%s\n", arguments.tsi, arguments.mcast_address.c_str(), arguments.mcast_port,
+      arguments.iface.c_str(), arguments.bitrate, arguments.loss * 100, arguments.burst, arguments.reorder * 100,
+      arguments.warmup, arguments.duration, arguments.send_only ? " (send only)" : "");
+
+  std::this_thread::sleep_for(std::chrono::seconds(arguments.warmup));
+  auto usage_start = MBMS_RT::Bench::ProcessUsage::of(arguments.server_pid);
+  auto packets_start = relay.packets();
+  auto dropped_start = relay.dropped();
+  auto lost_start = stream ? stream->lost_objects() : 0;
+  auto start = std::chrono::steady_clock::now();
+  tracker.set_measuring(true);
+  std::this_thread::sleep_for(std::chrono::seconds(arguments.duration));
+  auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  auto usage_end = MBMS_RT::Bench::ProcessUsage::of(arguments.server_pid);
+  tracker.set_measuring(false);
+  auto packets = relay.packets() - packets_start;
+  auto dropped = relay.dropped() - dropped_start;
+
+  // objects sent at the end of the measurement can still complete
+  sender.stop();
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+  auto lost = stream ? stream->lost_objects() - lost_start : 0;
+
+  sender_work.reset();
+  sender_io.stop();
+  for (auto& thread : sender_threads) {
+    thread.join();
+  }
+  if (tick) {
+    tick->cancel();
+  }
+  stream.reset();
+  mw_work.reset();
+  mw_io.stop();
+  for (auto& thread : mw_threads) {
+    thread.join();
+  }
+
+  printf("sent       %10lu objects %9.2f Mbit/s  %lu packets, %lu dropped by the relay\n",
+      static_cast<unsigned long>(tracker.sent_objects()), tracker.sent_bytes() * 8 / seconds / 1e6,
+      static_cast<unsigned long>(packets), static_cast<unsigned long>(dropped));
+  if (!arguments.send_only) {
+    auto latency = tracker.latency().summary();
+    printf("received   %10lu objects %9.2f Mbit/s  %lu not received, %lu reported lost by reassembly\n",
+        static_cast<unsigned long>(tracker.received_objects()), tracker.received_bytes() * 8 / seconds / 1e6,
+        static_cast<unsigned long>(tracker.missing()), static_cast<unsigned long>(lost));
+    printf("completion p50 %8.3f ms  p99 %8.3f ms  p999 %8.3f ms  max %8.3f ms after the last packet was sent\n",
+        latency.p50_ms, latency.p99_ms, latency.p999_ms, latency.max_ms);
+  }
+  auto cpu = usage_end.cpu_seconds - usage_start.cpu_seconds;
+  auto who = arguments.server_pid != 0 ? "" : (arguments.send_only ? ", of the sender" : ", including the sender");
+  printf("CPU        %.2f s (%.1f%%)%s\n", cpu, 100.0 * cpu / seconds, who);
+  printf("memory     RSS %lu kB, peak %lu kB%s\n", static_cast<unsigned long>(usage_end.rss_kb),
+      static_cast<unsigned long>(usage_end.peak_rss_kb), who);
+  return 0;
+}
@@ -0,0 +1,478 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+// HTTP origin load benchmark: simulates players that poll HLS media playlists and fetch the listed segments at
+// the live edge. By default the serving path (RestHandler + CacheManagement) runs in-process and is fed by an
+// injector that stands in for FLUTE reception; with --url an external mw instance is loaded instead.
+
+#include <argp.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <libconfig.h++>
+#include <boost/asio.hpp>
+
+#include "cpprest/http_client.h"
+#include "spdlog/spdlog.h"
+
+#include "File.h"
+#include "CacheManagement.h"
+#include "CacheItems.h"
+#include "HlsMediaPlaylist.h"
+#include "RestHandler.h"
+#include "SchedulingStats.h"
+#include "BenchStats.h"
+
+using web::http::methods;
+using web::http::client::http_client;
+using web::http::client::http_client_config;
+
+static char doc[] = "5G-MAG-RT MBMS Middleware HTTP origin load benchmark";  // NOLINT
+
+static struct argp_option options[] = {  // NOLINT
+    {"players", 'n', "N", 0, "Number of simulated players (default: 100)", 0},
+    {"duration", 'd', "SECS", 0, "Measurement duration (default: 30)", 0},
+    {"warmup", 'w', "SECS", 0, "Time before measuring starts (default: 5)", 0},
+    {"streams", 'r', "N", 0, "In-process: number of injected streams, players are spread over them (default: 4)", 0},
+    {"segment-duration", 's', "SECS", 0, "In-process: segment duration (default: 2)", 0},
+    {"segment-size", 'b', "KB", 0, "In-process: segment size (default: 500)", 0},
+    {"threads", 't', "N", 0, "In-process: io threads for the middleware side (default: 4)", 0},
+    {"config", 'c', "FILE", 0, "In-process: mw configuration file for cache and HTTP server settings", 0},
+    {"url", 'u', "URL", 0, "Load an external mw instead, URL of a media playlist. Repeat for several streams", 0},
+    {"server-pid", 'p', "PID", 0, "External mw: process to report CPU and memory usage for", 0},
+    {"log-level", 'l', "LEVEL", 0, "Log verbosity: 0 = trace ... 6 = none. Default: 3.", 0},
+    {nullptr, 0, nullptr, 0, nullptr, 0}};
+
+/**
+ * Holds all options passed on the command line
+ */
+struct bench_arguments {
+  unsigned players = 100;
+  unsigned duration = 30;
+  unsigned warmup = 5;
+  unsigned streams = 4;
+  unsigned segment_duration = 2;
+  unsigned segment_size = 500;
+  unsigned threads = 4;
+  const char* config_file = nullptr;
+  std::vector<std::string> urls;
+  pid_t server_pid = 0;
+  unsigned log_level = 3;
+};
+
+static auto parse_opt(int key, char *arg, struct argp_state *state) -> error_t {
+  auto arguments = static_cast<struct bench_arguments *>(state->input);
+  auto number = [arg]() { return static_cast<unsigned>(strtoul(arg, nullptr, 10)); };
+  switch (key) {
+    case 'n': arguments->players = number(); break;
+    case 'd': arguments->duration = number(); break;
+    case 'w': arguments->warmup = number(); break;
+    case 'r': arguments->streams = std::max(1U, number()); break;
+    case 's': arguments->segment_duration = std::max(1U, number()); break;
+    case 'b': arguments->segment_size = number(); break;
+    case 't': arguments->threads = std::max(1U, number()); break;
+    case 'c': arguments->config_file = arg; break;
+    case 'u': arguments->urls.emplace_back(arg); break;
+    case 'p': arguments->server_pid = static_cast<pid_t>(strtol(arg, nullptr, 10)); break;
+    case 'l': arguments->log_level = number(); break;
+    default:
+      return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
+
+static struct argp argp = {options, parse_opt, nullptr, doc, nullptr, nullptr, nullptr};
+
+namespace {
+  /**
+   * Stands in for FLUTE reception: adds a segment per stream to the cache every segment duration and maintains a
+   * sliding window media playlist for it, served through a CachedPlaylist like the playlists of the seamless
+   * streams.
+   */
+  class Injector {
+    public:
+      Injector(boost::asio::io_service& io, MBMS_RT::CacheManagement& cache, const bench_arguments& args)
+        : _cache(cache)
+        , _timer(io)
+        , _segment_duration(args.segment_duration)
+      {
+        // null TS packets, so media inspection on the serving side sees a valid transport stream
+        _payload.resize(std::max(188U, args.segment_size * 1024 / 188 * 188));
+        for (size_t i = 0; i < _payload.size(); i += 188) {
+          _payload[i] = 0x47;
+          _payload[i + 1] = 0x1f;
+          _payload[i + 2] = static_cast<char>(0xff);
+          _payload[i + 3] = 0x10;
+        }
+        for (unsigned i = 0; i < args.streams; i++) {
+          auto stream = std::make_shared<Stream>();
+          stream->base = "bench/stream" + std::to_string(i) + "/";
+          stream->playlist.set_version(3);
+          stream->playlist.set_target_duration(static_cast<int>(_segment_duration));
+          _streams.push_back(stream);
+          auto location = stream->base + "index.m3u8";
+          _cache.add_item(std::make_shared<MBMS_RT::CachedPlaylist>(location, 0,
+                [stream]() -> const std::string& { return stream->content; },
+                [stream](const std::map<std::string, std::string>& /*query*/,
+                  const MBMS_RT::CachedPlaylist::reply_cb_t& reply) {
+                  std::string content;
+                  {
+                    const std::lock_guard<std::mutex> lock(stream->mutex);
+                    content = stream->content;
+                  }
+                  reply(200, std::move(content));
+                }));
+        }
+        // players joining at start find a full window
+        for (unsigned i = 0; i < kWindow; i++) {
+          inject();
+        }
+        _next = std::chrono::steady_clock::now();
+        schedule();
+      };
+
+      std::vector<std::string> playlist_paths() const {
+        std::vector<std::string> paths;
+        for (const auto& stream : _streams) {
+          paths.push_back("/" + stream->base + "index.m3u8");
+        }
+        return paths;
+      };
+
+      void stop() { _timer.cancel(); };
+
+    private:
+      static constexpr unsigned kWindow = 5;
+
+      struct Stream {
+        std::mutex mutex;
+        std::string base;
+        MBMS_RT::HlsMediaPlaylist playlist;
+        std::string content;
+      };
+
+      void schedule() {
+        _next += std::chrono::seconds(_segment_duration);
+        _timer.expires_at(_next);
+        _timer.async_wait([this](const boost::system::error_code& ec) {
+          if (ec) return;
+          inject();
+          _cache.check_file_expiry_and_cache_size();
+          schedule();
+        });
+      };
+
+      void inject() {
+        for (const auto& stream : _streams) {
+          auto name = "segment" + std::to_string(_seq) + ".ts";
+          auto location = stream->base + name;
+          LibFlute::FecOti fec_oti{LibFlute::FecScheme::CompactNoCode, _payload.size(), 1428, 64};
+          auto file = std::make_shared<LibFlute::File>(_seq, fec_oti, location, "video/mp2t", 0,
+              _payload.data(), _payload.size(), true);
+          _cache.add_item(std::make_shared<MBMS_RT::CachedFile>(location, time(nullptr), std::move(file)));
+
+          const std::lock_guard<std::mutex> lock(stream->mutex);
+          stream->playlist.add_segment({name, static_cast<int>(_seq), static_cast<double>(_segment_duration)});
+          MBMS_RT::HlsMediaPlaylist window;
+          window.set_version(3);
+          window.set_target_duration(static_cast<int>(_segment_duration));
+          const auto& segments = stream->playlist.segments();
+          auto first = segments.size() > kWindow ? segments.size() - kWindow : 0;
+          for (auto i = first; i < segments.size(); i++) {
+            window.add_segment(segments[i]);
+          }
+          stream->playlist = window;
+          stream->content = stream->playlist.to_string();
+          if (first > 0) {
+            // the segment that left the window
+            _cache.remove_item(stream->base + segments[0].uri);
+          }
+        }
+        _seq++;
+      };
+
+      MBMS_RT::CacheManagement& _cache;
+      boost::asio::steady_timer _timer;
+      unsigned _segment_duration;
+      std::chrono::steady_clock::time_point _next;
+      std::vector<char> _payload;
+      std::vector<std::shared_ptr<Stream>> _streams;
+      unsigned _seq = 1;
+  };
+
+  struct Results {
+    MBMS_RT::Bench::LatencyRecorder playlists;
+    MBMS_RT::Bench::LatencyRecorder segments;
+    std::atomic<bool> measuring = {false};
+    std::atomic<bool> stopping = {false};
+    std::atomic<unsigned> in_flight = {0};
+  };
+
+  /**
+   * A live player: reloads the media playlist once per target duration (or earlier after a reload that returned
+   * no new segment, RFC 8216 6.3.4), and fetches new segments one after the other over its own connection.
+   * It starts three segments from the live edge.
+   */
+  class Player : public std::enable_shared_from_this<Player> {
+    public:
+      Player(boost::asio::io_service& io, Results& results, const std::string& origin, std::string playlist_path)
+        : _client(origin, config())
+        , _timer(io)
+        , _results(results)
+        , _playlist_path(std::move(playlist_path))
+        , _base(_playlist_path.substr(0, _playlist_path.rfind('/') + 1))
+      {
+      };
+
+      void start(std::chrono::milliseconds delay) { wait(delay); };
+
+    private:
+      static http_client_config config() {
+        http_client_config config;
+        config.set_timeout(std::chrono::seconds(10));
+        return config;
+      };
+
+      void wait(std::chrono::milliseconds delay) {
+        if (_results.stopping) return;
+        _timer.expires_from_now(delay);
+        _timer.async_wait([self = shared_from_this()](const boost::system::error_code& ec) {
+          if (!ec) self->reload();
+        });
+      };
+
+      void reload() {
+        if (_results.stopping) return;
+        _reload_at = std::chrono::steady_clock::now();
+        auto self = shared_from_this();
+        get(_playlist_path, _results.playlists, [self](const std::vector<unsigned char>& body) {
+          try {
+            MBMS_RT::HlsMediaPlaylist playlist(std::string_view(reinterpret_cast<const char*>(body.data()),
+                  body.size()));
+            self->_target_duration = std::chrono::seconds(std::max(1, playlist.target_duration()));
+            const auto& segments = playlist.segments();
+            auto first = self->_last_seq < 0 && segments.size() > 3 ? segments.size() - 3 : 0;
+            auto found_new = false;
+            for (auto i = first; i < segments.size(); i++) {
+              if (segments[i].seq > self->_last_seq) {
+                self->_queue.push_back(segments[i].uri);
+                self->_last_seq = segments[i].seq;
+                found_new = true;
+              }
+            }
+            self->_unchanged = !found_new;
+          } catch (const std::exception& ex) {
+            spdlog::warn("Invalid playlist at {}: {}", self->_playlist_path, ex.what());
+          }
+          self->next();
+        });
+      };
+
+      void next() {
+        if (_queue.empty()) {
+          auto interval = _unchanged ? _target_duration / 2 : _target_duration;
+          auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - _reload_at);
+          wait(std::max(std::chrono::milliseconds(0), std::chrono::duration_cast<std::chrono::milliseconds>(interval) - elapsed));
+          return;
+        }
+        auto uri = _queue.front();
+        _queue.pop_front();
+        auto self = shared_from_this();
+        get(uri.find("://") != std::string::npos || uri[0] == '/' ? uri : _base + uri, _results.segments,
+            [self](const std::vector<unsigned char>& /*body*/) { self->next(); });
+      };
+
+      template <typename F>
+      void get(const std::string& path, MBMS_RT::Bench::LatencyRecorder& recorder, F done) {
+        if (_results.stopping) return;
+        auto start = std::chrono::steady_clock::now();
+        _results.in_flight++;
+        auto& results = _results;
+        _client.request(methods::GET, path).then([](const web::http::http_response& response) {
+          if (response.status_code() != 200) {
+            throw std::runtime_error("HTTP status " + std::to_string(response.status_code()));
+          }
+          return response.extract_vector();
+        }).then([start, &recorder, &results, done, path](const pplx::task<std::vector<unsigned char>>& task) {
+          std::vector<unsigned char> body;
+          auto ok = false;
+          try {
+            body = task.get();
+            ok = true;
+          } catch (const std::exception& ex) {
+            SPDLOG_DEBUG("GET {} failed: {}", path, ex.what());
+          }
+          if (results.measuring) {
+            if (ok) {
+              recorder.record(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start), body.size());
+            } else {
+              recorder.record_error();
+            }
+          }
+          results.in_flight--;
+          done(body);
+        });
+      };
+
+      http_client _client;
+      boost::asio::steady_timer _timer;
+      Results& _results;
+      std::string _playlist_path;
+      std::string _base;
+      std::deque<std::string> _queue;
+      int _last_seq = -1;
+      bool _unchanged = false;
+      std::chrono::steady_clock::duration _target_duration = std::chrono::seconds(2);
+      std::chrono::steady_clock::time_point _reload_at;
+  };
+
+  auto run_io(boost::asio::io_service& io, unsigned threads) -> std::vector<std::thread> {
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; i++) {
+      pool.emplace_back([&io]() { io.run(); });
+    }
+    return pool;
+  }
+}
+
+/**
+ *  Main entry point for the benchmark.
+ *
+ * @param argc  Command line agument count
+ * @param argv  Command line arguments
+ * @return 0 on success, 1 if requests failed
+ */
+auto main(int argc, char **argv) -> int {
+  bench_arguments arguments;
+  argp_parse(&argp, argc, argv, 0, nullptr, &arguments);
+  spdlog::set_level(static_cast<spdlog::level::level_enum>(arguments.log_level));
+
+  libconfig::Config cfg;
+  if (arguments.config_file != nullptr) {
+    try {
+      cfg.readFile(arguments.config_file);
+    } catch (const std::exception& ex) {
+      spdlog::error("Cannot read config file at {}", arguments.config_file);
+      return 1;
+    }
+  }
+
+  auto in_process = arguments.urls.empty();
+  boost::asio::io_service mw_io;
+  auto mw_work = std::make_unique<boost::asio::io_service::work>(mw_io);
+  boost::asio::io_service::strand mw_strand(mw_io);
+  std::unique_ptr<MBMS_RT::CacheManagement> cache;
+  std::unique_ptr<MBMS_RT::RestHandler> rest_handler;
+  std::unique_ptr<Injector> injector;
+  std::unique_ptr<MBMS_RT::ServiceAnnouncement> service_announcement;
+  std::map<std::string, std::shared_ptr<MBMS_RT::Service>> services;
+  MBMS_RT::SchedulingStats scheduling;
+  std::vector<std::thread> mw_threads;
+
+  std::string origin;
+  std::vector<std::string> playlist_paths;
+  if (in_process) {
+    origin = "http://127.0.0.1:3021/";
+    cfg.lookupValue("mw.http_server.uri", origin);
+    cache = std::make_unique<MBMS_RT::CacheManagement>(cfg, mw_io);
+    rest_handler = std::make_unique<MBMS_RT::RestHandler>(cfg, origin, *cache, &service_announcement, services,
+        scheduling, mw_strand);
+    injector = std::make_unique<Injector>(mw_io, *cache, arguments);
+    playlist_paths = injector->playlist_paths();
+    mw_threads = run_io(mw_io, arguments.threads);
+  } else {
+    for (const auto& url : arguments.urls) {
+      web::uri uri(url);
+      auto authority = uri.authority().to_string();
+      if (origin.empty()) {
+        origin = authority;
+      } else if (origin != authority) {
+        spdlog::error("All playlists must be served by the same origin");
+        return 1;
+      }
+      playlist_paths.push_back(uri.resource().to_string());
+    }
+  }
+
+  printf("%u players, %zu stream(s) at %s, %u s warmup, %u s measurement%s\n", arguments.players,
+      playlist_paths.size(), origin.c_str(), arguments.warmup, arguments.duration,
+      in_process ? " (in-process server)" : "");
+
+  Results results;
+  boost::asio::io_service player_io;
+  auto player_work = std::make_unique<boost::asio::io_service::work>(player_io);
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> stagger(0, static_cast<int>(arguments.segment_duration * 1000));
+  for (unsigned i = 0; i < arguments.players; i++) {
+    auto player = std::make_shared<Player>(player_io, results, origin, playlist_paths[i % playlist_paths.size()]);
+    player->start(std::chrono::milliseconds(stagger(rng)));
+  }
+  auto player_threads = run_io(player_io, 1);
+
+  std::this_thread::sleep_for(std::chrono::seconds(arguments.warmup));
+  auto usage_start = MBMS_RT::Bench::ProcessUsage::of(arguments.server_pid);
+  auto start = std::chrono::steady_clock::now();
+  results.measuring = true;
+  std::this_thread::sleep_for(std::chrono::seconds(arguments.duration));
+  results.measuring = false;
+  auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  auto usage_end = MBMS_RT::Bench::ProcessUsage::of(arguments.server_pid);
+
+  // let the requests in flight complete, players do not issue new ones
+  results.stopping = true;
+  for (int i = 0; i < 100 && results.in_flight > 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  player_work.reset();
+  player_io.stop();
+  for (auto& thread : player_threads) {
+    thread.join();
+  }
+  if (injector) {
+    injector->stop();
+  }
+  rest_handler.reset();
+  mw_work.reset();
+  mw_io.stop();
+  for (auto& thread : mw_threads) {
+    thread.join();
+  }
+
+  auto playlists = results.playlists.summary();
+  auto segments = results.segments.summary();
+  MBMS_RT::Bench::print_summary("playlist", playlists, seconds);
+  MBMS_RT::Bench::print_summary("segment", segments, seconds);
+  auto requests = playlists.count + segments.count;
+  auto cpu = usage_end.cpu_seconds - usage_start.cpu_seconds;
+  printf("total      %10lu req %8.1f req/s  CPU %.2f s (%.1f%%), %.1f us/request%s\n",
+      static_cast<unsigned long>(requests), requests / seconds, cpu, 100.0 * cpu / seconds,
+      requests > 0 ? cpu * 1e6 / requests : 0.0,
+      in_process ? ", including the load generator" : "");
+  printf("memory     RSS %lu kB, peak %lu kB%s\n", static_cast<unsigned long>(usage_end.rss_kb),
+      static_cast<unsigned long>(usage_end.peak_rss_kb), in_process ? ", including the load generator" : "");
+  return playlists.errors + segments.errors > 0 ? 1 : 0;
+}
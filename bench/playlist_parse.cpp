@@ -0,0 +1,54 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+// Microbenchmark of the HLS media playlist parser and serializer. A seamless switching stream parses the CDN
+// playlist of each stream every second, and serializes its generated playlist on every update.
+
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "HlsMediaPlaylist.h"
+#include "Fixtures.h"
+
+namespace {
+  void BM_HlsMediaPlaylistParse(benchmark::State& state) {
+    auto content = MBMS_RT::Bench::hls_media_playlist(static_cast<unsigned>(state.range(0)));
+    for (auto _ : state) {
+      MBMS_RT::HlsMediaPlaylist playlist(content);
+      benchmark::DoNotOptimize(playlist.segments().data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * content.size()));
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+  }
+  BENCHMARK(BM_HlsMediaPlaylistParse)->Arg(10)->Arg(100)->Arg(1000)->Arg(5000);
+
+  void BM_HlsMediaPlaylistSerialize(benchmark::State& state) {
+    MBMS_RT::HlsMediaPlaylist playlist(MBMS_RT::Bench::hls_media_playlist(static_cast<unsigned>(state.range(0))));
+    std::vector<size_t> offsets;
+    size_t bytes = 0;
+    for (auto _ : state) {
+      auto out = playlist.to_string(&offsets);
+      bytes += out.size();
+      benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(bytes));
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+  }
+  BENCHMARK(BM_HlsMediaPlaylistSerialize)->Arg(10)->Arg(100)->Arg(1000)->Arg(5000);
+}
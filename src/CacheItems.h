@@ -17,6 +17,9 @@
 
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <map>
 #include <libconfig.h++>
 #include <boost/asio.hpp>
 #include "seamless/Segment.h"
@@ -59,9 +62,20 @@ namespace MBMS_RT {
       std::string content_location() const { return _content_location; };
       virtual unsigned long received_at() const { return _received_at; };
 
+      /**
+       * Retained items are kept regardless of their age and the cache size, their owner removes them
+       */
+      virtual bool retained() const { return false; };
+
+      /**
+       * True exactly once, for the first request that is served from this item
+       */
+      bool first_request() { return !_requested.exchange(true); };
+
     private:
       std::string _content_location;
       unsigned long _received_at;
+      std::atomic<bool> _requested = {false};
   };
 
   class CachedFile : public CacheItem {
@@ -96,6 +110,7 @@ namespace MBMS_RT {
       virtual ItemSource item_source() const { return _segment->data_source(); };
 
       virtual unsigned long received_at() const { return _segment->received_at(); };
+      virtual bool retained() const { return _segment->retained(); };
 
     private:
       std::shared_ptr<Segment> _segment;
@@ -103,13 +118,32 @@ namespace MBMS_RT {
 
   class CachedPlaylist : public CacheItem {
     public:
+      /**
+       * Receives the HTTP status code and the playlist to send
+       */
+      typedef std::function<void(unsigned short status, std::string content)> reply_cb_t;
+      typedef std::function<void(const std::map<std::string, std::string>& query, reply_cb_t reply)> request_cb_t;
+
       CachedPlaylist(const std::string& content_location, unsigned long received_at,
-          std::function<const std::string&(void)> playlist_cb)
+          std::function<const std::string&(void)> playlist_cb, request_cb_t request_cb = nullptr)
         : CacheItem( content_location, received_at ) 
         , _playlist_cb( playlist_cb ) 
+        , _request_cb( std::move(request_cb) )
         {}
       virtual ~CachedPlaylist() = default;
 
+      /**
+       * Lets the playlist owner answer a request, possibly later (e.g. blocking playlist reload).
+       * Returns false if the owner does not handle requests, the playlist is then served from buffer().
+       */
+      bool handle_request(const std::map<std::string, std::string>& query, reply_cb_t reply) const {
+        if (!_request_cb) {
+          return false;
+        }
+        _request_cb(query, std::move(reply));
+        return true;
+      };
+
       virtual ItemType item_type() const { return ItemType::Playlist; };
       virtual char* buffer() const { return (char*)_playlist_cb().c_str(); };
       virtual uint32_t content_length() const { return _playlist_cb().size(); };
@@ -118,6 +152,7 @@ namespace MBMS_RT {
 
     private:
       std::function<const std::string&(void)> _playlist_cb;
+      request_cb_t _request_cb;
   };
 
   class CachedManifest : public CacheItem {
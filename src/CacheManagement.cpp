@@ -18,25 +18,113 @@
 #include "CacheManagement.h"
 #include "spdlog/spdlog.h"
 
+namespace {
+  auto source_label(MBMS_RT::ItemSource source) -> const char* {
+    switch (source) {
+      case MBMS_RT::ItemSource::Broadcast: return "broadcast";
+      case MBMS_RT::ItemSource::CDN: return "cdn";
+      case MBMS_RT::ItemSource::Generated: return "generated";
+      default: return "unavailable";
+    }
+  }
+}
+
 MBMS_RT::CacheManagement::CacheManagement(const libconfig::Config& cfg, boost::asio::io_service& io_service)
-  : _io_service(io_service)
+  : _hit_metric(Metrics::registry().counter("mw_cache_requests_total", "Requests for cached files",
+        {{"result", "hit"}}))
+  , _miss_metric(Metrics::registry().counter("mw_cache_requests_total", "Requests for cached files",
+        {{"result", "miss"}}))
+  , _expired_metric(Metrics::registry().counter("mw_cache_evictions_total", "Items removed by cache management",
+        {{"reason", "expired"}}))
+  , _evicted_metric(Metrics::registry().counter("mw_cache_evictions_total", "Items removed by cache management",
+        {{"reason", "size"}}))
+  , _io_service(io_service)
+  , _reassembly(cfg)
+{
+  for (auto source : {ItemSource::Broadcast, ItemSource::CDN, ItemSource::Generated, ItemSource::Unavailable}) {
+    _served_metrics[static_cast<size_t>(source)] = &Metrics::registry().counter("mw_cache_served_bytes_total",
+        "Bytes served from the cache over HTTP", {{"source", source_label(source)}});
+  }
+  // Stored bytes change with every received object, they are computed when scraped
+  _collector = Metrics::registry().add_collector([this](std::ostream& out) {
+    std::array<uint64_t, 4> bytes = {};
+    std::array<uint64_t, 4> items = {};
+    {
+      const std::lock_guard<std::mutex> lock(_mutex);
+      for (const auto& item : _cache_items) {
+        auto idx = static_cast<size_t>(item.second->item_source());
+        bytes[idx] += item.second->content_length();
+        items[idx]++;
+      }
+    }
+    out << "# HELP mw_cache_bytes Bytes held in the cache\n# TYPE mw_cache_bytes gauge\n";
+    for (auto source : {ItemSource::Broadcast, ItemSource::CDN, ItemSource::Generated, ItemSource::Unavailable}) {
+      out << "mw_cache_bytes{source=\"" << source_label(source) << "\"} " << bytes[static_cast<size_t>(source)] << "\n";
+    }
+    out << "# HELP mw_cache_items Items held in the cache\n# TYPE mw_cache_items gauge\n";
+    for (auto source : {ItemSource::Broadcast, ItemSource::CDN, ItemSource::Generated, ItemSource::Unavailable}) {
+      out << "mw_cache_items{source=\"" << source_label(source) << "\"} " << items[static_cast<size_t>(source)] << "\n";
+    }
+  });
+  configure(cfg);
+}
+
+auto MBMS_RT::CacheManagement::configure(const libconfig::Config& cfg) -> void
+{
+  unsigned max_cache_size = 512;
+  cfg.lookupValue("mw.cache.max_total_size", max_cache_size);
+  _max_cache_size = max_cache_size * 1024 * 1024;
+  unsigned max_cache_file_age = 30;
+  cfg.lookupValue("mw.cache.max_file_age", max_cache_file_age);
+  _max_cache_file_age = max_cache_file_age;
+  _reassembly.configure(cfg);
+}
+
+MBMS_RT::CacheManagement::~CacheManagement()
 {
-  cfg.lookupValue("mw.cache.max_total_size", _max_cache_size);
-  _max_cache_size *= 1024 * 1024;
-  cfg.lookupValue("mw.cache.max_file_age", _max_cache_file_age);
+  Metrics::registry().remove_collector(_collector);
 }
 
+struct MBMS_RT::CacheManagement::Waiter {
+  Waiter(boost::asio::io_service& io_service, wait_cb_t cb)
+    : timer(io_service)
+    , callback(std::move(cb)) {}
+
+  // Called once, either by the timer or when the item is added
+  auto complete(std::shared_ptr<CacheItem> item) -> void {
+    if (!done.exchange(true)) {
+      callback(std::move(item));
+    }
+  }
+
+  boost::asio::steady_timer timer;
+  wait_cb_t callback;
+  std::atomic<bool> done = {false};
+};
+
 auto MBMS_RT::CacheManagement::check_file_expiry_and_cache_size() -> void
 {
+  _reassembly.enforce(_max_cache_file_age);
+  {
+    const std::lock_guard<std::mutex> lock(_waiters_mutex);
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = _expected_items.begin(); it != _expected_items.end();) {
+      it = it->second < now ? _expected_items.erase(it) : std::next(it);
+    }
+  }
+
+  const std::lock_guard<std::mutex> lock(_mutex);
   std::multimap<unsigned, std::string> items_by_age;
   for (auto it = _cache_items.cbegin(); it != _cache_items.cend();) {
-    spdlog::debug("checking {}", it->second->content_location());
+    SPDLOG_TRACE("checking {}", it->second->content_location());
     if (it->second->received_at() != 0) {
       auto age = time(nullptr) - it->second->received_at();
-      if (age > _max_cache_file_age) {
+      // Segments retained for the DVR window do not expire, but still count against the size limit
+      if (age > _max_cache_file_age && !it->second->retained()) {
         spdlog::info("Cache management deleting expired item at {} after {} seconds",
             it->second->content_location(), age);
         it = _cache_items.erase(it);
+        _expired_metric.inc();
       } else {
         items_by_age.insert(std::make_pair(age, it->first));
         ++it;
@@ -49,9 +137,97 @@ auto MBMS_RT::CacheManagement::check_file_expiry_and_cache_size() -> void
   for (const auto& it : items_by_age) {
     total_size += _cache_items[it.second]->content_length();
     if (total_size > _max_cache_size) {
-        spdlog::info("Cache management deleting item at {} (aged {} secs) due to cache size limit",
-            it.second, it.first);
+        spdlog::info("Cache management deleting {}item at {} (aged {} secs) due to cache size limit",
+            _cache_items[it.second]->retained() ? "retained " : "", it.second, it.first);
         _cache_items.erase(it.second);
+        _evicted_metric.inc();
     }
   }
 }
+
+auto MBMS_RT::CacheManagement::remove_item(const std::string& location, const std::shared_ptr<CacheItem>& item) -> void
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _cache_items.find(location);
+  if (item && it != _cache_items.end() && it->second == item) {
+    _cache_items.erase(it);
+  }
+}
+
+auto MBMS_RT::CacheManagement::item(const std::string& location) const -> std::shared_ptr<CacheItem>
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _cache_items.find(location);
+  return it == _cache_items.end() ? nullptr : it->second;
+}
+
+auto MBMS_RT::CacheManagement::item_map() const -> std::map<std::string, std::shared_ptr<CacheItem>>
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  return _cache_items;
+}
+
+auto MBMS_RT::CacheManagement::expect_item(const std::string& location, std::chrono::milliseconds timeout) -> void
+{
+  const std::lock_guard<std::mutex> lock(_waiters_mutex);
+  _expected_items[location] = std::chrono::steady_clock::now() + timeout;
+  _has_waiters = true;
+}
+
+auto MBMS_RT::CacheManagement::wait_for_item(const std::string& location, wait_cb_t cb) const -> bool
+{
+  std::shared_ptr<Waiter> waiter;
+  {
+    const std::lock_guard<std::mutex> lock(_waiters_mutex);
+    auto expected = _expected_items.find(location);
+    if (expected == _expected_items.end() || expected->second <= std::chrono::steady_clock::now()) {
+      return false;
+    }
+    waiter = std::make_shared<Waiter>(_io_service, std::move(cb));
+    waiter->timer.expires_at(expected->second);
+    _waiters.emplace(location, waiter);
+    _has_waiters = true;
+  }
+  // the item may have been added between the caller's lookup and registering the waiter
+  if (auto existing = item(location)) {
+    waiter->complete(existing);
+  }
+  std::weak_ptr<Waiter> weak = waiter;
+  waiter->timer.async_wait([this, location, weak](const boost::system::error_code& ec) {
+    auto waiter = weak.lock();
+    if (ec || !waiter) {
+      return;
+    }
+    {
+      const std::lock_guard<std::mutex> lock(_waiters_mutex);
+      auto range = _waiters.equal_range(location);
+      for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == waiter) {
+          _waiters.erase(it);
+          break;
+        }
+      }
+    }
+    waiter->complete(nullptr);
+  });
+  return true;
+}
+
+auto MBMS_RT::CacheManagement::notify_waiters(const std::shared_ptr<CacheItem>& item) -> void
+{
+  std::vector<std::shared_ptr<Waiter>> waiters;
+  {
+    const std::lock_guard<std::mutex> lock(_waiters_mutex);
+    _expected_items.erase(item->content_location());
+    auto range = _waiters.equal_range(item->content_location());
+    for (auto it = range.first; it != range.second; ++it) {
+      waiters.push_back(std::move(it->second));
+    }
+    _waiters.erase(range.first, range.second);
+    _has_waiters = !_waiters.empty() || !_expected_items.empty();
+  }
+  for (auto& waiter : waiters) {
+    waiter->timer.cancel();
+    waiter->complete(item);
+  }
+}
@@ -17,30 +17,116 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
 #include <libconfig.h++>
 #include <boost/asio.hpp>
 #include "CacheItems.h"
+#include "ReassemblyBudget.h"
+#include "Metrics.h"
+#include "LatencyTrace.h"
 
 namespace MBMS_RT {
   class CacheManagement {
     public:
       CacheManagement(const libconfig::Config& cfg, boost::asio::io_service& io_service);
-      virtual ~CacheManagement() = default;
+      virtual ~CacheManagement();
+
+      /**
+       * Reads the size and age limits of the cache and the reassembly budget from mw.cache. Items that exceed
+       * new limits are removed by the next check_file_expiry_and_cache_size().
+       */
+      void configure(const libconfig::Config& cfg);
 
       void add_item(std::shared_ptr<CacheItem> item) {
-        _cache_items[item->content_location()] = item;
+        LatencyTrace::instance().record(LatencyTrace::Stage::CacheInsert, item->content_location());
+        {
+          const std::lock_guard<std::mutex> lock(_mutex);
+          _cache_items[item->content_location()] = item;
+        }
+        if (_has_waiters) {
+          notify_waiters(item);
+        }
+      };
+      void remove_item(const std::string& location) {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        _cache_items.erase(location);
       };
-      void remove_item(const std::string& location) { _cache_items.erase(location); };
-      const std::map<std::string, std::shared_ptr<CacheItem>>& item_map() const { return _cache_items; };
+
+      /**
+       * Removes the item at location only if it has not been replaced by another item in the meantime
+       */
+      void remove_item(const std::string& location, const std::shared_ptr<CacheItem>& item);
+
+      std::shared_ptr<CacheItem> item(const std::string& location) const;
+
+      /**
+       * Announces that an item is about to be received at location (e.g. the live edge segment of a low-latency
+       * DASH stream). Requests for it are held until the item is added or the timeout expires.
+       */
+      void expect_item(const std::string& location, std::chrono::milliseconds timeout);
+
+      typedef std::function<void(std::shared_ptr<CacheItem> item)> wait_cb_t;
+
+      /**
+       * Calls cb once the expected item at location has been added, or with nullptr if it does not arrive in time.
+       * Returns false (and does not call cb) if no item is expected at location.
+       */
+      bool wait_for_item(const std::string& location, wait_cb_t cb) const;
+
+      /**
+       * Returns a snapshot of the cache contents. The cache is modified from all io threads, so the map itself
+       * is never handed out.
+       */
+      std::map<std::string, std::shared_ptr<CacheItem>> item_map() const;
 
       void check_file_expiry_and_cache_size();
 
+      unsigned max_file_age() const { return _max_cache_file_age; };
+
+      /**
+       * Counts a request for a cached file. A hit is a request that could be served with data.
+       */
+      void count_request(bool hit) const {
+        _requests++;
+        if (hit) _hits++;
+        (hit ? _hit_metric : _miss_metric).inc();
+      };
+      void count_served(ItemSource source, uint64_t bytes) const { _served_metrics[static_cast<size_t>(source)]->inc(bytes); };
+      uint64_t requests() const { return _requests; };
+      uint64_t hits() const { return _hits; };
+
+      ReassemblyBudget& reassembly() { return _reassembly; };
+      const ReassemblyBudget& reassembly() const { return _reassembly; };
+
 
     private:
+      struct Waiter;
+      void notify_waiters(const std::shared_ptr<CacheItem>& item);
+
+      mutable std::mutex _mutex;
       std::map<std::string, std::shared_ptr<CacheItem>> _cache_items;
-      unsigned _max_cache_size = 512;
+      std::atomic<unsigned> _max_cache_size = {512 * 1024 * 1024};
       unsigned _total_cache_size = 0;
-      unsigned _max_cache_file_age = 30;
+      std::atomic<unsigned> _max_cache_file_age = {30};
+      mutable std::atomic<uint64_t> _requests = {0};
+      mutable std::atomic<uint64_t> _hits = {0};
+      Metrics::Counter& _hit_metric;
+      Metrics::Counter& _miss_metric;
+      Metrics::Counter& _expired_metric;
+      Metrics::Counter& _evicted_metric;
+      std::array<Metrics::Counter*, 4> _served_metrics;
+      unsigned _collector;
       boost::asio::io_service& _io_service;
+      ReassemblyBudget _reassembly;
+
+      mutable std::mutex _waiters_mutex;
+      std::map<std::string, std::chrono::steady_clock::time_point> _expected_items;
+      mutable std::multimap<std::string, std::shared_ptr<Waiter>> _waiters;
+      mutable std::atomic<bool> _has_waiters = {false};
   };
 }
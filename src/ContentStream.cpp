@@ -18,6 +18,9 @@
 #include <regex>
 #include "ContentStream.h"
 #include "CacheItems.h"
+#include "LatencyTrace.h"
+#include "FluteCapture.h"
+#include "LogRateLimit.h"
 #include "HlsPrimaryPlaylist.h"
 
 #include "spdlog/spdlog.h"
@@ -26,14 +29,20 @@
 MBMS_RT::ContentStream::ContentStream(std::string base, std::string flute_if, boost::asio::io_service &io_service,
                                       CacheManagement &cache, DeliveryProtocol protocol, const libconfig::Config &cfg)
     : _5gbc_stream_iface(std::move(flute_if)), _cfg(cfg), _delivery_protocol(protocol), _base(std::move(base)),
-      _io_service(io_service), _cache(cache), _flute_thread{} {
+      _io_service(io_service), _strand(io_service), _cache(cache), _flute_thread{} {
 }
 
 MBMS_RT::ContentStream::~ContentStream() {
   spdlog::debug("Destroying content stream at base {}", _base);
+  if (_replay_subscription != 0) {
+    FluteCapture::instance().unsubscribe(_replay_subscription);
+  }
+  if (_flute_thread.joinable()) {
+    _flute_thread.join();
+  }
   if (_flute_receiver) {
     _flute_receiver->stop();
-    _flute_thread.join();
+    _cache.reassembly().remove_session(_flute_receiver.get());
   }
 }
 
@@ -41,6 +50,10 @@ auto MBMS_RT::ContentStream::configure_5gbc_delivery_from_sdp(const std::string
   spdlog::debug("ContentStream parsing SDP");
   std::istringstream iss(sdp);
   for (std::string line; std::getline(iss, line);) {
+    // SDP lines end with CRLF (RFC 4566), the regexes below do not match a trailing CR
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
     const std::regex sdp_line_regex("^([a-z])\\=(.+)$");
     std::smatch match;
     if (std::regex_match(line, match, sdp_line_regex)) {
@@ -95,7 +108,7 @@ auto MBMS_RT::ContentStream::configure_5gbc_delivery_from_sdp(const std::string
 }
 
 auto MBMS_RT::ContentStream::flute_file_received(std::shared_ptr<LibFlute::File> file) -> void {
-  spdlog::info("ContentStream: {} (TOI {}, MIME type {}) has been received at {}",
+  SPDLOG_DEBUG("ContentStream: {} (TOI {}, MIME type {}) has been received at {}",
                file->meta().content_location, file->meta().toi, file->meta().content_type, file->received_at());
   if (file->meta().content_location != "index.m3u8") { // ignore generated manifests
     std::string content_location = file->meta().content_location;
@@ -105,14 +118,32 @@ auto MBMS_RT::ContentStream::flute_file_received(std::shared_ptr<LibFlute::File>
     }
 
     //if this is an MPD also update our internal representation of the MPD
+    auto dash_manifest = std::atomic_load(&_dash_manifest);
     if (file->meta().content_location.find(".mpd") != std::string::npos) {
+      if (dash_manifest) {
+        try {
+          dash_manifest->update(std::string(file->buffer(), file->length()));
+          return;
+        } catch (const std::runtime_error& e) {
+          MW_LOG_RATE_LIMITED(spdlog::level::warn, "ContentStream: cannot parse received MPD: {}", e.what());
+        }
+      }
       _cache.add_item(std::make_shared<CachedFile>(
-          _base_path + "manifest.mpd", file->received_at(), std::move(file))
+          _base_path + "manifest.mpd", FluteCapture::received_at(*file), std::move(file))
       );
     } else {
+      auto location = file->meta().content_location;
       _cache.add_item(std::make_shared<CachedFile>(
-          content_location, file->received_at(), std::move(file))
+          content_location, FluteCapture::received_at(*file), std::move(file))
       );
+      DashManifest::SegmentInfo next;
+      if (dash_manifest && !dash_manifest->object_received(location, DashManifest::low_latency() ? &next : nullptr)) {
+        SPDLOG_DEBUG("ContentStream: {} is not a segment of the MPD", location);
+      } else if (!next.location.empty()) {
+        // low-latency DASH: players request the next segment before it has been received
+        _cache.expect_item(_base_path + next.location,
+            std::chrono::milliseconds(static_cast<int64_t>(2000 * next.duration_seconds)));
+      }
     }
 
   }
@@ -123,16 +154,80 @@ auto MBMS_RT::ContentStream::start() -> void {
   if (_5gbc_stream_type == "FLUTE/UDP") {
     spdlog::info("Starting FLUTE receiver on {}:{} for TSI {}", _5gbc_stream_mcast_addr, _5gbc_stream_mcast_port,
                  _5gbc_stream_flute_tsi);
-    _flute_thread = std::thread{[&]() {
-      _flute_receiver = std::make_unique<LibFlute::Receiver>(_5gbc_stream_iface, _5gbc_stream_mcast_addr,
-                                                             atoi(_5gbc_stream_mcast_port.c_str()),
-                                                             _5gbc_stream_flute_tsi, _io_service);
-      _flute_receiver->register_completion_callback(
-          boost::bind(&ContentStream::flute_file_received, this, _1)); //NOLINT
+    Metrics::Labels labels = {{"tsi", std::to_string(_5gbc_stream_flute_tsi)}};
+    auto objects_metric = &Metrics::registry().counter("mw_flute_objects_received_total",
+        "FLUTE objects received completely", labels);
+    auto bytes_metric = &Metrics::registry().counter("mw_flute_bytes_received_total",
+        "Bytes of the FLUTE objects received completely", labels);
+    _lost_metric = &Metrics::registry().counter("mw_flute_objects_lost_total",
+        "FLUTE objects that were not received completely", labels);
+
+    std::weak_ptr<ContentStream> weak = weak_from_this();
+    auto session = FluteCapture::session(_5gbc_stream_mcast_addr, _5gbc_stream_mcast_port, _5gbc_stream_flute_tsi);
+    auto completed = _strand.wrap(
+        [weak, objects_metric, bytes_metric, session](std::shared_ptr<LibFlute::File> file) { //NOLINT
+          FluteCapture::instance().record(session, {}, file);
+          objects_metric->inc();
+          bytes_metric->inc(file->length());
+          if (auto self = weak.lock()) {
+            LatencyTrace::instance().record(LatencyTrace::Stage::FluteReceived, file->meta().content_location,
+                self->_base);
+            self->_counters->broadcast_objects++;
+            self->_counters->broadcast_bytes += file->length();
+            self->flute_file_received(std::move(file));
+          }
+        });
+    if (FluteCapture::instance().replaying()) {
+      _replay_subscription = FluteCapture::instance().subscribe(session, completed);
+      return;
+    }
+    _flute_thread = std::thread{[&, completed]() {
+      auto receiver = std::make_unique<LibFlute::Receiver>(_5gbc_stream_iface, _5gbc_stream_mcast_addr,
+                                                           atoi(_5gbc_stream_mcast_port.c_str()),
+                                                           _5gbc_stream_flute_tsi, _io_service);
+      receiver->register_completion_callback(completed);
+      _cache.reassembly().add_session(flute_info(), receiver.get(), false, _5gbc_stream_flute_tsi);
+      const std::lock_guard<std::mutex> lock(_flute_receiver_mutex);
+      if (_drained) {
+        // drained while the receiver was being set up
+        receiver->stop();
+      }
+      _flute_receiver = std::move(receiver);
     }};
   }
 };
 
+auto MBMS_RT::ContentStream::drain() -> void {
+  spdlog::info("ContentStream at base {} draining", _base);
+  if (_replay_subscription != 0) {
+    FluteCapture::instance().unsubscribe(_replay_subscription);
+    _replay_subscription = 0;
+  }
+  const std::lock_guard<std::mutex> lock(_flute_receiver_mutex);
+  _drained = true;
+  if (_flute_receiver) {
+    _flute_receiver->stop();
+  }
+}
+
+auto MBMS_RT::ContentStream::same_configuration(const ContentStream &other) const -> bool {
+  return stream_type() == other.stream_type() &&
+         _delivery_protocol == other._delivery_protocol &&
+         _base == other._base &&
+         _base_path == other._base_path &&
+         _playlist_path == other._playlist_path &&
+         _5gbc_stream_iface == other._5gbc_stream_iface &&
+         _5gbc_stream_type == other._5gbc_stream_type &&
+         _5gbc_stream_mcast_addr == other._5gbc_stream_mcast_addr &&
+         _5gbc_stream_mcast_port == other._5gbc_stream_mcast_port &&
+         _5gbc_stream_flute_tsi == other._5gbc_stream_flute_tsi;
+}
+
+auto MBMS_RT::ContentStream::lost_objects() const -> uint64_t {
+  const std::lock_guard<std::mutex> lock(_flute_receiver_mutex);
+  return _flute_receiver ? _cache.reassembly().lost_objects(_flute_receiver.get()) : 0;
+}
+
 auto MBMS_RT::ContentStream::read_master_manifest(const std::string &manifest) -> void {
   if (_delivery_protocol == DeliveryProtocol::HLS) {
     auto pl = HlsPrimaryPlaylist(manifest, "");
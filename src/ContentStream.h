@@ -17,16 +17,22 @@
 
 #pragma once
 
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <libconfig.h++>
+#include <boost/asio.hpp>
 #include "File.h"
 #include "Receiver.h"
 #include "CacheManagement.h"
 #include "DeliveryProtocols.h"
+#include "ReceptionCounters.h"
+#include "Metrics.h"
+#include "DashManifest.h"
 
 namespace MBMS_RT {
-  class ContentStream {
+  class ContentStream : public std::enable_shared_from_this<ContentStream> {
     public:
       ContentStream(std::string base, std::string flute_if, boost::asio::io_service& io_service, CacheManagement& cache, DeliveryProtocol protocol, const libconfig::Config& cfg);
       virtual ~ContentStream();
@@ -40,7 +46,23 @@ namespace MBMS_RT {
 
       bool configure_5gbc_delivery_from_sdp(const std::string& sdp);
       void read_master_manifest(const std::string& manifest);
-      void start();
+      virtual void start();
+
+      /**
+       * Stops reception. Already received content stays available until the stream is destroyed.
+       */
+      virtual void drain();
+
+      /**
+       * Applies the settings of cfg that can change while the stream is running. Called on the control strand.
+       */
+      virtual void reconfigure(const libconfig::Config& /*cfg*/) {}
+
+      /**
+       * True if the other stream would receive the same content in the same way, i.e. replacing this stream by
+       * the other one would make no difference apart from metadata.
+       */
+      virtual bool same_configuration(const ContentStream& other) const;
 
       virtual void flute_file_received(std::shared_ptr<LibFlute::File> file);
 
@@ -49,6 +71,13 @@ namespace MBMS_RT {
 
       std::string flute_info() const;
 
+      const ReceptionCounters& counters() const { return *_counters; };
+
+      /**
+       * Number of objects that were not received via broadcast
+       */
+      virtual uint64_t lost_objects() const;
+
       DeliveryProtocol delivery_protocol() const { return _delivery_protocol; };
       std::string delivery_protocol_string() const { return _delivery_protocol == DeliveryProtocol::HLS ? "HLS" :
         (_delivery_protocol == DeliveryProtocol::DASH ? "DASH" : "RTP"); };
@@ -69,11 +98,17 @@ namespace MBMS_RT {
     std::string base_path() const { return _base_path; }
     void set_base_path(std::string p) { _base_path = p; };
 
+      /**
+       * DASH: received MPDs update the service manifest, received segments are listed in it
+       */
+      void set_dash_manifest(std::shared_ptr<DashManifest> manifest) { std::atomic_store(&_dash_manifest, std::move(manifest)); };
+
     protected:
       const libconfig::Config& _cfg;
       DeliveryProtocol _delivery_protocol;
       std::string _base = "";
       std::string _base_path;
+      std::shared_ptr<DashManifest> _dash_manifest;
       std::string _playlist_path;
       std::string _5gbc_stream_iface;
       std::string _5gbc_stream_type = "none";
@@ -81,9 +116,23 @@ namespace MBMS_RT {
       std::string _5gbc_stream_mcast_port = {};
       unsigned long long _5gbc_stream_flute_tsi = 0;
       std::thread _flute_thread;
+      // The receiver is created on _flute_thread, guarded by _flute_receiver_mutex
+      mutable std::mutex _flute_receiver_mutex;
       std::unique_ptr<LibFlute::Receiver> _flute_receiver;
+      bool _drained = false;
+      unsigned _replay_subscription = 0;   /**< FLUTE capture replay instead of the receiver */
 
       boost::asio::io_service& _io_service;
+
+      /**
+       * All handlers of this stream (received files, timers, CDN responses) are serialized on this strand, so
+       * streams can be processed in parallel on the io threads.
+       */
+      boost::asio::io_service::strand _strand;
+
+      // shared with the segments, which may outlive the stream in the cache
+      std::shared_ptr<ReceptionCounters> _counters = std::make_shared<ReceptionCounters>();
+      Metrics::Counter* _lost_metric = nullptr;
       CacheManagement& _cache;
 
       std::string _resolution;
@@ -16,8 +16,717 @@
 //
 
 #include "DashManifest.h"
+#include "CacheManagement.h"
 
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <iterator>
+#include <stdexcept>
 #include <utility>
+#include "spdlog/spdlog.h"
+
+namespace {
+  // Live window that is listed if the MPD does not signal a timeShiftBufferDepth
+  constexpr double kDefaultWindow = 300.0;
+  // Upper bound for the number of segments that are expanded per representation and call
+  constexpr uint64_t kMaxExpandedSegments = 100000;
+
+  auto attribute(const tinyxml2::XMLElement* element, const char* name) -> std::string {
+    auto value = element->Attribute(name);
+    return value != nullptr ? value : "";
+  }
+
+  auto parse_uint(const char* value, uint64_t& out) -> bool {
+    if (value == nullptr) return false;
+    std::string_view v(value);
+    auto [ptr, ec] = std::from_chars(v.data(), v.data() + v.size(), out);
+    return ec == std::errc() && ptr == v.data() + v.size();
+  }
+
+  auto uint_attribute(const tinyxml2::XMLElement* element, const char* name, uint64_t& out) -> bool {
+    return parse_uint(element->Attribute(name), out);
+  }
+
+  auto set_uint_attribute(tinyxml2::XMLElement* element, const char* name, uint64_t value) -> void {
+    element->SetAttribute(name, std::to_string(value).c_str());
+  }
+
+  auto is_absolute(const std::string& url) -> bool {
+    return url.find("://") != std::string::npos || (!url.empty() && url[0] == '/');
+  }
+
+  /**
+   * Applies the first BaseURL child of element to base. Absolute BaseURLs point to the origin and are removed from the
+   * local MPD: segments are served relative to the location of the local MPD.
+   */
+  auto resolve_base_url(tinyxml2::XMLElement* element, const std::string& base) -> std::string {
+    auto base_url = element->FirstChildElement("BaseURL");
+    if (base_url == nullptr || base_url->GetText() == nullptr) {
+      return base;
+    }
+    std::string url = base_url->GetText();
+    if (is_absolute(url)) {
+      element->DeleteChild(base_url);
+      return "";
+    }
+    return base.substr(0, base.rfind('/') + 1) + url;
+  }
+
+  auto format_identifier(uint64_t value, std::string_view format) -> std::string {
+    auto s = std::to_string(value);
+    // only the width tag defined by ISO/IEC 23009-1 (%0[width]d) is supported
+    unsigned width = 0;
+    if (format.size() > 3 && format.substr(0, 2) == "%0" && format.back() == 'd') {
+      std::from_chars(format.data() + 2, format.data() + format.size() - 1, width);
+    }
+    if (s.size() < width) {
+      s.insert(0, width - s.size(), '0');
+    }
+    return s;
+  }
+
+  /**
+   * Splits a media template at its $Number$ or $Time$ identifier. The remaining identifiers are substituted.
+   */
+  auto split_template(std::string_view tmpl, const MBMS_RT::DashManifest::Representation& rep,
+      std::string& prefix, std::string& identifier, std::string& format, std::string& suffix) -> bool {
+    identifier.clear();
+    prefix.clear();
+    suffix.clear();
+    auto* out = &prefix;
+    size_t pos = 0;
+    while (pos < tmpl.size()) {
+      auto start = tmpl.find('$', pos);
+      if (start == std::string_view::npos) {
+        out->append(tmpl.substr(pos));
+        break;
+      }
+      auto end = tmpl.find('$', start + 1);
+      if (end == std::string_view::npos) {
+        return false;
+      }
+      out->append(tmpl.substr(pos, start - pos));
+      auto id = tmpl.substr(start + 1, end - start - 1);
+      auto percent = id.find('%');
+      auto name = id.substr(0, percent);
+      auto fmt = percent == std::string_view::npos ? std::string_view() : id.substr(percent);
+      if (id.empty()) {
+        out->push_back('$');
+      } else if (name == "RepresentationID") {
+        out->append(rep.id);
+      } else if (name == "Bandwidth") {
+        out->append(format_identifier(rep.bandwidth, fmt));
+      } else if ((name == "Number" || name == "Time") && identifier.empty()) {
+        identifier = std::string(name);
+        format = std::string(fmt);
+        out = &suffix;
+      } else {
+        return false;
+      }
+      pos = end + 1;
+    }
+    return true;
+  }
+}
+
+bool MBMS_RT::DashManifest::_low_latency = false;
+double MBMS_RT::DashManifest::_availability_time_offset = 0;
+
+auto MBMS_RT::DashManifest::configure(const libconfig::Config& cfg) -> void
+{
+  cfg.lookupValue("mw.dash.low_latency.enabled", _low_latency);
+  cfg.lookupValue("mw.dash.low_latency.availability_time_offset", _availability_time_offset);
+  if (_low_latency) {
+    spdlog::info("DashManifest: low-latency DASH enabled, availabilityTimeOffset {}",
+        _availability_time_offset > 0 ? std::to_string(_availability_time_offset) : "one segment duration");
+  }
+}
 
 MBMS_RT::DashManifest::DashManifest(std::string content, std::string base_path)
-    : content(std::move(content)), base_path(std::move(base_path)) {}
\ No newline at end of file
+    : _content(std::move(content)), _base_path(std::move(base_path))
+{
+  parse();
+}
+
+auto MBMS_RT::DashManifest::parse_date_time(std::string_view value) -> double
+{
+  std::string v(value);
+  struct tm tm = {};
+  double seconds = 0;
+  int consumed = 0;
+  if (sscanf(v.c_str(), "%4d-%2d-%2dT%2d:%2d:%lf%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+        &tm.tm_hour, &tm.tm_min, &seconds, &consumed) != 6) {
+    return 0;
+  }
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  double offset = 0;
+  auto zone = v.substr(consumed);
+  if (!zone.empty() && (zone[0] == '+' || zone[0] == '-')) {
+    int hours = 0;
+    int minutes = 0;
+    if (sscanf(zone.c_str() + 1, "%2d:%2d", &hours, &minutes) < 1) {
+      return 0;
+    }
+    offset = (zone[0] == '+' ? 1 : -1) * (hours * 3600.0 + minutes * 60.0);
+  }
+  return static_cast<double>(timegm(&tm)) + seconds - offset;
+}
+
+auto MBMS_RT::DashManifest::parse_duration(std::string_view value) -> double
+{
+  if (value.empty() || value[0] != 'P') {
+    return 0;
+  }
+  std::string v(value.substr(1));
+  double total = 0;
+  bool in_time = false;
+  const char* p = v.c_str();
+  while (*p != '\0') {
+    if (*p == 'T') {
+      in_time = true;
+      p++;
+      continue;
+    }
+    char* end = nullptr;
+    double n = strtod(p, &end);
+    if (end == p || *end == '\0') {
+      return 0;
+    }
+    switch (*end) {
+      case 'Y': total += n * 365 * 86400; break;
+      case 'M': total += in_time ? n * 60 : n * 30 * 86400; break;
+      case 'W': total += n * 7 * 86400; break;
+      case 'D': total += n * 86400; break;
+      case 'H': total += n * 3600; break;
+      case 'S': total += n; break;
+      default: return 0;
+    }
+    p = end + 1;
+  }
+  return total;
+}
+
+auto MBMS_RT::DashManifest::parse() -> void
+{
+  _document = std::make_unique<tinyxml2::XMLDocument>();
+  if (_document->Parse(_content.c_str(), _content.size()) != tinyxml2::XML_SUCCESS) {
+    throw std::runtime_error("Invalid MPD: XML parsing failed");
+  }
+  auto mpd = _document->FirstChildElement("MPD");
+  if (mpd == nullptr) {
+    throw std::runtime_error("Invalid MPD: no MPD element");
+  }
+
+  _dynamic = attribute(mpd, "type") == "dynamic";
+  _availability_start_time = parse_date_time(attribute(mpd, "availabilityStartTime"));
+  _time_shift_buffer_depth = parse_duration(attribute(mpd, "timeShiftBufferDepth"));
+  _media_presentation_duration = parse_duration(attribute(mpd, "mediaPresentationDuration"));
+  if (_dynamic && _availability_start_time == 0) {
+    spdlog::warn("DashManifest: dynamic MPD without a valid availabilityStartTime");
+  }
+
+  auto read_template = [](const tinyxml2::XMLElement* element, SegmentTemplate& tpl) {
+    if (element == nullptr) return;
+    if (element->Attribute("media")) tpl.media = element->Attribute("media");
+    if (element->Attribute("initialization")) tpl.initialization = element->Attribute("initialization");
+    uint_attribute(element, "timescale", tpl.timescale);
+    uint_attribute(element, "duration", tpl.duration);
+    uint_attribute(element, "startNumber", tpl.start_number);
+    uint_attribute(element, "presentationTimeOffset", tpl.presentation_time_offset);
+    if (tpl.timescale == 0) tpl.timescale = 1;
+    auto timeline = element->FirstChildElement("SegmentTimeline");
+    if (timeline != nullptr) {
+      tpl.timeline.clear();
+      uint64_t t = 0;
+      for (auto s = timeline->FirstChildElement("S"); s != nullptr; s = s->NextSiblingElement("S")) {
+        SegmentTimelineEntry entry;
+        entry.t = t;
+        uint_attribute(s, "t", entry.t);
+        uint_attribute(s, "d", entry.d);
+        entry.r = s->Int64Attribute("r", 0);
+        tpl.timeline.push_back(entry);
+        t = entry.t + entry.d * (entry.r < 0 ? 1 : entry.r + 1);
+      }
+    }
+  };
+
+  // model first, the states below keep pointers into it
+  _periods.clear();
+  std::vector<RepresentationState> states;
+  auto mpd_base = resolve_base_url(mpd, "");
+  double period_start = 0;
+  for (auto p = mpd->FirstChildElement("Period"); p != nullptr; p = p->NextSiblingElement("Period")) {
+    Period period;
+    period.id = attribute(p, "id");
+    if (p->Attribute("start")) period_start = parse_duration(attribute(p, "start"));
+    period.start = period_start;
+    period.duration = parse_duration(attribute(p, "duration"));
+    auto period_base = resolve_base_url(p, mpd_base);
+    SegmentTemplate period_tpl;
+    auto period_tpl_element = p->FirstChildElement("SegmentTemplate");
+    read_template(period_tpl_element, period_tpl);
+
+    for (auto a = p->FirstChildElement("AdaptationSet"); a != nullptr; a = a->NextSiblingElement("AdaptationSet")) {
+      AdaptationSet as;
+      as.id = attribute(a, "id");
+      as.mime_type = attribute(a, "mimeType");
+      auto as_base = resolve_base_url(a, period_base);
+      SegmentTemplate as_tpl = period_tpl;
+      auto as_tpl_element = a->FirstChildElement("SegmentTemplate");
+      read_template(as_tpl_element, as_tpl);
+      auto inherited = as_tpl_element ? as_tpl_element : period_tpl_element;
+
+      for (auto r = a->FirstChildElement("Representation"); r != nullptr; r = r->NextSiblingElement("Representation")) {
+        Representation rep;
+        rep.id = attribute(r, "id");
+        rep.bandwidth = r->UnsignedAttribute("bandwidth", 0);
+        rep.base_url = resolve_base_url(r, as_base);
+        rep.segment_template = as_tpl;
+        auto rep_tpl_element = r->FirstChildElement("SegmentTemplate");
+        read_template(rep_tpl_element, rep.segment_template);
+        rep.has_template = rep_tpl_element != nullptr || inherited != nullptr;
+        if (rep.has_template && !rep.segment_template.media.empty()) {
+          // every representation gets its own SegmentTemplate, their segment lists differ once content is received
+          if (rep_tpl_element == nullptr) {
+            rep_tpl_element = inherited->DeepClone(_document.get())->ToElement();
+            r->InsertEndChild(rep_tpl_element);
+          }
+          RepresentationState state;
+          state.period_start = period.start;
+          state.period_duration = period.duration > 0 ? period.duration :
+            (_media_presentation_duration > period.start ? _media_presentation_duration - period.start : 0);
+          state.segment_template = rep_tpl_element;
+          state.base_url = rep.base_url;
+          state.number_based = rep.segment_template.media.find("$Number") != std::string::npos;
+          states.push_back(std::move(state));
+        }
+        as.representations.push_back(std::move(rep));
+      }
+      if (as_tpl_element != nullptr && !as.representations.empty()) {
+        a->DeleteChild(as_tpl_element);
+      }
+      period.adaptation_sets.push_back(std::move(as));
+    }
+    if (period_tpl_element != nullptr) {
+      p->DeleteChild(period_tpl_element);
+    }
+    if (period.duration > 0) {
+      period_start = period.start + period.duration;
+    }
+    _periods.push_back(std::move(period));
+  }
+
+  // link the states to the model, the model is not modified anymore
+  _states.clear();
+  size_t idx = 0;
+  for (auto& period : _periods) {
+    for (auto& as : period.adaptation_sets) {
+      for (auto& rep : as.representations) {
+        if (idx < states.size() && rep.has_template && !rep.segment_template.media.empty()) {
+          states[idx].representation = &rep;
+          _states.push_back(std::move(states[idx]));
+          idx++;
+        }
+      }
+    }
+  }
+
+  // write the merged template attributes, inherited ones are lost when the parent templates are removed
+  for (auto& state : _states) {
+    const auto& tpl = state.representation->segment_template;
+    auto el = state.segment_template;
+    el->SetAttribute("media", tpl.media.c_str());
+    if (!tpl.initialization.empty()) el->SetAttribute("initialization", tpl.initialization.c_str());
+    set_uint_attribute(el, "timescale", tpl.timescale);
+    set_uint_attribute(el, "startNumber", tpl.start_number);
+    if (tpl.duration > 0) set_uint_attribute(el, "duration", tpl.duration);
+    if (tpl.presentation_time_offset > 0) set_uint_attribute(el, "presentationTimeOffset", tpl.presentation_time_offset);
+    if (!tpl.timeline.empty() && el->FirstChildElement("SegmentTimeline") == nullptr) {
+      auto timeline = _document->NewElement("SegmentTimeline");
+      for (const auto& entry : tpl.timeline) {
+        auto s = _document->NewElement("S");
+        set_uint_attribute(s, "t", entry.t);
+        set_uint_attribute(s, "d", entry.d);
+        if (entry.r != 0) s->SetAttribute("r", entry.r);
+        timeline->InsertEndChild(s);
+      }
+      el->InsertEndChild(timeline);
+    }
+    if (_low_latency && _dynamic) {
+      // segments can be requested as soon as they start, the response completes when they have been received
+      auto duration = tpl.duration > 0 ? tpl.duration : (tpl.timeline.empty() ? 0 : tpl.timeline.back().d);
+      auto offset = _availability_time_offset > 0 ? _availability_time_offset :
+        static_cast<double>(duration) / tpl.timescale;
+      if (offset > 0) {
+        el->SetAttribute("availabilityTimeOffset", offset);
+        el->SetAttribute("availabilityTimeComplete", "false");
+      }
+    }
+  }
+
+  _segments.clear();
+  auto now = static_cast<double>(time(nullptr));
+  for (size_t i = 0; i < _states.size(); i++) {
+    expand(i, now);
+  }
+  _modified = true;
+  spdlog::info("DashManifest: parsed {} MPD with {} periods, {} segment template representations, {} segment locations",
+      _dynamic ? "dynamic" : "static", _periods.size(), _states.size(), _segments.size());
+}
+
+auto MBMS_RT::DashManifest::segment_location(const RepresentationState& state, uint64_t number, uint64_t time) const -> std::string
+{
+  std::string prefix, identifier, format, suffix;
+  if (!split_template(state.representation->segment_template.media, *state.representation, prefix, identifier, format, suffix)) {
+    return "";
+  }
+  if (identifier.empty()) {
+    return state.base_url + prefix;
+  }
+  return state.base_url + prefix + format_identifier(identifier == "Number" ? number : time, format) + suffix;
+}
+
+auto MBMS_RT::DashManifest::add_segment(size_t state, uint64_t number, uint64_t time, uint64_t duration) -> void
+{
+  const auto& s = _states[state];
+  const auto& tpl = s.representation->segment_template;
+  SegmentEntry entry;
+  entry.state = state;
+  entry.info.representation_id = s.representation->id;
+  entry.info.number = number;
+  entry.info.time = time;
+  entry.info.duration = duration;
+  entry.info.duration_seconds = static_cast<double>(duration) / tpl.timescale;
+  if (_dynamic) {
+    auto media_time = static_cast<double>(time + duration) - static_cast<double>(tpl.presentation_time_offset);
+    entry.info.availability_start = _availability_start_time + s.period_start + media_time / tpl.timescale;
+  }
+  entry.info.location = segment_location(s, number, time);
+  auto location = entry.info.location;
+  _segments[location] = std::move(entry);
+}
+
+auto MBMS_RT::DashManifest::expand(size_t state, double now) -> void
+{
+  auto& s = _states[state];
+  const auto& tpl = s.representation->segment_template;
+  // media time of the live edge, only used for dynamic MPDs
+  auto elapsed = now - _availability_start_time - s.period_start;
+  auto live_edge = static_cast<double>(tpl.presentation_time_offset) + elapsed * tpl.timescale;
+
+  if (!tpl.timeline.empty()) {
+    uint64_t number = tpl.start_number;
+    uint64_t count = 0;
+    for (size_t i = 0; i < tpl.timeline.size() && count < kMaxExpandedSegments; i++) {
+      const auto& entry = tpl.timeline[i];
+      if (entry.d == 0) break;
+      int64_t repeat = entry.r;
+      if (repeat < 0) {
+        // repeat until the next entry, the end of the period or the live edge
+        double end = i + 1 < tpl.timeline.size() ? static_cast<double>(tpl.timeline[i + 1].t) :
+          (_dynamic ? live_edge : static_cast<double>(tpl.presentation_time_offset) + s.period_duration * tpl.timescale);
+        repeat = end > entry.t ? static_cast<int64_t>(std::ceil((end - entry.t) / entry.d)) - 1 : 0;
+      }
+      for (int64_t r = 0; r <= repeat && count < kMaxExpandedSegments; r++, number++, count++) {
+        if (!s.expanded || number > s.expanded_until) {
+          add_segment(state, number, entry.t + r * entry.d, entry.d);
+          s.expanded_until = number;
+        }
+      }
+    }
+    s.expanded = true;
+    return;
+  }
+
+  if (tpl.duration == 0) {
+    return;
+  }
+  uint64_t first = tpl.start_number;
+  uint64_t last = 0;
+  if (_dynamic) {
+    auto window = _time_shift_buffer_depth > 0 ? _time_shift_buffer_depth : kDefaultWindow;
+    auto seconds_per_segment = static_cast<double>(tpl.duration) / tpl.timescale;
+    if (elapsed < 0) {
+      return;
+    }
+    auto available = static_cast<uint64_t>(elapsed / seconds_per_segment);
+    // allow objects that are delivered shortly before their availability start time
+    last = tpl.start_number + available + 2;
+    if (elapsed > window) {
+      first = tpl.start_number + static_cast<uint64_t>((elapsed - window) / seconds_per_segment);
+    }
+  } else {
+    if (s.period_duration <= 0) {
+      return;
+    }
+    auto count = static_cast<uint64_t>(std::ceil(s.period_duration * tpl.timescale / tpl.duration));
+    if (count == 0) {
+      return;
+    }
+    last = tpl.start_number + count - 1;
+  }
+  if (last - first >= kMaxExpandedSegments) {
+    first = last - kMaxExpandedSegments + 1;
+  }
+
+  // drop the segments that left the window
+  if (s.expanded) {
+    for (auto n = s.expanded_from; n < first && n <= s.expanded_until; n++) {
+      _segments.erase(segment_location(s, n, tpl.presentation_time_offset + (n - tpl.start_number) * tpl.duration));
+    }
+  }
+  for (auto n = first; n <= last; n++) {
+    if (!s.expanded || n < s.expanded_from || n > s.expanded_until) {
+      add_segment(state, n, tpl.presentation_time_offset + (n - tpl.start_number) * tpl.duration, tpl.duration);
+    }
+  }
+  s.expanded = true;
+  s.expanded_from = first;
+  s.expanded_until = std::max(s.expanded_until, last);
+}
+
+auto MBMS_RT::DashManifest::match_template(size_t state, const std::string& location) -> bool
+{
+  // Fallback for segments outside of the expanded window, e.g. if the local clock is off
+  auto& s = _states[state];
+  const auto& tpl = s.representation->segment_template;
+  std::string prefix, identifier, format, suffix;
+  if (!split_template(tpl.media, *s.representation, prefix, identifier, format, suffix) || identifier.empty()) {
+    return false;
+  }
+  prefix = s.base_url + prefix;
+  if (location.size() <= prefix.size() + suffix.size() || location.compare(0, prefix.size(), prefix) != 0 ||
+      location.compare(location.size() - suffix.size(), suffix.size(), suffix) != 0) {
+    return false;
+  }
+  uint64_t value = 0;
+  auto digits = std::string_view(location).substr(prefix.size(), location.size() - prefix.size() - suffix.size());
+  auto [ptr, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+  if (ec != std::errc() || ptr != digits.data() + digits.size()) {
+    return false;
+  }
+  uint64_t duration = tpl.duration;
+  if (duration == 0 && !tpl.timeline.empty()) {
+    duration = tpl.timeline.back().d;
+  }
+  if (identifier == "Number") {
+    if (value < tpl.start_number) {
+      return false;
+    }
+    add_segment(state, value, tpl.presentation_time_offset + (value - tpl.start_number) * duration, duration);
+  } else {
+    if (duration == 0) {
+      return false;
+    }
+    uint64_t number = tpl.start_number;
+    if (value > tpl.presentation_time_offset) {
+      number += (value - tpl.presentation_time_offset) / duration;
+    }
+    add_segment(state, number, value, duration);
+  }
+  return _segments.find(location) != _segments.end();
+}
+
+auto MBMS_RT::DashManifest::mark_received(const std::string& location) -> bool
+{
+  auto it = _segments.find(location);
+  if (it == _segments.end()) {
+    // the live edge has moved on since the map was last extended
+    auto now = static_cast<double>(time(nullptr));
+    for (size_t i = 0; i < _states.size(); i++) {
+      if (_dynamic) {
+        expand(i, now);
+      }
+    }
+    it = _segments.find(location);
+    for (size_t i = 0; it == _segments.end() && i < _states.size(); i++) {
+      if (match_template(i, location)) {
+        it = _segments.find(location);
+      }
+    }
+    if (it == _segments.end()) {
+      return false;
+    }
+  }
+  auto& state = _states[it->second.state];
+  const auto& info = it->second.info;
+  state.received[info.time] = ReceivedSegment{info.number, info.duration, location};
+  state.dirty = true;
+  prune_received(state);
+  return true;
+}
+
+auto MBMS_RT::DashManifest::prune_received(RepresentationState& state) -> void
+{
+  // Segments behind the time shift buffer of a dynamic MPD are no longer listed, forget them with their map entry
+  const auto& tpl = state.representation->segment_template;
+  auto window = static_cast<uint64_t>((_time_shift_buffer_depth > 0 ? _time_shift_buffer_depth : kDefaultWindow) *
+      tpl.timescale);
+  auto newest = std::prev(state.received.end())->first;
+  while (!state.received.empty()) {
+    auto oldest = state.received.begin();
+    if (!(_dynamic && oldest->first + window < newest) && state.received.size() <= kMaxExpandedSegments) {
+      break;
+    }
+    _segments.erase(oldest->second.location);
+    state.received.erase(oldest);
+  }
+}
+
+auto MBMS_RT::DashManifest::object_received(const std::string& location, SegmentInfo* next) -> bool
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  if (!mark_received(location)) {
+    return false;
+  }
+  if (next != nullptr) {
+    // a late segment may have been pruned right away
+    auto entry = _segments.find(location);
+    if (entry == _segments.end()) {
+      return true;
+    }
+    const auto& state = _states[entry->second.state];
+    auto it = _segments.find(segment_location(state, entry->second.info.number + 1,
+          entry->second.info.time + entry->second.info.duration));
+    if (it == _segments.end()) {
+      return true;
+    }
+    *next = it->second.info;
+  }
+  return true;
+}
+
+auto MBMS_RT::DashManifest::segment_info(const std::string& location, SegmentInfo& info) -> bool
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _segments.find(location);
+  if (it == _segments.end()) {
+    return false;
+  }
+  info = it->second.info;
+  return true;
+}
+
+auto MBMS_RT::DashManifest::update(std::string content) -> void
+{
+  auto updated = DashManifest(std::move(content), _base_path);
+
+  const std::lock_guard<std::mutex> lock(_mutex);
+  std::vector<std::string> received;
+  for (const auto& state : _states) {
+    for (const auto& segment : state.received) {
+      received.push_back(segment.second.location);
+    }
+  }
+  std::swap(_content, updated._content);
+  std::swap(_document, updated._document);
+  _dynamic = updated._dynamic;
+  _availability_start_time = updated._availability_start_time;
+  _time_shift_buffer_depth = updated._time_shift_buffer_depth;
+  _media_presentation_duration = updated._media_presentation_duration;
+  // moving the vectors keeps their elements, so the states still point into the new model
+  std::swap(_periods, updated._periods);
+  std::swap(_states, updated._states);
+  std::swap(_segments, updated._segments);
+  for (const auto& location : received) {
+    mark_received(location);
+  }
+  _modified = true;
+}
+
+auto MBMS_RT::DashManifest::render_representation(RepresentationState& state) -> void
+{
+  const auto& tpl = state.representation->segment_template;
+  auto el = state.segment_template;
+  auto timeline = el->FirstChildElement("SegmentTimeline");
+  if (timeline == nullptr) {
+    timeline = _document->NewElement("SegmentTimeline");
+    el->InsertEndChild(timeline);
+  }
+  timeline->DeleteChildren();
+
+  if (state.received.empty()) {
+    // nothing cached (anymore), fall back to the segment list of the source MPD
+    set_uint_attribute(el, "startNumber", tpl.start_number);
+    if (tpl.timeline.empty()) {
+      el->DeleteChild(timeline);
+      if (tpl.duration > 0) set_uint_attribute(el, "duration", tpl.duration);
+    }
+    for (const auto& entry : tpl.timeline) {
+      auto s = _document->NewElement("S");
+      set_uint_attribute(s, "t", entry.t);
+      set_uint_attribute(s, "d", entry.d);
+      if (entry.r != 0) s->SetAttribute("r", entry.r);
+      timeline->InsertEndChild(s);
+    }
+    return;
+  }
+
+  // $Number$ addressing requires consecutive numbers, only the latest contiguous run can be listed
+  auto first = state.received.begin();
+  if (state.number_based) {
+    auto it = std::prev(state.received.end());
+    while (it != state.received.begin() && std::prev(it)->second.number + 1 == it->second.number) {
+      --it;
+    }
+    first = it;
+  }
+
+  set_uint_attribute(el, "startNumber", first->second.number);
+  el->DeleteAttribute("duration");
+  tinyxml2::XMLElement* current = nullptr;
+  uint64_t expected = 0;
+  uint64_t current_d = 0;
+  int64_t repeat = 0;
+  for (auto it = first; it != state.received.end(); ++it) {
+    if (current != nullptr && it->first == expected && it->second.duration == current_d) {
+      repeat++;
+      current->SetAttribute("r", repeat);
+    } else {
+      current = _document->NewElement("S");
+      set_uint_attribute(current, "t", it->first);
+      set_uint_attribute(current, "d", it->second.duration);
+      timeline->InsertEndChild(current);
+      current_d = it->second.duration;
+      repeat = 0;
+    }
+    expected = it->first + it->second.duration;
+  }
+}
+
+auto MBMS_RT::DashManifest::render(const CacheManagement& cache) -> std::string
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  if (!_document) {
+    return _content;
+  }
+  for (auto& state : _states) {
+    // remove segments that have expired from the cache
+    while (!state.received.empty() && !cache.item(_base_path + state.received.begin()->second.location)) {
+      state.received.erase(state.received.begin());
+      state.dirty = true;
+    }
+    if (state.dirty) {
+      render_representation(state);
+      state.dirty = false;
+      _modified = true;
+    }
+  }
+  if (_modified) {
+    tinyxml2::XMLPrinter printer;
+    _document->Print(&printer);
+    _rendered = std::string(printer.CStr(), printer.CStrSize() > 0 ? printer.CStrSize() - 1 : 0);
+    _modified = false;
+  }
+  return _rendered;
+}
+
+auto MBMS_RT::DashManifest::content() const -> std::string
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  return _content;
+}
@@ -19,19 +19,195 @@
 #ifndef MW_DASHMANIFEST_H
 #define MW_DASHMANIFEST_H
 
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <libconfig.h++>
+#include "tinyxml2.h"
 
 namespace MBMS_RT {
+  class CacheManagement;
+
+  /**
+   * Parsed DASH MPD that is used to generate the middleware-local manifest.
+   *
+   * The segment lists of all SegmentTemplate based representations are expanded into a map from segment location
+   * (relative to base_path, with the BaseURL chain applied) to segment number, media time and availability start time.
+   * Received objects are matched against this map, and the SegmentTimeline of the generated MPD only lists segments
+   * that are actually in the cache. Only representations that received segments since the last call to render() are
+   * rewritten, the printed MPD is reused otherwise.
+   */
   class DashManifest {
   public:
+    /**
+     * Throws std::runtime_error if the content is not a valid MPD
+     */
     DashManifest(std::string content, std::string base_path);
 
     DashManifest() = default;
 
     ~DashManifest() = default;
 
-    std::string content;
-    std::string base_path;
+    struct SegmentTimelineEntry {
+      uint64_t t = 0;
+      uint64_t d = 0;
+      int64_t r = 0;
+    };
+
+    struct SegmentTemplate {
+      std::string media;
+      std::string initialization;
+      uint64_t timescale = 1;
+      uint64_t duration = 0;
+      uint64_t start_number = 1;
+      uint64_t presentation_time_offset = 0;
+      std::vector<SegmentTimelineEntry> timeline;
+    };
+
+    struct Representation {
+      std::string id;
+      unsigned long bandwidth = 0;
+      std::string base_url;
+      bool has_template = false;
+      SegmentTemplate segment_template;
+    };
+
+    struct AdaptationSet {
+      std::string id;
+      std::string mime_type;
+      std::vector<Representation> representations;
+    };
+
+    struct Period {
+      std::string id;
+      double start = 0;
+      double duration = 0;
+      std::vector<AdaptationSet> adaptation_sets;
+    };
+
+    struct SegmentInfo {
+      std::string location;
+      std::string representation_id;
+      uint64_t number = 0;
+      uint64_t time = 0;
+      uint64_t duration = 0;
+      double duration_seconds = 0;
+      /**
+       * Wall clock time (seconds since the epoch) at which the segment becomes available, 0 for static MPDs
+       */
+      double availability_start = 0;
+    };
+
+    /**
+     * Replaces the model with a newer version of the MPD. Segments received so far stay listed.
+     * Throws std::runtime_error if the content is not a valid MPD.
+     */
+    void update(std::string content);
+
+    /**
+     * Reads the low-latency settings (mw.dash.low_latency) that apply to all MPDs
+     */
+    static void configure(const libconfig::Config& cfg);
+
+    /**
+     * True if MPDs announce segments before they are complete (availabilityTimeOffset) and requests for the
+     * next segment are held until it has been received
+     */
+    static bool low_latency() { return _low_latency; };
+
+    /**
+     * Marks the segment at location (relative to base_path) as received.
+     * Returns false if the location is not a segment of this MPD. If next is set, it receives the segment that
+     * follows in the same representation, if that is known.
+     */
+    bool object_received(const std::string& location, SegmentInfo* next = nullptr);
+
+    /**
+     * Looks up a segment location (relative to base_path)
+     */
+    bool segment_info(const std::string& location, SegmentInfo& info);
+
+    /**
+     * Returns the middleware-local MPD. Segments that have expired from the cache are removed from the segment lists.
+     */
+    std::string render(const CacheManagement& cache);
+
+    std::string content() const;
+    const std::string& base_path() const { return _base_path; };
+    bool dynamic() const { return _dynamic; };
+    double availability_start_time() const { return _availability_start_time; };
+    const std::vector<Period>& periods() const { return _periods; };
+
+    /**
+     * Parses an xs:dateTime (e.g. 2022-05-03T08:00:00Z) to seconds since the epoch. Returns 0 on error.
+     */
+    static double parse_date_time(std::string_view value);
+
+    /**
+     * Parses an xs:duration (e.g. PT1H2M3.5S) to seconds. Returns 0 on error.
+     */
+    static double parse_duration(std::string_view value);
+
+  private:
+    struct ReceivedSegment {
+      uint64_t number = 0;
+      uint64_t duration = 0;
+      std::string location;
+    };
+
+    struct SegmentEntry {
+      size_t state = 0;
+      SegmentInfo info;
+    };
+
+    struct RepresentationState {
+      Representation* representation = nullptr;
+      double period_start = 0;
+      double period_duration = 0;
+      tinyxml2::XMLElement* segment_template = nullptr;
+      std::string base_url;
+      bool number_based = false;
+      bool dirty = false;
+      bool expanded = false;
+      uint64_t expanded_from = 0;
+      uint64_t expanded_until = 0;
+      /**
+       * Received segments by media time
+       */
+      std::map<uint64_t, ReceivedSegment> received;
+    };
+
+    void parse();
+    void add_segment(size_t state, uint64_t number, uint64_t time, uint64_t duration);
+    void expand(size_t state, double now);
+    bool match_template(size_t state, const std::string& location);
+    bool mark_received(const std::string& location);
+    void prune_received(RepresentationState& state);
+    void render_representation(RepresentationState& state);
+    std::string segment_location(const RepresentationState& state, uint64_t number, uint64_t time) const;
+
+    static bool _low_latency;
+    static double _availability_time_offset;
+
+    mutable std::mutex _mutex;
+    std::string _content;
+    std::string _base_path;
+    std::unique_ptr<tinyxml2::XMLDocument> _document;
+
+    bool _dynamic = false;
+    double _availability_start_time = 0;
+    double _time_shift_buffer_depth = 0;
+    double _media_presentation_duration = 0;
+    std::vector<Period> _periods;
+    std::vector<RepresentationState> _states;
+    std::unordered_map<std::string, SegmentEntry> _segments;
+
+    bool _modified = true;
+    std::string _rendered;
   };
 }
 
@@ -0,0 +1,420 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "FluteCapture.h"
+#include "LogRateLimit.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <set>
+#include <vector>
+#include "spdlog/spdlog.h"
+
+namespace {
+  constexpr size_t kHeaderSize = 36;
+  constexpr size_t kIndexEntrySize = 16;
+  constexpr uint8_t kFlagServiceAnnouncement = 0x01;
+
+  auto put(std::string& out, uint64_t value, size_t bytes) -> void {
+    for (size_t i = 0; i < bytes; i++) {
+      out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+  }
+
+  auto get(const uint8_t* in, size_t bytes) -> uint64_t {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++) {
+      value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return value;
+  }
+
+  auto wall_clock_us() -> uint64_t {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+}
+
+auto MBMS_RT::FluteCapture::instance() -> FluteCapture&
+{
+  static FluteCapture capture;
+  return capture;
+}
+
+MBMS_RT::FluteCapture::~FluteCapture()
+{
+  stop();
+}
+
+auto MBMS_RT::FluteCapture::configure(const libconfig::Config& cfg) -> void
+{
+  bool capture = false;
+  cfg.lookupValue("mw.capture.enabled", capture);
+  cfg.lookupValue("mw.capture.path", _path);
+  unsigned max_size = 1024;
+  cfg.lookupValue("mw.capture.max_size", max_size);
+  unsigned chunk_size = 64;
+  cfg.lookupValue("mw.capture.chunk_size", chunk_size);
+  unsigned max_queued = 256;
+  cfg.lookupValue("mw.capture.queue_size", max_queued);
+  _max_size = static_cast<uint64_t>(std::max(1U, max_size)) * 1024 * 1024;
+  // the oldest chunk is deleted as a whole, keep chunks small compared to the limit
+  _chunk_size = std::min(static_cast<uint64_t>(std::max(1U, chunk_size)) * 1024 * 1024,
+      std::max<uint64_t>(_max_size / 4, 1024 * 1024));
+  _max_queued = std::max(1U, max_queued);
+
+  bool replay = false;
+  cfg.lookupValue("mw.capture.replay.enabled", replay);
+  cfg.lookupValue("mw.capture.replay.speed", _replay_speed);
+  cfg.lookupValue("mw.capture.replay.start", _replay_start);
+  cfg.lookupValue("mw.capture.replay.loop", _replay_loop);
+
+  if (replay) {
+    _replaying = true;
+    spdlog::info("Replaying the FLUTE capture at {} ({})", _path,
+        _replay_speed > 0 ? fmt::format("{}x speed", _replay_speed) : std::string("maximum speed"));
+    if (capture) {
+      spdlog::warn("FLUTE capture is disabled while replaying");
+    }
+    return;
+  }
+  if (!capture) {
+    return;
+  }
+
+  std::error_code ec;
+  std::filesystem::create_directories(_path, ec);
+  if (ec) {
+    spdlog::error("Cannot create the FLUTE capture directory at {}: {}", _path, ec.message());
+    return;
+  }
+  // captures are only appended to, a restart continues after the existing chunks
+  _chunk_sizes = chunks();
+  _chunk = _chunk_sizes.empty() ? 0 : _chunk_sizes.rbegin()->first;
+  _capturing = true;
+  _writer = std::thread{[this]() { write_loop(); }};
+  spdlog::info("Capturing received FLUTE objects to {}, keeping up to {} MB", _path, _max_size / 1024 / 1024);
+}
+
+auto MBMS_RT::FluteCapture::record(const std::string& session, const std::string& tmgi,
+    const std::shared_ptr<LibFlute::File>& file) -> void
+{
+  if (!_capturing) {
+    return;
+  }
+  {
+    const std::lock_guard<std::mutex> lock(_queue_mutex);
+    if (_queue.size() >= _max_queued) {
+      _dropped++;
+      MW_LOG_RATE_LIMITED(spdlog::level::warn, "FLUTE capture cannot keep up, dropped {}",
+          file->meta().content_location);
+      return;
+    }
+    _queue.push_back({wall_clock_us(), session, tmgi, file});
+  }
+  _queue_cv.notify_one();
+}
+
+auto MBMS_RT::FluteCapture::write_loop() -> void
+{
+  std::unique_lock<std::mutex> lock(_queue_mutex);
+  for (;;) {
+    _queue_cv.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+    while (!_queue.empty()) {
+      auto record = std::move(_queue.front());
+      _queue.pop_front();
+      lock.unlock();
+      write(record);
+      lock.lock();
+    }
+    if (_stopping) {
+      break;
+    }
+  }
+  if (_data != nullptr) fclose(_data);
+  if (_index != nullptr) fclose(_index);
+  _data = nullptr;
+  _index = nullptr;
+}
+
+auto MBMS_RT::FluteCapture::write(const Record& record) -> void
+{
+  if (_data == nullptr || _chunk_bytes >= _chunk_size) {
+    open_chunk();
+    if (_data == nullptr) {
+      return;
+    }
+  }
+  const auto& meta = record.file->meta();
+  auto session = record.session.substr(0, 255);
+  auto tmgi = record.tmgi.substr(0, 255);
+  auto location = meta.content_location.substr(0, 65535);
+  auto content_type = meta.content_type.substr(0, 65535);
+
+  std::string header;
+  header.reserve(kHeaderSize + session.size() + tmgi.size() + location.size() + content_type.size());
+  header.append("FLC1");
+  put(header, record.time_us, 8);
+  put(header, meta.toi, 4);
+  put(header, tmgi.empty() ? 0 : kFlagServiceAnnouncement, 1);
+  put(header, session.size(), 1);
+  put(header, tmgi.size(), 1);
+  put(header, 0, 1);
+  put(header, location.size(), 2);
+  put(header, content_type.size(), 2);
+  put(header, meta.expires, 8);
+  put(header, record.file->length(), 4);
+  header.append(session).append(tmgi).append(location).append(content_type);
+
+  std::string index;
+  put(index, record.time_us, 8);
+  put(index, _chunk_bytes, 8);
+
+  // the index entry is written last, it never points to an incomplete record
+  if (fwrite(header.data(), 1, header.size(), _data) != header.size() ||
+      fwrite(record.file->buffer(), 1, record.file->length(), _data) != record.file->length() ||
+      fflush(_data) != 0 ||
+      fwrite(index.data(), 1, index.size(), _index) != index.size() ||
+      fflush(_index) != 0) {
+    MW_LOG_RATE_LIMITED(spdlog::level::err, "Writing to the FLUTE capture at {} failed: {}", _path,
+        strerror(errno));
+    // continue in a new chunk, the reader stops at the damaged record
+    _chunk_bytes = _chunk_size;
+    return;
+  }
+  _chunk_bytes += header.size() + record.file->length();
+  _chunk_sizes[_chunk] = _chunk_bytes;
+}
+
+auto MBMS_RT::FluteCapture::open_chunk() -> void
+{
+  if (_data != nullptr) fclose(_data);
+  if (_index != nullptr) fclose(_index);
+  _chunk++;
+  _chunk_bytes = 0;
+  _data = fopen(chunk_path(_chunk, "flc").c_str(), "wb");
+  _index = fopen(chunk_path(_chunk, "idx").c_str(), "wb");
+  if (_data == nullptr || _index == nullptr) {
+    MW_LOG_RATE_LIMITED(spdlog::level::err, "Cannot create FLUTE capture chunk {}: {}",
+        chunk_path(_chunk, "flc"), strerror(errno));
+    if (_data != nullptr) fclose(_data);
+    if (_index != nullptr) fclose(_index);
+    _data = nullptr;
+    _index = nullptr;
+    return;
+  }
+  _chunk_sizes[_chunk] = 0;
+  enforce_size_limit();
+}
+
+auto MBMS_RT::FluteCapture::enforce_size_limit() -> void
+{
+  uint64_t total = 0;
+  for (const auto& chunk : _chunk_sizes) {
+    total += chunk.second;
+  }
+  // the current chunk is never deleted
+  while (total + _chunk_size > _max_size && _chunk_sizes.size() > 1) {
+    auto oldest = _chunk_sizes.begin();
+    std::error_code ec;
+    std::filesystem::remove(chunk_path(oldest->first, "idx"), ec);
+    std::filesystem::remove(chunk_path(oldest->first, "flc"), ec);
+    SPDLOG_DEBUG("FLUTE capture: removed chunk {}", oldest->first);
+    total -= oldest->second;
+    _chunk_sizes.erase(oldest);
+  }
+}
+
+auto MBMS_RT::FluteCapture::chunk_path(uint64_t chunk, const char* extension) const -> std::string
+{
+  char name[64];
+  snprintf(name, sizeof(name), "capture-%010" PRIu64 ".%s", chunk, extension);
+  return (std::filesystem::path(_path) / name).string();
+}
+
+auto MBMS_RT::FluteCapture::chunks() const -> std::map<uint64_t, uint64_t>
+{
+  std::map<uint64_t, uint64_t> chunks;
+  std::error_code ec;
+  for (const auto& entry : std::filesystem::directory_iterator(_path, ec)) {
+    auto name = entry.path().filename().string();
+    if (name.rfind("capture-", 0) != 0 || entry.path().extension() != ".flc") {
+      continue;
+    }
+    auto chunk = strtoull(name.c_str() + 8, nullptr, 10);
+    if (chunk > 0) {
+      std::error_code size_ec;
+      auto size = entry.file_size(size_ec);
+      chunks[chunk] = size_ec ? 0 : size;
+    }
+  }
+  return chunks;
+}
+
+auto MBMS_RT::FluteCapture::subscribe(const std::string& session, file_cb_t cb) -> unsigned
+{
+  const std::lock_guard<std::mutex> lock(_subscribers_mutex);
+  auto id = _next_id++;
+  _subscribers.emplace(session, std::make_pair(id, std::move(cb)));
+  spdlog::info("Receiving FLUTE session {} from the capture", session);
+  return id;
+}
+
+auto MBMS_RT::FluteCapture::unsubscribe(unsigned id) -> void
+{
+  const std::lock_guard<std::mutex> lock(_subscribers_mutex);
+  for (auto it = _subscribers.begin(); it != _subscribers.end(); ++it) {
+    if (it->second.first == id) {
+      _subscribers.erase(it);
+      return;
+    }
+  }
+}
+
+auto MBMS_RT::FluteCapture::start_replay(boost::asio::io_service& io_service, announcement_cb_t announcement_cb) -> void
+{
+  if (!_replaying || _replay.joinable()) {
+    return;
+  }
+  _replay = std::thread{[this, &io_service, cb = std::move(announcement_cb)]() { replay_loop(io_service, cb); }};
+}
+
+auto MBMS_RT::FluteCapture::replay_loop(boost::asio::io_service& io_service, announcement_cb_t announcement_cb) -> void
+{
+  std::set<std::string> announced;
+  uint64_t replayed = 0;
+  do {
+    auto chunk_list = chunks();
+    if (chunk_list.empty()) {
+      spdlog::error("No FLUTE capture found at {}", _path);
+      return;
+    }
+    uint64_t first_us = 0;
+    uint64_t start_us = 0;
+    auto started_at = std::chrono::steady_clock::now();
+    for (const auto& chunk : chunk_list) {
+      std::unique_ptr<FILE, decltype(&fclose)> index(fopen(chunk_path(chunk.first, "idx").c_str(), "rb"), &fclose);
+      std::unique_ptr<FILE, decltype(&fclose)> data(fopen(chunk_path(chunk.first, "flc").c_str(), "rb"), &fclose);
+      if (!index || !data) {
+        continue;
+      }
+      uint8_t entry[kIndexEntrySize];
+      while (fread(entry, 1, sizeof(entry), index.get()) == sizeof(entry)) {
+        if (_replay_stopping) {
+          return;
+        }
+        auto time_us = get(entry, 8);
+        auto offset = get(entry + 8, 8);
+        if (first_us == 0) {
+          first_us = time_us;
+        }
+        if (time_us < first_us + _replay_start * 1000000ULL) {
+          continue;
+        }
+        if (start_us == 0) {
+          start_us = time_us;
+          started_at = std::chrono::steady_clock::now();
+        }
+
+        // read the record before waiting for its time, so it is dispatched on time
+        uint8_t header[kHeaderSize];
+        if (fseek(data.get(), static_cast<long>(offset), SEEK_SET) != 0 ||
+            fread(header, 1, sizeof(header), data.get()) != sizeof(header) || memcmp(header, "FLC1", 4) != 0) {
+          spdlog::warn("FLUTE capture chunk {} is damaged at offset {}", chunk.first, offset);
+          break;
+        }
+        auto toi = static_cast<uint32_t>(get(header + 12, 4));
+        auto flags = header[16];
+        std::vector<std::string> strings;
+        for (auto length : {get(header + 17, 1), get(header + 18, 1), get(header + 20, 2), get(header + 22, 2)}) {
+          std::string value(length, '\0');
+          if (length > 0 && fread(value.data(), 1, length, data.get()) != length) {
+            break;
+          }
+          strings.push_back(std::move(value));
+        }
+        auto expires = get(header + 24, 8);
+        std::vector<char> content(get(header + 32, 4));
+        if (strings.size() != 4 ||
+            (!content.empty() && fread(content.data(), 1, content.size(), data.get()) != content.size())) {
+          spdlog::warn("FLUTE capture chunk {} is truncated at offset {}", chunk.first, offset);
+          break;
+        }
+        const auto& session = strings[0];
+
+        if (_replay_speed > 0) {
+          auto due = started_at + std::chrono::microseconds(
+              static_cast<int64_t>((time_us - start_us) / _replay_speed));
+          while (!_replay_stopping && std::chrono::steady_clock::now() < due) {
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+                  due - std::chrono::steady_clock::now(), std::chrono::milliseconds(100)));
+          }
+        }
+
+        LibFlute::FecOti fec_oti{LibFlute::FecScheme::CompactNoCode, content.size(), 1428, 64};
+        auto file = std::make_shared<LibFlute::File>(toi, fec_oti, strings[2], strings[3], expires,
+            content.data(), content.size(), true);
+        auto deliver = [&]() {
+          const std::lock_guard<std::mutex> lock(_subscribers_mutex);
+          auto range = _subscribers.equal_range(session);
+          for (auto it = range.first; it != range.second; ++it) {
+            it->second.second(file);
+          }
+          return range.first != range.second;
+        };
+        if (!deliver() && (flags & kFlagServiceAnnouncement) != 0 && announced.insert(session).second &&
+            announcement_cb) {
+          // as if the modem reported the service announcement session
+          auto slash = session.rfind('/');
+          announcement_cb(strings[1], session.substr(0, slash), strtoull(session.c_str() + slash + 1, nullptr, 10));
+          deliver();
+        }
+        replayed++;
+
+        if (_replay_speed <= 0) {
+          // at maximum speed, wait until the io threads have caught up
+          auto done = std::make_shared<std::promise<void>>();
+          auto caught_up = done->get_future();
+          io_service.post([done]() { done->set_value(); });
+          while (!_replay_stopping && caught_up.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+          }
+        }
+      }
+    }
+    spdlog::info("Replayed {} objects from the FLUTE capture at {}", replayed, _path);
+  } while (_replay_loop && !_replay_stopping);
+}
+
+auto MBMS_RT::FluteCapture::stop() -> void
+{
+  _replay_stopping = true;
+  if (_replay.joinable()) {
+    _replay.join();
+  }
+  {
+    const std::lock_guard<std::mutex> lock(_queue_mutex);
+    _stopping = true;
+  }
+  _queue_cv.notify_one();
+  if (_writer.joinable()) {
+    _writer.join();
+  }
+}
@@ -0,0 +1,163 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <libconfig.h++>
+#include <boost/asio.hpp>
+#include "File.h"
+
+namespace MBMS_RT {
+  /**
+   * Records the FLUTE objects received by the service announcement and the content streams, and replays such a
+   * capture through the same completion callbacks instead of receiving from the network.
+   *
+   * A capture is a directory of chunk files (capture-<n>.flc) that are only ever appended to. Each chunk has an
+   * index (capture-<n>.idx) with the reception time and file offset of every record. When the capture exceeds its
+   * size limit, the oldest chunks are deleted, so it holds the most recent objects.
+   *
+   * Records (little endian): "FLC1", reception time (us since the epoch, 8 bytes), TOI (4), flags (1, bit 0:
+   * service announcement), session length (1), TMGI length (1), reserved (1), content location length (2),
+   * content type length (2), expires (8), data length (4), followed by the session, TMGI, content location,
+   * content type and data. Index entries are the reception time (8) and the record offset (8).
+   */
+  class FluteCapture {
+    public:
+      typedef std::function<void(std::shared_ptr<LibFlute::File>)> file_cb_t;
+      /**
+       * Called on the replay thread for a service announcement session that has no subscriber, with its TMGI,
+       * multicast address (address:port) and TSI. Returns when the session has been set up.
+       */
+      typedef std::function<void(const std::string& tmgi, const std::string& address, unsigned long long tsi)>
+        announcement_cb_t;
+
+      static FluteCapture& instance();
+
+      /**
+       * Reads mw.capture. Starts writing if capturing is enabled. Replay takes precedence over capturing. Must be
+       * called before any receiver is started.
+       */
+      void configure(const libconfig::Config& cfg);
+
+      bool capturing() const { return _capturing; };
+      bool replaying() const { return _replaying; };
+
+      /**
+       * Reception time of file (seconds since the epoch). Replayed objects are not reassembled by LibFlute and carry
+       * none, they count as received when they are injected.
+       */
+      static unsigned long received_at(const LibFlute::File& file) {
+        return file.received_at() != 0 ? file.received_at() : static_cast<unsigned long>(time(nullptr));
+      };
+
+      /**
+       * Identifies a FLUTE session in the capture
+       */
+      static std::string session(const std::string& address, const std::string& port, unsigned long long tsi) {
+        return address + ":" + port + "/" + std::to_string(tsi);
+      };
+
+      /**
+       * Queues a received object to be written. Never blocks, objects are dropped (and counted) if the writer
+       * falls behind.
+       *
+       * @param tmgi set for service announcement sessions
+       */
+      void record(const std::string& session, const std::string& tmgi, const std::shared_ptr<LibFlute::File>& file);
+
+      /**
+       * Replay: cb receives the objects of session. It is called with a lock held and must not block.
+       *
+       * @return id for unsubscribe
+       */
+      unsigned subscribe(const std::string& session, file_cb_t cb);
+      void unsubscribe(unsigned id);
+
+      /**
+       * Starts replaying the capture on a separate thread
+       */
+      void start_replay(boost::asio::io_service& io_service, announcement_cb_t announcement_cb);
+
+      /**
+       * Stops replaying, and writes the objects queued for capture
+       */
+      void stop();
+
+      uint64_t dropped() const { return _dropped; };
+
+    private:
+      FluteCapture() = default;
+      ~FluteCapture();
+
+      struct Record {
+        uint64_t time_us;
+        std::string session;
+        std::string tmgi;
+        std::shared_ptr<LibFlute::File> file;
+      };
+
+      void write_loop();
+      void write(const Record& record);
+      void open_chunk();
+      void enforce_size_limit();
+      void replay_loop(boost::asio::io_service& io_service, announcement_cb_t announcement_cb);
+
+      std::string chunk_path(uint64_t chunk, const char* extension) const;
+      std::map<uint64_t, uint64_t> chunks() const;
+
+      bool _capturing = false;
+      bool _replaying = false;
+      std::string _path = "/var/cache/5gmag-rt/capture";
+      uint64_t _max_size = 1024ULL * 1024 * 1024;
+      uint64_t _chunk_size = 64ULL * 1024 * 1024;
+      size_t _max_queued = 256;
+      double _replay_speed = 1.0;
+      unsigned _replay_start = 0;
+      bool _replay_loop = false;
+
+      // writer
+      std::mutex _queue_mutex;
+      std::condition_variable _queue_cv;
+      std::deque<Record> _queue;
+      bool _stopping = false;
+      std::thread _writer;
+      std::atomic<uint64_t> _dropped = {0};
+      FILE* _data = nullptr;
+      FILE* _index = nullptr;
+      uint64_t _chunk = 0;
+      uint64_t _chunk_bytes = 0;
+      std::map<uint64_t, uint64_t> _chunk_sizes;   /**< size of the chunks on disk, by number */
+
+      // replay
+      std::mutex _subscribers_mutex;
+      std::multimap<std::string, std::pair<unsigned, file_cb_t>> _subscribers;
+      unsigned _next_id = 1;
+      std::atomic<bool> _replay_stopping = {false};
+      std::thread _replay;
+  };
+}
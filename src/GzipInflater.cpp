@@ -0,0 +1,66 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "GzipInflater.h"
+
+MBMS_RT::GzipInflater::GzipInflater()
+{
+  // 32 + MAX_WBITS: automatic detection of gzip and zlib headers
+  _initialized = inflateInit2(&_stream, 32 + MAX_WBITS) == Z_OK;
+}
+
+MBMS_RT::GzipInflater::~GzipInflater()
+{
+  if (_initialized) {
+    inflateEnd(&_stream);
+  }
+}
+
+auto MBMS_RT::GzipInflater::inflate(const char* data, size_t length, std::string& out,
+    const progress_callback_t& progress) -> bool
+{
+  out.clear();
+  if (!_initialized || inflateReset(&_stream) != Z_OK) {
+    return false;
+  }
+
+  _stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  _stream.avail_in = static_cast<uInt>(length);
+
+  int ret = Z_OK;
+  while (ret != Z_STREAM_END) {
+    auto produced = out.size();
+    out.resize(produced + CHUNK_SIZE);
+    _stream.next_out = reinterpret_cast<Bytef*>(&out[produced]);
+    _stream.avail_out = CHUNK_SIZE;
+
+    ret = ::inflate(&_stream, Z_NO_FLUSH);
+    out.resize(produced + CHUNK_SIZE - _stream.avail_out);
+
+    if (ret != Z_OK && ret != Z_STREAM_END) {
+      return false;
+    }
+    if (progress) {
+      progress(out);
+    }
+    if (ret == Z_OK && _stream.avail_in == 0 && _stream.avail_out != 0) {
+      // input exhausted before the end of the stream
+      return false;
+    }
+  }
+  return true;
+}
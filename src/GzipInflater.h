@@ -0,0 +1,54 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <zlib.h>
+
+namespace MBMS_RT {
+  /**
+   * Streaming gzip/zlib decompressor. The zlib state is kept between calls, and the output is written into a
+   * caller supplied string so its allocation can be reused for subsequent objects.
+   */
+  class GzipInflater {
+    public:
+      typedef std::function<void(std::string_view)> progress_callback_t;
+
+      GzipInflater();
+      virtual ~GzipInflater();
+
+      /**
+       * Decompresses data into out, replacing its previous content.
+       * The progress callback is called with the complete output produced so far after each decompressed chunk.
+       *
+       * @return false if the data is not valid gzip/zlib or is truncated
+       */
+      bool inflate(const char* data, size_t length, std::string& out, const progress_callback_t& progress = nullptr);
+
+      static bool is_gzip(const char* data, size_t length) {
+        return length >= 2 && static_cast<unsigned char>(data[0]) == 0x1f && static_cast<unsigned char>(data[1]) == 0x8b;
+      };
+
+    private:
+      z_stream _stream = {};
+      bool _initialized = false;
+      static constexpr size_t CHUNK_SIZE = 64 * 1024;
+  };
+}
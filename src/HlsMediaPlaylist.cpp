@@ -17,74 +17,431 @@
 
 #include "HlsMediaPlaylist.h"
 
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <stdexcept>
 #include "spdlog/spdlog.h"
-#include "boost/algorithm/string.hpp"
-#include <sstream>
 
-MBMS_RT::HlsMediaPlaylist::HlsMediaPlaylist(const std::string& content)
-{
-  spdlog::debug("Parsing HLS media playlist: {}", content);
+namespace {
+  auto trim(std::string_view s) -> std::string_view {
+    auto is_space = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+    while (!s.empty() && is_space(s.front())) s.remove_prefix(1);
+    while (!s.empty() && is_space(s.back())) s.remove_suffix(1);
+    return s;
+  }
 
-  std::istringstream iss(content);
-  int idx = 0;
-  int seq_nr = 0;
-  double extinf = -1;
-  for (std::string line; std::getline(iss, line); idx++ )
-  {
-    boost::algorithm::trim(line);
-
-    if (idx==0) {
-      if ( line != "#EXTM3U") {
-        throw("HLS playlist parsing failed: first line is not #EXTM3U");
-      } else {
-        continue;
+  template <typename T>
+  auto parse_int(std::string_view s, T& value) -> bool {
+    s = trim(s);
+    auto result = std::from_chars(s.data(), s.data() + s.size(), value);
+    return result.ec == std::errc();
+  }
+
+  // Decimal number without exponent, as used for EXTINF durations. std::from_chars for floating point types is not
+  // available with all toolchains we build on, so the integer and fractional parts are parsed separately.
+  auto parse_decimal(std::string_view s, double& value) -> bool {
+    static constexpr double kPow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+                                        1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18};
+    s = trim(s);
+    const char* end = s.data() + s.size();
+    uint64_t integer = 0;
+    auto result = std::from_chars(s.data(), end, integer);
+    if (result.ec != std::errc()) {
+      return false;
+    }
+    double v = static_cast<double>(integer);
+    if (result.ptr < end && *result.ptr == '.') {
+      const char* fraction_start = result.ptr + 1;
+      // ignore digits beyond double precision
+      const char* fraction_end = std::min(end, fraction_start + 18);
+      uint64_t fraction = 0;
+      auto fr = std::from_chars(fraction_start, fraction_end, fraction);
+      if (fr.ec == std::errc()) {
+        v += static_cast<double>(fraction) / kPow10[fr.ptr - fraction_start];
       }
     }
+    value = v;
+    return true;
+  }
 
-    size_t cpos = line.rfind(':');
+  auto parse_byterange(std::string_view s, MBMS_RT::HlsMediaPlaylist::ByteRange& range) -> void {
+    auto at = s.find('@');
+    parse_int(s.substr(0, at), range.length);
+    if (at != std::string_view::npos) {
+      parse_int(s.substr(at + 1), range.offset);
+    }
+  }
 
-    if (line.rfind("#EXT-X-VERSION", 0) == 0) {
-      if (_version != -1) {
-        throw("HLS playlist parsing failed: duplicate #EXT-X-VERSION");
+  // Calls handler(name, value) for each attribute of an attribute list (RFC 8216, section 4.2). The quotes of
+  // quoted-string values are removed.
+  template <typename Handler>
+  auto for_each_attribute(std::string_view list, Handler handler) -> void {
+    size_t pos = 0;
+    while (pos < list.size()) {
+      auto eq = list.find('=', pos);
+      if (eq == std::string_view::npos) {
+        return;
+      }
+      auto name = trim(list.substr(pos, eq - pos));
+      std::string_view value;
+      if (eq + 1 < list.size() && list[eq + 1] == '"') {
+        auto close = list.find('"', eq + 2);
+        if (close == std::string_view::npos) {
+          return;
+        }
+        value = list.substr(eq + 2, close - eq - 2);
+        pos = list.find(',', close);
+      } else {
+        pos = list.find(',', eq + 1);
+        value = trim(list.substr(eq + 1, pos == std::string_view::npos ? std::string_view::npos : pos - eq - 1));
+      }
+      handler(name, value);
+      if (pos == std::string_view::npos) {
+        return;
       }
-      if (cpos != std::string::npos) {
-        _version = atoi(line.substr(cpos+1).c_str());
+      pos++;
+    }
+  }
+
+  auto append_decimal(std::string& out, double value) -> void {
+    char number[32];
+    auto length = snprintf(number, sizeof(number), "%g", value);
+    out.append(number, std::clamp(length, 0, static_cast<int>(sizeof(number)) - 1));
+  }
+
+  // True if line is the given tag, either without a value or followed by ':' and the value
+  auto tag_value(std::string_view line, std::string_view tag, std::string_view& value) -> bool {
+    if (line.size() < tag.size() || line.compare(0, tag.size(), tag) != 0) {
+      return false;
+    }
+    auto rest = line.substr(tag.size());
+    if (rest.empty()) {
+      value = {};
+      return true;
+    }
+    if (rest.front() != ':') {
+      // a different tag sharing the prefix
+      return false;
+    }
+    value = rest.substr(1);
+    return true;
+  }
+}
+
+MBMS_RT::HlsMediaPlaylist::HlsMediaPlaylist(std::string_view content)
+{
+  SPDLOG_TRACE("Parsing HLS media playlist: {}", content);
+
+  bool first_line = true;
+  int seq_nr = 0;
+  std::string key;
+  std::string map;
+  Segment next{{}, 0, -1};
+  std::vector<Part> parts;
+  size_t pos = 0;
+  while (pos < content.size()) {
+    auto nl = content.find('\n', pos);
+    auto line = trim(content.substr(pos, nl == std::string_view::npos ? std::string_view::npos : nl - pos));
+    pos = nl == std::string_view::npos ? content.size() : nl + 1;
+
+    if (first_line) {
+      if (line != "#EXTM3U") {
+        throw std::runtime_error("HLS playlist parsing failed: first line is not #EXTM3U");
       }
-    } else if (line.rfind("#EXT-X-TARGETDURATION", 0) == 0) {
-      if (cpos != std::string::npos) {
-        _targetduration = atoi(line.substr(cpos+1).c_str());
+      first_line = false;
+      continue;
+    }
+    if (line.empty()) {
+      continue;
+    }
+
+    if (line.front() != '#') {
+      next.uri = std::string(line);
+      next.seq = seq_nr++;
+      next.key = key;
+      next.map = map;
+      next.parts = std::move(parts);
+      parts.clear();
+      _segments.push_back(std::move(next));
+      next = Segment{{}, 0, -1};
+      continue;
+    }
+
+    std::string_view value;
+    if (tag_value(line, "#EXTINF", value)) {
+      auto comma = value.find(',');
+      parse_decimal(value.substr(0, comma), next.extinf);
+      if (comma != std::string_view::npos) {
+        next.title = std::string(value.substr(comma + 1));
       }
-    } else if (line.rfind("#EXT-X-MEDIA-SEQUENCE", 0) == 0) {
-      if (cpos != std::string::npos) {
-        seq_nr = atoi(line.substr(cpos+1).c_str());
+    } else if (tag_value(line, "#EXT-X-PART", value)) {
+      Part part;
+      for_each_attribute(value, [&part](std::string_view name, std::string_view v) {
+        if (name == "URI") part.uri = std::string(v);
+        else if (name == "DURATION") parse_decimal(v, part.duration);
+        else if (name == "INDEPENDENT") part.independent = v == "YES";
+        else if (name == "GAP") part.gap = v == "YES";
+        else if (name == "BYTERANGE") parse_byterange(v, part.byterange);
+      });
+      parts.push_back(std::move(part));
+    } else if (tag_value(line, "#EXT-X-PRELOAD-HINT", value)) {
+      PreloadHint hint;
+      for_each_attribute(value, [&hint](std::string_view name, std::string_view v) {
+        if (name == "TYPE") hint.type = std::string(v);
+        else if (name == "URI") hint.uri = std::string(v);
+        else if (name == "BYTERANGE-START") parse_int(v, hint.byterange_start);
+        else if (name == "BYTERANGE-LENGTH") parse_int(v, hint.byterange_length);
+      });
+      // a hint for the next part takes precedence over a hint for the next initialization section
+      if (_preload_hint.uri.empty() || hint.type == "PART") {
+        _preload_hint = std::move(hint);
       }
-    } else if (line.rfind("#EXTINF", 0) == 0) {
-      if (cpos != std::string::npos) {
-        extinf = atof(line.substr(cpos+1).c_str());
+    } else if (tag_value(line, "#EXT-X-RENDITION-REPORT", value)) {
+      RenditionReport report;
+      for_each_attribute(value, [&report](std::string_view name, std::string_view v) {
+        if (name == "URI") report.uri = std::string(v);
+        else if (name == "LAST-MSN") parse_int(v, report.last_msn);
+        else if (name == "LAST-PART") parse_int(v, report.last_part);
+      });
+      _rendition_reports.push_back(std::move(report));
+    } else if (tag_value(line, "#EXT-X-SERVER-CONTROL", value)) {
+      for_each_attribute(value, [this](std::string_view name, std::string_view v) {
+        if (name == "CAN-BLOCK-RELOAD") _server_control.can_block_reload = v == "YES";
+        else if (name == "CAN-SKIP-UNTIL") parse_decimal(v, _server_control.can_skip_until);
+        else if (name == "CAN-SKIP-DATERANGES") _server_control.can_skip_dateranges = v == "YES";
+        else if (name == "HOLD-BACK") parse_decimal(v, _server_control.hold_back);
+        else if (name == "PART-HOLD-BACK") parse_decimal(v, _server_control.part_hold_back);
+      });
+    } else if (tag_value(line, "#EXT-X-PART-INF", value)) {
+      for_each_attribute(value, [this](std::string_view name, std::string_view v) {
+        if (name == "PART-TARGET") parse_decimal(v, _part_target);
+      });
+    } else if (tag_value(line, "#EXT-X-BYTERANGE", value)) {
+      parse_byterange(value, next.byterange);
+    } else if (tag_value(line, "#EXT-X-PROGRAM-DATE-TIME", value)) {
+      next.program_date_time = std::string(value);
+    } else if (tag_value(line, "#EXT-X-DISCONTINUITY", value)) {
+      next.discontinuity = true;
+    } else if (tag_value(line, "#EXT-X-KEY", value)) {
+      key = value == "METHOD=NONE" ? "" : std::string(value);
+    } else if (tag_value(line, "#EXT-X-MAP", value)) {
+      map = std::string(value);
+    } else if (tag_value(line, "#EXT-X-MEDIA-SEQUENCE", value)) {
+      parse_int(value, seq_nr);
+    } else if (tag_value(line, "#EXT-X-DISCONTINUITY-SEQUENCE", value)) {
+      parse_int(value, _discontinuity_sequence);
+    } else if (tag_value(line, "#EXT-X-TARGETDURATION", value)) {
+      parse_int(value, _targetduration);
+    } else if (tag_value(line, "#EXT-X-VERSION", value)) {
+      if (_version != -1) {
+        throw std::runtime_error("HLS playlist parsing failed: duplicate #EXT-X-VERSION");
       }
-    } else if (line.rfind('#', 0) == 0) {
-        spdlog::debug("HLS playlist parser ignoring unhandled line {}", line);
-    } else if (line.size() > 0) {
-        _segments.push_back({line, seq_nr++, extinf});
+      parse_int(value, _version);
+    } else if (tag_value(line, "#EXT-X-PLAYLIST-TYPE", value)) {
+      _playlist_type = std::string(value);
+    } else if (tag_value(line, "#EXT-X-ENDLIST", value)) {
+      _ended = true;
+    } else {
+      SPDLOG_DEBUG("HLS playlist parser ignoring unhandled line {}", line);
     }
   }
+  if (first_line) {
+    throw std::runtime_error("HLS playlist parsing failed: playlist is empty");
+  }
+  _pending_parts = std::move(parts);
 }
 
-
-auto MBMS_RT::HlsMediaPlaylist::to_string() const -> std::string
+auto MBMS_RT::HlsMediaPlaylist::to_string(std::vector<size_t>* segment_offsets) const -> std::string
 {
-  std::stringstream pl;
+  int version = std::max(3, _version);
+  size_t size = 128;
+  for (const auto& seg : _segments) {
+    size += 64 + seg.uri.size() + seg.title.size() + seg.program_date_time.size();
+    for (const auto& part : seg.parts) size += 64 + part.uri.size();
+    if (seg.byterange.length > 0) version = std::max(version, 4);
+    if (!seg.map.empty()) version = std::max(version, 6);
+  }
+  if (_server_control.can_skip_until > 0) {
+    // EXT-X-SKIP in delta updates
+    version = std::max(version, 9);
+  }
+  for (const auto& part : _pending_parts) size += 64 + part.uri.size();
+
+  std::string pl;
+  pl.reserve(size);
+  char number[32];
+  auto append_number = [&pl, &number](auto value) {
+    auto result = std::to_chars(number, number + sizeof(number), value);
+    pl.append(number, result.ptr);
+  };
+
+  auto append_parts = [&pl, &append_number](const std::vector<Part>& parts) {
+    for (const auto& part : parts) {
+      pl += "#EXT-X-PART:DURATION=";
+      append_decimal(pl, part.duration);
+      pl += ",URI=\"";
+      pl += part.uri;
+      pl += '"';
+      if (part.independent) {
+        pl += ",INDEPENDENT=YES";
+      }
+      if (part.byterange.length > 0) {
+        pl += ",BYTERANGE=\"";
+        append_number(part.byterange.length);
+        if (part.byterange.offset >= 0) {
+          pl += '@';
+          append_number(part.byterange.offset);
+        }
+        pl += '"';
+      }
+      if (part.gap) {
+        pl += ",GAP=YES";
+      }
+      pl += '\n';
+    }
+  };
 
-  pl << "#EXTM3U" << std::endl;
-  pl << "#EXT-X-VERSION:3" << std::endl;
+  pl += "#EXTM3U\n#EXT-X-VERSION:";
+  append_number(version);
+  pl += '\n';
 
-  if (_segments.size() > 0) {
-    pl << "#EXT-X-TARGETDURATION:" << _targetduration << std::endl;
-    pl << "#EXT-X-MEDIA-SEQUENCE:" << _segments[0].seq << std::endl;
+  if (!_segments.empty()) {
+    pl += "#EXT-X-TARGETDURATION:";
+    append_number(_targetduration);
+    pl += '\n';
+    if (!_playlist_type.empty()) {
+      pl += "#EXT-X-PLAYLIST-TYPE:";
+      pl += _playlist_type;
+      pl += '\n';
+    }
+    const auto& sc = _server_control;
+    if (sc.can_block_reload || sc.can_skip_until > 0 || sc.hold_back > 0 || sc.part_hold_back > 0) {
+      pl += "#EXT-X-SERVER-CONTROL:";
+      auto start = pl.size();
+      auto separator = [&pl, start]() { if (pl.size() > start) pl += ','; };
+      if (sc.can_block_reload) {
+        pl += "CAN-BLOCK-RELOAD=YES";
+      }
+      if (sc.can_skip_until > 0) {
+        separator();
+        pl += "CAN-SKIP-UNTIL=";
+        append_decimal(pl, sc.can_skip_until);
+        if (sc.can_skip_dateranges) {
+          pl += ",CAN-SKIP-DATERANGES=YES";
+        }
+      }
+      if (sc.hold_back > 0) {
+        separator();
+        pl += "HOLD-BACK=";
+        append_decimal(pl, sc.hold_back);
+      }
+      if (sc.part_hold_back > 0) {
+        separator();
+        pl += "PART-HOLD-BACK=";
+        append_decimal(pl, sc.part_hold_back);
+      }
+      pl += '\n';
+    }
+    if (_part_target > 0) {
+      pl += "#EXT-X-PART-INF:PART-TARGET=";
+      append_decimal(pl, _part_target);
+      pl += '\n';
+    }
+    pl += "#EXT-X-MEDIA-SEQUENCE:";
+    append_number(_segments[0].seq);
+    pl += '\n';
+    if (_discontinuity_sequence > 0) {
+      pl += "#EXT-X-DISCONTINUITY-SEQUENCE:";
+      append_number(_discontinuity_sequence);
+      pl += '\n';
+    }
+  }
+
+  // EXT-X-KEY and EXT-X-MAP apply until they are replaced, so they are only written when they change
+  const std::string* key = nullptr;
+  const std::string* map = nullptr;
+  if (segment_offsets != nullptr) {
+    segment_offsets->clear();
+    segment_offsets->reserve(_segments.size());
   }
   for (const auto& seg : _segments) {
-    pl << "#EXTINF:" << seg.extinf << std::endl;
-    pl << "/" << seg.uri << std::endl;
+    if (segment_offsets != nullptr) {
+      segment_offsets->push_back(pl.size());
+    }
+    if (seg.discontinuity) {
+      pl += "#EXT-X-DISCONTINUITY\n";
+    }
+    if (key == nullptr ? !seg.key.empty() : *key != seg.key) {
+      pl += "#EXT-X-KEY:";
+      pl += seg.key.empty() ? "METHOD=NONE" : seg.key;
+      pl += '\n';
+    }
+    key = &seg.key;
+    if (!seg.map.empty() && (map == nullptr || *map != seg.map)) {
+      pl += "#EXT-X-MAP:";
+      pl += seg.map;
+      pl += '\n';
+      map = &seg.map;
+    }
+    if (!seg.program_date_time.empty()) {
+      pl += "#EXT-X-PROGRAM-DATE-TIME:";
+      pl += seg.program_date_time;
+      pl += '\n';
+    }
+    append_parts(seg.parts);
+    pl += "#EXTINF:";
+    append_decimal(pl, seg.extinf);
+    pl += ',';
+    pl += seg.title;
+    pl += '\n';
+    if (seg.byterange.length > 0) {
+      pl += "#EXT-X-BYTERANGE:";
+      append_number(seg.byterange.length);
+      if (seg.byterange.offset >= 0) {
+        pl += '@';
+        append_number(seg.byterange.offset);
+      }
+      pl += '\n';
+    }
+    pl += seg.uri;
+    pl += '\n';
+  }
+  if (!_segments.empty()) {
+    append_parts(_pending_parts);
+    if (!_preload_hint.uri.empty()) {
+      pl += "#EXT-X-PRELOAD-HINT:TYPE=";
+      pl += _preload_hint.type;
+      pl += ",URI=\"";
+      pl += _preload_hint.uri;
+      pl += '"';
+      if (_preload_hint.byterange_start > 0) {
+        pl += ",BYTERANGE-START=";
+        append_number(_preload_hint.byterange_start);
+      }
+      if (_preload_hint.byterange_length >= 0) {
+        pl += ",BYTERANGE-LENGTH=";
+        append_number(_preload_hint.byterange_length);
+      }
+      pl += '\n';
+    }
+    for (const auto& report : _rendition_reports) {
+      pl += "#EXT-X-RENDITION-REPORT:URI=\"";
+      pl += report.uri;
+      pl += '"';
+      if (report.last_msn >= 0) {
+        pl += ",LAST-MSN=";
+        append_number(report.last_msn);
+      }
+      if (report.last_part >= 0) {
+        pl += ",LAST-PART=";
+        append_number(report.last_part);
+      }
+      pl += '\n';
+    }
+  }
+  if (_ended) {
+    pl += "#EXT-X-ENDLIST\n";
   }
-  return std::move(pl.str());
+  return pl;
 }
@@ -17,32 +17,133 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace MBMS_RT {
+  /**
+   * HLS media playlist (RFC 8216, section 4.3.3), including the Low-Latency HLS extensions of RFC 8216bis
+   * (partial segments, preload hints, server control and rendition reports).
+   *
+   * Parsing is a single pass over the content without copying lines. Tags that apply to a segment are stored with
+   * the segment, so a playlist that is rewritten from parsed segments keeps them. Tags that are not modelled are
+   * ignored.
+   */
   class HlsMediaPlaylist {
     public:
-      HlsMediaPlaylist(const std::string& content);
+      /**
+       * Parses content. Throws std::runtime_error if it is not an HLS playlist.
+       */
+      HlsMediaPlaylist(std::string_view content);
       HlsMediaPlaylist() = default;
       ~HlsMediaPlaylist() = default;
 
+      struct ByteRange {
+        uint64_t length = 0;
+        int64_t offset = -1;   /**< -1: directly follows the previous sub-range */
+      };
+
+      struct Part {
+        std::string uri;
+        double duration = 0;
+        bool independent = false;
+        bool gap = false;
+        ByteRange byterange = {};
+      };
+
+      struct PreloadHint {
+        std::string type = "PART";
+        std::string uri = {};                 /**< empty if there is no hint */
+        uint64_t byterange_start = 0;
+        int64_t byterange_length = -1;        /**< -1: until the end of the resource */
+      };
+
+      struct RenditionReport {
+        std::string uri;
+        int last_msn = -1;
+        int last_part = -1;
+      };
+
+      struct ServerControl {
+        bool can_block_reload = false;
+        double can_skip_until = 0;
+        bool can_skip_dateranges = false;
+        double hold_back = 0;
+        double part_hold_back = 0;
+      };
+
       struct Segment {
         std::string uri;
         int seq;
         double extinf;
+        std::string title = {};              /**< EXTINF title */
+        bool discontinuity = false;          /**< EXT-X-DISCONTINUITY precedes the segment */
+        std::string program_date_time = {};  /**< EXT-X-PROGRAM-DATE-TIME value */
+        std::string key = {};                /**< attributes of the EXT-X-KEY that applies to the segment */
+        std::string map = {};                /**< attributes of the EXT-X-MAP that applies to the segment */
+        ByteRange byterange = {};            /**< EXT-X-BYTERANGE, length 0 if not present */
+        std::vector<Part> parts = {};        /**< EXT-X-PART entries preceding the segment */
       };
       const std::vector<Segment>& segments() const { return _segments; };
       void add_segment(Segment segment) { _segments.push_back(std::move(segment)); };
 
-      std::string to_string() const;
+      /**
+       * Parts of the segment that follows the last listed segment and has not been completed yet
+       */
+      const std::vector<Part>& pending_parts() const { return _pending_parts; };
+      void set_pending_parts(std::vector<Part> parts) { _pending_parts = std::move(parts); };
+
+      const PreloadHint& preload_hint() const { return _preload_hint; };
+      void set_preload_hint(PreloadHint hint) { _preload_hint = std::move(hint); };
+
+      const std::vector<RenditionReport>& rendition_reports() const { return _rendition_reports; };
+      void set_rendition_reports(std::vector<RenditionReport> reports) { _rendition_reports = std::move(reports); };
+
+      const ServerControl& server_control() const { return _server_control; };
+      void set_server_control(ServerControl control) { _server_control = control; };
+
+      double part_target() const { return _part_target; };
+      void set_part_target(double target) { _part_target = target; };
+
+      /**
+       * URIs are written as they are stored in the segments.
+       *
+       * @param segment_offsets if set, receives the offset of the first line of each segment (its tags) in the
+       *                        output, which allows cutting delta updates from the playlist without serializing it again
+       */
+      std::string to_string(std::vector<size_t>* segment_offsets = nullptr) const;
 
       void set_target_duration(int duration) { _targetduration = duration; };
       int target_duration() const { return _targetduration; };
 
+      void set_version(int version) { _version = version; };
+      int version() const { return _version; };
+
+      void set_discontinuity_sequence(int seq) { _discontinuity_sequence = seq; };
+      int discontinuity_sequence() const { return _discontinuity_sequence; };
+
+      void set_ended(bool ended) { _ended = ended; };
+      bool ended() const { return _ended; };
+
+      /**
+       * EXT-X-PLAYLIST-TYPE (EVENT or VOD), empty if not present
+       */
+      void set_playlist_type(std::string type) { _playlist_type = std::move(type); };
+      const std::string& playlist_type() const { return _playlist_type; };
+
     private:
       int _version = -1;
-      int _targetduration;
+      int _targetduration = 0;
+      int _discontinuity_sequence = 0;
+      bool _ended = false;
+      std::string _playlist_type = {};
+      double _part_target = 0;
+      ServerControl _server_control = {};
+      PreloadHint _preload_hint = {};
       std::vector<Segment> _segments = {};
+      std::vector<Part> _pending_parts = {};
+      std::vector<RenditionReport> _rendition_reports = {};
   };
 }
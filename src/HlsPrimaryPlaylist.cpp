@@ -24,7 +24,7 @@
 
 MBMS_RT::HlsPrimaryPlaylist::HlsPrimaryPlaylist(const std::string& content, const std::string& base_path)
 {
-  spdlog::debug("Parsing HLS primary playlist: {}", content);
+  SPDLOG_TRACE("Parsing HLS primary playlist: {}", content);
 
   std::istringstream iss(content);
   int idx = 0;
@@ -74,7 +74,7 @@ MBMS_RT::HlsPrimaryPlaylist::HlsPrimaryPlaylist(const std::string& content, cons
         }
       }
     } else if (line.rfind('#', 0) == 0) {
-        spdlog::debug("HLS playlist parser ignoring unhandled line {}", line);
+        SPDLOG_DEBUG("HLS playlist parser ignoring unhandled line {}", line);
     } else if (line.size() > 0) {
       std::string uri = base_path + line;
       _streams.push_back({uri, resolution, codecs, bandwidth, frame_rate});
@@ -120,7 +120,7 @@ auto MBMS_RT::HlsPrimaryPlaylist::to_string() const -> std::string
   pl << "#EXT-X-VERSION:3" << std::endl;
 
   for (const auto& s : _streams) {
-    pl << "#EXT-X-STREAM-INF:BANDWITH=" << s.bandwidth << 
+    pl << "#EXT-X-STREAM-INF:BANDWIDTH=" << s.bandwidth << 
       ",RESOLUTION=" << s.resolution <<
       ",FRAME-RATE=" << std::fixed << std::setprecision(3) << s.frame_rate <<
       ",CODECS=\"" << s.codecs << "\"" << std::endl;
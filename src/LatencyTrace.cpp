@@ -0,0 +1,114 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "LatencyTrace.h"
+
+#include <chrono>
+#include <cstring>
+#include "spdlog/spdlog.h"
+
+auto MBMS_RT::LatencyTrace::instance() -> LatencyTrace&
+{
+  static LatencyTrace trace;
+  return trace;
+}
+
+auto MBMS_RT::LatencyTrace::stage_name(Stage stage) -> const char*
+{
+  switch (stage) {
+    case Stage::FluteReceived: return "flute_received";
+    case Stage::CdnReceived: return "cdn_received";
+    case Stage::CacheInsert: return "cache_insert";
+    case Stage::PlaylistPublish: return "playlist_publish";
+    case Stage::FirstRequest: return "first_request";
+    case Stage::LastByteSent: return "last_byte_sent";
+  }
+  return "unknown";
+}
+
+auto MBMS_RT::LatencyTrace::now_us() -> uint64_t
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+auto MBMS_RT::LatencyTrace::configure(const libconfig::Config& cfg) -> void
+{
+  bool enabled = false;
+  cfg.lookupValue("mw.trace.enabled", enabled);
+  unsigned size = 8192;
+  cfg.lookupValue("mw.trace.size", size);
+  if (enabled && size > 0) {
+    _size = size;
+    _slots = std::make_unique<Slot[]>(_size);
+    _enabled = true;
+    spdlog::info("Latency tracing enabled, keeping the last {} events", _size);
+  }
+}
+
+auto MBMS_RT::LatencyTrace::record(Stage stage, std::string_view location, std::string_view stream) -> void
+{
+  if (!_enabled) {
+    return;
+  }
+  auto timestamp = now_us();
+  auto idx = _head.fetch_add(1, std::memory_order_relaxed);
+  auto& slot = _slots[idx % _size];
+  if (slot.busy.exchange(true, std::memory_order_acquire)) {
+    _dropped++;
+    return;
+  }
+
+  // keep the end of long locations, it identifies the object
+  if (location.size() > kMaxLocation) location.remove_prefix(location.size() - kMaxLocation);
+  if (stream.size() > kMaxStream) stream.remove_prefix(stream.size() - kMaxStream);
+  slot.sequence = idx + 1;
+  slot.timestamp_us = timestamp;
+  slot.stage = stage;
+  slot.location_length = static_cast<uint8_t>(location.size());
+  slot.stream_length = static_cast<uint8_t>(stream.size());
+  memcpy(slot.location, location.data(), location.size());
+  memcpy(slot.stream, stream.data(), stream.size());
+
+  slot.busy.store(false, std::memory_order_release);
+}
+
+auto MBMS_RT::LatencyTrace::events() const -> std::vector<Event>
+{
+  std::vector<Event> events;
+  if (!_enabled) {
+    return events;
+  }
+  auto head = _head.load(std::memory_order_acquire);
+  auto first = head > _size ? head - _size : 0;
+  events.reserve(head - first);
+  for (auto idx = first; idx < head; idx++) {
+    auto& slot = _slots[idx % _size];
+    if (slot.busy.exchange(true, std::memory_order_acquire)) {
+      // being written
+      continue;
+    }
+    // skip slots that have not been written yet, or already hold a newer event
+    if (slot.sequence == idx + 1) {
+      events.push_back({slot.timestamp_us, slot.stage,
+          std::string(slot.location, slot.location_length),
+          std::string(slot.stream, slot.stream_length)});
+    }
+    slot.busy.store(false, std::memory_order_release);
+  }
+  return events;
+}
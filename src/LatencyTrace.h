@@ -0,0 +1,98 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <libconfig.h++>
+
+namespace MBMS_RT {
+  /**
+   * Records per object timestamps along the delivery pipeline, from FLUTE reception to the HTTP response.
+   *
+   * Events go into a fixed size ring buffer. Writers claim a slot with a single atomic increment and then try to
+   * take the slot's busy flag. Recording never blocks: if the slot is busy (a reader is copying it, or the buffer
+   * wrapped while it was being written), the event is dropped and counted. When the buffer wraps, the oldest events are
+   * overwritten.
+   * Timestamps are taken from the monotonic clock in microseconds.
+   */
+  class LatencyTrace {
+    public:
+      enum class Stage {
+        FluteReceived,    /**< FLUTE object completed */
+        CdnReceived,      /**< object fetched from the CDN */
+        CacheInsert,      /**< item added to the cache */
+        PlaylistPublish,  /**< segment listed in a generated playlist */
+        FirstRequest,     /**< first HTTP request for the item */
+        LastByteSent      /**< response to the first request has been sent */
+      };
+      static const char* stage_name(Stage stage);
+
+      struct Event {
+        uint64_t timestamp_us;
+        Stage stage;
+        std::string location;
+        std::string stream;
+      };
+
+      static LatencyTrace& instance();
+
+      /**
+       * Reads mw.trace.enabled and mw.trace.size. Must be called before the io threads are started.
+       */
+      void configure(const libconfig::Config& cfg);
+
+      bool enabled() const { return _enabled; };
+      void record(Stage stage, std::string_view location, std::string_view stream = {});
+
+      /**
+       * The events currently in the buffer, oldest first
+       */
+      std::vector<Event> events() const;
+
+      uint64_t dropped() const { return _dropped; };
+
+      static uint64_t now_us();
+
+    private:
+      LatencyTrace() = default;
+
+      static constexpr size_t kMaxLocation = 128;
+      static constexpr size_t kMaxStream = 64;
+      struct Slot {
+        std::atomic<bool> busy = {false};
+        uint64_t sequence = 0;    /**< index of the event in the slot + 1, 0 if empty */
+        uint64_t timestamp_us = 0;
+        Stage stage = Stage::FluteReceived;
+        uint8_t location_length = 0;
+        uint8_t stream_length = 0;
+        char location[kMaxLocation] = {};
+        char stream[kMaxStream] = {};
+      };
+
+      bool _enabled = false;
+      size_t _size = 0;
+      std::unique_ptr<Slot[]> _slots;
+      std::atomic<uint64_t> _head = {0};
+      std::atomic<uint64_t> _dropped = {0};
+  };
+}
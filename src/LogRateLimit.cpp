@@ -0,0 +1,58 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "LogRateLimit.h"
+
+#include <chrono>
+
+std::atomic<uint64_t> MBMS_RT::LogRateLimit::_interval_us = {1000000};
+std::atomic<unsigned> MBMS_RT::LogRateLimit::_burst = {10};
+
+auto MBMS_RT::LogRateLimit::configure(const libconfig::Config& cfg) -> void
+{
+  unsigned interval = 1000;
+  cfg.lookupValue("mw.log.rate_limit.interval", interval);
+  unsigned burst = 10;
+  cfg.lookupValue("mw.log.rate_limit.burst", burst);
+  _interval_us = static_cast<uint64_t>(interval) * 1000;
+  _burst = burst;
+}
+
+auto MBMS_RT::LogRateLimit::allow(uint64_t& suppressed) -> bool
+{
+  auto burst = _burst.load(std::memory_order_relaxed);
+  if (burst == 0) {
+    // rate limiting disabled
+    suppressed = 0;
+    return true;
+  }
+
+  uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  auto start = _window_start.load(std::memory_order_relaxed);
+  if (now - start >= _interval_us.load(std::memory_order_relaxed) &&
+      _window_start.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+    _count.store(0, std::memory_order_relaxed);
+  }
+
+  if (_count.fetch_add(1, std::memory_order_relaxed) < burst) {
+    suppressed = _suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+  }
+  _suppressed.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
@@ -0,0 +1,70 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <libconfig.h++>
+#include "spdlog/spdlog.h"
+
+namespace MBMS_RT {
+  /**
+   * Limits how often a single log statement is emitted. Each call site gets its own limiter (see
+   * MW_LOG_RATE_LIMITED): at most `burst` messages are logged per interval, the rest are counted and the count is
+   * reported with the next message that gets through.
+   */
+  class LogRateLimit {
+    public:
+      /**
+       * Reads mw.log.rate_limit.interval (milliseconds) and mw.log.rate_limit.burst.
+       */
+      static void configure(const libconfig::Config& cfg);
+
+      /**
+       * True if the message may be logged. suppressed is set to the number of messages dropped since the last
+       * one that was logged.
+       */
+      bool allow(uint64_t& suppressed);
+
+    private:
+      static std::atomic<uint64_t> _interval_us;
+      static std::atomic<unsigned> _burst;
+
+      std::atomic<uint64_t> _window_start = {0};
+      std::atomic<unsigned> _count = {0};
+      std::atomic<uint64_t> _suppressed = {0};
+  };
+}
+
+/**
+ * Logs like spdlog::log(level, ...), rate limited per call site. Use for messages that can repeat for every packet,
+ * object or request.
+ */
+#define MW_LOG_RATE_LIMITED(level, ...)                                                                   \
+  do {                                                                                                    \
+    static MBMS_RT::LogRateLimit mw_rate_limit_;                                                          \
+    if (spdlog::should_log(level)) {                                                                      \
+      uint64_t mw_suppressed_ = 0;                                                                        \
+      if (mw_rate_limit_.allow(mw_suppressed_)) {                                                         \
+        if (mw_suppressed_ > 0) {                                                                         \
+          spdlog::log(level, "({} similar messages suppressed)", mw_suppressed_);                         \
+        }                                                                                                 \
+        spdlog::log(level, __VA_ARGS__);                                                                  \
+      }                                                                                                   \
+    }                                                                                                     \
+  } while (0)
@@ -0,0 +1,365 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include "MediaInspector.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+  constexpr size_t kTsPacketSize = 188;
+  constexpr uint8_t kTsSyncByte = 0x47;
+  constexpr uint64_t kPtsWrap = uint64_t(1) << 33;
+
+  auto read16(const uint8_t* p) -> uint32_t { return (uint32_t(p[0]) << 8) | p[1]; }
+  auto read32(const uint8_t* p) -> uint32_t {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+  }
+  auto read64(const uint8_t* p) -> uint64_t { return (uint64_t(read32(p)) << 32) | read32(p + 4); }
+
+  auto read_timestamp(const uint8_t* p) -> uint64_t {
+    return (uint64_t(p[0] & 0x0e) << 29) | (uint64_t(p[1]) << 22) | (uint64_t(p[2] & 0xfe) << 14) |
+      (uint64_t(p[3]) << 7) | (p[4] >> 1);
+  }
+
+  /**
+   * Finds the next packet start at or after pos: a sync byte that is followed by another one a packet later
+   */
+  auto ts_sync(const uint8_t* data, size_t length, size_t pos) -> size_t {
+    while (pos + kTsPacketSize <= length) {
+      auto p = static_cast<const uint8_t*>(memchr(data + pos, kTsSyncByte, length - pos));
+      if (p == nullptr) {
+        return length;
+      }
+      pos = p - data;
+      if (pos + kTsPacketSize >= length || data[pos + kTsPacketSize] == kTsSyncByte) {
+        return pos;
+      }
+      pos++;
+    }
+    return length;
+  }
+
+  auto is_video_stream_type(uint8_t type) -> bool {
+    return type == 0x01 || type == 0x02 || type == 0x10 || type == 0x1b || type == 0x24;
+  }
+
+  auto is_audio_stream_type(uint8_t type) -> bool {
+    return type == 0x03 || type == 0x04 || type == 0x0f || type == 0x11 || type == 0x81 || type == 0x87;
+  }
+
+  struct Box {
+    const uint8_t* payload;
+    size_t size;
+    uint32_t type;
+  };
+
+  constexpr auto fourcc(const char (&s)[5]) -> uint32_t {
+    return (uint32_t(uint8_t(s[0])) << 24) | (uint32_t(uint8_t(s[1])) << 16) | (uint32_t(uint8_t(s[2])) << 8) | uint8_t(s[3]);
+  }
+
+  /**
+   * Calls f(box, offset) for each box in [data, data + length). Stops at the first malformed box.
+   */
+  template <typename F>
+  auto for_each_box(const uint8_t* data, size_t length, F f) -> void {
+    size_t pos = 0;
+    while (pos + 8 <= length) {
+      uint64_t size = read32(data + pos);
+      size_t header = 8;
+      if (size == 1) {
+        if (pos + 16 > length) return;
+        size = read64(data + pos + 8);
+        header = 16;
+      } else if (size == 0) {
+        size = length - pos;
+      }
+      if (size < header || size > length - pos) {
+        return;
+      }
+      f(Box{data + pos + header, static_cast<size_t>(size - header), read32(data + pos + 4)}, pos);
+      pos += size;
+    }
+  }
+}
+
+auto MBMS_RT::MediaInspector::inspect(const char* data, size_t length, const Track& track) -> Timing
+{
+  auto bytes = reinterpret_cast<const uint8_t*>(data);
+  if (bytes == nullptr || length < 8) {
+    return {};
+  }
+  if (bytes[0] == kTsSyncByte && (length < kTsPacketSize * 2 || bytes[kTsPacketSize] == kTsSyncByte)) {
+    return inspect_ts(bytes, length);
+  }
+  auto type = read32(bytes + 4);
+  if (type == fourcc("styp") || type == fourcc("moof") || type == fourcc("sidx") || type == fourcc("ftyp") ||
+      type == fourcc("prft") || type == fourcc("emsg")) {
+    return inspect_fmp4(bytes, length, track);
+  }
+  return {};
+}
+
+auto MBMS_RT::MediaInspector::inspect_ts(const uint8_t* data, size_t length) -> Timing
+{
+  Timing timing;
+  timing.container = Container::TS;
+  timing.timescale = 90000;
+
+  uint32_t pmt_pid = 0x2000;     // invalid until the PAT has been seen
+  uint32_t timing_pid = 0x2000;
+  bool video = false;
+  bool first = true;
+  uint64_t reference = 0;        // first timestamp, later ones are unwrapped relative to it
+  int64_t min_pts = 0, max_pts = 0, first_dts = 0, last_dts = 0;
+  uint64_t pes_count = 0;
+
+  auto unwrap = [&reference](uint64_t ts) -> int64_t {
+    auto diff = static_cast<int64_t>((ts - reference) & (kPtsWrap - 1));
+    return diff >= static_cast<int64_t>(kPtsWrap / 2) ? diff - static_cast<int64_t>(kPtsWrap) : diff;
+  };
+
+  for (size_t pos = ts_sync(data, length, 0); pos + kTsPacketSize <= length; pos += kTsPacketSize) {
+    if (data[pos] != kTsSyncByte) {
+      pos = ts_sync(data, length, pos + 1);
+      if (pos + kTsPacketSize > length) break;
+    }
+    const uint8_t* p = data + pos;
+    bool pusi = p[1] & 0x40;
+    uint32_t pid = ((p[1] & 0x1f) << 8) | p[2];
+    uint8_t afc = (p[3] >> 4) & 0x03;
+    size_t offset = 4;
+    bool random_access = false;
+    if (afc & 0x02) {
+      uint8_t af_length = p[4];
+      if (af_length > 0) {
+        random_access = p[5] & 0x40;
+      }
+      offset += 1 + af_length;
+    }
+    if (!(afc & 0x01) || offset >= kTsPacketSize) {
+      continue;
+    }
+    const uint8_t* payload = p + offset;
+    size_t payload_length = kTsPacketSize - offset;
+
+    if (pid == timing_pid) {
+      if (video && random_access && pusi) {
+        timing.keyframe_offsets.push_back(static_cast<uint32_t>(pos));
+      }
+      if (!pusi || payload_length < 14 || payload[0] != 0 || payload[1] != 0 || payload[2] != 1) {
+        continue;
+      }
+      uint8_t flags = payload[7] >> 6;
+      if (!(flags & 0x02)) {
+        continue;
+      }
+      auto pts = read_timestamp(payload + 9);
+      auto dts = (flags == 0x03 && payload_length >= 19) ? read_timestamp(payload + 14) : pts;
+      if (first) {
+        reference = pts;
+        first = false;
+        min_pts = max_pts = 0;
+        first_dts = last_dts = unwrap(dts);
+      }
+      auto upts = unwrap(pts);
+      min_pts = std::min(min_pts, upts);
+      max_pts = std::max(max_pts, upts);
+      last_dts = unwrap(dts);
+      pes_count++;
+    } else if (pusi && (pid == 0 || pid == pmt_pid)) {
+      // PSI section, skip the pointer field
+      size_t section = 1 + payload[0];
+      if (section + 12 > payload_length) {
+        continue;
+      }
+      const uint8_t* s = payload + section;
+      size_t end = std::min(payload_length - section, size_t(3 + (read16(s + 1) & 0x0fff)));
+      if (end < 12) {
+        continue;
+      }
+      end -= 4;  // CRC
+      if (pid == 0 && s[0] == 0x00) {
+        for (size_t i = 8; i + 4 <= end; i += 4) {
+          if (read16(s + i) != 0) {
+            pmt_pid = read16(s + i + 2) & 0x1fff;
+            break;
+          }
+        }
+      } else if (pid == pmt_pid && s[0] == 0x02 && timing_pid == 0x2000) {
+        for (size_t i = 12 + (read16(s + 10) & 0x0fff); i + 5 <= end; i += 5 + (read16(s + i + 3) & 0x0fff)) {
+          uint8_t type = s[i];
+          uint32_t es_pid = read16(s + i + 1) & 0x1fff;
+          if (is_video_stream_type(type)) {
+            timing_pid = es_pid;
+            video = true;
+            break;
+          }
+          if (is_audio_stream_type(type) && timing_pid == 0x2000) {
+            timing_pid = es_pid;
+          }
+        }
+      }
+    }
+  }
+
+  if (pes_count == 0) {
+    return timing;
+  }
+  // the last frame lasts as long as the average frame
+  int64_t frame_duration = pes_count > 1 ? (last_dts - first_dts) / static_cast<int64_t>(pes_count - 1) : 0;
+  timing.start_pts = (reference + min_pts) & (kPtsWrap - 1);
+  timing.start = static_cast<double>(timing.start_pts) / timing.timescale;
+  timing.duration = static_cast<double>(max_pts - min_pts + frame_duration) / timing.timescale;
+  timing.valid = timing.duration > 0;
+  return timing;
+}
+
+auto MBMS_RT::MediaInspector::inspect_fmp4(const uint8_t* data, size_t length, Track track) -> Timing
+{
+  Timing timing;
+  timing.container = Container::FMP4;
+
+  bool found = false;
+  uint64_t start = 0;
+  uint64_t end = 0;
+  for_each_box(data, length, [&](const Box& box, size_t offset) {
+    if (box.type == fourcc("moov") && track.timescale == 0) {
+      // initialization data in front of the media data
+      track = init_track(reinterpret_cast<const char*>(box.payload) - 8, box.size + 8);
+      return;
+    }
+    if (box.type != fourcc("moof")) {
+      return;
+    }
+    for_each_box(box.payload, box.size, [&](const Box& traf, size_t) {
+      if (traf.type != fourcc("traf")) {
+        return;
+      }
+      uint32_t track_id = 0;
+      uint32_t default_duration = 0;
+      uint32_t default_flags = 0;
+      uint64_t decode_time = 0;
+      bool has_decode_time = false;
+      uint64_t duration = 0;
+      bool sync = false;
+      bool first_run = true;
+      for_each_box(traf.payload, traf.size, [&](const Box& b, size_t) {
+        if (b.type == fourcc("tfhd") && b.size >= 8) {
+          uint32_t flags = read32(b.payload) & 0xffffff;
+          track_id = read32(b.payload + 4);
+          size_t pos = 8;
+          if (flags & 0x01) pos += 8;
+          if (flags & 0x02) pos += 4;
+          if ((flags & 0x08) && pos + 4 <= b.size) { default_duration = read32(b.payload + pos); pos += 4; }
+          if (flags & 0x10) pos += 4;
+          if ((flags & 0x20) && pos + 4 <= b.size) { default_flags = read32(b.payload + pos); }
+        } else if (b.type == fourcc("tfdt") && b.size >= 8) {
+          decode_time = b.payload[0] == 1 && b.size >= 12 ? read64(b.payload + 4) : read32(b.payload + 4);
+          has_decode_time = true;
+        } else if (b.type == fourcc("trun") && b.size >= 8) {
+          uint32_t flags = read32(b.payload) & 0xffffff;
+          uint32_t count = read32(b.payload + 4);
+          size_t pos = 8;
+          if (flags & 0x01) pos += 4;
+          uint32_t first_flags = default_flags;
+          if ((flags & 0x04) && pos + 4 <= b.size) { first_flags = read32(b.payload + pos); pos += 4; }
+          size_t sample_size = ((flags & 0x100) ? 4 : 0) + ((flags & 0x200) ? 4 : 0) + ((flags & 0x400) ? 4 : 0) +
+            ((flags & 0x800) ? 4 : 0);
+          if (sample_size == 0 || !(flags & 0x100)) {
+            duration += uint64_t(count) * default_duration;
+          }
+          if (sample_size > 0) {
+            count = static_cast<uint32_t>(std::min<size_t>(count, (b.size - std::min(pos, b.size)) / sample_size));
+            for (uint32_t i = 0; i < count; i++, pos += sample_size) {
+              const uint8_t* sample = b.payload + pos;
+              if (flags & 0x100) duration += read32(sample);
+              if (i == 0 && !(flags & 0x04) && (flags & 0x400)) {
+                first_flags = read32(sample + ((flags & 0x100) ? 4 : 0) + ((flags & 0x200) ? 4 : 0));
+              }
+            }
+          }
+          if (first_run) {
+            // sample_is_non_sync_sample
+            sync = !(first_flags & 0x10000);
+            first_run = false;
+          }
+        }
+      });
+      if (track.id == 0) {
+        track.id = track_id;
+      }
+      if (track_id != track.id || !has_decode_time) {
+        return;
+      }
+      if (sync) {
+        timing.keyframe_offsets.push_back(static_cast<uint32_t>(offset));
+      }
+      start = found ? std::min(start, decode_time) : decode_time;
+      end = found ? std::max(end, decode_time + duration) : decode_time + duration;
+      found = true;
+    });
+  });
+
+  if (!found || track.timescale == 0) {
+    return timing;
+  }
+  timing.timescale = track.timescale;
+  timing.start_pts = start;
+  timing.start = static_cast<double>(start) / track.timescale;
+  timing.duration = static_cast<double>(end - start) / track.timescale;
+  timing.valid = timing.duration > 0;
+  return timing;
+}
+
+auto MBMS_RT::MediaInspector::init_track(const char* data, size_t length) -> Track
+{
+  Track result;
+  bool video = false;
+  auto bytes = reinterpret_cast<const uint8_t*>(data);
+  for_each_box(bytes, length, [&](const Box& moov, size_t) {
+    if (moov.type != fourcc("moov")) {
+      return;
+    }
+    for_each_box(moov.payload, moov.size, [&](const Box& trak, size_t) {
+      if (trak.type != fourcc("trak") || video) {
+        return;
+      }
+      Track track;
+      bool is_video = false;
+      for_each_box(trak.payload, trak.size, [&](const Box& b, size_t) {
+        if (b.type == fourcc("tkhd") && b.size >= 24) {
+          track.id = read32(b.payload + (b.payload[0] == 1 ? 20 : 12));
+        } else if (b.type == fourcc("mdia")) {
+          for_each_box(b.payload, b.size, [&](const Box& m, size_t) {
+            if (m.type == fourcc("mdhd") && m.size >= 24) {
+              track.timescale = read32(m.payload + (m.payload[0] == 1 ? 20 : 12));
+            } else if (m.type == fourcc("hdlr") && m.size >= 12) {
+              is_video = read32(m.payload + 8) == fourcc("vide");
+            }
+          });
+        }
+      });
+      if (track.timescale != 0 && (result.timescale == 0 || is_video)) {
+        result = track;
+        video = is_video;
+      }
+    });
+  });
+  return result;
+}
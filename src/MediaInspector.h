@@ -0,0 +1,69 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace MBMS_RT {
+  /**
+   * Extracts the timing of a media segment (MPEG-2 TS or fragmented MP4) in a single pass over its data.
+   *
+   * TS: the PAT/PMT select the video PID (or the first audio PID), the PES headers of that PID provide the PTS/DTS
+   * and the random access indicator marks keyframes. Only the 188 byte packet headers are looked at otherwise.
+   * fMP4: only the box headers are walked, timing comes from tfdt and the sample durations in trun. The timescale
+   * is in the initialization segment, see init_track().
+   */
+  class MediaInspector {
+    public:
+      enum class Container {
+        Unknown,
+        TS,
+        FMP4
+      };
+
+      struct Track {
+        uint32_t id = 0;         /**< fMP4 track id, 0 selects the first track fragment */
+        uint32_t timescale = 0;
+      };
+
+      struct Timing {
+        bool valid = false;
+        Container container = Container::Unknown;
+        uint32_t timescale = 0;
+        uint64_t start_pts = 0;                  /**< earliest presentation (TS) or decode (fMP4) time in timescale units */
+        double start = 0;                        /**< start_pts in seconds */
+        double duration = 0;                     /**< seconds */
+        std::vector<uint32_t> keyframe_offsets;  /**< byte offsets of the packets/fragments starting with a keyframe */
+      };
+
+      static Timing inspect(const char* data, size_t length) { return inspect(data, length, Track()); };
+      static Timing inspect(const char* data, size_t length, const Track& track);
+
+      /**
+       * Reads the id and timescale of the first video track (or the first track) from an initialization segment
+       */
+      static Track init_track(const char* data, size_t length);
+
+    private:
+      static Timing inspect_ts(const uint8_t* data, size_t length);
+      static Timing inspect_fmp4(const uint8_t* data, size_t length, Track track);
+  };
+}
@@ -0,0 +1,187 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "Metrics.h"
+
+#include <cmath>
+#include <sstream>
+
+auto MBMS_RT::Metrics::registry() -> Metrics&
+{
+  static Metrics metrics;
+  return metrics;
+}
+
+auto MBMS_RT::Metrics::shard() -> size_t
+{
+  static std::atomic<size_t> next = {0};
+  thread_local size_t idx = next++;
+  return idx % 16;
+}
+
+auto MBMS_RT::Metrics::latency_buckets() -> const std::vector<double>&
+{
+  static const std::vector<double> buckets = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+  return buckets;
+}
+
+auto MBMS_RT::Metrics::Counter::value() const -> uint64_t
+{
+  uint64_t sum = 0;
+  for (const auto& shard : _shards) {
+    sum += shard.value.load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+MBMS_RT::Metrics::Histogram::Histogram(std::vector<double> bounds)
+  : _bounds(std::move(bounds))
+  , _buckets(_bounds.size() + 1)
+{
+}
+
+auto MBMS_RT::Metrics::Histogram::observe(double value) -> void
+{
+  size_t idx = 0;
+  while (idx < _bounds.size() && value > _bounds[idx]) idx++;
+  _buckets[idx].inc();
+  if (value > 0) {
+    _sum_ns.inc(static_cast<uint64_t>(std::llround(value * 1e9)));
+  }
+}
+
+auto MBMS_RT::Metrics::Histogram::write(std::ostream& out, const std::string& name, const std::string& labels) const
+  -> void
+{
+  // the le label is added to the existing labels
+  auto with_le = [&labels](const std::string& le) {
+    return labels.empty() ? "{le=\"" + le + "\"}" : labels.substr(0, labels.size() - 1) + ",le=\"" + le + "\"}";
+  };
+  uint64_t cumulative = 0;
+  for (size_t idx = 0; idx < _buckets.size(); idx++) {
+    cumulative += _buckets[idx].value();
+    std::ostringstream le;
+    if (idx < _bounds.size()) {
+      le << _bounds[idx];
+    } else {
+      le << "+Inf";
+    }
+    out << name << "_bucket" << with_le(le.str()) << " " << cumulative << "\n";
+  }
+  out << name << "_sum" << labels << " " << _sum_ns.value() / 1e9 << "\n";
+  out << name << "_count" << labels << " " << cumulative << "\n";
+}
+
+auto MBMS_RT::Metrics::format_labels(const Labels& labels) -> std::string
+{
+  if (labels.empty()) {
+    return "";
+  }
+  std::string res = "{";
+  for (const auto& label : labels) {
+    if (res.size() > 1) res += ",";
+    res += label.first + "=\"";
+    for (auto c : label.second) {
+      if (c == '"' || c == '\\') res += '\\';
+      if (c == '\n') { res += "\\n"; continue; }
+      res += c;
+    }
+    res += "\"";
+  }
+  return res + "}";
+}
+
+auto MBMS_RT::Metrics::family(const std::string& name, const std::string& help, Type type) -> Family&
+{
+  auto it = _families.find(name);
+  if (it == _families.end()) {
+    it = _families.emplace(name, Family{help, type, {}, {}, {}}).first;
+  }
+  return it->second;
+}
+
+auto MBMS_RT::Metrics::counter(const std::string& name, const std::string& help, const Labels& labels) -> Counter&
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto& metric = family(name, help, Type::Counter).counters[format_labels(labels)];
+  if (!metric) {
+    metric = std::make_unique<Counter>();
+  }
+  return *metric;
+}
+
+auto MBMS_RT::Metrics::gauge(const std::string& name, const std::string& help, const Labels& labels) -> Gauge&
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto& metric = family(name, help, Type::Gauge).gauges[format_labels(labels)];
+  if (!metric) {
+    metric = std::make_unique<Gauge>();
+  }
+  return *metric;
+}
+
+auto MBMS_RT::Metrics::histogram(const std::string& name, const std::string& help, const Labels& labels,
+    const std::vector<double>& bounds) -> Histogram&
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto& metric = family(name, help, Type::Histogram).histograms[format_labels(labels)];
+  if (!metric) {
+    metric = std::make_unique<Histogram>(bounds);
+  }
+  return *metric;
+}
+
+auto MBMS_RT::Metrics::add_collector(std::function<void(std::ostream&)> collector) -> unsigned
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto id = _next_collector++;
+  _collectors[id] = std::move(collector);
+  return id;
+}
+
+auto MBMS_RT::Metrics::remove_collector(unsigned id) -> void
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  _collectors.erase(id);
+}
+
+auto MBMS_RT::Metrics::serialize() const -> std::string
+{
+  std::ostringstream out;
+  const std::lock_guard<std::mutex> lock(_mutex);
+  for (const auto& it : _families) {
+    const auto& name = it.first;
+    const auto& family = it.second;
+    out << "# HELP " << name << " " << family.help << "\n";
+    out << "# TYPE " << name << " " <<
+      (family.type == Type::Counter ? "counter" : (family.type == Type::Gauge ? "gauge" : "histogram")) << "\n";
+    for (const auto& metric : family.counters) {
+      out << name << metric.first << " " << metric.second->value() << "\n";
+    }
+    for (const auto& metric : family.gauges) {
+      out << name << metric.first << " " << metric.second->value() << "\n";
+    }
+    for (const auto& metric : family.histograms) {
+      metric.second->write(out, name, metric.first);
+    }
+  }
+  for (const auto& collector : _collectors) {
+    collector.second(out);
+  }
+  return out.str();
+}
@@ -0,0 +1,135 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace MBMS_RT {
+  /**
+   * Process wide registry of Prometheus metrics.
+   *
+   * Counters and histograms are split into cache line sized shards. Every thread increments its own shard
+   * with relaxed atomics, so hot paths never contend, and the shards are summed up when the metrics are scraped.
+   * Registration takes a lock: hot paths should look up their metrics once and keep the returned reference.
+   */
+  class Metrics {
+    public:
+      typedef std::vector<std::pair<std::string, std::string>> Labels;
+
+      class Counter {
+        public:
+          void inc(uint64_t value = 1) { _shards[shard()].value.fetch_add(value, std::memory_order_relaxed); };
+          uint64_t value() const;
+        private:
+          struct alignas(64) Shard { std::atomic<uint64_t> value = {0}; };
+          std::array<Shard, 16> _shards;
+      };
+
+      class Gauge {
+        public:
+          void set(int64_t value) { _value.store(value, std::memory_order_relaxed); };
+          void add(int64_t value) { _value.fetch_add(value, std::memory_order_relaxed); };
+          int64_t value() const { return _value.load(std::memory_order_relaxed); };
+        private:
+          std::atomic<int64_t> _value = {0};
+      };
+
+      class Histogram {
+        public:
+          explicit Histogram(std::vector<double> bounds);
+          void observe(double value);
+          void write(std::ostream& out, const std::string& name, const std::string& labels) const;
+        private:
+          std::vector<double> _bounds;
+          std::vector<Counter> _buckets;  /**< one more than bounds, for +Inf */
+          Counter _sum_ns;
+      };
+
+      /**
+       * Observes the time from construction to destruction in a histogram
+       */
+      class ScopedTimer {
+        public:
+          explicit ScopedTimer(Histogram& histogram)
+            : _histogram(histogram), _start(std::chrono::steady_clock::now()) {};
+          ~ScopedTimer() {
+            _histogram.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count());
+          };
+        private:
+          Histogram& _histogram;
+          std::chrono::steady_clock::time_point _start;
+      };
+
+      /**
+       * Latency buckets in seconds, from 100us to 10s
+       */
+      static const std::vector<double>& latency_buckets();
+
+      static Metrics& registry();
+
+      Counter& counter(const std::string& name, const std::string& help, const Labels& labels = {});
+      Gauge& gauge(const std::string& name, const std::string& help, const Labels& labels = {});
+      Histogram& histogram(const std::string& name, const std::string& help, const Labels& labels = {},
+          const std::vector<double>& bounds = latency_buckets());
+
+      /**
+       * Adds a function that writes metrics computed at scrape time, in exposition format.
+       * @return an id for remove_collector()
+       */
+      unsigned add_collector(std::function<void(std::ostream&)> collector);
+      void remove_collector(unsigned id);
+
+      /**
+       * All metrics in Prometheus text exposition format
+       */
+      std::string serialize() const;
+
+    private:
+      Metrics() = default;
+
+      static size_t shard();
+
+      enum class Type { Counter, Gauge, Histogram };
+      struct Family {
+        std::string help;
+        Type type;
+        std::map<std::string, std::unique_ptr<Counter>> counters;
+        std::map<std::string, std::unique_ptr<Gauge>> gauges;
+        std::map<std::string, std::unique_ptr<Histogram>> histograms;
+      };
+
+      Family& family(const std::string& name, const std::string& help, Type type);
+      static std::string format_labels(const Labels& labels);
+
+      mutable std::mutex _mutex;
+      std::map<std::string, Family> _families;
+      std::map<unsigned, std::function<void(std::ostream&)>> _collectors;
+      unsigned _next_collector = 0;
+  };
+}
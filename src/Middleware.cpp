@@ -15,8 +15,16 @@
 // under the License.
 //
 #include "Middleware.h"
+#include "LogRateLimit.h"
+#include "DashManifest.h"
+#include "FluteCapture.h"
 #include "spdlog/spdlog.h"
 
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iterator>
+
 /**
  *
  * @param io_service
@@ -27,9 +35,12 @@
 MBMS_RT::Middleware::Middleware(boost::asio::io_service &io_service, const libconfig::Config &cfg,
                                 const std::string &api_url,
                                 const std::string &iface)
-    : _rp(cfg), _control(cfg), _cache(cfg, io_service), _api(cfg, api_url, _cache, &_service_announcement, _services),
-      _tick_interval(1), _timer(io_service, _tick_interval), _control_timer(io_service, _control_tick_interval),
-      _cfg(cfg), _interface(iface), _io_service(io_service) {
+    : _strand(io_service), _rp(cfg),
+      _modem_events(cfg, io_service, _strand, boost::bind(&Middleware::handle_modem_event, this, _1, _2)), //NOLINT
+      _api(cfg, api_url, _cache, &_service_announcement, _services, _scheduling, _strand), _cache(cfg, io_service),
+      _control(cfg), _reporter(cfg, _strand, _control), _control_timer(io_service, _control_tick_interval),
+      _tick_interval(1), _timer(io_service, _tick_interval),
+      _cfg(cfg), _interface(iface), _io_service(io_service), _snapshot(cfg) {
   cfg.lookupValue("mw.seamless_switching.enabled", _seamless);
   if (_seamless) {
     spdlog::info("Seamless switching mode enabled");
@@ -42,9 +53,134 @@ MBMS_RT::Middleware::Middleware(boost::asio::io_service &io_service, const libco
     spdlog::info("Control System API enabled");
   }
 
-  _handle_local_service_announcement();
-  _timer.async_wait(boost::bind(&Middleware::tick_handler, this)); //NOLINT
-  _control_timer.async_wait(boost::bind(&Middleware::control_tick_handler, this)); //NOLINT
+  _scheduling.threads = SchedulingStats::configured_threads(cfg);
+  LatencyTrace::instance().configure(cfg);
+  DashManifest::configure(cfg);
+  FluteCapture::instance().configure(cfg);
+  cfg.lookupValue("mw.service_announcement_tsi", _service_announcement_tsi);
+
+  if (!_handle_local_service_announcement() && !FluteCapture::instance().replaying()) {
+    _restore_snapshot();
+  }
+  FluteCapture::instance().start_replay(io_service, [this](const std::string &tmgi, const std::string &address,
+                                                           unsigned long long tsi) {
+    // the replayed session takes the place of the one the modem would report
+    auto done = std::make_shared<std::promise<void>>();
+    _strand.post([this, done, tmgi, address, tsi]() {
+      if (!_service_announcement) {
+        _service_announcement = std::make_unique<MBMS_RT::ServiceAnnouncement>(_cfg, tmgi, address, tsi, _interface,
+                                                                               _io_service, _strand,
+                                                                               _cache, _seamless,
+                                                                               boost::bind(&Middleware::get_service,
+                                                                                           this, _1),
+                                                                               boost::bind(&Middleware::set_service,
+                                                                                           this, _1, _2)); //NOLINT
+        _service_announcement->start_flute_receiver(address);
+      }
+      done->set_value();
+    });
+    done->get_future().wait_for(std::chrono::seconds(5));
+  });
+  _timer.async_wait(_strand.wrap(boost::bind(&Middleware::tick_handler, this))); //NOLINT
+  _control_timer.async_wait(_strand.wrap(boost::bind(&Middleware::control_tick_handler, this))); //NOLINT
+}
+
+MBMS_RT::Middleware::~Middleware() {
+  // no more replayed objects for the services, and write what has been captured
+  FluteCapture::instance().stop();
+  _save_snapshot();
+}
+
+auto MBMS_RT::Middleware::shutdown(std::chrono::milliseconds timeout) -> void {
+  spdlog::info("Shutting down");
+  // players get the responses they are waiting for, which can depend on content that is still being received
+  _api.close(timeout);
+
+  auto done = std::make_shared<std::promise<void>>();
+  _strand.post([this, done]() {
+    _stopping = true;
+    _timer.cancel();
+    _control_timer.cancel();
+    if (_service_announcement) {
+      _service_announcement->stop_flute_receiver();
+    }
+    for (const auto &service: _services) {
+      for (const auto &stream: service.second->content_streams()) {
+        stream.second->drain();
+      }
+    }
+    done->set_value();
+  });
+  if (done->get_future().wait_for(timeout) != std::future_status::ready) {
+    spdlog::warn("Stopping the receivers did not finish within {} ms", timeout.count());
+  }
+}
+
+auto MBMS_RT::Middleware::reload(std::function<bool()> read_config) -> void {
+  // everything that reads the configuration after startup runs on the control strand
+  _strand.post([this, read_config]() {
+    if (_stopping || !read_config()) {
+      return;
+    }
+    _cache.configure(_cfg);
+    for (const auto &service: _services) {
+      for (const auto &stream: service.second->content_streams()) {
+        stream.second->reconfigure(_cfg);
+      }
+    }
+
+    bool seamless = false;
+    _cfg.lookupValue("mw.seamless_switching.enabled", seamless);
+    if (seamless != _seamless) {
+      spdlog::info("Seamless switching mode {}", seamless ? "enabled" : "disabled");
+      _seamless = seamless;
+      if (_service_announcement) {
+        // The streams change their type, so they are replaced. The replaced streams are drained like after an
+        // announcement update, the service announcement session keeps running.
+        _service_announcement->set_seamless_switching(seamless);
+        _service_announcement->refresh();
+      }
+    }
+    spdlog::info("Configuration reloaded");
+  });
+}
+
+/**
+ * Sets up the service announcement session, services and streams from the snapshot of the last run, and starts
+ * receiving the service announcement right away. The next announcement that is received replaces the restored
+ * one, only services that changed in the meantime are set up again.
+ */
+auto MBMS_RT::Middleware::_restore_snapshot() -> void {
+  auto state = _snapshot.load();
+  if (!state) {
+    return;
+  }
+  spdlog::info("Restoring services from the service announcement of TMGI {} saved {} seconds ago", state->tmgi,
+               time(nullptr) - state->saved_at);
+  _service_announcement = std::make_unique<MBMS_RT::ServiceAnnouncement>(_cfg, state->tmgi, state->mcast_address,
+                                                                         state->tsi, _interface,
+                                                                         _io_service, _strand, _cache, _seamless,
+                                                                         boost::bind(&Middleware::get_service,
+                                                                                     this, _1),  //NOLINT
+                                                                         boost::bind(&Middleware::set_service,
+                                                                                     this, _1, _2)); //NOLINT
+  _service_announcement->parse_bootstrap(state->bootstrap);
+  _service_announcement->start_flute_receiver(state->mcast_address);
+  _service_announcement_restored = true;
+}
+
+/**
+ * Saves the received service announcement if it changed since it was last saved. Runs on the control strand.
+ */
+auto MBMS_RT::Middleware::_save_snapshot() -> void {
+  // restored and local announcements have TOI 0, only received ones are saved
+  if (!_snapshot.enabled() || !_service_announcement || _service_announcement->toi() == 0 ||
+      _service_announcement->toi() == _snapshot_toi || _service_announcement->mcast_address().empty()) {
+    return;
+  }
+  _snapshot_toi = _service_announcement->toi();
+  _snapshot.save({_service_announcement->tmgi(), _service_announcement->mcast_address(),
+                  _service_announcement->tsi(), time(nullptr), _service_announcement->content()});
 }
 
 /**
@@ -70,7 +206,7 @@ auto MBMS_RT::Middleware::_handle_local_service_announcement() -> bool {
       _cfg.lookupValue("mw.local_service.mcast_address", mcast_address);
 
       _service_announcement = std::make_unique<MBMS_RT::ServiceAnnouncement>(_cfg, tmgi, mcast_address, 0, _interface,
-                                                                             _io_service, _cache, _seamless,
+                                                                             _io_service, _strand, _cache, _seamless,
                                                                              boost::bind(&Middleware::get_service, this,
                                                                                          _1),  //NOLINT
                                                                              boost::bind(&Middleware::set_service, this,
@@ -89,56 +225,264 @@ auto MBMS_RT::Middleware::_handle_local_service_announcement() -> bool {
  *
  */
 void MBMS_RT::Middleware::tick_handler() {
-  auto mchs = _rp.getMchInfo();
-  for (auto const &mch: mchs.as_array()) {
-    for (auto const &mtch: mch.at("mtchs").as_array()) {
-      auto tmgi = mtch.at("tmgi").as_string();
-      auto dest = mtch.at("dest").as_string();
-      unsigned tsi = 0;
-      _cfg.lookupValue("mw.service_announcement_tsi", tsi);
-      auto is_service_announcement = std::stoul(tmgi.substr(0, 6), nullptr, 16) < 0xF;
-      if (!dest.empty() && is_service_announcement && !_service_announcement) {
-        // automatically start receiving the service announcement
-        // 26.346 5.2.3.1.1 : the pre-defined TSI value shall be "0". 
-        _service_announcement = std::make_unique<MBMS_RT::ServiceAnnouncement>(_cfg, tmgi, dest, tsi, _interface,
-                                                                               _io_service,
-                                                                               _cache, _seamless,
-                                                                               boost::bind(&Middleware::get_service,
-                                                                                           this, _1),
-                                                                               boost::bind(&Middleware::set_service,
-                                                                                           this, _1, _2)); //NOLINT
-        _service_announcement->start_flute_receiver(dest);
-      }
-    }
+  if (_stopping) {
+    return;
   }
+  static auto &timer_lag = Metrics::registry().histogram("mw_tick_timer_lag_seconds",
+      "Lateness of the 1 s control plane tick");
+  static auto &queue_lag = Metrics::registry().histogram("mw_io_queue_lag_seconds",
+      "Delay between posting a handler to the io_service and its execution");
+  auto lag = std::chrono::microseconds(
+      (boost::posix_time::microsec_clock::universal_time() - _timer.expires_at()).total_microseconds());
+  _scheduling.timer.record(lag);
+  timer_lag.observe(std::chrono::duration<double>(lag).count());
+  auto posted = std::chrono::steady_clock::now();
+  _io_service.post([this, posted]() {
+    auto lag = std::chrono::steady_clock::now() - posted;
+    _scheduling.queue.record(std::chrono::duration_cast<std::chrono::microseconds>(lag));
+    queue_lag.observe(std::chrono::duration<double>(lag).count());
+  });
 
   _cache.check_file_expiry_and_cache_size();
+  _save_snapshot();
+  for (const auto &service: _services) {
+    service.second->remove_drained_streams();
+  }
+  auto now = time(nullptr);
+  _draining_streams.erase(std::remove_if(_draining_streams.begin(), _draining_streams.end(),
+        [&](const auto& s) { return now - s.first > _cache.max_file_age(); }),
+      _draining_streams.end());
+  if (!_modem_events.connected()) {
+    poll_modem();
+    if (_control_system) {
+      poll_status();
+    }
+  } else if (!_service_announcement) {
+    // the modem only reports changes, so starting the service announcement is retried here
+    _start_service_announcement();
+  }
 
   _timer.expires_at(_timer.expires_at() + _tick_interval);
-  _timer.async_wait(boost::bind(&Middleware::tick_handler, this)); //NOLINT
+  _timer.async_wait(_strand.wrap(boost::bind(&Middleware::tick_handler, this))); //NOLINT
 }
 
 /**
+ * Requests the MCH info from the modem without blocking the io threads. Only one request is in flight at a time,
+ * so an unresponsive modem API does not pile up requests.
+ */
+void MBMS_RT::Middleware::poll_modem() {
+  if (_mch_info_pending) {
+    return;
+  }
+  _mch_info_pending = true;
+  _rp.getMchInfo([this](bool ok, web::json::value mchs) {
+    _strand.post([this, ok, mchs]() {
+      _mch_info_pending = false;
+      handle_mch_info(ok, mchs);
+    });
+  });
+}
+
+/**
+ * Handles an event pushed by the modem. Runs on the control strand.
  *
+ * @param type Event type
+ * @param event The complete event
  */
-void MBMS_RT::Middleware::control_tick_handler() {
-  if (_control_system) {
+void MBMS_RT::Middleware::handle_modem_event(const std::string &type, const web::json::value &event) {
+  if (type == "mch_info") {
+    handle_mch_info(true, event.at("mch_info"));
+  } else if (type == "status") {
+    const auto &status = event.at("status");
+    if (status.has_field("cinr_db")) {
+      _reporter.add_cinr_sample(status.at("cinr_db").as_double());
+    }
+  } else {
+    spdlog::debug("Ignoring unknown modem event {}", type);
+  }
+}
+
+/**
+ * Compares the MTCHs in the MCH info with the previous result, and only acts on changes.
+ *
+ * @param ok Whether the modem API request succeeded
+ * @param mchs MCH info as returned by the modem
+ */
+void MBMS_RT::Middleware::handle_mch_info(bool ok, const web::json::value &mchs) {
+  if (!ok || _stopping) {
+    // keep the last known state until the modem is reachable again
+    return;
+  }
+
+  std::map<std::string, std::string> mtchs;
+  try {
+    for (auto const &mch: mchs.as_array()) {
+      for (auto const &mtch: mch.at("mtchs").as_array()) {
+        mtchs[mtch.at("tmgi").as_string()] = mtch.at("dest").as_string();
+      }
+    }
+  } catch (const std::exception &ex) {
+    MW_LOG_RATE_LIMITED(spdlog::level::warn, "Ignoring invalid MCH info from modem: {}", ex.what());
+    return;
+  }
+
+  if (mtchs == _mtchs && _service_announcement) {
+    return;
+  }
+  for (const auto &mtch: mtchs) {
+    auto it = _mtchs.find(mtch.first);
+    if (it == _mtchs.end() || it->second != mtch.second) {
+      spdlog::info("MTCH for TMGI {} available at {}", mtch.first, mtch.second.empty() ? "n/a" : mtch.second);
+    }
+  }
+  for (const auto &mtch: _mtchs) {
+    if (mtchs.find(mtch.first) == mtchs.end()) {
+      spdlog::info("MTCH for TMGI {} is no longer available", mtch.first);
+    }
+  }
+  _mtchs = std::move(mtchs);
+  _start_service_announcement();
+}
+
+/**
+ * Starts receiving the service announcement on the MTCHs of the last MCH info, unless it is already received.
+ * Replaces a restored service announcement that has moved since the snapshot was saved.
+ */
+auto MBMS_RT::Middleware::_start_service_announcement() -> void {
+  for (const auto &mtch: _mtchs) {
+    const auto &tmgi = mtch.first;
+    const auto &dest = mtch.second;
+    unsigned long service_id = 0;
     try {
-      auto status = _rp.getStatus();
-      auto cinr = status.at("cinr_db").as_double();
-      spdlog::debug("CINR ist {}", cinr);
-
-      std::vector<std::string> tmgis;
-      auto services = _control.sendHello(cinr, tmgis);
-      for (const auto &ctrl_service: services.as_array()) {
-        spdlog::debug("control system sent service: {}", ctrl_service.serialize());
+      service_id = std::stoul(tmgi.substr(0, 6), nullptr, 16);
+    } catch (const std::exception &ex) {
+      spdlog::warn("Ignoring invalid TMGI {}", tmgi);
+      continue;
+    }
+    auto is_service_announcement = service_id < 0xF;
+    if (!dest.empty() && is_service_announcement && _service_announcement_restored &&
+        (tmgi != _service_announcement->tmgi() || dest != _service_announcement->mcast_address())) {
+      spdlog::info("Service announcement moved to TMGI {} at {} since the snapshot was saved", tmgi, dest);
+      // the new announcement removes the restored services it does not describe
+      _restored_services = _service_announcement->service_ids();
+      _service_announcement.reset();
+    }
+    if (!dest.empty() && is_service_announcement && !_service_announcement) {
+      // automatically start receiving the service announcement
+      // 26.346 5.2.3.1.1 : the pre-defined TSI value shall be "0". 
+      _service_announcement = std::make_unique<MBMS_RT::ServiceAnnouncement>(_cfg, tmgi, dest,
+                                                                             _service_announcement_tsi, _interface,
+                                                                             _io_service, _strand,
+                                                                             _cache, _seamless,
+                                                                             boost::bind(&Middleware::get_service,
+                                                                                         this, _1),
+                                                                             boost::bind(&Middleware::set_service,
+                                                                                         this, _1, _2)); //NOLINT
+      _service_announcement->adopt_services(_restored_services);
+      if (_service_announcement->start_flute_receiver(dest)) {
+        _restored_services.clear();
+      } else {
+        // retried with the next MCH info or tick
+        _service_announcement.reset();
       }
-    } catch (...) {}
+      _service_announcement_restored = false;
+    }
   }
+}
 
+/**
+ * Samples the CINR for the control system reports when the modem does not push its status.
+ */
+void MBMS_RT::Middleware::poll_status() {
+  if (_status_pending) {
+    return;
+  }
+  _status_pending = true;
+  _rp.getStatus([this](bool ok, web::json::value status) {
+    _strand.post([this, ok, status]() {
+      _status_pending = false;
+      try {
+        if (ok && status.has_field("cinr_db")) {
+          _reporter.add_cinr_sample(status.at("cinr_db").as_double());
+        }
+      } catch (const std::exception &ex) {
+        MW_LOG_RATE_LIMITED(spdlog::level::warn, "Ignoring invalid status from modem: {}", ex.what());
+      }
+    });
+  });
+}
+
+/**
+ * Closes the reporting interval, sends the KPI reports and the hello to the control system.
+ */
+void MBMS_RT::Middleware::control_tick_handler() {
+  if (_stopping) {
+    return;
+  }
+  if (_control_system && _control.enabled()) {
+    std::vector<ControlSystemReporter::StreamTotals> streams;
+    for (const auto &service: _services) {
+      for (const auto &stream: service.second->content_streams()) {
+        const auto &counters = stream.second->counters();
+        streams.push_back({service.first, stream.second->base(), counters.broadcast_objects,
+                           counters.broadcast_bytes, counters.cdn_objects, counters.cdn_bytes,
+                           stream.second->lost_objects()});
+      }
+    }
+    _reporter.add_report(streams, _cache.requests(), _cache.hits());
+    _reporter.flush();
+
+    std::vector<std::string> tmgis;
+    for (const auto &mtch: _mtchs) {
+      tmgis.push_back(mtch.first);
+    }
+    spdlog::debug("CINR is {}", _reporter.last_cinr());
+    _control.sendHello(_reporter.last_cinr(), tmgis, [this](bool ok, web::json::value services) {
+      if (ok) {
+        _strand.post([this, services]() { apply_control_commands(services); });
+      }
+    });
+  }
 
   _control_timer.expires_at(_control_timer.expires_at() + _control_tick_interval);
-  _control_timer.async_wait(boost::bind(&Middleware::control_tick_handler, this)); //NOLINT
+  _control_timer.async_wait(_strand.wrap(boost::bind(&Middleware::control_tick_handler, this))); //NOLINT
+}
+
+/**
+ * Applies the service activation commands the control system returned for the hello.
+ * Entries of the form {"service_id": "...", "active": false} deactivate a service: it is removed, and not set up
+ * again from the service announcement until it is activated again.
+ *
+ * @param services The hello response
+ */
+void MBMS_RT::Middleware::apply_control_commands(const web::json::value &services) {
+  if (!services.is_array()) {
+    return;
+  }
+  bool refresh = false;
+  for (const auto &ctrl_service: services.as_array()) {
+    spdlog::debug("control system sent service: {}", ctrl_service.serialize());
+    try {
+      if (!ctrl_service.has_field("service_id")) {
+        continue;
+      }
+      auto service_id = ctrl_service.at("service_id").as_string();
+      auto active = !ctrl_service.has_field("active") || ctrl_service.at("active").as_bool();
+      if (active && _inactive_services.erase(service_id) > 0) {
+        spdlog::info("Control system activated service {}", service_id);
+        refresh = true;
+      } else if (!active && _inactive_services.insert(service_id).second) {
+        spdlog::info("Control system deactivated service {}", service_id);
+        set_service(service_id, nullptr);
+      }
+    } catch (const std::exception &ex) {
+      spdlog::warn("Ignoring invalid command from control system: {}", ex.what());
+    }
+  }
+  if (refresh && _service_announcement) {
+    // the announcement has not changed, so the re-activated services have to be set up from the current one
+    _service_announcement->refresh();
+  }
 }
 
 /**
@@ -153,3 +497,35 @@ auto MBMS_RT::Middleware::get_service(const std::string &service_id) -> std::sha
     return nullptr;
   }
 }
+
+/**
+ *
+ * @param {string} service_id
+ * @param service The service, or nullptr to remove the service. The streams of a removed service are drained.
+ */
+void MBMS_RT::Middleware::set_service(const std::string &service_id, std::shared_ptr<Service> service) {
+  auto existing = get_service(service_id);
+  if (existing && existing != service) {
+    _retire_service(existing);
+  }
+  if (service && _inactive_services.find(service_id) != _inactive_services.end()) {
+    // the announcement has already started its streams
+    spdlog::info("Service {} has been deactivated by the control system, not starting it", service_id);
+    _retire_service(service);
+    _services.erase(service_id);
+  } else if (service) {
+    _services[service_id] = std::move(service);
+  } else {
+    _services.erase(service_id);
+  }
+}
+
+/**
+ * Keeps the streams of a removed service until their content has expired from the cache, like the streams a
+ * service drains itself. The service object can go away right away.
+ */
+void MBMS_RT::Middleware::_retire_service(const std::shared_ptr<Service> &service) {
+  auto streams = service->retire();
+  _draining_streams.insert(_draining_streams.end(), std::make_move_iterator(streams.begin()),
+                           std::make_move_iterator(streams.end()));
+}
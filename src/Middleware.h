@@ -16,6 +16,9 @@
 //
 #pragma once
 
+#include <chrono>
+#include <functional>
+#include <set>
 #include <string>
 #include <filesystem>
 #include <libconfig.h++>
@@ -23,32 +26,73 @@
 #include "RpRestClient.h"
 #include "Service.h"
 #include "ServiceAnnouncement.h"
+#include "ServiceSnapshot.h"
 #include "File.h"
 #include "RestHandler.h"
 #include "CacheManagement.h"
+#include "SchedulingStats.h"
+#include "ModemEventChannel.h"
+#include "LatencyTrace.h"
 #include "Service.h"
 #include "on_demand/ControlSystemRestClient.h"
+#include "on_demand/ControlSystemReporter.h"
 
 namespace MBMS_RT {
   class Middleware {
     public:
       Middleware( boost::asio::io_service& io_service, const libconfig::Config& cfg, const std::string& api_url, const std::string& iface);
+      virtual ~Middleware();
 
       std::shared_ptr<Service> get_service(const std::string& service_id);
-      void set_service(const std::string& service_id, std::shared_ptr<Service> service) { _services[service_id] = service; };
+      void set_service(const std::string& service_id, std::shared_ptr<Service> service);
+
+      /**
+       * Stops accepting HTTP requests and waits for the responses in flight, then stops the service announcement
+       * and content stream receivers. Blocks, and must not be called from an io thread.
+       *
+       * @param timeout for each of the two steps
+       */
+      void shutdown(std::chrono::milliseconds timeout);
+
+      /**
+       * Calls read_config on the control strand, then applies the cache limits, stream settings and the seamless
+       * switching mode of the new configuration. Running receivers are kept.
+       *
+       * @param read_config re-reads the configuration, returns false if it could not be read
+       */
+      void reload(std::function<bool()> read_config);
 
     private:
       void tick_handler();
+      void poll_modem();
+      void handle_mch_info(bool ok, const web::json::value& mchs);
+      void handle_modem_event(const std::string& type, const web::json::value& event);
+      void poll_status();
+      void apply_control_commands(const web::json::value& services);
 
       bool _seamless = false;
+      bool _stopping = false;
 
+      /**
+       * Serializes all control plane handlers (ticks, service announcement processing, service updates) while
+       * content streams run on their own strands.
+       */
+      boost::asio::io_service::strand _strand;
+      SchedulingStats _scheduling;
 
       MBMS_RT::RpRestClient _rp;
+      bool _mch_info_pending = false;
+      std::map<std::string, std::string> _mtchs; /**< destination address by TMGI, from the last mch_info */
+      unsigned _service_announcement_tsi = 0;
+      MBMS_RT::ModemEventChannel _modem_events;
+      bool _status_pending = false;
       MBMS_RT::RestHandler _api;
       MBMS_RT::CacheManagement _cache;
 
       bool _control_system = false;
       MBMS_RT::ControlSystemRestClient _control;
+      MBMS_RT::ControlSystemReporter _reporter;
+      std::set<std::string> _inactive_services; /**< services deactivated by the control system */
       boost::posix_time::seconds _control_tick_interval = boost::posix_time::seconds(10);
       boost::asio::deadline_timer _control_timer;
       void control_tick_handler();
@@ -63,6 +107,17 @@ namespace MBMS_RT {
       const std::string& _interface;
       boost::asio::io_service& _io_service;
 
+      void _retire_service(const std::shared_ptr<Service>& service);
+      Service::drained_streams_t _draining_streams; /**< streams of removed services, kept until their content expires */
+
       bool _handle_local_service_announcement();
+      void _restore_snapshot();
+      void _start_service_announcement();
+      void _save_snapshot();
+
+      ServiceSnapshot _snapshot;
+      uint32_t _snapshot_toi = 0;
+      bool _service_announcement_restored = false;
+      std::set<std::string> _restored_services; /**< restored services the next announcement takes over */
     };
 };
@@ -0,0 +1,123 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "ModemEventChannel.h"
+
+#include <istream>
+
+#include "LogRateLimit.h"
+#include "spdlog/spdlog.h"
+
+namespace {
+  // a single event is far smaller, this only bounds the memory used by a misbehaving peer
+  const size_t kMaxEventSize = 1024 * 1024;
+}
+
+MBMS_RT::ModemEventChannel::ModemEventChannel(const libconfig::Config& cfg, boost::asio::io_service& io_service,
+    boost::asio::io_service::strand& strand, event_callback_t event_cb)
+  : _strand(strand)
+  , _socket(io_service)
+  , _buffer(kMaxEventSize)
+  , _reconnect_timer(io_service)
+  , _event_cb(std::move(event_cb))
+{
+  cfg.lookupValue("mw.modem_events.enabled", _enabled);
+  cfg.lookupValue("mw.modem_events.socket", _path);
+  int secs = 5;
+  cfg.lookupValue("mw.modem_events.reconnect_interval", secs);
+  _reconnect_interval = boost::posix_time::seconds(secs);
+
+  if (_enabled) {
+    spdlog::info("Modem event channel enabled at {}", _path);
+    _strand.post([this]() { connect(); });
+  }
+}
+
+MBMS_RT::ModemEventChannel::~ModemEventChannel()
+{
+  _reconnect_timer.cancel();
+  boost::system::error_code ec;
+  _socket.close(ec);
+}
+
+auto MBMS_RT::ModemEventChannel::connect() -> void
+{
+  _socket.async_connect(boost::asio::local::stream_protocol::endpoint(_path),
+      _strand.wrap([this](const boost::system::error_code& ec) {
+        if (ec) {
+          spdlog::debug("Modem event channel: connecting to {} failed: {}", _path, ec.message());
+          boost::system::error_code close_ec;
+          _socket.close(close_ec);
+          schedule_reconnect();
+          return;
+        }
+        spdlog::info("Modem event channel connected to {}", _path);
+        _connected = true;
+        read();
+      }));
+}
+
+auto MBMS_RT::ModemEventChannel::schedule_reconnect() -> void
+{
+  _reconnect_timer.expires_from_now(_reconnect_interval);
+  _reconnect_timer.async_wait(_strand.wrap([this](const boost::system::error_code& ec) {
+    if (!ec) {
+      connect();
+    }
+  }));
+}
+
+auto MBMS_RT::ModemEventChannel::read() -> void
+{
+  boost::asio::async_read_until(_socket, _buffer, '\n',
+      _strand.wrap([this](const boost::system::error_code& ec, size_t /*bytes*/) {
+        if (ec) {
+          if (ec == boost::asio::error::operation_aborted) {
+            return;
+          }
+          spdlog::warn("Modem event channel disconnected ({}), falling back to polling", ec.message());
+          _connected = false;
+          _buffer.consume(_buffer.size());
+          boost::system::error_code close_ec;
+          _socket.close(close_ec);
+          schedule_reconnect();
+          return;
+        }
+        std::istream is(&_buffer);
+        std::string line;
+        std::getline(is, line);
+        handle_line(line);
+        read();
+      }));
+}
+
+auto MBMS_RT::ModemEventChannel::handle_line(const std::string& line) -> void
+{
+  if (line.empty() || line == "\r") {
+    return;
+  }
+  try {
+    auto event = web::json::value::parse(line);
+    auto type = event.at("type").as_string();
+    SPDLOG_DEBUG("Modem event channel: received {} event", type);
+    if (_event_cb) {
+      _event_cb(type, event);
+    }
+  } catch (const std::exception& ex) {
+    MW_LOG_RATE_LIMITED(spdlog::level::warn, "Modem event channel: ignoring invalid event: {}", ex.what());
+  }
+}
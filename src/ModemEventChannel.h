@@ -0,0 +1,67 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <libconfig.h++>
+#include <boost/asio.hpp>
+#include "cpprest/json.h"
+
+namespace MBMS_RT {
+  /**
+   * Push channel from the modem (receive process) over a local Unix domain socket.
+   *
+   * The modem sends newline delimited JSON events of the form {"type": "mch_info", "mch_info": [...]} or
+   * {"type": "status", "status": {...}}, using the same payloads as its REST API. The current state is sent
+   * right after connecting, and an event is sent on every change. While the channel is not connected, the
+   * middleware falls back to polling the REST API, and a reconnect is attempted periodically.
+   */
+  class ModemEventChannel {
+    public:
+      typedef std::function<void(const std::string& type, const web::json::value& event)> event_callback_t;
+
+      /**
+       * @param strand All handlers and event callbacks run on this strand
+       */
+      ModemEventChannel(const libconfig::Config& cfg, boost::asio::io_service& io_service,
+          boost::asio::io_service::strand& strand, event_callback_t event_cb);
+      virtual ~ModemEventChannel();
+
+      bool enabled() const { return _enabled; };
+      bool connected() const { return _connected; };
+
+    private:
+      void connect();
+      void schedule_reconnect();
+      void read();
+      void handle_line(const std::string& line);
+
+      bool _enabled = false;
+      std::string _path = "/tmp/5gmag-rt-modem-events.sock";
+      std::atomic<bool> _connected = {false};
+      boost::posix_time::seconds _reconnect_interval = boost::posix_time::seconds(5);
+
+      boost::asio::io_service::strand& _strand;
+      boost::asio::local::stream_protocol::socket _socket;
+      boost::asio::streambuf _buffer;
+      boost::asio::deadline_timer _reconnect_timer;
+      event_callback_t _event_cb;
+  };
+}
@@ -0,0 +1,231 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "MultipartSplitter.h"
+
+#include <algorithm>
+#include <cctype>
+
+namespace {
+  auto iequals(std::string_view a, std::string_view b) -> bool {
+    return a.size() == b.size() &&
+      std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) { return std::tolower(x) == std::tolower(y); });
+  }
+
+  auto ifind(std::string_view haystack, std::string_view needle) -> size_t {
+    auto it = std::search(haystack.begin(), haystack.end(), needle.begin(), needle.end(),
+        [](char x, char y) { return std::tolower(x) == std::tolower(y); });
+    return it == haystack.end() ? std::string_view::npos : it - haystack.begin();
+  }
+
+  auto is_space(char c) -> bool {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+  }
+
+  auto trimmed(MBMS_RT::MultipartSplitter::Range r, std::string_view buffer) -> MBMS_RT::MultipartSplitter::Range {
+    while (r.length > 0 && is_space(buffer[r.offset])) { r.offset++; r.length--; }
+    while (r.length > 0 && is_space(buffer[r.offset + r.length - 1])) { r.length--; }
+    return r;
+  }
+}
+
+auto MBMS_RT::MultipartSplitter::reset() -> void
+{
+  _state = State::Headers;
+  _delimiter.clear();
+  _pos = 0;
+  _search_from = 0;
+  _in_preamble = true;
+  _current = {};
+  _parts.clear();
+}
+
+auto MBMS_RT::MultipartSplitter::feed(std::string_view buffer) -> void
+{
+  for (;;) {
+    switch (_state) {
+      case State::Headers: {
+        // skip leading empty lines
+        while (_pos < buffer.size() && is_space(buffer[_pos])) _pos++;
+        if (_pos + 2 > buffer.size()) return;
+        if (buffer.compare(_pos, 2, "--") == 0) {
+          // no top level headers, the document starts with the first delimiter
+          auto nl = buffer.find('\n', _pos);
+          if (nl == std::string_view::npos) return;
+          _delimiter = std::string(trimmed({_pos, nl - _pos}, buffer).in(buffer));
+          _pos = nl + 1;
+          _in_preamble = false;
+          _state = State::PartHeaders;
+        } else if (!parse_headers(buffer, true)) {
+          return;
+        }
+        break;
+      }
+      case State::PartHeaders:
+        if (!parse_headers(buffer, false)) {
+          return;
+        }
+        break;
+      case State::Body: {
+        size_t pos = _search_from;
+        for (;;) {
+          pos = buffer.find(_delimiter, pos);
+          if (pos == std::string_view::npos || pos == 0 || buffer[pos - 1] == '\n') break;
+          pos++;
+        }
+        auto after = pos + _delimiter.size();
+        if (pos == std::string_view::npos || after + 2 > buffer.size()) {
+          // keep enough overlap to detect a delimiter that is split across two calls
+          auto overlap = _delimiter.size() + 2;
+          _search_from = std::max(_search_from, buffer.size() > overlap ? buffer.size() - overlap : 0);
+          if (pos != std::string_view::npos) _search_from = std::min(_search_from, pos);
+          return;
+        }
+        if (!_in_preamble) {
+          // the line break preceding the delimiter belongs to the delimiter
+          auto end = pos;
+          if (end > _current.body.offset && buffer[end - 1] == '\n') end--;
+          if (end > _current.body.offset && buffer[end - 1] == '\r') end--;
+          _current.body.length = end - _current.body.offset;
+          while (_current.body.length > 0 && is_space(buffer[_current.body.offset])) {
+            _current.body.offset++;
+            _current.body.length--;
+          }
+          _parts.push_back(_current);
+        }
+        if (buffer.compare(after, 2, "--") == 0) {
+          _state = State::Done;
+          return;
+        }
+        auto nl = buffer.find('\n', after);
+        if (nl == std::string_view::npos) {
+          _search_from = pos;
+          return;
+        }
+        _pos = nl + 1;
+        _in_preamble = false;
+        _current = {};
+        _state = State::PartHeaders;
+        break;
+      }
+      case State::Done:
+      case State::Failed:
+        return;
+    }
+  }
+}
+
+auto MBMS_RT::MultipartSplitter::parse_headers(std::string_view buffer, bool top_level) -> bool
+{
+  // locate the empty line terminating the header block
+  size_t headers_end = 0;
+  size_t body_start = 0;
+  if (buffer.compare(_pos, 2, "\r\n") == 0) {
+    headers_end = _pos;
+    body_start = _pos + 2;
+  } else if (buffer.compare(_pos, 1, "\n") == 0) {
+    headers_end = _pos;
+    body_start = _pos + 1;
+  } else {
+    auto lf = buffer.find("\n\n", _pos);
+    auto crlf = buffer.find("\n\r\n", _pos);
+    if (lf == std::string_view::npos && crlf == std::string_view::npos) return false;
+    if (crlf < lf) {
+      headers_end = crlf + 1;
+      body_start = crlf + 3;
+    } else {
+      headers_end = lf + 1;
+      body_start = lf + 2;
+    }
+  }
+
+  Range content_type;
+  Range* last = nullptr;
+  for (size_t line_start = _pos; line_start < headers_end;) {
+    auto nl = buffer.find('\n', line_start);
+    auto line_end = std::min(nl, headers_end);
+    if (buffer[line_start] == ' ' || buffer[line_start] == '\t') {
+      // folded header: extend the value of the previous header
+      if (last != nullptr) {
+        last->length = line_end - last->offset;
+      }
+    } else {
+      last = nullptr;
+      auto colon = buffer.find(':', line_start);
+      if (colon != std::string_view::npos && colon < line_end) {
+        auto name = buffer.substr(line_start, colon - line_start);
+        Range value{colon + 1, line_end - colon - 1};
+        if (iequals(name, "Content-Type")) {
+          last = top_level ? &content_type : &_current.content_type;
+        } else if (iequals(name, "Content-Location")) {
+          last = &_current.content_location;
+        } else if (iequals(name, "Content-Transfer-Encoding")) {
+          last = &_current.transfer_encoding;
+        }
+        if (last != nullptr) {
+          *last = value;
+        }
+      }
+    }
+    line_start = line_end + 1;
+  }
+
+  if (top_level) {
+    auto value = trimmed(content_type, buffer).in(buffer);
+    auto bpos = ifind(value, "boundary=");
+    if (ifind(value, "multipart/") != 0 || bpos == std::string_view::npos) {
+      _state = State::Failed;
+      return false;
+    }
+    auto boundary = value.substr(bpos + 9);
+    if (!boundary.empty() && boundary[0] == '"') {
+      boundary = boundary.substr(1, boundary.find('"', 1) - 1);
+    } else {
+      auto end = std::find_if(boundary.begin(), boundary.end(), [](char c) { return c == ';' || is_space(c); });
+      boundary = boundary.substr(0, end - boundary.begin());
+    }
+    if (boundary.empty()) {
+      _state = State::Failed;
+      return false;
+    }
+    _delimiter = "--" + std::string(boundary);
+    _current = {};
+  } else {
+    // strip parameters from the part content type
+    auto ct = _current.content_type.in(buffer);
+    auto semicolon = ct.find(';');
+    if (semicolon != std::string_view::npos) {
+      _current.content_type.length = semicolon;
+    }
+    _current.content_type = trimmed(_current.content_type, buffer);
+    _current.content_location = trimmed(_current.content_location, buffer);
+    _current.transfer_encoding = trimmed(_current.transfer_encoding, buffer);
+    _current.body.offset = body_start;
+  }
+  _pos = body_start;
+  _search_from = body_start;
+  _state = State::Body;
+  return true;
+}
+
+auto MBMS_RT::MultipartSplitter::requires_decoding(std::string_view buffer) const -> bool
+{
+  return std::any_of(_parts.begin(), _parts.end(), [&buffer](const Part& part) {
+    auto encoding = part.transfer_encoding.in(buffer);
+    return iequals(encoding, "base64") || iequals(encoding, "quoted-printable");
+  });
+}
@@ -0,0 +1,83 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace MBMS_RT {
+  /**
+   * Splits a multipart/related document (e.g. a service announcement bootstrap file) into its parts without
+   * copying any data. Parts are stored as offsets into the buffer, so the buffer can keep growing between
+   * calls to feed() while it is being received or decompressed.
+   */
+  class MultipartSplitter {
+    public:
+      MultipartSplitter() = default;
+      ~MultipartSplitter() = default;
+
+      struct Range {
+        size_t offset = 0;
+        size_t length = 0;
+        std::string_view in(std::string_view buffer) const { return buffer.substr(offset, length); };
+      };
+
+      struct Part {
+        Range content_type;
+        Range content_location;
+        Range transfer_encoding;
+        Range body;
+      };
+
+      /**
+       * Scans the data that has been appended to the buffer since the last call.
+       * Data already passed in earlier calls must not have been modified.
+       */
+      void feed(std::string_view buffer);
+      void reset();
+
+      bool complete() const { return _state == State::Done; };
+      bool failed() const { return _state == State::Failed; };
+      const std::vector<Part>& parts() const { return _parts; };
+
+      /**
+       * True if a part uses a transfer encoding (base64, quoted-printable) that has to be decoded before use.
+       */
+      bool requires_decoding(std::string_view buffer) const;
+
+    private:
+      enum class State {
+        Headers,
+        PartHeaders,
+        Body,
+        Done,
+        Failed
+      };
+
+      bool parse_headers(std::string_view buffer, bool top_level);
+
+      State _state = State::Headers;
+      std::string _delimiter;
+      size_t _pos = 0;
+      size_t _search_from = 0;
+      bool _in_preamble = true;
+      Part _current = {};
+      std::vector<Part> _parts;
+  };
+}
@@ -0,0 +1,188 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "ReassemblyBudget.h"
+
+#include <algorithm>
+#include "spdlog/spdlog.h"
+
+MBMS_RT::ReassemblyBudget::ReassemblyBudget(const libconfig::Config& cfg)
+{
+  configure(cfg);
+}
+
+auto MBMS_RT::ReassemblyBudget::configure(const libconfig::Config& cfg) -> void
+{
+  unsigned max_total = 256;
+  cfg.lookupValue("mw.cache.max_reassembly_size", max_total);
+  _max_total = static_cast<uint64_t>(max_total) * 1024 * 1024;
+  unsigned max_session = 64;
+  cfg.lookupValue("mw.cache.max_session_reassembly_size", max_session);
+  _max_session = static_cast<uint64_t>(max_session) * 1024 * 1024;
+}
+
+auto MBMS_RT::ReassemblyBudget::add_session(const std::string& name, LibFlute::Receiver* receiver,
+    bool service_announcement, unsigned long long tsi) -> void
+{
+  Session session{name, service_announcement};
+  Metrics::Labels labels = {{"tsi", std::to_string(tsi)}};
+  session.dropped_metric = &Metrics::registry().counter("mw_flute_objects_dropped_total",
+      "FLUTE objects dropped by the reassembly memory budget", labels);
+  session.lost_metric = &Metrics::registry().counter("mw_flute_objects_evicted_total",
+      "Incomplete FLUTE objects evicted by the reassembly memory budget", labels);
+
+  const std::lock_guard<std::mutex> lock(_mutex);
+  _sessions[receiver] = std::move(session);
+}
+
+auto MBMS_RT::ReassemblyBudget::remove_session(LibFlute::Receiver* receiver) -> void
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _sessions.find(receiver);
+  if (it != _sessions.end()) {
+    _removed_dropped_objects += it->second.dropped_objects;
+    _removed_dropped_bytes += it->second.dropped_bytes;
+    _sessions.erase(it);
+  }
+}
+
+auto MBMS_RT::ReassemblyBudget::drop(Session& session, const Object& object, const char* reason) -> void
+{
+  spdlog::info("Dropping FLUTE object {} ({} bytes) of session {}: {}",
+      object.content_location, object.length, session.name, reason);
+  object.receiver->remove_file_with_content_location(object.content_location);
+  session.bytes -= object.length;
+  session.objects--;
+  session.dropped_objects++;
+  session.dropped_bytes += object.length;
+  session.dropped_metric->inc();
+  if (!object.complete) {
+    session.lost_objects++;
+    session.lost_metric->inc();
+  }
+  _total_bytes -= object.length;
+}
+
+auto MBMS_RT::ReassemblyBudget::enforce(unsigned max_file_age) -> void
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto now = time(nullptr);
+
+  // Lowest priority first, oldest first within the same priority
+  auto drop_order = [](const Object& a, const Object& b) {
+    if (a.priority != b.priority) return a.priority > b.priority;
+    return a.received_at < b.received_at;
+  };
+
+  std::vector<std::pair<Session*, Object>> all_objects;
+  _total_bytes = 0;
+  for (auto& it : _sessions) {
+    auto& session = it.second;
+    session.bytes = 0;
+    session.objects = 0;
+    session.incomplete_objects = 0;
+
+    std::vector<Object> objects;
+    for (const auto& file : it.first->file_list()) {
+      const auto& location = file->meta().content_location;
+      Priority priority = Priority::Old;
+      if (session.service_announcement) {
+        priority = Priority::ServiceAnnouncement;
+      } else if (location.find(".m3u8") != std::string::npos || location.find(".mpd") != std::string::npos) {
+        priority = Priority::Playlist;
+      } else if (!file->complete()) {
+        priority = Priority::LiveEdge;
+      }
+      Object object{it.first, location, file->length(), file->received_at(), priority, file->complete()};
+
+      session.bytes += object.length;
+      session.objects++;
+      if (!file->complete()) {
+        session.incomplete_objects++;
+      }
+      _total_bytes += object.length;
+
+      if (file->complete() && priority != Priority::ServiceAnnouncement &&
+          object.received_at != 0 && now - object.received_at > max_file_age) {
+        // handed over to the cache long ago, only kept by the receiver to detect repetitions
+        drop(session, object, "expired");
+      } else if (_max_session > 0 && object.length > _max_session && priority != Priority::ServiceAnnouncement) {
+        drop(session, object, "larger than the session quota");
+      } else {
+        objects.push_back(std::move(object));
+      }
+    }
+
+    std::sort(objects.begin(), objects.end(), drop_order);
+    for (auto& object : objects) {
+      if (_max_session > 0 && session.bytes > _max_session && object.priority != Priority::ServiceAnnouncement) {
+        drop(session, object, "session quota exceeded");
+      } else {
+        all_objects.emplace_back(&session, std::move(object));
+      }
+    }
+  }
+
+  if (_max_total > 0 && _total_bytes > _max_total) {
+    std::sort(all_objects.begin(), all_objects.end(),
+        [&drop_order](const auto& a, const auto& b) { return drop_order(a.second, b.second); });
+    for (const auto& it : all_objects) {
+      if (_total_bytes <= _max_total || it.second.priority == Priority::ServiceAnnouncement) break;
+      drop(*it.first, it.second, "reassembly memory limit exceeded");
+    }
+  }
+}
+
+auto MBMS_RT::ReassemblyBudget::session_stats() const -> std::vector<SessionStats>
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  std::vector<SessionStats> stats;
+  for (const auto& it : _sessions) {
+    const auto& s = it.second;
+    stats.push_back({s.name, s.bytes, s.objects, s.incomplete_objects, s.dropped_objects, s.dropped_bytes});
+  }
+  return stats;
+}
+
+auto MBMS_RT::ReassemblyBudget::total_bytes() const -> uint64_t
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  return _total_bytes;
+}
+
+auto MBMS_RT::ReassemblyBudget::dropped_objects() const -> uint64_t
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  uint64_t dropped = _removed_dropped_objects;
+  for (const auto& it : _sessions) dropped += it.second.dropped_objects;
+  return dropped;
+}
+
+auto MBMS_RT::ReassemblyBudget::dropped_bytes() const -> uint64_t
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  uint64_t dropped = _removed_dropped_bytes;
+  for (const auto& it : _sessions) dropped += it.second.dropped_bytes;
+  return dropped;
+}
+
+auto MBMS_RT::ReassemblyBudget::lost_objects(LibFlute::Receiver* receiver) const -> uint64_t
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _sessions.find(receiver);
+  return it == _sessions.end() ? 0 : it->second.lost_objects;
+}
@@ -0,0 +1,119 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <libconfig.h++>
+#include "Receiver.h"
+#include "Metrics.h"
+
+namespace MBMS_RT {
+  /**
+   * Bounds the memory held by the objects of all FLUTE receivers.
+   *
+   * Every receiver registers itself as a session. When a session exceeds its quota, or all sessions together
+   * exceed the global limit, objects are dropped from the receivers in reverse priority order
+   * (old objects first, then live edge segments, then playlists, service announcement objects last).
+   */
+  class ReassemblyBudget {
+    public:
+      ReassemblyBudget(const libconfig::Config& cfg);
+      virtual ~ReassemblyBudget() = default;
+
+      /**
+       * Reads the limits from mw.cache.max_reassembly_size and mw.cache.max_session_reassembly_size (MB)
+       */
+      void configure(const libconfig::Config& cfg);
+
+      enum class Priority {
+        ServiceAnnouncement,
+        Playlist,
+        LiveEdge,
+        Old
+      };
+
+      void add_session(const std::string& name, LibFlute::Receiver* receiver, bool service_announcement,
+          unsigned long long tsi);
+      void remove_session(LibFlute::Receiver* receiver);
+
+      /**
+       * Checks the memory use of all sessions and drops objects as needed.
+       *
+       * @param max_file_age Completed objects older than this are dropped regardless of memory use
+       */
+      void enforce(unsigned max_file_age);
+
+      struct SessionStats {
+        std::string name;
+        uint64_t bytes;
+        unsigned objects;
+        unsigned incomplete_objects;
+        uint64_t dropped_objects;
+        uint64_t dropped_bytes;
+      };
+      std::vector<SessionStats> session_stats() const;
+
+      uint64_t limit() const { return _max_total; };
+      uint64_t session_limit() const { return _max_session; };
+      uint64_t total_bytes() const;
+      uint64_t dropped_objects() const;
+      uint64_t dropped_bytes() const;
+
+      /**
+       * Number of incomplete objects that have been dropped from the session of receiver, i.e. objects lost
+       */
+      uint64_t lost_objects(LibFlute::Receiver* receiver) const;
+
+    private:
+      struct Session {
+        std::string name;
+        bool service_announcement;
+        uint64_t bytes = 0;
+        unsigned objects = 0;
+        unsigned incomplete_objects = 0;
+        uint64_t dropped_objects = 0;
+        uint64_t dropped_bytes = 0;
+        uint64_t lost_objects = 0;
+        Metrics::Counter* dropped_metric = nullptr;
+        Metrics::Counter* lost_metric = nullptr;
+      };
+
+      struct Object {
+        LibFlute::Receiver* receiver;
+        std::string content_location;
+        uint64_t length;
+        unsigned long received_at;
+        Priority priority;
+        bool complete;
+      };
+
+      void drop(Session& session, const Object& object, const char* reason);
+
+      mutable std::mutex _mutex;
+      std::map<LibFlute::Receiver*, Session> _sessions;
+      std::atomic<uint64_t> _max_total = {0};
+      std::atomic<uint64_t> _max_session = {0};
+      uint64_t _total_bytes = 0;
+      uint64_t _removed_dropped_objects = 0;
+      uint64_t _removed_dropped_bytes = 0;
+  };
+}
@@ -0,0 +1,35 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace MBMS_RT {
+  /**
+   * Cumulative reception counters of a content stream. Updated from the stream strand and from cpprest threads
+   * (CDN responses), read by the control system reporting.
+   */
+  struct ReceptionCounters {
+    std::atomic<uint64_t> broadcast_objects = {0};
+    std::atomic<uint64_t> broadcast_bytes = {0};
+    std::atomic<uint64_t> cdn_objects = {0};
+    std::atomic<uint64_t> cdn_bytes = {0};
+    std::atomic<uint64_t> lost_objects = {0};  /**< objects that were announced but not received via broadcast */
+  };
+}
@@ -17,9 +17,13 @@
 
 #include "RestHandler.h"
 #include "seamless/SeamlessContentStream.h"
+#include "LatencyTrace.h"
 
+#include <cstring>
+#include <future>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include "spdlog/spdlog.h"
 #include <boost/algorithm/string/join.hpp>
@@ -32,24 +36,63 @@ using web::http::status_codes;
 using web::http::experimental::listener::http_listener;
 using web::http::experimental::listener::http_listener_config;
 
+namespace {
+  /**
+   * Splits an ISO BMFF segment into CMAF chunks: each chunk starts with a moof box, boxes in front of the first
+   * moof (styp, sidx, prft, ...) belong to the first chunk. Returns (offset, length) pairs.
+   */
+  auto cmaf_chunks(const char* data, size_t length) -> std::vector<std::pair<size_t, size_t>> {
+    std::vector<std::pair<size_t, size_t>> chunks;
+    size_t start = 0;
+    size_t pos = 0;
+    bool moof_seen = false;
+    while (pos + 8 <= length) {
+      auto p = reinterpret_cast<const uint8_t*>(data) + pos;
+      uint64_t size = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+      if (size == 1 && pos + 16 <= length) {
+        size = 0;
+        for (int i = 8; i < 16; i++) size = (size << 8) | p[i];
+      } else if (size == 0) {
+        size = length - pos;
+      }
+      if (size < 8 || size > length - pos) {
+        break;
+      }
+      if (std::memcmp(p + 4, "moof", 4) == 0) {
+        if (moof_seen) {
+          chunks.emplace_back(start, pos - start);
+          start = pos;
+        }
+        moof_seen = true;
+      }
+      pos += size;
+    }
+    chunks.emplace_back(start, length - start);
+    return chunks;
+  }
+}
+
 MBMS_RT::RestHandler::RestHandler(const libconfig::Config& cfg, const std::string& url, const CacheManagement& cache,
     const std::unique_ptr<MBMS_RT::ServiceAnnouncement>* service_announcement,
-    const std::map<std::string, std::shared_ptr<Service>>& services )
-    : _cfg(cfg)
+    const std::map<std::string, std::shared_ptr<Service>>& services, const SchedulingStats& scheduling,
+    boost::asio::io_service::strand& strand)
+    : _cache(cache)
+    , _cfg(cfg)
     , _services(services) 
-    , _cache(cache)
+    , _scheduling(scheduling)
     , _service_announcement_h(service_announcement)
+    , _strand(strand)
 {
   http_listener_config server_config;
   if (url.rfind("https", 0) == 0) {
-    server_config.set_ssl_context_callback(
-        [&](boost::asio::ssl::context& ctx) {
-          std::string cert_file = "/usr/share/5gmag-rt/cert.pem";
-          cfg.lookupValue("mw.http_server.cert", cert_file);
-
-          std::string key_file = "/usr/share/5gmag-rt/key.pem";
-          cfg.lookupValue("mw.http_server.key", key_file);
+    // The configuration can be reloaded while connections are accepted, so it is read here and not in the callback
+    std::string cert_file = "/usr/share/5gmag-rt/cert.pem";
+    cfg.lookupValue("mw.http_server.cert", cert_file);
 
+    std::string key_file = "/usr/share/5gmag-rt/key.pem";
+    cfg.lookupValue("mw.http_server.key", key_file);
+    server_config.set_ssl_context_callback(
+        [cert_file, key_file](boost::asio::ssl::context& ctx) {
           ctx.set_options(boost::asio::ssl::context::default_workarounds);
           ctx.use_certificate_chain_file(cert_file);
           ctx.use_private_key_file(key_file, boost::asio::ssl::context::pem);
@@ -65,6 +108,12 @@ MBMS_RT::RestHandler::RestHandler(const libconfig::Config& cfg, const std::strin
   _api_path = "mw-api";
   cfg.lookupValue("mw.http_server.api_path", _api_path);
 
+  for (const auto& route : {"service_announcement", "files", "reassembly", "scheduling", "services", "metrics",
+                            "trace", "file", "other"}) {
+    _route_latency[route] = &Metrics::registry().histogram("mw_http_request_duration_seconds",
+        "Time spent handling HTTP GET requests", {{"route", route}});
+  }
+
   _listener = std::make_unique<http_listener>(
       url, server_config);
 
@@ -76,10 +125,39 @@ MBMS_RT::RestHandler::RestHandler(const libconfig::Config& cfg, const std::strin
 
 MBMS_RT::RestHandler::~RestHandler() = default;
 
+auto MBMS_RT::RestHandler::close(std::chrono::milliseconds timeout) -> bool {
+  if (!_listener) {
+    return true;
+  }
+  spdlog::info("Closing the HTTP server, waiting for in-flight responses");
+  // close() completes once all open requests have been answered. Those can wait for content from the io threads,
+  // so the listener must be closed from another thread.
+  auto closed = std::make_shared<std::promise<void>>();
+  auto done = closed->get_future();
+  _listener->close().then([closed](pplx::task<void> task) {
+    try {
+      task.get();
+    } catch (const std::exception& ex) {
+      spdlog::warn("Closing the HTTP server failed: {}", ex.what());
+    }
+    closed->set_value();
+  });
+  if (done.wait_for(timeout) != std::future_status::ready) {
+    spdlog::warn("HTTP responses still in flight after {} ms", timeout.count());
+    return false;
+  }
+  return true;
+}
+
 void MBMS_RT::RestHandler::get(http_request message) {
   auto uri = message.relative_uri();
-        spdlog::debug("request for  {}", uri.to_string() );
+        SPDLOG_DEBUG("request for  {}", uri.to_string() );
   auto paths = uri::split_path(uri::decode(message.relative_uri().path()));
+
+  auto route = _route_latency.find(paths.empty() ? "other" :
+      (paths[0] != _api_path ? "file" : (paths.size() > 1 ? paths[1] : "other")));
+  Metrics::ScopedTimer timer(route != _route_latency.end() ? *route->second : *_route_latency.at("other"));
+
   if (_require_bearer_token &&
     (message.headers()["Authorization"] != "Bearer " + _api_key)) {
     message.reply(status_codes::Unauthorized);
@@ -90,10 +168,19 @@ void MBMS_RT::RestHandler::get(http_request message) {
     message.reply(status_codes::NotFound);
   } else {
     if (paths[0] == _api_path) {
-      if (paths[1] == "service_announcement") {
-        if (*_service_announcement_h) {
+      if (paths.size() < 2) {
+        message.reply(status_codes::NotFound);
+        return;
+      } else if (paths[1] == "service_announcement") {
+        // the announcement is updated on the control strand
+        _strand.post([this, message]() {
+          if (!*_service_announcement_h) {
+            message.reply(status_codes::NotFound);
+            return;
+          }
           std::vector<value> items;
-          for (const auto& item : (*_service_announcement_h)->items()) {
+          for (const auto& it : (*_service_announcement_h)->items()) {
+            const auto& item = it.second;
             if (item.content_type != "application/mbms-envelope+xml") {
               value i;
               i["location"] = value(item.uri);
@@ -110,11 +197,8 @@ void MBMS_RT::RestHandler::get(http_request message) {
           sa["content"] = value((*_service_announcement_h)->content());
           sa["items"] = value::array(items);
           message.reply(status_codes::OK, sa);
-          return;
-        } else {
-          message.reply(status_codes::NotFound);
-          return;
-        }
+        });
+        return;
       } else if (paths[1] == "files") {
         std::vector<value> files;
         for (const auto& item : _cache.item_map()) {
@@ -132,46 +216,98 @@ void MBMS_RT::RestHandler::get(http_request message) {
         }
         message.reply(status_codes::OK, value::array(files));
         return;
+      } else if (paths[1] == "reassembly") {
+        const auto& budget = _cache.reassembly();
+        std::vector<value> sessions;
+        for (const auto& stats : budget.session_stats()) {
+          value s;
+          s["name"] = value(stats.name);
+          s["bytes"] = value(stats.bytes);
+          s["objects"] = value(stats.objects);
+          s["incomplete_objects"] = value(stats.incomplete_objects);
+          s["dropped_objects"] = value(stats.dropped_objects);
+          s["dropped_bytes"] = value(stats.dropped_bytes);
+          sessions.push_back(s);
+        }
+        value r;
+        r["limit"] = value(budget.limit());
+        r["session_limit"] = value(budget.session_limit());
+        r["bytes"] = value(budget.total_bytes());
+        r["dropped_objects"] = value(budget.dropped_objects());
+        r["dropped_bytes"] = value(budget.dropped_bytes());
+        r["sessions"] = value::array(sessions);
+        message.reply(status_codes::OK, r);
+        return;
+      } else if (paths[1] == "scheduling") {
+        auto lag = [](const SchedulingLag& l) -> value {
+          value v;
+          v["last_us"] = value(l.last_us());
+          v["max_us"] = value(l.max_us());
+          v["average_us"] = value(l.average_us());
+          v["samples"] = value(l.samples());
+          return v;
+        };
+        value sched;
+        sched["threads"] = value(_scheduling.threads);
+        sched["timer_lag"] = lag(_scheduling.timer);
+        sched["queue_lag"] = lag(_scheduling.queue);
+        message.reply(status_codes::OK, sched);
+        return;
+      } else if (paths[1] == "metrics") {
+        message.reply(status_codes::OK, Metrics::registry().serialize(), "text/plain; version=0.0.4");
+        return;
+      } else if (paths[1] == "trace") {
+        auto query = uri::split_query(uri.query());
+        auto format = query.find("format");
+        if (format != query.end() && format->second == "chrome") {
+          message.reply(status_codes::OK, trace_as_chrome_json());
+        } else {
+          message.reply(status_codes::OK, trace_as_json());
+        }
+        return;
       } else if (paths[1] == "services") {
-        std::vector<value> services;
-        for (const auto& service : _services) {
-          auto s = service.second;
-          value ser;
-
-          std::vector<value> names;
-          for (const auto& name : s->names()) {
-            value n;
-            n["lang"] = value(name.first);
-            n["name"] = value(name.second);
-            names.push_back(n);
-          }
-          ser["names"] = value::array(names);
-          ser["protocol"] = value(s->delivery_protocol_string());
-          ser["manifest_path"] = value(s->manifest_path());
-
-          std::vector<value> streams;
-          for (const auto& stream : s->content_streams()) {
-            value s;
-            s["base"] = value(stream.second->base());
-            s["type"] = value(stream.second->stream_type_string());
-            s["flute_info"] = value(stream.second->flute_info());
-            s["resolution"] = value(stream.second->resolution());
-            s["codecs"] = value(stream.second->codecs());
-            s["bandwidth"] = value(stream.second->bandwidth());
-            s["frame_rate"] = value(stream.second->frame_rate());
-            s["playlist_path"] = value(stream.second->playlist_path());
-            if (stream.second->stream_type() == ContentStream::StreamType::SeamlessSwitching) {
-              s["cdn_ept"] = value(std::dynamic_pointer_cast<SeamlessContentStream>(stream.second)->cdn_endpoint());
-            } else {
-              s["cdn_ept"] = value("n/a");
+        // services and streams are set up and removed on the control strand
+        _strand.post([this, message]() {
+          std::vector<value> services;
+          for (const auto& service : _services) {
+            auto s = service.second;
+            value ser;
+
+            std::vector<value> names;
+            for (const auto& name : s->names()) {
+              value n;
+              n["lang"] = value(name.first);
+              n["name"] = value(name.second);
+              names.push_back(n);
             }
-            streams.push_back(s);
-          }
-          ser["streams"] = value::array(streams);
+            ser["names"] = value::array(names);
+            ser["protocol"] = value(s->delivery_protocol_string());
+            ser["manifest_path"] = value(s->manifest_path());
 
-          services.push_back(ser);
-        }
-        message.reply(status_codes::OK, value::array(services));
+            std::vector<value> streams;
+            for (const auto& stream : s->content_streams()) {
+              value s;
+              s["base"] = value(stream.second->base());
+              s["type"] = value(stream.second->stream_type_string());
+              s["flute_info"] = value(stream.second->flute_info());
+              s["resolution"] = value(stream.second->resolution());
+              s["codecs"] = value(stream.second->codecs());
+              s["bandwidth"] = value(stream.second->bandwidth());
+              s["frame_rate"] = value(stream.second->frame_rate());
+              s["playlist_path"] = value(stream.second->playlist_path());
+              if (stream.second->stream_type() == ContentStream::StreamType::SeamlessSwitching) {
+                s["cdn_ept"] = value(std::dynamic_pointer_cast<SeamlessContentStream>(stream.second)->cdn_endpoint());
+              } else {
+                s["cdn_ept"] = value("n/a");
+              }
+              streams.push_back(s);
+            }
+            ser["streams"] = value::array(streams);
+
+            services.push_back(ser);
+          }
+          message.reply(status_codes::OK, value::array(services));
+        });
         return;
       } else {
         message.reply(status_codes::NotFound);
@@ -179,26 +315,94 @@ void MBMS_RT::RestHandler::get(http_request message) {
       }
     } else {
       auto path = uri.to_string().erase(0,1); // remove leading /
-      spdlog::debug("checking for file at path {}", path );
-
-      auto it = _cache.item_map().find(path);
-      if (it != _cache.item_map().cend()) {
-        if (it->second->buffer() != nullptr) {
-          web::http::http_response response(status_codes::OK);
-          response.headers().add(U("RT-MBMS-MW-File-Origin"), it->second->item_source_as_string());
-          auto instream = Concurrency::streams::rawptr_stream<uint8_t>::open_istream((uint8_t*)it->second->buffer(), it->second->content_length());
-          response.set_body(instream);
-          message.reply(response);
-        } else {
-          message.reply(status_codes::NotFound);
+      SPDLOG_DEBUG("checking for file at path {}", path );
+
+      auto item = _cache.item(path);
+      auto query_start = path.find('?');
+      if (!item && query_start != std::string::npos) {
+        // playlist requests can carry delivery directives (_HLS_msn, _HLS_part, ...)
+        item = _cache.item(path.substr(0, query_start));
+      }
+      if (item && item->item_type() == CacheItem::ItemType::Playlist) {
+        const auto* cache = &_cache;
+        const auto& location = item->content_location();
+        std::string content_type = location.size() > 4 && location.compare(location.size() - 4, 4, ".mpd") == 0 ?
+          "application/dash+xml" : "application/vnd.apple.mpegurl";
+        auto handled = std::static_pointer_cast<CachedPlaylist>(item)->handle_request(uri::split_query(uri.query()),
+            [message, cache, content_type](unsigned short status, std::string content) {
+              cache->count_request(status == status_codes::OK);
+              if (status != status_codes::OK) {
+                message.reply(status);
+                return;
+              }
+              cache->count_served(ItemSource::Generated, content.size());
+              web::http::http_response response(status);
+              response.headers().add(U("RT-MBMS-MW-File-Origin"), "GEN");
+              response.set_body(std::move(content), content_type);
+              message.reply(response);
+            });
+        if (handled) {
+          return;
         }
-      } else {
-        message.reply(status_codes::NotFound);
       }
+      if (!item && _cache.wait_for_item(path, [this, message](std::shared_ptr<CacheItem> item) {
+            // low-latency DASH: the segment was requested before it had been received
+            serve_item(message, item, true);
+          })) {
+        return;
+      }
+      serve_item(message, item, false);
     }
   }
 }
 
+void MBMS_RT::RestHandler::serve_item(const http_request& message, const std::shared_ptr<CacheItem>& item, bool chunked) const {
+  auto buffer = item ? item->buffer() : nullptr;
+  _cache.count_request(buffer != nullptr);
+  if (buffer == nullptr) {
+    message.reply(status_codes::NotFound);
+    return;
+  }
+  _cache.count_served(item->item_source(), item->content_length());
+
+  web::http::http_response response(status_codes::OK);
+  response.headers().add(U("RT-MBMS-MW-File-Origin"), item->item_source_as_string());
+  if (chunked) {
+    // Send one HTTP chunk per CMAF chunk (moof/mdat pair)
+    Concurrency::streams::producer_consumer_buffer<uint8_t> body;
+    response.set_body(body.create_istream());
+    for (const auto& chunk : cmaf_chunks(buffer, item->content_length())) {
+      body.putn_nocopy(reinterpret_cast<const uint8_t*>(buffer) + chunk.first, chunk.second);
+    }
+    body.close(std::ios_base::out);
+  } else {
+    auto instream = Concurrency::streams::rawptr_stream<uint8_t>::open_istream((uint8_t*)buffer, item->content_length());
+    response.set_body(instream);
+  }
+  auto& trace = LatencyTrace::instance();
+  if (trace.enabled() && item->first_request()) {
+    auto location = item->content_location();
+    trace.record(LatencyTrace::Stage::FirstRequest, location);
+    message.reply(response).then([location, item](pplx::task<void> sent) {
+      try {
+        sent.get();
+        LatencyTrace::instance().record(LatencyTrace::Stage::LastByteSent, location);
+      } catch (const std::exception& ex) {
+        SPDLOG_DEBUG("Sending {} failed: {}", location, ex.what());
+      }
+    });
+  } else {
+    // the body refers to the item buffer, keep the item until the response has been sent
+    message.reply(response).then([item](pplx::task<void> sent) {
+      try {
+        sent.get();
+      } catch (const std::exception& ex) {
+        SPDLOG_DEBUG("Sending {} failed: {}", item->content_location(), ex.what());
+      }
+    });
+  }
+}
+
 void MBMS_RT::RestHandler::put(http_request message) {
   if (_require_bearer_token &&
     (message.headers()["Authorization"] != "Bearer " + _api_key)) {
@@ -214,3 +418,89 @@ void MBMS_RT::RestHandler::put(http_request message) {
   }
 }
 
+
+namespace {
+  struct TracedObject {
+    std::string stream;
+    std::vector<std::pair<MBMS_RT::LatencyTrace::Stage, uint64_t>> stages;
+  };
+
+  // Groups the trace events by object location, keeping the order in which the stages were recorded
+  auto traced_objects(const std::vector<MBMS_RT::LatencyTrace::Event>& events)
+    -> std::map<std::string, TracedObject> {
+    std::map<std::string, TracedObject> objects;
+    for (const auto& event : events) {
+      auto& object = objects[event.location];
+      if (object.stream.empty()) {
+        object.stream = event.stream;
+      }
+      object.stages.emplace_back(event.stage, event.timestamp_us);
+    }
+    return objects;
+  }
+}
+
+auto MBMS_RT::RestHandler::trace_as_json() const -> value
+{
+  auto events = LatencyTrace::instance().events();
+  std::vector<value> objects;
+  for (const auto& [location, object] : traced_objects(events)) {
+    value o;
+    o["location"] = value(location);
+    o["stream"] = value(object.stream);
+    value stages = value::object();
+    for (const auto& [stage, timestamp] : object.stages) {
+      auto name = LatencyTrace::stage_name(stage);
+      if (!stages.has_field(name)) {
+        stages[name] = value(timestamp);
+      }
+    }
+    o["stages"] = stages;
+    o["total_us"] = value(object.stages.back().second - object.stages.front().second);
+    objects.push_back(o);
+  }
+  value trace;
+  trace["enabled"] = value(LatencyTrace::instance().enabled());
+  trace["now_us"] = value(LatencyTrace::now_us());
+  trace["dropped"] = value(LatencyTrace::instance().dropped());
+  trace["objects"] = value::array(objects);
+  return trace;
+}
+
+auto MBMS_RT::RestHandler::trace_as_chrome_json() const -> value
+{
+  // one complete ("X") event per pair of consecutive stages, one thread row per stream
+  auto events = LatencyTrace::instance().events();
+  std::map<std::string, unsigned> tids;
+  std::vector<value> trace_events;
+  for (const auto& [location, object] : traced_objects(events)) {
+    auto tid = tids.emplace(object.stream, tids.size() + 1).first->second;
+    for (size_t i = 1; i < object.stages.size(); i++) {
+      const auto& [from, start] = object.stages[i - 1];
+      const auto& [to, end] = object.stages[i];
+      value e;
+      e["name"] = value(std::string(LatencyTrace::stage_name(from)) + " -> " + LatencyTrace::stage_name(to));
+      e["cat"] = value("latency");
+      e["ph"] = value("X");
+      e["ts"] = value(start);
+      e["dur"] = value(end - start);
+      e["pid"] = value(1);
+      e["tid"] = value(tid);
+      e["args"]["location"] = value(location);
+      trace_events.push_back(e);
+    }
+  }
+  for (const auto& [stream, tid] : tids) {
+    value e;
+    e["name"] = value("thread_name");
+    e["ph"] = value("M");
+    e["pid"] = value(1);
+    e["tid"] = value(tid);
+    e["args"]["name"] = value(stream.empty() ? "-" : stream);
+    trace_events.push_back(e);
+  }
+  value trace;
+  trace["traceEvents"] = value::array(trace_events);
+  trace["displayTimeUnit"] = value("ms");
+  return trace;
+}
@@ -15,6 +15,7 @@
 // under the License.
 //
 #pragma once
+#include <chrono>
 #include <string>
 #include <vector>
 #include <map>
@@ -34,6 +35,8 @@
 #include "Service.h"
 #include "ServiceAnnouncement.h"
 #include "CacheManagement.h"
+#include "SchedulingStats.h"
+#include "Metrics.h"
 
 namespace MBMS_RT {
   /**
@@ -46,26 +49,42 @@ namespace MBMS_RT {
        *
        *  @param cfg Config singleton reference
        *  @param url URL to open the server on
+       *  @param strand Control strand that modifies the service announcement and the services
        */
       RestHandler(const libconfig::Config& cfg, const std::string& url, const CacheManagement& cache,
           const std::unique_ptr<MBMS_RT::ServiceAnnouncement>* service_announcement,
-          const std::map<std::string, std::shared_ptr<MBMS_RT::Service>>& services );
+          const std::map<std::string, std::shared_ptr<MBMS_RT::Service>>& services,
+          const SchedulingStats& scheduling, boost::asio::io_service::strand& strand );
       /**
        *  Default destructor.
        */
       virtual ~RestHandler();
 
+      /**
+       *  Stops accepting connections and waits up to timeout for the responses in flight.
+       *
+       *  @return false if responses were still outstanding at the timeout
+       */
+      bool close(std::chrono::milliseconds timeout);
+
     private:
 
       const CacheManagement& _cache;
       void get(web::http::http_request message);
       void put(web::http::http_request message);
+      void serve_item(const web::http::http_request& message, const std::shared_ptr<CacheItem>& item, bool chunked) const;
+      web::json::value trace_as_json() const;
+      web::json::value trace_as_chrome_json() const;
       const libconfig::Config& _cfg;
    //   const std::map<std::string, LibFlute::File>& _files;
       const std::map<std::string, std::shared_ptr<Service>>& _services;
+      const SchedulingStats& _scheduling;
       const std::unique_ptr<MBMS_RT::ServiceAnnouncement>* _service_announcement_h = {};
+      boost::asio::io_service::strand& _strand;
       unsigned _total_cache_size;
 
+      std::map<std::string, Metrics::Histogram*> _route_latency;
+
       std::unique_ptr<web::http::experimental::listener::http_listener> _listener;
       bool _require_bearer_token = false;
       std::string _api_key;
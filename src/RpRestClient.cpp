@@ -17,9 +17,11 @@
 
 #include "RpRestClient.h"
 
+#include "LogRateLimit.h"
 #include "spdlog/spdlog.h"
 
 using web::http::client::http_client;
+using web::http::client::http_client_config;
 using web::http::status_codes;
 using web::http::methods;
 using web::http::http_response;
@@ -28,33 +30,44 @@ MBMS_RT::RpRestClient::RpRestClient(const libconfig::Config& cfg)
 {
   std::string url = "http://localhost:3010/modem-api/";
   cfg.lookupValue("modem.restful_api.uri", url);
-  _client = std::make_unique<http_client>(url);
+  // An unresponsive modem must not leave requests pending for the default 30 seconds
+  http_client_config client_config;
+  client_config.set_timeout(std::chrono::seconds(5));
+  _client = std::make_unique<http_client>(url, client_config);
 }
 
-auto MBMS_RT::RpRestClient::getMchInfo() -> web::json::value
+auto MBMS_RT::RpRestClient::getMchInfo(completion_callback_t completion_cb) -> void
 {
-  auto res = web::json::value::array();
-  try {
-    _client->request(methods::GET, "mch_info")
-      .then([&res](http_response response) { // NOLINT
-          if (response.status_code() == status_codes::OK) {
-            res = response.extract_json().get();
-          }
-        }).wait();
-  } catch (web::http::http_exception ex) { }
-  return res;
+  _getJson("mch_info", std::move(completion_cb));
+}
+
+auto MBMS_RT::RpRestClient::getStatus(completion_callback_t completion_cb) -> void
+{
+  _getJson("status", std::move(completion_cb));
 }
 
-auto MBMS_RT::RpRestClient::getStatus() -> web::json::value
+auto MBMS_RT::RpRestClient::_getJson(const std::string& path, completion_callback_t completion_cb) -> void
 {
-  auto res = web::json::value::array();
   try {
-    _client->request(methods::GET, "status")
-      .then([&res](http_response response) { // NOLINT
-          if (response.status_code() == status_codes::OK) {
-            res = response.extract_json().get();
+    _client->request(methods::GET, path)
+      .then([](http_response response) { // NOLINT
+          if (response.status_code() != status_codes::OK) {
+            throw web::http::http_exception("Modem API returned status " + std::to_string(response.status_code()));
+          }
+          return response.extract_json();
+        })
+      .then([completion_cb, path](pplx::task<web::json::value> previous) { // NOLINT
+          web::json::value res;
+          try {
+            res = previous.get();
+          } catch (const std::exception& ex) {
+            MW_LOG_RATE_LIMITED(spdlog::level::warn, "Modem API request for {} failed: {}", path, ex.what());
+            completion_cb(false, web::json::value::null());
+            return;
           }
-        }).wait();
-  } catch (web::http::http_exception ex) { }
-  return res;
+          completion_cb(true, std::move(res));
+        });
+  } catch (web::http::http_exception ex) {
+    completion_cb(false, web::json::value::null());
+  }
 }
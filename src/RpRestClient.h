@@ -16,6 +16,7 @@
 //
 #pragma once
 
+#include <functional>
 #include <string>
 #include <libconfig.h++>
 #include "cpprest/http_client.h"
@@ -27,10 +28,18 @@ namespace MBMS_RT {
 
       virtual ~RpRestClient() {};
 
-      web::json::value getMchInfo();
-      web::json::value getStatus();
+      typedef std::function<void(bool ok, web::json::value result)> completion_callback_t;
+
+      /**
+       * Non-blocking requests. The callback is invoked on a cpprest thread, with ok == false if the modem API
+       * could not be reached or returned an error.
+       */
+      void getMchInfo(completion_callback_t completion_cb);
+      void getStatus(completion_callback_t completion_cb);
 
     private:
+      void _getJson(const std::string& path, completion_callback_t completion_cb);
+
       std::unique_ptr<web::http::client::http_client> _client;
   };
 }
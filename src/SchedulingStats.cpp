@@ -0,0 +1,43 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "SchedulingStats.h"
+
+#include <algorithm>
+#include <thread>
+
+auto MBMS_RT::SchedulingLag::record(std::chrono::microseconds lag) -> void
+{
+  uint64_t us = std::max<int64_t>(lag.count(), 0);
+  _last = us;
+  if (us > _max) {
+    _max = us;
+  }
+  // exponentially weighted moving average, weight 1/8
+  auto samples = _samples++;
+  _average = samples == 0 ? us : _average - _average / 8 + us / 8;
+}
+
+auto MBMS_RT::SchedulingStats::configured_threads(const libconfig::Config& cfg) -> unsigned
+{
+  unsigned threads = 1;
+  cfg.lookupValue("mw.threads", threads);
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1U);
+  }
+  return threads;
+}
@@ -0,0 +1,60 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <libconfig.h++>
+
+namespace MBMS_RT {
+  /**
+   * Tracks how late handlers run on the io_service compared to when they were due.
+   * Samples are recorded from a single strand, and read from the REST API threads.
+   */
+  class SchedulingLag {
+    public:
+      void record(std::chrono::microseconds lag);
+
+      uint64_t last_us() const { return _last; };
+      uint64_t max_us() const { return _max; };
+      uint64_t average_us() const { return _average; };
+      uint64_t samples() const { return _samples; };
+
+    private:
+      std::atomic<uint64_t> _last = {0};
+      std::atomic<uint64_t> _max = {0};
+      std::atomic<uint64_t> _average = {0};
+      std::atomic<uint64_t> _samples = {0};
+  };
+
+  /**
+   * Execution model metrics: number of io threads, lateness of the periodic tick timer and the delay between
+   * posting a handler and its execution.
+   */
+  struct SchedulingStats {
+    /**
+     * Number of threads running the io_service, as configured in mw.threads (0: one per CPU core)
+     */
+    static unsigned configured_threads(const libconfig::Config& cfg);
+
+    unsigned threads = 1;
+    SchedulingLag timer;
+    SchedulingLag queue;
+  };
+}
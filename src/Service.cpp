@@ -16,6 +16,7 @@
 //
 
 #include <regex>
+#include <algorithm>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/classification.hpp>
 #include "Service.h"
@@ -28,6 +29,11 @@
 #include "gmime/gmime.h"
 #include "tinyxml2.h"
 
+MBMS_RT::Service::~Service() {
+  // The generated manifest refers to this object. Only remove it if it has not been replaced by another service.
+  _cache.remove_item(_manifest_path, _manifest_item);
+}
+
 auto MBMS_RT::Service::add_name(const std::string &name, const std::string &lang) -> void {
   spdlog::debug("Service name added: {} ({})", name, lang);
   _names[lang] = name;
@@ -38,24 +44,59 @@ auto MBMS_RT::Service::read_master_manifest(const std::string &manifest, const s
   if (_delivery_protocol == DeliveryProtocol::HLS) {
     _hls_primary_playlist = HlsPrimaryPlaylist(manifest, base_path);
   } else if(_delivery_protocol == DeliveryProtocol::DASH) {
-    _dash_manifest = DashManifest(manifest, base_path);
+    try {
+      if (_dash_manifest && _dash_manifest->base_path() == base_path) {
+        _dash_manifest->update(manifest);
+      } else {
+        _dash_manifest = std::make_shared<DashManifest>(manifest, base_path);
+        for (const auto& stream : _content_streams) {
+          stream.second->set_dash_manifest(_dash_manifest);
+        }
+      }
+    } catch (const std::runtime_error& e) {
+      // serve the MPD as received
+      spdlog::warn("service: cannot parse MPD, serving it unmodified: {}", e.what());
+      _dash_manifest.reset();
+      _manifest = manifest;
+    }
+  }
+
+  CachedPlaylist::request_cb_t request_cb = nullptr;
+  if (_dash_manifest) {
+    // render on request: the segment lists follow the cache content
+    auto dash_manifest = _dash_manifest;
+    const auto* cache = &_cache;
+    request_cb = [dash_manifest, cache](const std::map<std::string, std::string>& /*query*/,
+        const CachedPlaylist::reply_cb_t& reply) {
+      SPDLOG_DEBUG("Service: master manifest requested");
+      reply(200, dash_manifest->render(*cache));
+    };
   }
 
   _manifest_path =
-      _delivery_protocol == DeliveryProtocol::HLS ? base_path + "manifest.m3u8" : base_path + "manifest.mpd",
-      _cache.add_item(std::make_shared<CachedPlaylist>(
-          _manifest_path,
-          0,
-          [&]() -> const std::string & {
-            spdlog::debug("Service: master manifest requested");
-            return _manifest;
-          }
-      ));
+      _delivery_protocol == DeliveryProtocol::HLS ? base_path + "manifest.m3u8" : base_path + "manifest.mpd";
+  _manifest_item = std::make_shared<CachedPlaylist>(
+      _manifest_path,
+      0,
+      [&]() -> const std::string & {
+        SPDLOG_DEBUG("Service: master manifest requested");
+        return _manifest;
+      },
+      request_cb
+  );
+  _cache.add_item(_manifest_item);
 }
 
 auto MBMS_RT::Service::add_and_start_content_stream(std::shared_ptr<ContentStream> s) -> void // NOLINT
 {
   spdlog::debug("adding stream with playlist path {}", s->playlist_path());
+  auto existing = _content_streams.find(s->playlist_path());
+  if (existing != _content_streams.end() && existing->second->same_configuration(*s)) {
+    // Keep the running stream and its received content, only the metadata below is updated
+    spdlog::debug("stream with playlist path {} is unchanged, keeping it", s->playlist_path());
+    s = existing->second;
+  }
+
   if (_delivery_protocol == DeliveryProtocol::HLS) {
     for (const auto &stream: _hls_primary_playlist.streams()) {
       if (stream.uri == s->playlist_path()) {
@@ -67,9 +108,78 @@ auto MBMS_RT::Service::add_and_start_content_stream(std::shared_ptr<ContentStrea
       }
     }
   }
-  _content_streams[s->playlist_path()] = s;
-  s->start();
 
+  if (_delivery_protocol == DeliveryProtocol::DASH && _dash_manifest) {
+    s->set_dash_manifest(_dash_manifest);
+  }
+
+  if (_updating) {
+    _updated_streams.insert(s->playlist_path());
+  }
+  if (existing == _content_streams.end() || existing->second != s) {
+    if (existing != _content_streams.end()) {
+      spdlog::info("stream with playlist path {} has changed, replacing it", s->playlist_path());
+      drain_content_stream(existing->second);
+    }
+    _content_streams[s->playlist_path()] = s;
+    s->start();
+  }
+
+  update_manifest();
+}
+
+auto MBMS_RT::Service::begin_update() -> void
+{
+  _updating = true;
+  _updated_streams.clear();
+}
+
+auto MBMS_RT::Service::finish_update() -> void
+{
+  _updating = false;
+  bool removed = false;
+  for (auto it = _content_streams.begin(); it != _content_streams.end();) {
+    if (_updated_streams.find(it->first) == _updated_streams.end()) {
+      spdlog::info("stream with playlist path {} is no longer announced, removing it", it->first);
+      drain_content_stream(it->second);
+      it = _content_streams.erase(it);
+      removed = true;
+    } else {
+      ++it;
+    }
+  }
+  _updated_streams.clear();
+  if (removed) {
+    update_manifest();
+  }
+}
+
+auto MBMS_RT::Service::drain_content_stream(std::shared_ptr<ContentStream> s) -> void
+{
+  s->drain();
+  _draining_streams.emplace_back(time(nullptr), std::move(s));
+}
+
+auto MBMS_RT::Service::remove_drained_streams() -> void
+{
+  auto now = time(nullptr);
+  _draining_streams.erase(std::remove_if(_draining_streams.begin(), _draining_streams.end(),
+        [&](const auto& s) { return now - s.first > _cache.max_file_age(); }),
+      _draining_streams.end());
+}
+
+auto MBMS_RT::Service::retire() -> drained_streams_t
+{
+  for (auto& stream : _content_streams) {
+    drain_content_stream(stream.second);
+  }
+  _content_streams.clear();
+  _updated_streams.clear();
+  return std::move(_draining_streams);
+}
+
+auto MBMS_RT::Service::update_manifest() -> void
+{
   if (_delivery_protocol == DeliveryProtocol::HLS) {
     // recreate the manifest
     HlsPrimaryPlaylist pl;
@@ -85,7 +195,9 @@ auto MBMS_RT::Service::add_and_start_content_stream(std::shared_ptr<ContentStrea
     }
     _manifest = pl.to_string();
   } else if(_delivery_protocol == DeliveryProtocol::DASH) {
-    _manifest = _dash_manifest.content;
+    if (_dash_manifest) {
+      _manifest = _dash_manifest->render(_cache);
+    }
   }
 }
 
@@ -18,6 +18,8 @@
 
 #include <string>
 #include <thread>
+#include <set>
+#include <vector>
 #include <libconfig.h++>
 #include "HlsPrimaryPlaylist.h"
 #include "DashManifest.h"
@@ -31,10 +33,30 @@ namespace MBMS_RT {
     public:
       Service(CacheManagement& cache)
         : _cache(cache) {};
-      virtual ~Service() = default;
+      virtual ~Service();
 
       void add_name(const std::string& name, const std::string& lang);
       void add_and_start_content_stream(std::shared_ptr<ContentStream> s);
+
+      /**
+       * Marks the start of a reconfiguration from a new SA version. Streams that are not added again
+       * before finish_update() is called are drained and removed.
+       */
+      void begin_update();
+      void finish_update();
+
+      /**
+       * Destroys drained streams once their content has expired from the cache
+       */
+      void remove_drained_streams();
+
+      typedef std::vector<std::pair<time_t, std::shared_ptr<ContentStream>>> drained_streams_t;
+
+      /**
+       * Drains all streams of a service that is being removed, and hands them over together with the streams that
+       * were already draining. The caller keeps them until their content has expired from the cache.
+       */
+      drained_streams_t retire();
       void read_master_manifest(const std::string& manifest, const std::string& base_path);
 
       const std::map<std::string, std::string>& names() const { return _names; };
@@ -48,14 +70,21 @@ namespace MBMS_RT {
       const std::string& manifest_path() const { return  _manifest_path; };
 
     private:
+      void drain_content_stream(std::shared_ptr<ContentStream> s);
+      void update_manifest();
+
       CacheManagement& _cache;
       DeliveryProtocol _delivery_protocol;
       std::map<std::string, std::shared_ptr<ContentStream>> _content_streams;
+      std::set<std::string> _updated_streams;
+      bool _updating = false;
+      drained_streams_t _draining_streams;
       std::map<std::string, std::string> _names;
 
       HlsPrimaryPlaylist _hls_primary_playlist;
-      DashManifest _dash_manifest;
+      std::shared_ptr<DashManifest> _dash_manifest;
       std::string _manifest;
       std::string _manifest_path;
+      std::shared_ptr<CacheItem> _manifest_item;
   };
 }
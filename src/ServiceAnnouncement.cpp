@@ -19,38 +19,50 @@
 #include <iostream>     // std::cin, std::cout
 #include <iomanip>      // std::get_time
 #include <ctime>        // struct std::tm
-#include <boost/algorithm/string/trim.hpp>
+#include <mutex>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/asio/post.hpp>
 #include "ServiceAnnouncement.h"
 #include "Service.h"
 #include "Receiver.h"
+#include "FluteCapture.h"
 #include "seamless/SeamlessContentStream.h"
 #include "Constants.h"
 
+#include "LogRateLimit.h"
 #include "spdlog/spdlog.h"
 #include "gmime/gmime.h"
 #include "tinyxml2.h"
 #include "cpprest/base_uri.h"
-#include <gzip/decompress.hpp>
 
 
 MBMS_RT::ServiceAnnouncement::ServiceAnnouncement(const libconfig::Config &cfg, std::string tmgi,
                                                   const std::string &mcast,
                                                   unsigned long long tsi, std::string iface,
-                                                  boost::asio::io_service &io_service, CacheManagement &cache,
+                                                  boost::asio::io_service &io_service,
+                                                  boost::asio::io_service::strand &strand, CacheManagement &cache,
                                                   bool seamless_switching,
                                                   get_service_callback_t get_service,
                                                   set_service_callback_t set_service)
-    : _cfg(cfg), _tmgi(std::move(tmgi)), _tsi(tsi), _iface(std::move(iface)), _io_service(io_service), _cache(cache),
-      _flute_thread{}, _seamless(seamless_switching), _get_service(std::move(get_service)),
-      _set_service(std::move(set_service)) {
+    : _get_service(std::move(get_service)), _set_service(std::move(set_service)), _seamless(seamless_switching),
+      _cfg(cfg), _iface(std::move(iface)), _tmgi(std::move(tmgi)), _tsi(tsi), _flute_thread{},
+      _io_service(io_service), _strand(strand), _cache(cache) {
 }
 
 MBMS_RT::ServiceAnnouncement::~ServiceAnnouncement() {
   spdlog::info("Closing service announcement session with TMGI {}", _tmgi);
-  _flute_receiver.reset();
+  // completion handlers already queued on the strand must not touch this object any more
+  _alive.reset();
+  if (_replay_subscription != 0) {
+    FluteCapture::instance().unsubscribe(_replay_subscription);
+  }
   if (_flute_thread.joinable()) {
     _flute_thread.join();
   }
+  if (_flute_receiver) {
+    _cache.reassembly().remove_session(_flute_receiver.get());
+  }
+  _flute_receiver.reset();
 }
 
 /**
@@ -58,79 +70,282 @@ MBMS_RT::ServiceAnnouncement::~ServiceAnnouncement() {
  * Used for receiving a service announcement file via multicast
  * @param mcast_address
  */
-auto MBMS_RT::ServiceAnnouncement::start_flute_receiver(const std::string &mcast_address) -> void {
+auto MBMS_RT::ServiceAnnouncement::start_flute_receiver(const std::string &mcast_address) -> bool {
   size_t delim = mcast_address.find(':');
   if (delim == std::string::npos) {
-    spdlog::error("Invalid multicast address {}", mcast_address);
-    return;
+    MW_LOG_RATE_LIMITED(spdlog::level::err, "Invalid multicast address {}", mcast_address);
+    return false;
   }
   _mcast_addr = mcast_address.substr(0, delim);
   _mcast_port = mcast_address.substr(delim + 1);
   spdlog::info("Starting FLUTE receiver on {}:{} for TSI {}", _mcast_addr, _mcast_port, _tsi);
-  _flute_thread = std::thread{[&]() {
-    _flute_receiver = std::make_unique<LibFlute::Receiver>(_iface, _mcast_addr, atoi(_mcast_port.c_str()), _tsi,
-                                                           _io_service);
-    _flute_receiver->register_completion_callback(
-        [&](std::shared_ptr<LibFlute::File> file) { //NOLINT
+  Metrics::Labels labels = {{"tsi", std::to_string(_tsi)}};
+  auto objects_metric = &Metrics::registry().counter("mw_flute_objects_received_total",
+      "FLUTE objects received completely", labels);
+  auto bytes_metric = &Metrics::registry().counter("mw_flute_bytes_received_total",
+      "Bytes of the FLUTE objects received completely", labels);
+  auto session = FluteCapture::session(_mcast_addr, _mcast_port, _tsi);
+  // Processing the announcement updates services and streams, so it runs on the control strand
+  std::weak_ptr<bool> alive = _alive;
+  auto completed = _strand.wrap(
+        [&, alive, objects_metric, bytes_metric, session](std::shared_ptr<LibFlute::File> file) { //NOLINT
+          if (alive.expired()) {
+            return;
+          }
+          FluteCapture::instance().record(session, _tmgi, file);
           spdlog::info("{} (TOI {}) has been received",
                        file->meta().content_location, file->meta().toi);
-          if (!_bootstrapped || _toi != file->meta().toi) {
-            _toi = file->meta().toi;
-            if (file->meta().content_type == "application/x-gzip") {
-              _raw_content = gzip::decompress(file->buffer(), file->length());
-            } else {
-              _raw_content = std::string(file->buffer());
+          objects_metric->inc();
+          bytes_metric->inc(file->length());
+          // Carousel repetitions are detected on the received (possibly compressed) data before any processing
+          auto hash = std::hash<std::string_view>{}(std::string_view(file->buffer(), file->length()));
+          if (_bootstrapped && hash == _received_hash) {
+            SPDLOG_DEBUG("Service announcement with TOI {} is unchanged", file->meta().toi);
+            return;
+          }
+          _received_hash = hash;
+          _toi = file->meta().toi;
+
+          // Decompress into the reused content buffer, splitting the multipart while the data is inflated
+          _splitter.reset();
+          if (file->meta().content_type == "application/x-gzip" || file->meta().content_type == "application/gzip" ||
+              GzipInflater::is_gzip(file->buffer(), file->length())) {
+            if (!_inflater.inflate(file->buffer(), file->length(), _raw_content,
+                                   [&](std::string_view data) { _splitter.feed(data); })) {
+              MW_LOG_RATE_LIMITED(spdlog::level::warn, "Decompressing service announcement with TOI {} failed", file->meta().toi);
+              _received_hash = 0;
+              return;
             }
-            parse_bootstrap(file->buffer());
+          } else {
+            _raw_content.assign(file->buffer(), file->length());
           }
+          _parseBootstrap(_raw_content);
         });
+  if (FluteCapture::instance().replaying()) {
+    _replay_subscription = FluteCapture::instance().subscribe(session, completed);
+    return true;
+  }
+  _flute_thread = std::thread{[&, completed]() {
+    _flute_receiver = std::make_unique<LibFlute::Receiver>(_iface, _mcast_addr, atoi(_mcast_port.c_str()), _tsi,
+                                                           _io_service);
+    _flute_receiver->register_completion_callback(completed);
+    _cache.reassembly().add_session("Service announcement " + _tmgi, _flute_receiver.get(), true, _tsi);
   }};
+  return true;
+}
+
+auto MBMS_RT::ServiceAnnouncement::stop_flute_receiver() -> void {
+  if (_replay_subscription != 0) {
+    FluteCapture::instance().unsubscribe(_replay_subscription);
+    _replay_subscription = 0;
+  }
+  if (_flute_thread.joinable()) {
+    _flute_thread.join();
+  }
+  if (_flute_receiver) {
+    spdlog::info("Stopping FLUTE receiver for the service announcement with TMGI {}", _tmgi);
+    _flute_receiver->stop();
+  }
 }
 
 /**
- * Parse the service announcement/bootstrap file
+ * Parse a service announcement/bootstrap file that has been read from a local file
  * @param str
  */
 auto
 MBMS_RT::ServiceAnnouncement::parse_bootstrap(const std::string &str) -> void {
+  _raw_content = str;
+  _splitter.reset();
+  _parseBootstrap(_raw_content);
+}
+
+auto
+MBMS_RT::ServiceAnnouncement::refresh() -> void {
+  if (!_bootstrapped) {
+    return;
+  }
+  _items.clear();
+  _bootstrapped = false;
+  _splitter.reset();
+  _parseBootstrap(_raw_content);
+}
+
+/**
+ * Parse the service announcement/bootstrap file.
+ * Items are matched against the previous SA by Content-Location, content hash and envelope version. Only USD bundles
+ * that changed (or whose referenced manifests/SDPs changed) are set up again.
+ * @param str
+ */
+auto
+MBMS_RT::ServiceAnnouncement::_parseBootstrap(const std::string &str) -> void {
+  auto bootstrap_hash = std::hash<std::string>{}(str);
+  if (_bootstrapped && bootstrap_hash == _bootstrap_hash) {
+    spdlog::debug("Service announcement unchanged, skipping");
+    return;
+  }
+  _bootstrap_hash = bootstrap_hash;
+  _bootstrapped = true;
+
   std::string bootstrap_format = ServiceAnnouncementFormatConstants::DEFAULT;
   _cfg.lookupValue("mw.bootstrap_format", bootstrap_format);
 
-  // Add all the SA items including their content to _items
-  _addServiceAnnouncementItems(str);
+  // Update _items with the SA items including their content, collecting the locations that changed
+  auto changed = _addServiceAnnouncementItems(str);
+  if (changed.empty()) {
+    return;
+  }
+
+  // Parse MBMS envelope: <metadataEnvelope>. This adds items whose version changed to the change set.
+  for (const auto &item: _items) {
+    if (item.second.content_type == ContentTypeConstants::MBMS_ENVELOPE) {
+      _handleMbmsEnvelope(item.second, changed);
+    }
+  }
 
-  // Parse MBMS envelope: <metadataEnvelope>
+  // Collect the USD bundles that need to be (re-)processed
+  std::vector<const Item *> dirty;
   for (const auto &item: _items) {
-    if (item.content_type == ContentTypeConstants::MBMS_ENVELOPE) {
-      _handleMbmsEnvelope(item);
+    if (item.second.content_type != ContentTypeConstants::MBMS_USER_SERVICE_DESCRIPTION) {
+      continue;
     }
+    bool is_dirty = changed.find(item.first) != changed.end();
+    auto deps = _usd_dependencies.find(item.first);
+    if (!is_dirty && deps != _usd_dependencies.end()) {
+      for (const auto &dep: deps->second) {
+        if (changed.find(dep) != changed.end()) {
+          is_dirty = true;
+          break;
+        }
+      }
+    }
+    if (is_dirty) {
+      dirty.push_back(&item.second);
+    } else {
+      spdlog::debug("USD bundle at {} unchanged, skipping", item.first);
+    }
+  }
+
+  // XML parsing of independent bundles is done in parallel, service setup stays sequential
+  std::vector<std::unique_ptr<tinyxml2::XMLDocument>> docs(dirty.size());
+  auto parse = [&docs, &dirty](size_t idx) {
+    docs[idx] = std::make_unique<tinyxml2::XMLDocument>();
+    docs[idx]->Parse(dirty[idx]->content.c_str());
+  };
+  if (dirty.size() > 1) {
+    boost::asio::thread_pool pool(std::min<size_t>(dirty.size(), std::max(1U, std::thread::hardware_concurrency())));
+    for (size_t idx = 0; idx < dirty.size(); idx++) {
+      boost::asio::post(pool, [&parse, idx]() { parse(idx); });
+    }
+    pool.join();
+  } else if (dirty.size() == 1) {
+    parse(0);
   }
 
   // Parse MBMS user service description bundle
+  for (size_t idx = 0; idx < dirty.size(); idx++) {
+    auto &deps = _usd_dependencies[dirty[idx]->uri];
+    deps.clear();
+    _current_dependencies = &deps;
+    _usd_services[dirty[idx]->uri] = _handleMbmbsUserServiceDescriptionBundle(*docs[idx], bootstrap_format);
+    _current_dependencies = nullptr;
+  }
+
+  // Remove services that are no longer described in any USD bundle
+  std::set<std::string> announced;
+  for (auto it = _usd_services.begin(); it != _usd_services.end();) {
+    if (_items.find(it->first) == _items.end()) {
+      it = _usd_services.erase(it);
+    } else {
+      announced.insert(it->second.begin(), it->second.end());
+      ++it;
+    }
+  }
+  for (auto it = _service_ids.begin(); it != _service_ids.end();) {
+    if (announced.find(*it) == announced.end()) {
+      _removeService(*it);
+      it = _service_ids.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  _service_ids.insert(announced.begin(), announced.end());
+}
+
+/**
+ * Unregisters a service that is no longer announced. Its streams are drained by the owner of the services.
+ * @param service_id
+ */
+void MBMS_RT::ServiceAnnouncement::_removeService(const std::string &service_id) {
+  auto service = _get_service(service_id);
+  if (service != nullptr) {
+    spdlog::info("Service {} is no longer announced, removing it", service_id);
+    _set_service(service_id, nullptr);
+  }
+}
+
+/**
+ * Iterates through the service announcement file and updates the the map of _items.
+ * Items that are no longer present are removed.
+ * @param {std::string} str
+ * @return the Content-Locations of all items that are new, modified or removed
+ */
+auto MBMS_RT::ServiceAnnouncement::_addServiceAnnouncementItems(const std::string &str) -> std::set<std::string> {
+  std::set<std::string> changed;
+  std::map<std::string, Item> items;
+
+  // The splitter may already have consumed (parts of) the buffer while it was decompressed
+  _splitter.feed(str);
+  if (_splitter.complete() && !_splitter.requires_decoding(str)) {
+    for (const auto &part: _splitter.parts()) {
+      _updateItem(items, changed, std::string(part.content_type.in(str)), std::string(part.content_location.in(str)),
+                  part.body.in(str));
+    }
+  } else {
+    spdlog::debug("Falling back to GMime for parsing the service announcement");
+    _addServiceAnnouncementItemsGMime(str, items, changed);
+  }
+
   for (const auto &item: _items) {
-    if (item.content_type == ContentTypeConstants::MBMS_USER_SERVICE_DESCRIPTION) {
-      _handleMbmbsUserServiceDescriptionBundle(item, bootstrap_format);
+    if (items.find(item.first) == items.end()) {
+      changed.insert(item.first);
+      _usd_dependencies.erase(item.first);
     }
   }
+  _items = std::move(items);
+  return changed;
 }
 
 /**
- * Iterates through the service announcement file and adds the different sections/items to the the list of _items
+ * Parses the service announcement file with GMime. Only used for multiparts that require content decoding.
  * @param {std::string} str
+ * @param items
+ * @param changed
  */
-void MBMS_RT::ServiceAnnouncement::_addServiceAnnouncementItems(const std::string &str) {
-  g_mime_init();
+void MBMS_RT::ServiceAnnouncement::_addServiceAnnouncementItemsGMime(const std::string &str,
+                                                                    std::map<std::string, Item> &items,
+                                                                    std::set<std::string> &changed) {
+  static std::once_flag gmime_initialized;
+  std::call_once(gmime_initialized, []() { g_mime_init(); });
+
   auto stream = g_mime_stream_mem_new_with_buffer(str.c_str(), str.length());
   auto parser = g_mime_parser_new_with_stream(stream);
   g_object_unref(stream);
 
   auto mpart = g_mime_parser_construct_part(parser, nullptr);
   g_object_unref(parser);
+  if (mpart == nullptr) {
+    spdlog::warn("Service announcement is not a valid MIME document");
+    return;
+  }
+
+  auto options = g_mime_format_options_new();
+  g_mime_format_options_add_hidden_header(options, "Content-Type");
+  g_mime_format_options_add_hidden_header(options, "Content-Transfer-Encoding");
+  g_mime_format_options_add_hidden_header(options, "Content-Location");
 
   auto iter = g_mime_part_iter_new(mpart);
   do {
     GMimeObject *current = g_mime_part_iter_get_current(iter);
-    GMimeObject *parent = g_mime_part_iter_get_parent(iter);
 
     if (GMIME_IS_PART (current)) {
       auto type = std::string(g_mime_content_type_get_mime_type(g_mime_object_get_content_type(current)));
@@ -138,31 +353,71 @@ void MBMS_RT::ServiceAnnouncement::_addServiceAnnouncementItems(const std::strin
       if (g_mime_object_get_header(current, "Content-Location")) {
         location = std::string(g_mime_object_get_header(current, "Content-Location"));
       }
-      auto options = g_mime_format_options_new();
-      g_mime_format_options_add_hidden_header(options, "Content-Type");
-      g_mime_format_options_add_hidden_header(options, "Content-Transfer-Encoding");
-      g_mime_format_options_add_hidden_header(options, "Content-Location");
-      std::string content = g_mime_object_to_string(current, options);
-      boost::algorithm::trim_left(content);
-
       if (location != "") {
-        _items.emplace_back(Item{
-            type,
-            location,
-            0, 0, 0,
-            content
-        });
+        auto content = g_mime_object_to_string(current, options);
+        std::string_view view(content);
+        while (!view.empty() && std::isspace(view.front())) view.remove_prefix(1);
+        _updateItem(items, changed, type, location, view);
+        g_free(content);
       }
     }
   } while (g_mime_part_iter_next(iter));
 
+  g_mime_part_iter_free(iter);
+  g_mime_format_options_free(options);
+  g_object_unref(mpart);
+}
+
+/**
+ * Moves an item into the new item map. The content is only copied if it differs from the previous SA.
+ * @param items The new item map
+ * @param changed Set of changed Content-Locations
+ * @param type
+ * @param location
+ * @param content
+ */
+void MBMS_RT::ServiceAnnouncement::_updateItem(std::map<std::string, Item> &items, std::set<std::string> &changed,
+                                               const std::string &type, const std::string &location,
+                                               std::string_view content) {
+  if (location.empty()) {
+    return;
+  }
+  auto hash = std::hash<std::string_view>{}(content);
+  auto existing = _items.find(location);
+  if (existing != _items.end() && existing->second.hash == hash && existing->second.content_type == type) {
+    items.emplace(location, std::move(existing->second));
+  } else {
+    Item item{type, location, 0, 0, 0, std::string(content), hash};
+    if (existing != _items.end()) {
+      item.valid_from = existing->second.valid_from;
+      item.valid_until = existing->second.valid_until;
+      item.version = existing->second.version;
+    }
+    items.emplace(location, std::move(item));
+    changed.insert(location);
+  }
+}
+
+/**
+ * Looks up an SA item by its Content-Location and records it as a dependency of the USD bundle being processed
+ * @param {std::string} uri
+ * @return the item, or nullptr if there is no item at this location
+ */
+auto MBMS_RT::ServiceAnnouncement::_findItem(const std::string &uri) -> const Item * {
+  if (_current_dependencies != nullptr) {
+    _current_dependencies->insert(uri);
+  }
+  auto it = _items.find(uri);
+  return it == _items.end() ? nullptr : &it->second;
 }
 
 /**
  * Parses the MBMS envelope
  * @param {MBMS_RT::ServiceAnnouncement::Item} item
+ * @param changed Set of changed Content-Locations, extended by items whose version changed
  */
-void MBMS_RT::ServiceAnnouncement::_handleMbmsEnvelope(const MBMS_RT::ServiceAnnouncement::Item &item) {
+void MBMS_RT::ServiceAnnouncement::_handleMbmsEnvelope(const MBMS_RT::ServiceAnnouncement::Item &item,
+                                                       std::set<std::string> &changed) {
   try {
     tinyxml2::XMLDocument doc;
     doc.Parse(item.content.c_str());
@@ -170,17 +425,20 @@ void MBMS_RT::ServiceAnnouncement::_handleMbmsEnvelope(const MBMS_RT::ServiceAnn
     for (auto *i = envelope->FirstChildElement(ServiceAnnouncementXmlElements::ITEM);
          i != nullptr; i = i->NextSiblingElement(ServiceAnnouncementXmlElements::ITEM)) {
       spdlog::debug("uri: {}", i->Attribute(ServiceAnnouncementXmlElements::METADATA_URI));
-      for (auto &ir: _items) {
-        if (ir.uri == i->Attribute(ServiceAnnouncementXmlElements::METADATA_URI)) {
-          std::stringstream ss_from(i->Attribute(ServiceAnnouncementXmlElements::VALID_FROM));
-          struct std::tm from;
-          ss_from >> std::get_time(&from, "%Y-%m-%dT%H:%M:%S.%fZ");
-          ir.valid_from = mktime(&from);
-          std::stringstream ss_until(i->Attribute(ServiceAnnouncementXmlElements::VALID_UNTIL));
-          struct std::tm until;
-          ss_until >> std::get_time(&until, "%Y-%m-%dT%H:%M:%S.%fZ");
-          ir.valid_until = mktime(&until);
-          ir.version = atoi(i->Attribute(ServiceAnnouncementXmlElements::VERSION));
+      auto ir = _items.find(i->Attribute(ServiceAnnouncementXmlElements::METADATA_URI));
+      if (ir != _items.end()) {
+        std::stringstream ss_from(i->Attribute(ServiceAnnouncementXmlElements::VALID_FROM));
+        struct std::tm from;
+        ss_from >> std::get_time(&from, "%Y-%m-%dT%H:%M:%S.%fZ");
+        ir->second.valid_from = mktime(&from);
+        std::stringstream ss_until(i->Attribute(ServiceAnnouncementXmlElements::VALID_UNTIL));
+        struct std::tm until;
+        ss_until >> std::get_time(&until, "%Y-%m-%dT%H:%M:%S.%fZ");
+        ir->second.valid_until = mktime(&until);
+        unsigned version = atoi(i->Attribute(ServiceAnnouncementXmlElements::VERSION));
+        if (version != ir->second.version) {
+          ir->second.version = version;
+          changed.insert(ir->first);
         }
       }
     }
@@ -191,15 +449,14 @@ void MBMS_RT::ServiceAnnouncement::_handleMbmsEnvelope(const MBMS_RT::ServiceAnn
 
 /**
  * Parses the MBMS USD
- * @param {MBMS_RT::ServiceAnnouncement::Item} item
+ * @param {tinyxml2::XMLDocument} doc The parsed USD bundle
+ * @return the ids of the services described in the bundle
  */
-void
-MBMS_RT::ServiceAnnouncement::_handleMbmbsUserServiceDescriptionBundle(const MBMS_RT::ServiceAnnouncement::Item &item,
-                                                                       const std::string &bootstrap_format) {
+auto
+MBMS_RT::ServiceAnnouncement::_handleMbmbsUserServiceDescriptionBundle(tinyxml2::XMLDocument &doc,
+                                                                       const std::string &bootstrap_format) -> std::set<std::string> {
+  std::set<std::string> service_ids;
   try {
-    tinyxml2::XMLDocument doc;
-    doc.Parse(item.content.c_str());
-
     auto bundle = doc.FirstChildElement(ServiceAnnouncementXmlElements::BUNDLE_DESCRIPTION);
     for (auto *usd = bundle->FirstChildElement(ServiceAnnouncementXmlElements::USER_SERVICE_DESCRIPTION);
          usd != nullptr;
@@ -213,6 +470,9 @@ MBMS_RT::ServiceAnnouncement::_handleMbmbsUserServiceDescriptionBundle(const MBM
       auto app_service = usd->FirstChildElement(ServiceAnnouncementXmlElements::APP_SERVICE);
       _handleAppService(app_service, service);
 
+      // Streams that are not set up again below are drained by finish_update()
+      service->begin_update();
+
       // For the default format we need an alternativeContent attribute to setup the service
       if (bootstrap_format == ServiceAnnouncementFormatConstants::FIVEG_MAG_BC_UC) {
         _setupBy5GMagConfig(app_service, service, usd);
@@ -222,6 +482,9 @@ MBMS_RT::ServiceAnnouncement::_handleMbmbsUserServiceDescriptionBundle(const MBM
         _setupByAlternativeContentElement(app_service, service, usd);
       }
 
+      service->finish_update();
+      service_ids.insert(service_id);
+
       if (is_new_service && service->content_streams().size() > 0) {
         _set_service(service_id, service);
       }
@@ -229,6 +492,7 @@ MBMS_RT::ServiceAnnouncement::_handleMbmbsUserServiceDescriptionBundle(const MBM
   } catch (std::exception e) {
     spdlog::warn("MBMS user service desription parsing failed: {}", e.what());
   }
+  return service_ids;
 }
 
 /**
@@ -276,23 +540,22 @@ void MBMS_RT::ServiceAnnouncement::_handleAppService(tinyxml2::XMLElement *app_s
 
   // Now search for the content that corresponds to appServiceDescriptionURI. For instance appServiceDescriptionURI="http://localhost/watchfolder/manifest.m3u8"
   // The attribute appServiceDescriptionURI of r12:appService references an Application Service Description which may be a Media Presentation Description fragment corresponding to a unified MPD.
-  for (const auto &item: _items) {
-    // item.uri is derived from the Content-Location of each entry in the bootstrap file. For HLS we are looking for the content of the master manifest in the bootstrap file:
-    if (item.uri == app_service->Attribute(ServiceAnnouncementXmlElements::APP_SERVICE_DESCRIPTION_URI)) {
-      web::uri uri(item.uri);
-
-      // remove file, leave only dir
-      const std::string &path = uri.path();
-      size_t spos = path.rfind('/');
-      auto base_path = path.substr(0, spos + 1);
-
-      // make relative path: remove leading /
-      if (base_path[0] == '/') {
-        base_path.erase(0, 1);
-      }
-      service->read_master_manifest(item.content, base_path);
-      _base_path = base_path;
+  // item->uri is derived from the Content-Location of each entry in the bootstrap file. For HLS we are looking for the content of the master manifest in the bootstrap file:
+  auto item = _findItem(app_service->Attribute(ServiceAnnouncementXmlElements::APP_SERVICE_DESCRIPTION_URI));
+  if (item != nullptr) {
+    web::uri uri(item->uri);
+
+    // remove file, leave only dir
+    const std::string &path = uri.path();
+    size_t spos = path.rfind('/');
+    auto base_path = path.substr(0, spos + 1);
+
+    // make relative path: remove leading /
+    if (base_path[0] == '/') {
+      base_path.erase(0, 1);
     }
+    service->read_master_manifest(item->content, base_path);
+    _base_path = base_path;
   }
 }
 
@@ -329,14 +592,13 @@ void MBMS_RT::ServiceAnnouncement::_setupBy5GMagConfig(tinyxml2::XMLElement *app
                                                _cfg);
         }
 
-        for (const auto &item: _items) {
-          if (item.uri == manifest_url) {
-            cs->read_master_manifest(item.content);
-          }
-          if (item.content_type == ContentTypeConstants::SDP &&
-              item.uri == sdp_uri) {
-            cs->configure_5gbc_delivery_from_sdp(item.content);
-          }
+        auto manifest = _findItem(manifest_url);
+        if (manifest != nullptr) {
+          cs->read_master_manifest(manifest->content);
+        }
+        auto sdp = _findItem(sdp_uri);
+        if (sdp != nullptr && sdp->content_type == ContentTypeConstants::SDP) {
+          cs->configure_5gbc_delivery_from_sdp(sdp->content);
         }
 
         broadcastContentStreams.push_back(cs);
@@ -447,14 +709,13 @@ void MBMS_RT::ServiceAnnouncement::_setupBy5GMagLegacyFormat(tinyxml2::XMLElemen
                                                _cfg);
 
           cs->set_base_path(_base_path);
-          for (const auto &item: _items) {
-            if (item.uri == manifest_url && service->delivery_protocol() == DeliveryProtocol::HLS) {
-              cs->read_master_manifest(item.content);
-            }
-            if (item.content_type == ContentTypeConstants::SDP &&
-                item.uri == sdp_uri) {
-              cs->configure_5gbc_delivery_from_sdp(item.content);
-            }
+          auto manifest = _findItem(manifest_url);
+          if (manifest != nullptr && service->delivery_protocol() == DeliveryProtocol::HLS) {
+            cs->read_master_manifest(manifest->content);
+          }
+          auto sdp = _findItem(sdp_uri);
+          if (sdp != nullptr && sdp->content_type == ContentTypeConstants::SDP) {
+            cs->configure_5gbc_delivery_from_sdp(sdp->content);
           }
 
           broadcastContentStreams.push_back(cs);
@@ -511,14 +772,13 @@ void MBMS_RT::ServiceAnnouncement::_setupByAlternativeContentElement(tinyxml2::X
             ServiceAnnouncementXmlElements::BASE_PATTERN)->GetText();
 
         if (broadcast_base_pattern == base) {
-          for (const auto &item: _items) {
-            if (item.uri == broadcast_base_pattern) {
-              cs->read_master_manifest(item.content);
-            }
-            if (item.content_type == ContentTypeConstants::SDP &&
-                item.uri == sdp_uri) {
-              broadcast_delivery_available = cs->configure_5gbc_delivery_from_sdp(item.content);
-            }
+          auto manifest = _findItem(broadcast_base_pattern);
+          if (manifest != nullptr) {
+            cs->read_master_manifest(manifest->content);
+          }
+          auto sdp = _findItem(sdp_uri);
+          if (sdp != nullptr && sdp->content_type == ContentTypeConstants::SDP) {
+            broadcast_delivery_available = cs->configure_5gbc_delivery_from_sdp(sdp->content);
           }
         }
       }
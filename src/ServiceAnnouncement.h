@@ -19,6 +19,9 @@
 
 #include <string>
 #include <thread>
+#include <map>
+#include <set>
+#include <string_view>
 #include <libconfig.h++>
 #include <tinyxml2.h>
 #include "cpprest/http_client.h"
@@ -27,6 +30,8 @@
 #include "Service.h"
 #include "CacheManagement.h"
 #include "Constants.h"
+#include "GzipInflater.h"
+#include "MultipartSplitter.h"
 
 namespace MBMS_RT {
   class ServiceAnnouncement {
@@ -36,7 +41,8 @@ namespace MBMS_RT {
 
     ServiceAnnouncement(const libconfig::Config &cfg, std::string tmgi, const std::string &mcast,
                         unsigned long long tsi,
-                        std::string iface, boost::asio::io_service &io_service, CacheManagement &cache,
+                        std::string iface, boost::asio::io_service &io_service,
+                        boost::asio::io_service::strand &strand, CacheManagement &cache,
                         bool seamless_switching,
                         get_service_callback_t get_service, set_service_callback_t set_service);
 
@@ -49,17 +55,56 @@ namespace MBMS_RT {
       time_t valid_until;
       unsigned version;
       std::string content;
+      size_t hash;
     };
 
-    const std::vector<Item> &items() const { return _items; };
+    const std::map<std::string, Item> &items() const { return _items; };
 
     const std::string &content() const { return _raw_content; };
 
     uint32_t toi() const { return _toi; };
 
+    const std::string &tmgi() const { return _tmgi; };
+    unsigned long long tsi() const { return _tsi; };
+    /**
+     * address:port of the FLUTE session, empty if no receiver has been started
+     */
+    std::string mcast_address() const { return _mcast_addr.empty() ? std::string() : _mcast_addr + ":" + _mcast_port; };
+
     void parse_bootstrap(const std::string &str);
 
-    void start_flute_receiver(const std::string &mcast_address);
+    /**
+     * Processes the current service announcement again as if all of its items had changed
+     */
+    void refresh();
+
+    /**
+     * @return false if mcast_address is not a valid address:port
+     */
+    bool start_flute_receiver(const std::string &mcast_address);
+
+    /**
+     * Stops receiving the service announcement. The services that have been set up are kept.
+     */
+    void stop_flute_receiver();
+
+    /**
+     * Ids of the services described by the current announcement
+     */
+    const std::set<std::string> &service_ids() const { return _service_ids; };
+
+    /**
+     * Takes over services that were set up by another announcement (e.g. one restored from a snapshot). They are
+     * removed like the own services once a received announcement no longer describes them.
+     */
+    void adopt_services(const std::set<std::string> &service_ids) {
+      _service_ids.insert(service_ids.begin(), service_ids.end());
+    };
+
+    /**
+     * Selects the stream type for the services set up from now on (see refresh())
+     */
+    void set_seamless_switching(bool seamless) { _seamless = seamless; };
 
   private:
 
@@ -68,7 +113,19 @@ namespace MBMS_RT {
 
     bool _seamless = false;
 
-    std::vector<Item> _items;
+    // SA items indexed by their Content-Location
+    std::map<std::string, Item> _items;
+    // Content-Locations of the items each USD bundle referenced during its last setup
+    std::map<std::string, std::set<std::string>> _usd_dependencies;
+    std::set<std::string> *_current_dependencies = nullptr;
+    // Ids of the services described by each USD bundle, and of all announced services
+    std::map<std::string, std::set<std::string>> _usd_services;
+    std::set<std::string> _service_ids;
+    size_t _bootstrap_hash = 0;
+    size_t _received_hash = 0;
+
+    GzipInflater _inflater;
+    MultipartSplitter _splitter;
 
     const libconfig::Config &_cfg;
 
@@ -84,15 +141,31 @@ namespace MBMS_RT {
     unsigned long long _tsi = 0;
     std::thread _flute_thread;
     std::unique_ptr<LibFlute::Receiver> _flute_receiver;
+    unsigned _replay_subscription = 0;   /**< FLUTE capture replay instead of the receiver */
+    std::shared_ptr<bool> _alive = std::make_shared<bool>(true);   /**< expires when the announcement is destroyed */
 
     boost::asio::io_service &_io_service;
+    boost::asio::io_service::strand &_strand;
     CacheManagement &_cache;
 
-    void _addServiceAnnouncementItems(const std::string &str);
+    void _parseBootstrap(const std::string &str);
+
+    std::set<std::string> _addServiceAnnouncementItems(const std::string &str);
+
+    void _addServiceAnnouncementItemsGMime(const std::string &str, std::map<std::string, Item> &items,
+                                           std::set<std::string> &changed);
+
+    void _updateItem(std::map<std::string, Item> &items, std::set<std::string> &changed, const std::string &type,
+                     const std::string &location, std::string_view content);
+
+    const Item *_findItem(const std::string &uri);
+
+    void _handleMbmsEnvelope(const Item &item, std::set<std::string> &changed);
 
-    void _handleMbmsEnvelope(const Item &item);
+    std::set<std::string>
+    _handleMbmbsUserServiceDescriptionBundle(tinyxml2::XMLDocument &doc, const std::string &bootstrap_format);
 
-    void _handleMbmbsUserServiceDescriptionBundle(const Item &item, const std::string &bootstrap_format);
+    void _removeService(const std::string &service_id);
 
     std::tuple<std::shared_ptr<MBMS_RT::Service>, bool>
     _registerService(tinyxml2::XMLElement *usd, const std::string &service_id);
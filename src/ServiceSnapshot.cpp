@@ -0,0 +1,123 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "ServiceSnapshot.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include "spdlog/spdlog.h"
+
+namespace {
+  constexpr const char* kMagic = "5gmag-rt-mw snapshot 1";
+}
+
+MBMS_RT::ServiceSnapshot::ServiceSnapshot(const libconfig::Config& cfg)
+{
+  cfg.lookupValue("mw.snapshot.enabled", _enabled);
+  cfg.lookupValue("mw.snapshot.path", _path);
+  cfg.lookupValue("mw.snapshot.max_age", _max_age);
+}
+
+auto MBMS_RT::ServiceSnapshot::load() const -> std::optional<State>
+{
+  if (!_enabled) {
+    return std::nullopt;
+  }
+  std::ifstream in(_path, std::ios::binary);
+  if (!in) {
+    spdlog::info("No service snapshot at {}", _path);
+    return std::nullopt;
+  }
+  std::string line;
+  if (!std::getline(in, line) || line != kMagic) {
+    spdlog::warn("Ignoring service snapshot at {}: unknown format", _path);
+    return std::nullopt;
+  }
+  State state;
+  size_t length = 0;
+  while (std::getline(in, line) && !line.empty()) {
+    auto space = line.find(' ');
+    auto key = line.substr(0, space);
+    auto value = space == std::string::npos ? std::string() : line.substr(space + 1);
+    try {
+      if (key == "saved_at") {
+        state.saved_at = static_cast<time_t>(std::stoll(value));
+      } else if (key == "tmgi") {
+        state.tmgi = value;
+      } else if (key == "address") {
+        state.mcast_address = value;
+      } else if (key == "tsi") {
+        state.tsi = std::stoull(value);
+      } else if (key == "length") {
+        length = std::stoul(value);
+      }
+    } catch (const std::exception&) {
+      spdlog::warn("Ignoring service snapshot at {}: invalid {}", _path, key);
+      return std::nullopt;
+    }
+  }
+  state.bootstrap.resize(length);
+  if (length == 0 || !in.read(state.bootstrap.data(), static_cast<std::streamsize>(length)) ||
+      state.mcast_address.empty()) {
+    spdlog::warn("Ignoring service snapshot at {}: incomplete", _path);
+    return std::nullopt;
+  }
+  auto age = time(nullptr) - state.saved_at;
+  if (age > static_cast<time_t>(_max_age)) {
+    spdlog::info("Ignoring service snapshot at {}: saved {} seconds ago", _path, age);
+    return std::nullopt;
+  }
+  return state;
+}
+
+auto MBMS_RT::ServiceSnapshot::save(const State& state) const -> bool
+{
+  if (!_enabled) {
+    return false;
+  }
+  std::error_code ec;
+  auto parent = std::filesystem::path(_path).parent_path();
+  if (!parent.empty()) {
+    std::filesystem::create_directories(parent, ec);
+  }
+  auto tmp = _path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out << kMagic << "\n"
+        << "saved_at " << state.saved_at << "\n"
+        << "tmgi " << state.tmgi << "\n"
+        << "address " << state.mcast_address << "\n"
+        << "tsi " << state.tsi << "\n"
+        << "length " << state.bootstrap.size() << "\n"
+        << "\n";
+    out.write(state.bootstrap.data(), static_cast<std::streamsize>(state.bootstrap.size()));
+    out.close();
+    if (!out) {
+      spdlog::warn("Cannot write service snapshot to {}", tmp);
+      return false;
+    }
+  }
+  // replacing the file keeps the previous snapshot intact if writing fails
+  std::filesystem::rename(tmp, _path, ec);
+  if (ec) {
+    spdlog::warn("Cannot write service snapshot to {}: {}", _path, ec.message());
+    return false;
+  }
+  spdlog::info("Saved service snapshot to {}", _path);
+  return true;
+}
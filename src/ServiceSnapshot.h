@@ -0,0 +1,63 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <ctime>
+#include <optional>
+#include <string>
+#include <libconfig.h++>
+
+namespace MBMS_RT {
+  /**
+   * Persists the last received service announcement and the session it was received on, so that services and
+   * their streams can be set up again right after a restart instead of waiting for the next carousel repetition.
+   * Services, streams and their SDPs are all derived from the service announcement, so it is the only state that
+   * is stored.
+   *
+   * The snapshot is a small header (one "key value" line each, terminated by an empty line) followed by the
+   * decompressed bootstrap multipart. It is written to a temporary file that replaces the previous snapshot.
+   */
+  class ServiceSnapshot {
+    public:
+      /**
+       * Reads mw.snapshot.enabled, mw.snapshot.path and mw.snapshot.max_age
+       */
+      explicit ServiceSnapshot(const libconfig::Config& cfg);
+
+      struct State {
+        std::string tmgi;
+        std::string mcast_address;   /**< address:port */
+        unsigned long long tsi = 0;
+        time_t saved_at = 0;
+        std::string bootstrap;
+      };
+
+      bool enabled() const { return _enabled; };
+
+      /**
+       * The stored state, if there is one that is not older than max_age
+       */
+      std::optional<State> load() const;
+      bool save(const State& state) const;
+
+    private:
+      bool _enabled = false;
+      std::string _path = "/var/cache/5gmag-rt/mw-snapshot";
+      unsigned _max_age = 3600;
+  };
+}
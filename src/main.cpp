@@ -28,8 +28,16 @@
 
 #include <argp.h>
 
+#include <algorithm>
+#include <chrono>
+#include <csignal>
 #include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iterator>
 #include <string>
+#include <thread>
+#include <vector>
 #include <filesystem>
 #include <libconfig.h++>
 #include <boost/asio.hpp>
@@ -41,6 +49,9 @@
 #include "spdlog/sinks/syslog_sink.h"
 
 #include "Middleware.h"
+#include "SchedulingStats.h"
+#include "LogRateLimit.h"
+#include "Metrics.h"
 
 using libconfig::Config;
 using libconfig::FileIOException;
@@ -60,7 +71,7 @@ static struct argp_option options[] = {  // NOLINT
     {"interface", 'i', "IF", 0, "IP address of the interface to bind flute receivers to (default: 192.168.180.10)", 0},
     {"log-level", 'l', "LEVEL", 0,
      "Log verbosity: 0 = trace, 1 = debug, 2 = info, 3 = warn, 4 = error, 5 = "
-     "critical, 6 = none. Default: 2.",
+     "critical, 6 = none. Default: mw.log.level, or 2.",
      0},
     {nullptr, 0, nullptr, 0, nullptr, 0}};
 
@@ -71,6 +82,7 @@ struct mw_arguments {
   const char *config_file = {};  /**< file path of the config file. */
   const char *flute_interface = {};  /**< file path of the config file. */
   unsigned log_level = 2;        /**< log level */
+  bool log_level_set = false;    /**< log level given on the command line, takes precedence over mw.log.level */
 };
 
 /**
@@ -87,6 +99,7 @@ static auto parse_opt(int key, char *arg, struct argp_state *state) -> error_t {
       break;
     case 'l':
       arguments->log_level = static_cast<unsigned>(strtoul(arg, nullptr, 10));
+      arguments->log_level_set = true;
       break;
     default:
       return ARGP_ERR_UNKNOWN;
@@ -110,6 +123,48 @@ void print_version(FILE *stream, struct argp_state * /*state*/) {
 
 static Config cfg;  /**< Global configuration object. */
 
+/**
+ * Applies the log level from mw.log.level, unless it was given on the command line.
+ */
+static void apply_log_level(const struct mw_arguments &arguments) {
+  auto level = arguments.log_level;
+  if (!arguments.log_level_set) {
+    cfg.lookupValue("mw.log.level", level);
+  }
+  spdlog::set_level(static_cast<spdlog::level::level_enum>(std::min(level, 6U)));
+}
+
+/**
+ * Re-reads the configuration file on SIGHUP. libconfig::Config cannot be swapped, and readFile() leaves it partly
+ * replaced when parsing fails. The file is therefore read once, its content is parsed into a separate object first,
+ * and only content that parsed is parsed into the global configuration.
+ * Must only be called through Middleware::reload(): the global configuration is rewritten in place, which is safe
+ * because after startup it is only read on the control strand.
+ *
+ * @return false if the file could not be read
+ */
+static auto reload_config(const struct mw_arguments &arguments) -> bool {
+  std::ifstream file(arguments.config_file);
+  if (!file) {
+    spdlog::error("I/O error while reading config file at {}. Keeping the current configuration.",
+        arguments.config_file);
+    return false;
+  }
+  std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  try {
+    Config check;
+    check.readString(content);
+  } catch(const ParseException &pex) {
+    spdlog::error("Config parse error at {}:{} - {}. Keeping the current configuration.",
+        arguments.config_file, pex.getLine(), pex.getError());
+    return false;
+  }
+  cfg.readString(content);
+  apply_log_level(arguments);
+  MBMS_RT::LogRateLimit::configure(cfg);
+  return true;
+}
+
 /**
  *  Main entry point for the program.
  *  
@@ -137,16 +192,33 @@ auto main(int argc, char **argv) -> int {
     exit(1);
   }
 
-  // Set up logging
+  // Set up logging. Messages are written to syslog from a background thread, so a slow log target does not stall
+  // the io threads. When the queue is full, the oldest messages are dropped unless mw.log.overflow is "block".
+  unsigned log_queue_size = 8192;
+  cfg.lookupValue("mw.log.queue_size", log_queue_size);
+  std::string log_overflow = "drop_oldest";
+  cfg.lookupValue("mw.log.overflow", log_overflow);
+  spdlog::init_thread_pool(log_queue_size, 1);
+
   std::string ident = "mw";
-  auto syslog_logger = spdlog::syslog_logger_mt("syslog", ident, LOG_PID | LOG_PERROR | LOG_CONS );
+  auto syslog_logger = log_overflow == "block" ?
+    spdlog::syslog_logger_mt<spdlog::async_factory>("syslog", ident, LOG_PID | LOG_PERROR | LOG_CONS ) :
+    spdlog::syslog_logger_mt<spdlog::async_factory_nonblock>("syslog", ident, LOG_PID | LOG_PERROR | LOG_CONS );
+  MBMS_RT::LogRateLimit::configure(cfg);
+  MBMS_RT::Metrics::registry().add_collector([](std::ostream& out) {
+    out << "# HELP mw_log_messages_dropped_total Log messages dropped because the log queue was full\n"
+        << "# TYPE mw_log_messages_dropped_total counter\n"
+        << "mw_log_messages_dropped_total " << spdlog::thread_pool()->overrun_counter() << "\n";
+  });
 
-  spdlog::set_level(
-      static_cast<spdlog::level::level_enum>(arguments.log_level));
+  apply_log_level(arguments);
   spdlog::set_pattern("[%H:%M:%S.%f %z] [%^%l%$] [thr %t] %v");
 
   spdlog::set_default_logger(syslog_logger);
   spdlog::info("5g-mag-rt mw v{}.{}.{} starting up", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
+  if (log_overflow != "block" && log_overflow != "drop_oldest") {
+    spdlog::warn("Unknown log overflow policy {}, dropping the oldest messages", log_overflow);
+  }
 
   std::string uri = "http://0.0.0.0:3020/";
   cfg.lookupValue("mw.http_server.uri", uri);
@@ -154,11 +226,62 @@ auto main(int argc, char **argv) -> int {
   try {
     boost::asio::io_service io;
     MBMS_RT::Middleware mw(io, cfg, uri, arguments.flute_interface);
-    io.run();
+
+    // Control plane and content streams run on their own strands, so the io_service can be run on a pool of threads
+    auto threads = MBMS_RT::SchedulingStats::configured_threads(cfg);
+    spdlog::info("Running io service on {} thread(s)", threads);
+    auto run = [&io]() {
+      try {
+        io.run();
+      } catch (const std::exception& ex) {
+        spdlog::error("BUG ALERT: Unhandled exception in io thread: {}", ex.what());
+        io.stop();
+      }
+    };
+
+    // SIGTERM/SIGINT: drain HTTP responses, stop the receivers, then the io service. This blocks until responses
+    // have been sent, so it runs on its own thread while the io threads keep serving.
+    // SIGHUP: reload the configuration, without touching the receive sessions.
+    unsigned shutdown_timeout = 5;
+    cfg.lookupValue("mw.shutdown_timeout", shutdown_timeout);
+    std::thread shutdown;
+    boost::asio::signal_set signals(io, SIGINT, SIGTERM, SIGHUP);
+    std::function<void(const boost::system::error_code&, int)> on_signal =
+      [&](const boost::system::error_code& ec, int signal) {
+        if (ec) {
+          return;
+        }
+        if (signal == SIGHUP) {
+          spdlog::info("SIGHUP received, reloading {}", arguments.config_file);
+          mw.reload([&arguments]() { return reload_config(arguments); });
+        } else if (!shutdown.joinable()) {
+          spdlog::info("{} received, shutting down", signal == SIGTERM ? "SIGTERM" : "SIGINT");
+          shutdown = std::thread([&]() {
+            mw.shutdown(std::chrono::seconds(shutdown_timeout));
+            io.stop();
+          });
+        }
+        signals.async_wait(on_signal);
+      };
+    signals.async_wait(on_signal);
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++) {
+      pool.emplace_back(run);
+    }
+    run();
+    for (auto& thread : pool) {
+      thread.join();
+    }
+    if (shutdown.joinable()) {
+      shutdown.join();
+    }
   } catch (const std::exception& ex) {
     spdlog::error("BUG ALERT: Unhandled exception in main: {}", ex.what());
   }
 
 exit:
+  // flush the log queue
+  spdlog::shutdown();
   return 0;
 }
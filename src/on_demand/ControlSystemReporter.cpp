@@ -0,0 +1,273 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#include "ControlSystemReporter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <zlib.h>
+#include "spdlog/spdlog.h"
+
+using web::json::value;
+
+namespace {
+  auto gzip(const std::string& data) -> std::vector<unsigned char> {
+    z_stream zs = {};
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      return {};
+    }
+    std::vector<unsigned char> out(deflateBound(&zs, data.size()));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    zs.avail_in = data.size();
+    zs.next_out = out.data();
+    zs.avail_out = out.size();
+    auto ret = deflate(&zs, Z_FINISH);
+    out.resize(ret == Z_STREAM_END ? zs.total_out : 0);
+    deflateEnd(&zs);
+    return out;
+  }
+
+  auto ratio(uint64_t part, uint64_t total) -> value {
+    return total == 0 ? value::null() : value(static_cast<double>(part) / total);
+  }
+}
+
+MBMS_RT::ControlSystemReporter::ControlSystemReporter(const libconfig::Config& cfg,
+    boost::asio::io_service::strand& strand, ControlSystemRestClient& client)
+  : _strand(strand)
+  , _client(client)
+  , _interval_start(std::chrono::steady_clock::now())
+{
+  int interval = 10;
+  cfg.lookupValue("mw.control_system.interval", interval);
+  _min_backoff = std::chrono::seconds(std::max(interval, 1));
+  int max_backoff = 600;
+  cfg.lookupValue("mw.control_system.max_backoff", max_backoff);
+  _max_backoff = std::chrono::seconds(std::max(max_backoff, interval));
+  cfg.lookupValue("mw.control_system.batch_size", _batch_size);
+  _batch_size = std::max(_batch_size, 1U);
+
+  std::string spool_dir = "/var/spool/5gmag-rt-mw";
+  cfg.lookupValue("mw.control_system.spool_dir", spool_dir);
+  _spool_dir = spool_dir;
+  unsigned max_spool_size = 16;
+  cfg.lookupValue("mw.control_system.max_spool_size", max_spool_size);
+  _max_spool_size = static_cast<uint64_t>(max_spool_size) * 1024 * 1024;
+}
+
+auto MBMS_RT::ControlSystemReporter::add_cinr_sample(double cinr) -> void
+{
+  _last_cinr = cinr;
+  _cinr_min = _cinr_samples == 0 ? cinr : std::min(_cinr_min, cinr);
+  _cinr_max = _cinr_samples == 0 ? cinr : std::max(_cinr_max, cinr);
+  _cinr_sum += cinr;
+  _cinr_samples++;
+}
+
+auto MBMS_RT::ControlSystemReporter::add_report(const std::vector<StreamTotals>& streams, uint64_t cache_requests,
+    uint64_t cache_hits) -> void
+{
+  auto now = std::chrono::steady_clock::now();
+  value report;
+  report["timestamp"] = value(std::chrono::duration_cast<std::chrono::seconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count());
+  report["interval"] = value(std::chrono::duration_cast<std::chrono::seconds>(now - _interval_start).count());
+  _interval_start = now;
+
+  value cinr;
+  cinr["samples"] = value(_cinr_samples);
+  if (_cinr_samples > 0) {
+    cinr["avg"] = value(_cinr_sum / _cinr_samples);
+    cinr["min"] = value(_cinr_min);
+    cinr["max"] = value(_cinr_max);
+  }
+  report["cinr"] = cinr;
+  _cinr_sum = 0;
+  _cinr_samples = 0;
+
+  // counters only grow, unless a stream has been replaced
+  auto delta = [](uint64_t current, uint64_t last) { return current >= last ? current - last : current; };
+
+  value cache;
+  auto requests = delta(cache_requests, _last_cache_requests);
+  auto hits = delta(cache_hits, _last_cache_hits);
+  cache["requests"] = value(requests);
+  cache["hits"] = value(hits);
+  cache["hit_rate"] = ratio(hits, requests);
+  report["cache"] = cache;
+  _last_cache_requests = cache_requests;
+  _last_cache_hits = cache_hits;
+
+  std::map<std::string, StreamTotals> per_service;
+  std::map<std::string, StreamTotals> totals;
+  for (const auto& stream : streams) {
+    auto key = stream.service_id + " " + stream.base;
+    StreamTotals last = {};
+    auto it = _last_totals.find(key);
+    if (it != _last_totals.end()) {
+      last = it->second;
+    }
+    auto& service = per_service[stream.service_id];
+    service.broadcast_objects += delta(stream.broadcast_objects, last.broadcast_objects);
+    service.broadcast_bytes += delta(stream.broadcast_bytes, last.broadcast_bytes);
+    service.cdn_objects += delta(stream.cdn_objects, last.cdn_objects);
+    service.cdn_bytes += delta(stream.cdn_bytes, last.cdn_bytes);
+    service.lost_objects += delta(stream.lost_objects, last.lost_objects);
+    totals[key] = stream;
+  }
+  _last_totals = std::move(totals);
+
+  std::vector<value> services;
+  for (const auto& it : per_service) {
+    const auto& s = it.second;
+    value service;
+    service["id"] = value(it.first);
+    service["broadcast_objects"] = value(s.broadcast_objects);
+    service["broadcast_bytes"] = value(s.broadcast_bytes);
+    service["cdn_objects"] = value(s.cdn_objects);
+    service["cdn_bytes"] = value(s.cdn_bytes);
+    service["broadcast_ratio"] = ratio(s.broadcast_bytes, s.broadcast_bytes + s.cdn_bytes);
+    service["lost_objects"] = value(s.lost_objects);
+    service["loss_rate"] = ratio(s.lost_objects, s.broadcast_objects + s.lost_objects);
+    services.push_back(service);
+  }
+  report["services"] = value::array(services);
+
+  _reports.push_back(std::move(report));
+}
+
+auto MBMS_RT::ControlSystemReporter::flush() -> void
+{
+  if (_sending || std::chrono::steady_clock::now() < _next_attempt) {
+    if (_reports.size() >= _batch_size) {
+      // offline: keep memory use bounded
+      spool(take_batch());
+    }
+    return;
+  }
+
+  std::filesystem::path file;
+  std::vector<unsigned char> body;
+  auto files = spooled_files();
+  if (!files.empty()) {
+    file = files.front();
+    std::ifstream ifs(file, std::ios::binary);
+    body.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    if (body.empty()) {
+      std::error_code ec;
+      std::filesystem::remove(file, ec);
+      return;
+    }
+  } else if (!_reports.empty()) {
+    body = take_batch();
+  } else {
+    return;
+  }
+
+  _sending = true;
+  _client.sendReports(body, [this, file, body](bool ok, const value& /*response*/) {
+    _strand.post([this, ok, file, body]() { sent(ok, file, body); });
+  });
+}
+
+auto MBMS_RT::ControlSystemReporter::sent(bool ok, const std::filesystem::path& spool_file,
+    std::vector<unsigned char> body) -> void
+{
+  _sending = false;
+  if (ok) {
+    if (!spool_file.empty()) {
+      std::error_code ec;
+      std::filesystem::remove(spool_file, ec);
+    }
+    _backoff = std::chrono::seconds(0);
+    _next_attempt = {};
+    if (!spooled_files().empty()) {
+      flush();
+    }
+  } else {
+    if (spool_file.empty()) {
+      spool(body);
+    }
+    _backoff = std::min(std::max(_min_backoff, _backoff * 2), _max_backoff);
+    _next_attempt = std::chrono::steady_clock::now() + _backoff;
+    spdlog::warn("Sending reports to the control system failed, retrying in {} seconds", _backoff.count());
+  }
+}
+
+auto MBMS_RT::ControlSystemReporter::take_batch() -> std::vector<unsigned char>
+{
+  value batch;
+  batch["sn"] = value(_client.machine_id());
+  batch["reports"] = value::array(_reports);
+  _reports.clear();
+  return gzip(batch.serialize());
+}
+
+auto MBMS_RT::ControlSystemReporter::spool(const std::vector<unsigned char>& body) -> void
+{
+  if (_spool_dir.empty() || body.empty()) {
+    spdlog::warn("Control system unreachable and no spool directory configured, dropping reports");
+    return;
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(_spool_dir, ec);
+
+  // zero padded, so the file names sort in the order the batches were created
+  char name[64];
+  snprintf(name, sizeof(name), "batch-%013lld-%06u.json.gz", static_cast<long long>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count()), _spool_counter++ % 1000000);
+  std::ofstream ofs(_spool_dir / name, std::ios::binary);
+  ofs.write(reinterpret_cast<const char*>(body.data()), body.size());
+  if (!ofs) {
+    spdlog::warn("Spooling reports to {} failed, dropping them", (_spool_dir / name).string());
+    return;
+  }
+  ofs.close();
+
+  // drop the oldest batches beyond the spool size limit
+  auto files = spooled_files();
+  std::vector<uint64_t> sizes;
+  uint64_t total = 0;
+  for (const auto& f : files) {
+    auto size = std::filesystem::file_size(f, ec);
+    sizes.push_back(ec ? 0 : size);
+    total += sizes.back();
+  }
+  for (size_t idx = 0; idx < files.size() && total > _max_spool_size; idx++) {
+    spdlog::info("Report spool exceeds {} bytes, dropping {}", _max_spool_size, files[idx].string());
+    std::filesystem::remove(files[idx], ec);
+    total -= sizes[idx];
+  }
+}
+
+auto MBMS_RT::ControlSystemReporter::spooled_files() const -> std::vector<std::filesystem::path>
+{
+  std::vector<std::filesystem::path> files;
+  std::error_code ec;
+  if (_spool_dir.empty() || !std::filesystem::is_directory(_spool_dir, ec)) {
+    return files;
+  }
+  for (const auto& entry : std::filesystem::directory_iterator(_spool_dir, ec)) {
+    auto name = entry.path().filename().string();
+    if (entry.is_regular_file(ec) && name.rfind("batch-", 0) == 0) {
+      files.push_back(entry.path());
+    }
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
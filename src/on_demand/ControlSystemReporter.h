@@ -0,0 +1,102 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+#include <libconfig.h++>
+#include <boost/asio.hpp>
+#include "cpprest/json.h"
+#include "ControlSystemRestClient.h"
+
+namespace MBMS_RT {
+  /**
+   * Aggregates reception KPIs per reporting interval and delivers them to the control system.
+   *
+   * Reports are collected into batches which are sent gzip compressed. Failed sends are retried with exponential
+   * backoff. While the control system cannot be reached, batches are spooled to disk (bounded in size) and sent
+   * oldest first once it is reachable again. All methods must be called on the given strand.
+   */
+  class ControlSystemReporter {
+    public:
+      ControlSystemReporter(const libconfig::Config& cfg, boost::asio::io_service::strand& strand,
+          ControlSystemRestClient& client);
+      virtual ~ControlSystemReporter() = default;
+
+      /**
+       * Cumulative counters of a content stream
+       */
+      struct StreamTotals {
+        std::string service_id;
+        std::string base;
+        uint64_t broadcast_objects;
+        uint64_t broadcast_bytes;
+        uint64_t cdn_objects;
+        uint64_t cdn_bytes;
+        uint64_t lost_objects;
+      };
+
+      void add_cinr_sample(double cinr);
+      double last_cinr() const { return _last_cinr; };
+
+      /**
+       * Closes the current interval: computes the deltas of the cumulative counters and queues the report.
+       */
+      void add_report(const std::vector<StreamTotals>& streams, uint64_t cache_requests, uint64_t cache_hits);
+
+      /**
+       * Sends the next batch (spooled batches first) unless a send is in progress or backing off.
+       */
+      void flush();
+
+    private:
+      void sent(bool ok, const std::filesystem::path& spool_file, std::vector<unsigned char> body);
+      std::vector<unsigned char> take_batch();
+      void spool(const std::vector<unsigned char>& body);
+      std::vector<std::filesystem::path> spooled_files() const;
+
+      boost::asio::io_service::strand& _strand;
+      ControlSystemRestClient& _client;
+
+      std::chrono::steady_clock::time_point _interval_start;
+      double _last_cinr = 0;
+      double _cinr_sum = 0;
+      double _cinr_min = 0;
+      double _cinr_max = 0;
+      unsigned _cinr_samples = 0;
+
+      std::map<std::string, StreamTotals> _last_totals;
+      uint64_t _last_cache_requests = 0;
+      uint64_t _last_cache_hits = 0;
+
+      std::vector<web::json::value> _reports;
+      unsigned _batch_size = 30;
+
+      bool _sending = false;
+      std::chrono::seconds _backoff = std::chrono::seconds(0);
+      std::chrono::seconds _min_backoff = std::chrono::seconds(10);
+      std::chrono::seconds _max_backoff = std::chrono::seconds(600);
+      std::chrono::steady_clock::time_point _next_attempt;
+
+      std::filesystem::path _spool_dir;
+      uint64_t _max_spool_size = 16 * 1024 * 1024;
+      unsigned _spool_counter = 0;
+  };
+}
@@ -40,10 +40,10 @@ MBMS_RT::ControlSystemRestClient::ControlSystemRestClient(const libconfig::Confi
   _machine_id = machine_id;
 }
 
-auto MBMS_RT::ControlSystemRestClient::sendHello(double cinr, const std::vector<std::string>& service_tmgis) -> web::json::value
+auto MBMS_RT::ControlSystemRestClient::sendHello(double cinr, const std::vector<std::string>& service_tmgis,
+    completion_callback_t completion_cb) -> void
 {
-  auto res = web::json::value::array();
-  if (!_client) return res;
+  if (!_client) return;
 
   web::json::value req;
   req["sn"] = value(_machine_id);
@@ -57,19 +57,55 @@ auto MBMS_RT::ControlSystemRestClient::sendHello(double cinr, const std::vector<
   for (const auto& tmgi : service_tmgis) {
     services.push_back(value(tmgi));
   }
-  req["services"] = web::json::value::array(/*services*/);
+  req["services"] = web::json::value::array(services);
 
+  web::http::http_request request(methods::POST);
+  request.set_request_uri("hello");
+  request.set_body(req);
+  _send(std::move(request), std::move(completion_cb));
+}
+
+auto MBMS_RT::ControlSystemRestClient::sendReports(std::vector<unsigned char> gzipped_batch,
+    completion_callback_t completion_cb) -> void
+{
+  if (!_client) return;
+
+  web::http::http_request request(methods::POST);
+  request.set_request_uri("reports");
+  request.set_body(std::move(gzipped_batch));
+  request.headers().set_content_type("application/json");
+  request.headers().add("Content-Encoding", "gzip");
+  _send(std::move(request), std::move(completion_cb));
+}
+
+auto MBMS_RT::ControlSystemRestClient::_send(web::http::http_request request, completion_callback_t completion_cb) -> void
+{
   try {
-    _client->request(methods::POST, "hello", req)
-      .then([&res](http_response response) { // NOLINT
-          if (response.status_code() == status_codes::OK) {
-            res = response.extract_json().get();
-            spdlog::debug("control system: {}", response.to_string());
-          }
-          else  {
+    _client->request(request)
+      .then([](http_response response) { // NOLINT
+          if (response.status_code() != status_codes::OK && response.status_code() != status_codes::NoContent) {
             spdlog::error("Error from control system: {} - {}", response.status_code(), response.to_string());
+            throw web::http::http_exception("Control system returned status " +
+                std::to_string(response.status_code()));
+          }
+          spdlog::debug("control system: {}", response.to_string());
+          if (response.status_code() == status_codes::NoContent) {
+            return pplx::task_from_result(web::json::value::null());
           }
-        }).wait();
-  } catch (web::http::http_exception ex) { }
-  return res;
+          return response.extract_json();
+        })
+      .then([completion_cb](pplx::task<web::json::value> previous) { // NOLINT
+          web::json::value res;
+          try {
+            res = previous.get();
+          } catch (const std::exception& ex) {
+            spdlog::debug("Control system request failed: {}", ex.what());
+            completion_cb(false, web::json::value::null());
+            return;
+          }
+          completion_cb(true, std::move(res));
+        });
+  } catch (web::http::http_exception ex) {
+    completion_cb(false, web::json::value::null());
+  }
 }
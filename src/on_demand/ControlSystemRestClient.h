@@ -14,7 +14,8 @@
 // See the License for the specific language governing permissions and limitations
 // under the License.
 //
-#include <string>
+#include <functional>
+#include <vector>
 #include <libconfig.h++>
 #include "cpprest/http_client.h"
 
@@ -25,9 +26,25 @@ class ControlSystemRestClient {
     ControlSystemRestClient(const libconfig::Config& cfg);
     virtual ~ControlSystemRestClient() = default;
 
-    web::json::value sendHello(double cinr, const std::vector<std::string>& service_tmgis);
+    typedef std::function<void(bool ok, web::json::value response)> completion_callback_t;
+
+    bool enabled() const { return _client != nullptr; };
+    const std::string& machine_id() const { return _machine_id; };
+
+    /**
+     * Sends the periodic hello. The response contains the service activation commands of the control system.
+     * All requests are non-blocking, callbacks are invoked on a cpprest thread.
+     */
+    void sendHello(double cinr, const std::vector<std::string>& service_tmgis, completion_callback_t completion_cb);
+
+    /**
+     * Sends a gzip compressed batch of KPI reports.
+     */
+    void sendReports(std::vector<unsigned char> gzipped_batch, completion_callback_t completion_cb);
 
   private:
+    void _send(web::http::http_request request, completion_callback_t completion_cb);
+
     std::unique_ptr<web::http::client::http_client> _client;
     std::string _machine_id = {};
 };
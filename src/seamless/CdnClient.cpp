@@ -18,6 +18,11 @@
 #include "CdnClient.h"
 #include "CdnFile.h"
 
+#include <atomic>
+#include <memory>
+
+#include "Metrics.h"
+#include "LogRateLimit.h"
 #include "spdlog/spdlog.h"
 
 using web::http::client::http_client;
@@ -33,24 +38,57 @@ MBMS_RT::CdnClient::CdnClient(const std::string& base_url)
 
 auto MBMS_RT::CdnClient::get(const std::string& path, std::function<void(std::shared_ptr<CdnFile>)> completion_cb) -> void
 {
-  spdlog::debug("Cdn client requesting {}", path);
+  SPDLOG_DEBUG("Cdn client requesting {}", path);
+  static auto& ok_latency = Metrics::registry().histogram("mw_cdn_request_duration_seconds",
+      "Duration of CDN requests until the response body has been received", {{"result", "ok"}});
+  static auto& error_latency = Metrics::registry().histogram("mw_cdn_request_duration_seconds",
+      "Duration of CDN requests until the response body has been received", {{"result", "error"}});
+  auto start = std::chrono::steady_clock::now();
+  auto elapsed = [start]() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  };
+  // the failure handler at the end of the chain also sees exceptions thrown by completion_cb, which must not be
+  // called a second time
+  auto called = std::make_shared<std::atomic<bool>>(false);
+  auto complete = [completion_cb, called](std::shared_ptr<CdnFile> file) {
+    if (completion_cb && !called->exchange(true)) {
+      completion_cb(std::move(file));
+    }
+  };
   try {
     _client->request(methods::GET, path)
-      .then([completion_cb](http_response response) { // NOLINT
-          if (response.status_code() == status_codes::OK) {
-            Concurrency::streams::container_buffer<std::vector<uint8_t>> buf;
-            response.body().read_to_end(buf)
-              .then([buf, completion_cb](size_t bytes_read){
-                spdlog::debug("Downloaded {} bytes", bytes_read);
-                auto cdn_file = std::make_shared<CdnFile>(bytes_read);
-                memcpy(cdn_file->buffer(), &(buf.collection())[0], bytes_read);
-                if (completion_cb) {
-                  completion_cb(cdn_file);
-                }
-            });
-          } else {
-                spdlog::debug("got status {}", response.status_code());
+      .then([complete, elapsed](http_response response) { // NOLINT
+          if (response.status_code() != status_codes::OK) {
+            SPDLOG_DEBUG("got status {}", response.status_code());
+            error_latency.observe(elapsed());
+            complete(nullptr);
+            return pplx::task_from_result();
+          }
+          Concurrency::streams::container_buffer<std::vector<uint8_t>> buf;
+          return response.body().read_to_end(buf)
+            .then([buf, complete, elapsed](size_t bytes_read){
+              SPDLOG_DEBUG("Downloaded {} bytes", bytes_read);
+              ok_latency.observe(elapsed());
+              auto cdn_file = std::make_shared<CdnFile>(bytes_read);
+              memcpy(cdn_file->buffer(), &(buf.collection())[0], bytes_read);
+              complete(cdn_file);
+          });
+        })
+      .then([complete, path, elapsed](pplx::task<void> previous) { // NOLINT
+          // observe failures of the request chain, unobserved task exceptions terminate the process
+          bool failed = false;
+          try {
+            previous.get();
+          } catch (const std::exception& ex) {
+            MW_LOG_RATE_LIMITED(spdlog::level::warn, "Cdn request for {} failed: {}", path, ex.what());
+            error_latency.observe(elapsed());
+            failed = true;
+          }
+          if (failed) {
+            complete(nullptr);
           }
-        }).wait();
-  } catch (web::http::http_exception ex) { }
+        });
+  } catch (web::http::http_exception ex) {
+    complete(nullptr);
+  }
 }
@@ -27,6 +27,10 @@ namespace MBMS_RT {
       CdnClient(const std::string& base_url);
       virtual ~CdnClient() = default;
 
+      /**
+       * Requests path from the CDN without blocking. completion_cb is called from a cpprest thread, with nullptr
+       * if the request failed.
+       */
       void get(const std::string& path, std::function<void(std::shared_ptr<CdnFile>)> completion_cb);
 
     private:
@@ -20,7 +20,7 @@
 MBMS_RT::CdnFile::CdnFile(size_t length)
   : _length( length )
 {
-  spdlog::debug("CdnFile with size {} created", length);
+  SPDLOG_TRACE("CdnFile with size {} created", length);
   _buffer = (char*)malloc(length);
   if (_buffer == nullptr) {
     throw "Failed to allocate CDN file buffer";
@@ -28,7 +28,7 @@ MBMS_RT::CdnFile::CdnFile(size_t length)
 }
 
 MBMS_RT::CdnFile::~CdnFile() {
-  spdlog::debug("CdnFile destroyed");
+  SPDLOG_TRACE("CdnFile destroyed");
   if (_buffer != nullptr) {
     free(_buffer);
   }
@@ -0,0 +1,72 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include "DvrIndex.h"
+
+#include <algorithm>
+#include <iterator>
+
+auto MBMS_RT::DvrIndex::add(int seq, int64_t start_ms, uint32_t duration_ms) -> void
+{
+  if (!empty()) {
+    if (seq <= back().seq) {
+      return;
+    }
+    start_ms = std::max(start_ms, back().end_ms());
+  }
+  _entries.push_back({start_ms, seq, duration_ms});
+}
+
+auto MBMS_RT::DvrIndex::pop_front() -> void
+{
+  if (empty()) {
+    return;
+  }
+  _first++;
+  if (_first == _entries.size()) {
+    clear();
+  } else if (_first > 64 && _first > _entries.size() / 2) {
+    _entries.erase(_entries.begin(), _entries.begin() + _first);
+    _first = 0;
+  }
+}
+
+auto MBMS_RT::DvrIndex::clear() -> void
+{
+  _entries.clear();
+  _first = 0;
+}
+
+auto MBMS_RT::DvrIndex::find(int64_t time_ms) const -> const Entry*
+{
+  auto begin = _entries.begin() + _first;
+  auto it = std::upper_bound(begin, _entries.end(), time_ms,
+      [](int64_t t, const Entry& e) { return t < e.start_ms; });
+  if (it != begin && std::prev(it)->end_ms() > time_ms) {
+    --it;
+  }
+  return it == _entries.end() ? nullptr : &*it;
+}
+
+auto MBMS_RT::DvrIndex::find_seq(int seq) const -> const Entry*
+{
+  auto begin = _entries.begin() + _first;
+  auto it = std::lower_bound(begin, _entries.end(), seq,
+      [](const Entry& e, int s) { return e.seq < s; });
+  return it == _entries.end() || it->seq != seq ? nullptr : &*it;
+}
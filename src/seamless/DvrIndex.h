@@ -0,0 +1,70 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace MBMS_RT {
+  /**
+   * Maps wall clock time to the segments of a time-shift buffer.
+   *
+   * Entries are kept in one contiguous vector, sorted by start time and sequence number, so seeks are a binary
+   * search. Entries are appended at the live edge and removed from the front; the vector is compacted once half of
+   * it has been removed.
+   */
+  class DvrIndex {
+    public:
+      struct Entry {
+        int64_t start_ms;      /**< program date-time of the segment start, milliseconds since the epoch */
+        int32_t seq;
+        uint32_t duration_ms;
+        int64_t end_ms() const { return start_ms + duration_ms; };
+      };
+
+      /**
+       * Appends a segment. Segments must be added in sequence number order; a start time before the end of the
+       * previous segment (e.g. a clock jump in the source) is moved to that end to keep the index sorted.
+       */
+      void add(int seq, int64_t start_ms, uint32_t duration_ms);
+      void pop_front();
+      void clear();
+
+      bool empty() const { return _first == _entries.size(); };
+      size_t size() const { return _entries.size() - _first; };
+      const Entry& front() const { return _entries[_first]; };
+      const Entry& back() const { return _entries.back(); };
+
+      /**
+       * Returns the segment that contains time_ms, or the first segment after it if time_ms falls into a gap.
+       * Times before the first segment return the first segment, nullptr if time_ms is after the last segment.
+       */
+      const Entry* find(int64_t time_ms) const;
+
+      /**
+       * Returns the entry for a sequence number, nullptr if it is not indexed
+       */
+      const Entry* find_seq(int seq) const;
+
+    private:
+      std::vector<Entry> _entries;
+      size_t _first = 0;
+  };
+}
@@ -20,11 +20,34 @@
 #include "CdnClient.h"
 #include "CacheItems.h"
 #include "HlsMediaPlaylist.h"
+#include "LatencyTrace.h"
+#include "LogRateLimit.h"
 #include <libgen.h>
+#include <climits>
+#include <cmath>
+#include <ctime>
+#include <set>
 
 #include "spdlog/spdlog.h"
 #include "cpprest/base_uri.h"
 
+namespace {
+  // Larger gaps between the measured end of a segment and the start of the next one are discontinuities
+  constexpr double kMaxTimestampGap = 0.5;
+  // MPEG-2 TS timestamps wrap after 2^33 ticks of the 90 kHz clock
+  constexpr double kTsTimestampPeriod = 8589934592.0 / 90000.0;
+
+  auto format_date_time(double seconds) -> std::string {
+    auto whole = static_cast<time_t>(std::floor(seconds));
+    struct tm tm = {};
+    gmtime_r(&whole, &tm);
+    char buf[40];
+    auto len = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(buf + len, sizeof(buf) - len, ".%03dZ", static_cast<int>((seconds - whole) * 1000) % 1000);
+    return buf;
+  }
+}
+
 MBMS_RT::SeamlessContentStream::SeamlessContentStream(std::string base, std::string flute_if,
                                                       boost::asio::io_service &io_service, CacheManagement &cache,
                                                       DeliveryProtocol protocol, const libconfig::Config &cfg)
@@ -32,27 +55,109 @@ MBMS_RT::SeamlessContentStream::SeamlessContentStream(std::string base, std::str
       _timer(io_service, _tick_interval) {
   cfg.lookupValue("mw.cache.max_segments_per_stream", _segments_to_keep);
   cfg.lookupValue("mw.seamless_switching.truncate_cdn_playlist_segments", _truncate_cdn_playlist_segments);
-  _timer.async_wait(boost::bind(&SeamlessContentStream::tick_handler, this)); //NOLINT
+  cfg.lookupValue("mw.seamless_switching.delta_updates", _delta_updates);
+  cfg.lookupValue("mw.dvr.window", _dvr_window);
 }
 
 MBMS_RT::SeamlessContentStream::~SeamlessContentStream() {
   spdlog::debug("Destroying seamless content stream at base {}", _base);
   _running = false;
   _timer.cancel();
+
+  std::unique_lock<std::mutex> lock(_segments_mutex);
+  auto pending = take_blocking_requests([](const BlockingRequest &) { return true; });
+  lock.unlock();
+  for (auto &request : pending) {
+    request.reply(503, {});
+  }
+
+  // The generated playlist refers to this object. Only remove it if it has not been replaced by another stream.
+  _cache.remove_item(_playlist_path, _playlist_item);
+
+  // let the cache expire the time-shift buffer like any other content
+  for (const auto &seg : _segments) {
+    seg.second->set_retained(false);
+  }
+  for (const auto &seg : _dvr_segments) {
+    seg.second->set_retained(false);
+  }
+}
+
+auto MBMS_RT::SeamlessContentStream::start() -> void {
+  ContentStream::start();
+  // Published here and not in set_cdn_endpoint: candidate streams built for a new service announcement are
+  // discarded if the running stream is kept, and must not replace its playlist in the meantime
+  if (_playlist_item) {
+    _cache.add_item(_playlist_item);
+  }
+  _running = true;
+  _timer.expires_from_now(_tick_interval);
+  schedule_tick();
+}
+
+auto MBMS_RT::SeamlessContentStream::drain() -> void {
+  ContentStream::drain();
+  // The timer belongs to the stream strand, the pending tick sees the flag and does not re-arm
+  _running = false;
+}
+
+/**
+ * Segment count and CDN playlist settings. The time-shift window is kept, its buffer is sized for it.
+ */
+auto MBMS_RT::SeamlessContentStream::reconfigure(const libconfig::Config &cfg) -> void {
+  int segments_to_keep = 10;
+  int truncate_cdn_playlist_segments = 7;
+  bool delta_updates = true;
+  cfg.lookupValue("mw.cache.max_segments_per_stream", segments_to_keep);
+  cfg.lookupValue("mw.seamless_switching.truncate_cdn_playlist_segments", truncate_cdn_playlist_segments);
+  cfg.lookupValue("mw.seamless_switching.delta_updates", delta_updates);
+  // the values are used by the playlist handlers on the stream strand
+  std::weak_ptr<ContentStream> weak = weak_from_this();
+  _strand.post([weak, segments_to_keep, truncate_cdn_playlist_segments, delta_updates]() {
+    auto self = std::static_pointer_cast<SeamlessContentStream>(weak.lock());
+    if (self) {
+      self->_segments_to_keep = segments_to_keep;
+      self->_truncate_cdn_playlist_segments = truncate_cdn_playlist_segments;
+      self->_delta_updates = delta_updates;
+    }
+  });
+}
+
+auto MBMS_RT::SeamlessContentStream::schedule_tick() -> void {
+  std::weak_ptr<ContentStream> weak = weak_from_this();
+  _timer.async_wait(_strand.wrap([weak](const boost::system::error_code &ec) { //NOLINT
+    auto self = std::static_pointer_cast<SeamlessContentStream>(weak.lock());
+    if (self && !ec) {
+      self->tick_handler();
+    }
+  }));
+}
+
+auto MBMS_RT::SeamlessContentStream::same_configuration(const ContentStream &other) const -> bool {
+  auto other_seamless = dynamic_cast<const SeamlessContentStream *>(&other);
+  return other_seamless != nullptr && ContentStream::same_configuration(other) &&
+         _cdn_endpoint == other_seamless->_cdn_endpoint;
 }
 
 auto MBMS_RT::SeamlessContentStream::flute_file_received(std::shared_ptr<LibFlute::File> file) -> void {
-  spdlog::debug("SeamlessContentStream: {} (TOI {}, MIME type {}) has been received",
+  SPDLOG_DEBUG("SeamlessContentStream: {} (TOI {}, MIME type {}) has been received",
                 file->meta().content_location, file->meta().toi, file->meta().content_type);
 
   if (file->meta().content_location == _playlist_path) {
-    spdlog::info("ContentStream: got PLAYLIST at {}", file->meta().content_location);
+    SPDLOG_DEBUG("ContentStream: got PLAYLIST at {}", file->meta().content_location);
     handle_playlist(std::string(file->buffer(), file->length()), MBMS_RT::ItemSource::Broadcast);
   } else if (file->meta().content_location == "index.m3u8") {
     // ignore the pathless master manifest generated by the core
   } else {
-    spdlog::info("ContentStream: got SEGMENT at {}", file->meta().content_location);
-    _flute_files[file->meta().content_location] = file;
+    SPDLOG_DEBUG("ContentStream: got SEGMENT at {}", file->meta().content_location);
+    const std::lock_guard<std::mutex> lock(_segments_mutex);
+    // parts and preload hints are usually listed before their object has been received
+    auto part = _parts.find(file->meta().content_location);
+    if (part != _parts.end()) {
+      part->second.part->set_flute_file(std::move(file));
+    } else {
+      _flute_files[file->meta().content_location] = file;
+    }
   }
 }
 
@@ -77,87 +182,532 @@ auto MBMS_RT::SeamlessContentStream::set_cdn_endpoint(const std::string &cdn_ept
 
   _cdn_client = std::make_shared<CdnClient>(_cdn_endpoint);
 
-  _cache.add_item(std::make_shared<CachedPlaylist>(
+  std::weak_ptr<ContentStream> weak = weak_from_this();
+  _playlist_item = std::make_shared<CachedPlaylist>(
       _playlist_path,
       0,
       [&]() -> const std::string & {
-        spdlog::debug("ContentStream: {} playlist requested", _playlist_path);
+        SPDLOG_DEBUG("ContentStream: {} playlist requested", _playlist_path);
         return _playlist;
+      },
+      [weak](const std::map<std::string, std::string> &query, CachedPlaylist::reply_cb_t reply) {
+        auto self = std::static_pointer_cast<SeamlessContentStream>(weak.lock());
+        if (self) {
+          self->playlist_request(query, std::move(reply));
+        } else {
+          reply(404, {});
+        }
       }
-  ));
+  );
 };
 
 
 auto MBMS_RT::SeamlessContentStream::handle_playlist(const std::string &content, ItemSource source) -> void {
-  auto playlist = MBMS_RT::HlsMediaPlaylist(content);
-  int seq = 0;
-  double extinf = 0;
+  HlsMediaPlaylist playlist;
+  try {
+    playlist = HlsMediaPlaylist(content);
+  } catch (const std::exception &ex) {
+    MW_LOG_RATE_LIMITED(spdlog::level::warn, "Ignoring invalid playlist for {}: {}", _playlist_path, ex.what());
+    return;
+  }
 
   auto count = playlist.segments().size();
   if (source == ItemSource::CDN) {
     count -= _truncate_cdn_playlist_segments;
   }
   int idx = 0;
+  // The low latency state (parts of the newest segments, preload hint) describes the live edge. A truncated CDN
+  // playlist lags behind the broadcast, so it only contributes whole segments.
+  bool live_edge = source == ItemSource::Broadcast || _truncate_cdn_playlist_segments == 0;
 
-  const std::lock_guard<std::mutex> lock(_segments_mutex);
+  std::vector<std::string> added;
+  std::unique_lock<std::mutex> lock(_segments_mutex);
+  if (_segments.empty()) {
+    _discontinuity_sequence = playlist.discontinuity_sequence();
+    if (_dvr_segments.empty()) {
+      _dvr_discontinuity_sequence = _discontinuity_sequence;
+    }
+  }
   for (const auto &segment: playlist.segments()) {
-    spdlog::debug("segment: seq {}, extinf {}, uri {}", segment.seq, segment.extinf, segment.uri);
-    if (_segments.find(segment.seq) == _segments.end()) {
+    SPDLOG_DEBUG("segment: seq {}, extinf {}, uri {}", segment.seq, segment.extinf, segment.uri);
+    auto existing = _segments.find(segment.seq);
+    if (existing == _segments.end() && _dvr_segments.find(segment.seq) != _dvr_segments.end()) {
+      // a lagging source still lists a segment that has moved to the time-shift buffer
+    } else if (existing == _segments.end()) {
       std::string full_uri = _playlist_dir + segment.uri;
+      auto entry = segment;
+      entry.parts = local_parts(segment.parts);
       auto seg =
-          std::make_shared<Segment>(full_uri, segment.seq, segment.extinf);
+          std::make_shared<Segment>(full_uri, std::move(entry));
+      if (!segment.map.empty()) {
+        seg->set_track(init_track(segment.map));
+      }
       if (_cdn_client) {
-        seg->set_cdn_client(_cdn_client);
+        seg->set_cdn_client(_cdn_client, _counters);
       }
 
       if (_flute_files.find(full_uri) != _flute_files.end()) {
         seg->set_flute_file(_flute_files[full_uri]);
         _flute_files.erase(full_uri);
-        spdlog::debug("Assigned already received flute file");
+        SPDLOG_DEBUG("Assigned already received flute file");
       }
 
+      // the listed values are fixed when the segment is added, players must not see them change
+      auto previous = _segments.find(segment.seq - 1);
+      apply_media_timing(*seg, previous == _segments.end() ? nullptr : previous->second.get());
+      if (_dvr_window > 0) {
+        seg->set_retained(true);
+        add_to_time_shift_buffer(*seg);
+      }
       _segments[segment.seq] = seg;
 
       _cache.add_item(std::make_shared<CachedSegment>(
           full_uri, 0, seg)
       );
+      added.push_back(std::move(full_uri));
+    } else if (live_edge) {
+      // parts are only listed for the newest segments
+      existing->second->set_parts(local_parts(segment.parts));
     }
     if (idx++ > count) {
       break;
     }
   }
 
+  if (live_edge) {
+    auto first_listed = playlist.segments().empty() ? INT_MAX : playlist.segments().front().seq;
+    for (auto it = _segments.begin(); it != _segments.end() && it->first < first_listed; ++it) {
+      it->second->set_parts({});
+    }
+    _pending_parts = local_parts(playlist.pending_parts());
+    _preload_hint = playlist.preload_hint();
+    if (!_preload_hint.uri.empty()) {
+      if (_preload_hint.type == "PART") {
+        add_part_object(_playlist_dir + _preload_hint.uri);
+      }
+      _preload_hint.uri = "/" + _playlist_dir + _preload_hint.uri;
+    }
+    _rendition_reports = playlist.rendition_reports();
+    _server_control = playlist.server_control();
+    _part_target = playlist.part_target();
+  }
+  // Delta updates are cut from the generated playlist, the skip capabilities of the source do not apply.
+  // Segments more than six target durations from the end can be skipped (the minimum skip boundary).
+  _server_control.can_skip_until = _delta_updates ? 6.0 * std::max(playlist.target_duration(), 1) : 0;
+  _server_control.can_skip_dateranges = false;
+
   while (_segments.size() > _segments_to_keep) {
     auto seg = _segments.extract(_segments.begin());
-    spdlog::debug("Removing oldest segment and cache item at {}", seg.mapped()->uri());
-    _cache.remove_item(seg.mapped()->uri());
+    SPDLOG_DEBUG("Removing oldest segment and cache item at {}", seg.mapped()->uri());
+    if (seg.mapped()->playlist_entry().discontinuity) {
+      _discontinuity_sequence++;
+    }
+    if (seg.mapped()->data_source() != ItemSource::Broadcast) {
+      _counters->lost_objects++;
+      if (_lost_metric) {
+        _lost_metric->inc();
+      }
+    }
+    if (_dvr_window > 0) {
+      _dvr_segments.insert(std::move(seg));
+    } else {
+      _cache.remove_item(seg.mapped()->uri());
+    }
   }
+  expire_time_shift_buffer();
   HlsMediaPlaylist pl;
   pl.set_target_duration(
       playlist.target_duration());  // [TODO] this will fail when targetdurations change or do not match
+  _target_duration = playlist.target_duration();
+  pl.set_version(playlist.version());
+  pl.set_discontinuity_sequence(_discontinuity_sequence);
+  pl.set_ended(playlist.ended());
+  pl.set_server_control(_server_control);
+  pl.set_part_target(_part_target);
+  std::set<std::string> listed_parts;
   for (const auto &seg: _segments) {
-    HlsMediaPlaylist::Segment s{
-        seg.second->uri(),
-        seg.second->seq(),
-        seg.second->extinf(),
-    };
-    pl.add_segment(s);
+    auto s = seg.second->playlist_entry();
+    s.uri = "/" + seg.second->uri();
+    for (const auto &part : s.parts) {
+      listed_parts.insert(part.uri);
+    }
+    pl.add_segment(std::move(s));
+  }
+  for (const auto &part : _pending_parts) {
+    listed_parts.insert(part.uri);
+  }
+  listed_parts.insert(_preload_hint.uri);
+  pl.set_pending_parts(_pending_parts);
+  pl.set_preload_hint(_preload_hint);
+  pl.set_rendition_reports(_rendition_reports);
+  _playlist = pl.to_string(&_segment_offsets);
+
+  _skippable_segments = 0;
+  if (_server_control.can_skip_until > 0) {
+    double remaining = 0;
+    for (const auto &seg: _segments) {
+      remaining += seg.second->extinf();
+    }
+    for (const auto &seg: _segments) {
+      if (remaining <= _server_control.can_skip_until) {
+        break;
+      }
+      remaining -= seg.second->extinf();
+      _skippable_segments++;
+    }
+  }
+
+  // drop the objects of parts that are no longer listed, players have moved on to the segments
+  for (auto it = _parts.begin(); it != _parts.end();) {
+    if (listed_parts.count("/" + it->first) == 0) {
+      _cache.remove_item(it->first, it->second.item);
+      it = _parts.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  auto ready = take_blocking_requests([this](const BlockingRequest &r) { return playlist_contains(r.msn, r.part); });
+  std::vector<std::string> replies;
+  replies.reserve(ready.size());
+  for (const auto &request : ready) {
+    replies.push_back(current_playlist(request.skip));
+  }
+  lock.unlock();
+
+  for (const auto &uri: added) {
+    LatencyTrace::instance().record(LatencyTrace::Stage::PlaylistPublish, uri, _base);
+  }
+  for (size_t i = 0; i < ready.size(); i++) {
+    ready[i].reply(200, std::move(replies[i]));
+  }
+}
+
+auto MBMS_RT::SeamlessContentStream::init_track(const std::string &map) -> MediaInspector::Track {
+  auto start = map.find("URI=\"");
+  if (start == std::string::npos) {
+    return {};
+  }
+  start += 5;
+  auto uri = _playlist_dir + map.substr(start, map.find('"', start) - start);
+  auto known = _init_tracks.find(uri);
+  if (known != _init_tracks.end()) {
+    return known->second;
+  }
+  MediaInspector::Track track;
+  auto file = _flute_files.find(uri);
+  if (file != _flute_files.end() && file->second->complete()) {
+    track = MediaInspector::init_track(file->second->buffer(), file->second->length());
+  } else if (auto item = _cache.item(uri)) {
+    auto buffer = item->buffer();
+    if (buffer != nullptr) {
+      track = MediaInspector::init_track(buffer, item->content_length());
+    }
+  }
+  if (track.timescale != 0) {
+    if (_init_tracks.size() > 16) {
+      _init_tracks.clear();
+    }
+    _init_tracks[uri] = track;
+  }
+  return track;
+}
+
+auto MBMS_RT::SeamlessContentStream::apply_media_timing(Segment &segment, const Segment *previous) const -> void {
+  auto timing = segment.timing();
+  if (!timing.valid) {
+    return;
+  }
+  auto entry = segment.playlist_entry();
+  SPDLOG_DEBUG("segment {}: EXTINF {}, measured start {} duration {}", entry.seq, entry.extinf, timing.start,
+      timing.duration);
+  entry.extinf = timing.duration;
+
+  auto previous_timing = previous ? previous->timing() : MediaInspector::Timing();
+  if (previous_timing.valid && previous_timing.container == timing.container) {
+    auto gap = timing.start - (previous_timing.start + previous_timing.duration);
+    if (timing.container == MediaInspector::Container::TS) {
+      gap = std::remainder(gap, kTsTimestampPeriod);
+    }
+    if (!entry.discontinuity && std::abs(gap) > kMaxTimestampGap) {
+      spdlog::info("Segment {} of {} does not continue the timeline (gap {:.3f}s), marking a discontinuity",
+          entry.seq, _playlist_path, gap);
+      entry.discontinuity = true;
+    }
+    const auto& previous_entry = previous->playlist_entry();
+    if (entry.program_date_time.empty() && !entry.discontinuity && !previous_entry.program_date_time.empty()) {
+      auto date_time = DashManifest::parse_date_time(previous_entry.program_date_time);
+      if (date_time > 0) {
+        entry.program_date_time = format_date_time(date_time + previous_timing.duration + gap);
+      }
+    }
+  }
+  segment.set_playlist_entry(std::move(entry));
+}
+
+auto MBMS_RT::SeamlessContentStream::add_to_time_shift_buffer(const Segment &segment) -> void {
+  const auto& entry = segment.playlist_entry();
+  auto duration_ms = static_cast<uint32_t>(std::lround(entry.extinf * 1000));
+  int64_t start_ms = 0;
+  if (!entry.program_date_time.empty()) {
+    start_ms = std::llround(DashManifest::parse_date_time(entry.program_date_time) * 1000);
+  }
+  if (start_ms <= 0) {
+    // no program date-time: continue the timeline, the first segment is assumed to have just ended
+    start_ms = _dvr_index.empty() ? static_cast<int64_t>(time(nullptr)) * 1000 - duration_ms : _dvr_index.back().end_ms();
+  }
+  _dvr_index.add(entry.seq, start_ms, duration_ms);
+}
+
+auto MBMS_RT::SeamlessContentStream::expire_time_shift_buffer() -> void {
+  if (_dvr_index.empty()) {
+    return;
+  }
+  auto oldest = _dvr_index.back().end_ms() - static_cast<int64_t>(_dvr_window) * 1000;
+  while (!_dvr_segments.empty()) {
+    auto seg = _dvr_segments.begin();
+    auto indexed = _dvr_index.find_seq(seg->first);
+    if (indexed != nullptr && indexed->end_ms() >= oldest) {
+      break;
+    }
+    SPDLOG_DEBUG("Removing segment at {} from the time-shift buffer", seg->second->uri());
+    if (seg->second->playlist_entry().discontinuity) {
+      _dvr_discontinuity_sequence++;
+    }
+    seg->second->set_retained(false);
+    _cache.remove_item(seg->second->uri());
+    while (!_dvr_index.empty() && _dvr_index.front().seq <= seg->first) {
+      _dvr_index.pop_front();
+    }
+    _dvr_segments.erase(seg);
+  }
+}
+
+auto MBMS_RT::SeamlessContentStream::time_shift_playlist(const std::map<std::string, std::string> &query) const
+    -> std::string {
+  if (_dvr_index.empty()) {
+    return {};
+  }
+  auto param_ms = [&query](const char* name) -> int64_t {
+    auto it = query.find(name);
+    return it == query.end() ? -1 : std::llround(atof(it->second.c_str()) * 1000);
+  };
+  auto start_ms = param_ms("start");
+  auto end_ms = param_ms("end");
+
+  // ?dvr: the whole buffer as a sliding window, ?start: an EVENT playlist from the start time,
+  // ?start&end: a VOD playlist if the end is in the buffer
+  int first_seq = _dvr_index.front().seq;
+  int last_seq = INT_MAX;
+  std::string type;
+  if (start_ms >= 0) {
+    auto first = _dvr_index.find(start_ms);
+    if (first == nullptr) {
+      return {};
+    }
+    first_seq = first->seq;
+    type = "EVENT";
+  }
+  if (end_ms >= 0 && end_ms <= _dvr_index.back().end_ms()) {
+    auto last = _dvr_index.find(end_ms - 1);
+    if (last == nullptr || last->seq < first_seq) {
+      return {};
+    }
+    last_seq = last->seq;
+    type = "VOD";
+  }
+
+  HlsMediaPlaylist pl;
+  int discontinuity_sequence = _dvr_discontinuity_sequence;
+  double longest = 0;
+  auto add = [&](const std::map<int, std::shared_ptr<Segment>>& segments) {
+    for (auto it = segments.begin(); it != segments.end() && it->first <= last_seq; ++it) {
+      auto entry = it->second->playlist_entry();
+      if (it->first < first_seq) {
+        discontinuity_sequence += entry.discontinuity ? 1 : 0;
+        continue;
+      }
+      entry.uri = "/" + it->second->uri();
+      entry.parts.clear();
+      if (pl.segments().empty() && entry.program_date_time.empty()) {
+        auto indexed = _dvr_index.find_seq(entry.seq);
+        if (indexed != nullptr) {
+          entry.program_date_time = format_date_time(indexed->start_ms / 1000.0);
+        }
+      }
+      longest = std::max(longest, entry.extinf);
+      pl.add_segment(std::move(entry));
+    }
+  };
+  add(_dvr_segments);
+  add(_segments);
+  if (pl.segments().empty()) {
+    return {};
+  }
+  pl.set_target_duration(std::max(_target_duration, static_cast<int>(std::lround(longest))));
+  pl.set_discontinuity_sequence(discontinuity_sequence);
+  pl.set_playlist_type(type);
+  pl.set_ended(type == "VOD");
+  return pl.to_string();
+}
+
+auto MBMS_RT::SeamlessContentStream::current_playlist(bool skip) const -> std::string {
+  if (!skip || _skippable_segments == 0 || _skippable_segments >= _segment_offsets.size()) {
+    return _playlist;
+  }
+  // Delta update: the header, EXT-X-SKIP in place of the skipped segments, and the rest of the playlist as is
+  auto header_end = _segment_offsets.front();
+  auto first_kept = _segment_offsets[_skippable_segments];
+  std::string delta;
+  delta.reserve(header_end + 256 + _playlist.size() - first_kept);
+  delta.append(_playlist, 0, header_end);
+  delta += "#EXT-X-SKIP:SKIPPED-SEGMENTS=";
+  delta += std::to_string(_skippable_segments);
+  delta += '\n';
+
+  // EXT-X-KEY and EXT-X-MAP are only written where they change, repeat them if they were set in the skipped part
+  auto kept = std::next(_segments.begin(), _skippable_segments);
+  const auto &entry = kept->second->playlist_entry();
+  const auto &previous = std::prev(kept)->second->playlist_entry();
+  if (!entry.key.empty() && entry.key == previous.key) {
+    delta += "#EXT-X-KEY:" + entry.key + "\n";
+  }
+  if (!entry.map.empty() && entry.map == previous.map) {
+    delta += "#EXT-X-MAP:" + entry.map + "\n";
+  }
+  delta.append(_playlist, first_kept, std::string::npos);
+  return delta;
+}
+
+auto MBMS_RT::SeamlessContentStream::local_parts(const std::vector<HlsMediaPlaylist::Part> &parts)
+    -> std::vector<HlsMediaPlaylist::Part> {
+  std::vector<HlsMediaPlaylist::Part> local;
+  local.reserve(parts.size());
+  for (const auto &part : parts) {
+    local.push_back(part);
+    if (!part.gap) {
+      add_part_object(_playlist_dir + part.uri);
+    }
+    local.back().uri = "/" + _playlist_dir + part.uri;
+  }
+  return local;
+}
+
+auto MBMS_RT::SeamlessContentStream::add_part_object(const std::string &location) -> void {
+  if (_parts.find(location) != _parts.end()) {
+    return;
+  }
+  // Parts are separate objects of the broadcast, or are fetched from the CDN like segments
+  auto part = std::make_shared<Segment>(location, HlsMediaPlaylist::Segment{location, -1, 0});
+  if (_cdn_client) {
+    part->set_cdn_client(_cdn_client, _counters);
+  }
+  auto file = _flute_files.find(location);
+  if (file != _flute_files.end()) {
+    part->set_flute_file(file->second);
+    _flute_files.erase(file);
+  }
+  auto item = std::make_shared<CachedSegment>(location, 0, part);
+  _cache.add_item(item);
+  _parts[location] = {part, item};
+}
+
+auto MBMS_RT::SeamlessContentStream::playlist_contains(int msn, int part) const -> bool {
+  int last = _segments.empty() ? -1 : _segments.rbegin()->first;
+  if (msn <= last) {
+    return true;
   }
-  _playlist = pl.to_string();
+  return msn == last + 1 && part >= 0 && part < static_cast<int>(_pending_parts.size());
 }
 
+auto MBMS_RT::SeamlessContentStream::take_blocking_requests(
+    const std::function<bool(const BlockingRequest &)> &predicate) -> std::vector<BlockingRequest> {
+  std::vector<BlockingRequest> taken;
+  for (auto it = _blocking_requests.begin(); it != _blocking_requests.end();) {
+    if (predicate(*it)) {
+      taken.push_back(std::move(*it));
+      it = _blocking_requests.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return taken;
+}
+
+auto MBMS_RT::SeamlessContentStream::playlist_request(const std::map<std::string, std::string> &query,
+                                                      CachedPlaylist::reply_cb_t reply) -> void {
+  if (_dvr_window > 0 && (query.count("start") || query.count("end") || query.count("dvr"))) {
+    std::unique_lock<std::mutex> lock(_segments_mutex);
+    auto playlist = time_shift_playlist(query);
+    lock.unlock();
+    reply(playlist.empty() ? 404 : 200, std::move(playlist));
+    return;
+  }
+  auto msn_param = query.find("_HLS_msn");
+  auto part_param = query.find("_HLS_part");
+  auto skip_param = query.find("_HLS_skip");
+  bool skip = skip_param != query.end() && (skip_param->second == "YES" || skip_param->second == "v2");
+  if (part_param != query.end() && msn_param == query.end()) {
+    reply(400, {});
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(_segments_mutex);
+  if (msn_param == query.end() || !_server_control.can_block_reload) {
+    auto playlist = current_playlist(skip);
+    lock.unlock();
+    reply(200, std::move(playlist));
+    return;
+  }
+
+  int msn = atoi(msn_param->second.c_str());
+  int part = part_param == query.end() ? -1 : atoi(part_param->second.c_str());
+  int last = _segments.empty() ? -1 : _segments.rbegin()->first;
+  if (msn > last + 2) {
+    lock.unlock();
+    reply(400, {});
+  } else if (playlist_contains(msn, part)) {
+    auto playlist = current_playlist(skip);
+    lock.unlock();
+    reply(200, std::move(playlist));
+  } else {
+    // held until the playlist contains the segment or part, for at most three target durations
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3 * std::max(_target_duration, 1));
+    _blocking_requests.push_back({msn, part, skip, deadline, std::move(reply)});
+  }
+}
 auto MBMS_RT::SeamlessContentStream::tick_handler() -> void {
   if (!_running) return;
 
-  spdlog::debug("Getting playlist from CDN at {}", _playlist_path);
+  SPDLOG_DEBUG("Getting playlist from CDN at {}", _playlist_path);
   if (_cdn_client) {
-    _cdn_client->get(_playlist_path,
-                     [&](std::shared_ptr<CdnFile> file) -> void { //NOLINT
-                       spdlog::debug("Playlist received from CDN");
-                       handle_playlist(std::string(file->buffer(), file->length()), MBMS_RT::ItemSource::CDN);
-                     });
+    std::weak_ptr<ContentStream> weak = weak_from_this();
+    _cdn_client->get(_playlist_path, _strand.wrap(
+                     [weak](std::shared_ptr<CdnFile> file) -> void { //NOLINT
+                       auto self = std::static_pointer_cast<SeamlessContentStream>(weak.lock());
+                       if (self && file) {
+                         SPDLOG_DEBUG("Playlist received from CDN");
+                         LatencyTrace::instance().record(LatencyTrace::Stage::CdnReceived, self->_playlist_path,
+                             self->_base);
+                         self->_counters->cdn_objects++;
+                         self->_counters->cdn_bytes += file->length();
+                         self->handle_playlist(std::string(file->buffer(), file->length()), MBMS_RT::ItemSource::CDN);
+                       }
+                     }));
   }
+  expire_blocking_requests();
+
   _timer.expires_at(_timer.expires_at() + _tick_interval);
-  _timer.async_wait(boost::bind(&SeamlessContentStream::tick_handler, this)); //NOLINT
+  schedule_tick();
+}
+
+auto MBMS_RT::SeamlessContentStream::expire_blocking_requests() -> void {
+  std::unique_lock<std::mutex> lock(_segments_mutex);
+  auto now = std::chrono::steady_clock::now();
+  auto expired = take_blocking_requests([now](const BlockingRequest &r) { return r.deadline <= now; });
+  lock.unlock();
+  for (auto &request : expired) {
+    request.reply(503, {});
+  }
 }
 
@@ -24,7 +24,11 @@
 #include "CacheManagement.h"
 #include "CdnClient.h"
 #include "seamless/Segment.h"
+#include "seamless/DvrIndex.h"
 #include "ContentStream.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <mutex>
 
 namespace MBMS_RT {
@@ -39,27 +43,93 @@ namespace MBMS_RT {
       void set_cdn_endpoint(const std::string& cdn_ept);
       virtual void flute_file_received(std::shared_ptr<LibFlute::File> file);
 
+      virtual void start();
+      virtual void drain();
+      virtual void reconfigure(const libconfig::Config& cfg);
+      virtual bool same_configuration(const ContentStream& other) const;
+
       std::string cdn_endpoint() const { return _cdn_endpoint + _playlist_path; };
+
+      /**
+       * Segments that were removed from the playlist without having been received via broadcast
+       */
+      virtual uint64_t lost_objects() const { return _counters->lost_objects; };
+      /**
+       * Answers a request for the generated playlist. Blocking playlist reloads (_HLS_msn, _HLS_part) are held until
+       * the requested segment or part is listed, and answered with 503 after three target durations.
+       * _HLS_skip requests get a delta update.
+       */
+      void playlist_request(const std::map<std::string, std::string>& query, CachedPlaylist::reply_cb_t reply);
+
     private:
+      struct BlockingRequest {
+        int msn;
+        int part;
+        bool skip;
+        std::chrono::steady_clock::time_point deadline;
+        CachedPlaylist::reply_cb_t reply;
+      };
+      struct PartObject {
+        std::shared_ptr<Segment> part;
+        std::shared_ptr<CacheItem> item;
+      };
+
       void handle_playlist( const std::string& content, ItemSource source);
+      std::vector<HlsMediaPlaylist::Part> local_parts(const std::vector<HlsMediaPlaylist::Part>& parts);
+      void add_part_object(const std::string& location);
+      MediaInspector::Track init_track(const std::string& map);
+      void add_to_time_shift_buffer(const Segment& segment);
+      void expire_time_shift_buffer();
+      std::string time_shift_playlist(const std::map<std::string, std::string>& query) const;
+      void apply_media_timing(Segment& segment, const Segment* previous) const;
+      bool playlist_contains(int msn, int part) const;
+      std::string current_playlist(bool skip) const;
+      std::vector<BlockingRequest> take_blocking_requests(const std::function<bool(const BlockingRequest&)>& predicate);
+      void expire_blocking_requests();
       void tick_handler();
+      void schedule_tick();
 
       std::string _cdn_endpoint = "none";
       std::shared_ptr<CdnClient> _cdn_client;
       std::string _playlist_dir;
       std::string _playlist = "none";
+      std::shared_ptr<CacheItem> _playlist_item;
       std::string _manifest;
 
       std::map<int, std::shared_ptr<Segment>> _segments;
       std::map<std::string, std::shared_ptr<LibFlute::File>> _flute_files;
       std::mutex _segments_mutex;
+      // fMP4 initialization segments (EXT-X-MAP URI) and their track
+      std::map<std::string, MediaInspector::Track> _init_tracks;
+
+      // Low-Latency HLS state of the live edge, guarded by _segments_mutex like the segments
+      std::map<std::string, PartObject> _parts;
+      std::vector<HlsMediaPlaylist::Part> _pending_parts;
+      HlsMediaPlaylist::PreloadHint _preload_hint;
+      std::vector<HlsMediaPlaylist::RenditionReport> _rendition_reports;
+      HlsMediaPlaylist::ServerControl _server_control;
+      double _part_target = 0;
+      int _target_duration = 0;
+      std::vector<BlockingRequest> _blocking_requests;
+
+      // Time-shift buffer: segments that have left the live playlist, indexed by program date-time
+      unsigned _dvr_window = 0;
+      DvrIndex _dvr_index;
+      std::map<int, std::shared_ptr<Segment>> _dvr_segments;
+      int _dvr_discontinuity_sequence = 0;
+
+      // offsets of the segments in _playlist, for delta updates
+      std::vector<size_t> _segment_offsets;
+      size_t _skippable_segments = 0;
+      bool _delta_updates = true;
 
       boost::posix_time::seconds _tick_interval;
       boost::asio::deadline_timer _timer;
 
       int _segments_to_keep = 10;
+      int _discontinuity_sequence = 0;
       int _truncate_cdn_playlist_segments = 7;
       
-      bool _running = true;
+      std::atomic<bool> _running = {false};
   };
 }
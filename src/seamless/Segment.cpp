@@ -16,53 +16,93 @@
 //
 
 #include "Segment.h"
+#include <algorithm>
 #include <future>
 
+#include "LatencyTrace.h"
 #include "spdlog/spdlog.h"
 
-MBMS_RT::Segment::Segment(std::string content_location,
-    int seq, double extinf)
+MBMS_RT::Segment::Segment(std::string content_location, HlsMediaPlaylist::Segment entry)
   : _content_location( std::move(content_location) )
-  , _seq(seq)
-  , _extinf(extinf)
+  , _entry( std::move(entry) )
+  , _byterange( _entry.byterange )
 {
-  spdlog::debug(" Segment at {} created", _content_location);
+  SPDLOG_DEBUG(" Segment at {} created", _content_location);
 }
 
 MBMS_RT::Segment::~Segment() {
-  spdlog::debug(" Segment at {} destroyed", _content_location);
+  SPDLOG_DEBUG(" Segment at {} destroyed", _content_location);
 }
 
 auto MBMS_RT::Segment::fetch_from_cdn() -> void
 {
-  if (_cdn_client) {
-    spdlog::debug("Requesting segment from CDN at {}", _content_location);
+  if (_cdn_client && !_cdn_fetch_pending.exchange(true)) {
+    SPDLOG_DEBUG("Requesting segment from CDN at {}", _content_location);
+    std::weak_ptr<Segment> weak = weak_from_this();
     _cdn_client->get(_content_location,
-        [&](std::shared_ptr<CdnFile> file) -> void {
-        spdlog::debug("Segment at {} received data from CDN", _content_location);
-        _content_received_at = time(nullptr);
-        _cdn_file = std::move(file);
+        [weak](std::shared_ptr<CdnFile> file) -> void {
+        auto self = weak.lock();
+        if (!self) {
+          return;
+        }
+        if (file) {
+          SPDLOG_DEBUG("Segment at {} received data from CDN", self->_content_location);
+          LatencyTrace::instance().record(LatencyTrace::Stage::CdnReceived, self->_content_location);
+          if (self->_counters) {
+            self->_counters->cdn_objects++;
+            self->_counters->cdn_bytes += file->length();
+          }
+          auto timing = self->inspect(file->buffer(), file->length());
+          const std::lock_guard<std::mutex> lock(self->_mutex);
+          self->_content_received_at = time(nullptr);
+          self->_cdn_file = std::move(file);
+          if (timing.valid && !self->_timing.valid) {
+            self->_timing = std::move(timing);
+          }
+        }
+        self->_cdn_fetch_pending = false;
         });
   }
 }
 
+auto MBMS_RT::Segment::inspect(const char* data, size_t length) const -> MediaInspector::Timing
+{
+  MediaInspector::Track track;
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    track = _track;
+  }
+  if (_byterange.length > 0) {
+    // the segment is a range of a larger object, its position is unknown if it follows the previous range
+    if (_byterange.offset < 0 || static_cast<uint64_t>(_byterange.offset) >= length) {
+      return {};
+    }
+    auto offset = static_cast<size_t>(_byterange.offset);
+    return MediaInspector::inspect(data + offset, std::min<size_t>(_byterange.length, length - offset), track);
+  }
+  return MediaInspector::inspect(data, length, track);
+}
+
 auto MBMS_RT::Segment::buffer() -> char*
 {
-  if (_flute_file && _flute_file->complete()) {
-    spdlog::debug("Segment at {} returning FLUTE file buffer ptr", _content_location);
-    return _flute_file->buffer();
-  } else if (_cdn_file) {
-    spdlog::debug("Segment at {} returning CDN file buffer ptr", _content_location);
-    return _cdn_file->buffer();
-  } else {
-    fetch_from_cdn();
-    spdlog::debug("Segment at {} has no data", _content_location);
-    return nullptr;
-  };
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    if (_flute_file && _flute_file->complete()) {
+      SPDLOG_TRACE("Segment at {} returning FLUTE file buffer ptr", _content_location);
+      return _flute_file->buffer();
+    } else if (_cdn_file) {
+      SPDLOG_TRACE("Segment at {} returning CDN file buffer ptr", _content_location);
+      return _cdn_file->buffer();
+    }
+  }
+  fetch_from_cdn();
+  SPDLOG_TRACE("Segment at {} has no data", _content_location);
+  return nullptr;
 }
 
 auto MBMS_RT::Segment::content_length() const -> uint32_t
 {
+  const std::lock_guard<std::mutex> lock(_mutex);
   if (_flute_file &&_flute_file->complete()) {
     return _flute_file->length();
   } else if (_cdn_file) {
@@ -74,6 +114,7 @@ auto MBMS_RT::Segment::content_length() const -> uint32_t
 
 auto MBMS_RT::Segment::data_source() const -> MBMS_RT::ItemSource
 {
+  const std::lock_guard<std::mutex> lock(_mutex);
   if (_flute_file &&_flute_file->complete()) {
     return MBMS_RT::ItemSource::Broadcast;
   } else if (_cdn_file) {
@@ -17,44 +17,105 @@
 
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
 #include "File.h"
+#include "FluteCapture.h"
 #include "seamless/CdnClient.h"
 #include "seamless/CdnFile.h"
 #include "ItemSource.h"
+#include "ReceptionCounters.h"
+#include "HlsMediaPlaylist.h"
+#include "MediaInspector.h"
 #include "Segment.h"
 
 namespace MBMS_RT {
-  class Segment {
+  class Segment : public std::enable_shared_from_this<Segment> {
     public:
-      Segment(std::string content_location, 
-          int seq, double extinf);
+      /**
+       * @param entry the segment as listed in the source playlist, including its tags
+       */
+      Segment(std::string content_location, HlsMediaPlaylist::Segment entry);
       virtual ~Segment();
 
       char* buffer();
       uint32_t content_length() const;
       virtual ItemSource data_source() const;
 
-      void set_cdn_client(std::shared_ptr<CdnClient> client) { _cdn_client = client; };
+      void set_cdn_client(std::shared_ptr<CdnClient> client, std::shared_ptr<ReceptionCounters> counters = nullptr) {
+        _cdn_client = client;
+        _counters = counters;
+      };
       void fetch_from_cdn();
 
-      void set_flute_file(std::shared_ptr<LibFlute::File> file) { _flute_file = file; _content_received_at = file->received_at(); };
+      void set_flute_file(std::shared_ptr<LibFlute::File> file) {
+        auto timing = file->complete() ? inspect(file->buffer(), file->length()) : MediaInspector::Timing();
+        const std::lock_guard<std::mutex> lock(_mutex);
+        _flute_file = file;
+        _content_received_at = FluteCapture::received_at(*file);
+        if (timing.valid) {
+          _timing = std::move(timing);
+        }
+      };
+
+      /**
+       * fMP4: the track (id, timescale) from the initialization segment, needed to inspect the media data.
+       * Must be set before data is received.
+       */
+      void set_track(MediaInspector::Track track) {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        _track = track;
+      };
+
+      /**
+       * Timing measured in the received media data, invalid until data has been received
+       */
+      MediaInspector::Timing timing() const {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        return _timing;
+      };
 
       std::string uri() const { return _content_location; };
-      int seq() const { return _seq; };
-      double extinf() const { return _extinf; };
+      int seq() const { return _entry.seq; };
+      double extinf() const { return _entry.extinf; };
+      const HlsMediaPlaylist::Segment& playlist_entry() const { return _entry; };
+      /**
+       * Replaces the partial segments listed for this segment. Only called by the owning stream, which
+       * serializes access to the playlist entries.
+       */
+      void set_parts(std::vector<HlsMediaPlaylist::Part> parts) { _entry.parts = std::move(parts); };
+      void set_playlist_entry(HlsMediaPlaylist::Segment entry) { _entry = std::move(entry); };
 
       unsigned long received_at() const { return _content_received_at; };
+
+      /**
+       * Retained segments (time-shift buffer) are not removed from the cache by age or size
+       */
+      bool retained() const { return _retained; };
+      void set_retained(bool retained) { _retained = retained; };
     private:
+      MediaInspector::Timing inspect(const char* data, size_t length) const;
+
+      // Segments are served from the REST API threads while the CDN response arrives on a cpprest thread
+      mutable std::mutex _mutex;
+      std::atomic<bool> _cdn_fetch_pending = {false};
+
       std::string _content_location;
       std::shared_ptr<CdnClient> _cdn_client;
+      std::shared_ptr<ReceptionCounters> _counters;
 
       std::shared_ptr<LibFlute::File> _flute_file;
       std::shared_ptr<CdnFile> _cdn_file;
-      int _seq;
-      double _extinf;
+      HlsMediaPlaylist::Segment _entry;
+      // copied from the entry, which is modified by the owning stream while data is inspected
+      const HlsMediaPlaylist::ByteRange _byterange;
+      MediaInspector::Track _track;
+      MediaInspector::Timing _timing;
 
-      unsigned long _content_received_at = 0;
+      std::atomic<unsigned long> _content_received_at = {0};
+      std::atomic<bool> _retained = {false};
 
   };
 }
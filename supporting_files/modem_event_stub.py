@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+#
+# 5G-MAG Reference Tools
+# MBMS Middleware Process
+#
+# Local stand-in for the modem side of the middleware's modem event channel (mw.modem_events).
+# Listens on a Unix domain socket, sends the current MCH info and status to every connecting middleware,
+# and pushes an event whenever the state is changed through commands on stdin:
+#
+#   add <tmgi> <dest>    announce an MTCH, e.g. "add 000000000001 238.1.1.95:40085"
+#   remove <tmgi>        remove an MTCH
+#   cinr <db>            change the reported CINR
+#   drop                 disconnect all clients (to test the fallback to polling)
+#
+import argparse
+import json
+import os
+import selectors
+import socket
+import sys
+
+
+def main():
+    parser = argparse.ArgumentParser(description="5G-MAG-RT modem event channel stub")
+    parser.add_argument("--socket", default="/tmp/5gmag-rt-modem-events.sock", help="Unix domain socket path")
+    parser.add_argument("--mtch", action="append", default=[], metavar="TMGI=DEST", help="initial MTCH")
+    parser.add_argument("--cinr", type=float, default=20.0, help="initial CINR in dB")
+    args = parser.parse_args()
+
+    mtchs = dict(m.split("=", 1) for m in args.mtch)
+    status = {"cinr_db": args.cinr}
+
+    def mch_info_event():
+        return {"type": "mch_info",
+                "mch_info": [{"mcs": 0, "mtchs": [{"tmgi": t, "dest": d, "lcid": i + 1}
+                                                  for i, (t, d) in enumerate(sorted(mtchs.items()))]}]}
+
+    def status_event():
+        return {"type": "status", "status": status}
+
+    if os.path.exists(args.socket):
+        os.unlink(args.socket)
+    server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    server.bind(args.socket)
+    server.listen()
+    server.setblocking(False)
+
+    sel = selectors.DefaultSelector()
+    sel.register(server, selectors.EVENT_READ, "accept")
+    sel.register(sys.stdin, selectors.EVENT_READ, "stdin")
+    clients = []
+
+    def send(client, event):
+        try:
+            client.sendall((json.dumps(event) + "\n").encode())
+        except OSError:
+            close(client)
+
+    def broadcast(event):
+        for client in list(clients):
+            send(client, event)
+
+    def close(client):
+        if client in clients:
+            clients.remove(client)
+            sel.unregister(client)
+            client.close()
+
+    print(f"Modem event stub listening on {args.socket}", flush=True)
+    try:
+        while True:
+            for key, _ in sel.select():
+                if key.data == "accept":
+                    client, _ = server.accept()
+                    clients.append(client)
+                    sel.register(client, selectors.EVENT_READ, "client")
+                    print("middleware connected", flush=True)
+                    send(client, mch_info_event())
+                    send(client, status_event())
+                elif key.data == "client":
+                    # the middleware does not send anything, readable means it disconnected
+                    if not key.fileobj.recv(4096):
+                        close(key.fileobj)
+                        print("middleware disconnected", flush=True)
+                else:
+                    line = sys.stdin.readline()
+                    if not line:
+                        return
+                    cmd = line.split()
+                    if not cmd:
+                        continue
+                    if cmd[0] == "add" and len(cmd) == 3:
+                        mtchs[cmd[1]] = cmd[2]
+                        broadcast(mch_info_event())
+                    elif cmd[0] == "remove" and len(cmd) == 2:
+                        mtchs.pop(cmd[1], None)
+                        broadcast(mch_info_event())
+                    elif cmd[0] == "cinr" and len(cmd) == 2:
+                        status["cinr_db"] = float(cmd[1])
+                        broadcast(status_event())
+                    elif cmd[0] == "drop":
+                        for client in list(clients):
+                            close(client)
+                    else:
+                        print("unknown command", flush=True)
+    finally:
+        server.close()
+        os.unlink(args.socket)
+
+
+if __name__ == "__main__":
+    main()
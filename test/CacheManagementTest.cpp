@@ -0,0 +1,149 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include <algorithm>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <libconfig.h++>
+#include <boost/asio.hpp>
+#include <gtest/gtest.h>
+
+#include "CacheManagement.h"
+
+namespace {
+  class TestItem : public MBMS_RT::CacheItem {
+    public:
+      TestItem(const std::string& content_location, unsigned long received_at, uint32_t length,
+          bool retained = false)
+        : CacheItem(content_location, received_at)
+        , _length(length)
+        , _retained(retained) {}
+
+      ItemType item_type() const override { return ItemType::Segment; };
+      char* buffer() const override { return nullptr; };
+      uint32_t content_length() const override { return _length; };
+      MBMS_RT::ItemSource item_source() const override { return MBMS_RT::ItemSource::Broadcast; };
+      bool retained() const override { return _retained; };
+
+    private:
+      uint32_t _length;
+      bool _retained;
+  };
+
+  constexpr unsigned ITEMS = 10000;
+
+  class CacheManagementTest : public ::testing::Test {
+    protected:
+      // max_total_size is in MB
+      void configure(unsigned max_total_size, unsigned max_file_age) {
+        _cfg.readString("mw = { cache = { max_total_size = " + std::to_string(max_total_size) +
+            "; max_file_age = " + std::to_string(max_file_age) + "; }; };");
+        _cache = std::make_unique<MBMS_RT::CacheManagement>(_cfg, _io_service);
+      }
+
+      static auto location(unsigned i) -> std::string {
+        return "watchfolder/1080p/segment-" + std::to_string(i) + ".m4s";
+      }
+
+      libconfig::Config _cfg;
+      boost::asio::io_service _io_service;
+      std::unique_ptr<MBMS_RT::CacheManagement> _cache;
+  };
+}
+
+TEST_F(CacheManagementTest, RemovesExpiredItems) {
+  configure(512, 30);
+  auto now = time(nullptr);
+  for (unsigned i = 0; i < ITEMS; i++) {
+    // every other item is older than the maximum age
+    _cache->add_item(std::make_shared<TestItem>(location(i), now - (i % 2 == 0 ? 60 : 10), 1000));
+  }
+  _cache->check_file_expiry_and_cache_size();
+
+  auto items = _cache->item_map();
+  EXPECT_EQ(items.size(), ITEMS / 2);
+  for (unsigned i = 0; i < ITEMS; i++) {
+    ASSERT_EQ(items.count(location(i)), i % 2 == 0 ? 0U : 1U) << location(i);
+  }
+}
+
+TEST_F(CacheManagementTest, KeepsRetainedAndUntimedItems) {
+  configure(512, 30);
+  auto now = time(nullptr);
+  _cache->add_item(std::make_shared<TestItem>("retained.m4s", now - 3600, 1000, true));
+  _cache->add_item(std::make_shared<TestItem>("manifest.m3u8", 0, 1000));
+  _cache->add_item(std::make_shared<TestItem>("expired.m4s", now - 3600, 1000));
+  _cache->check_file_expiry_and_cache_size();
+
+  EXPECT_NE(_cache->item("retained.m4s"), nullptr);
+  EXPECT_NE(_cache->item("manifest.m3u8"), nullptr);
+  EXPECT_EQ(_cache->item("expired.m4s"), nullptr);
+}
+
+TEST_F(CacheManagementTest, EvictsOldestItemsAboveSizeLimit) {
+  configure(1, 3600);
+  auto now = time(nullptr);
+  constexpr uint32_t size = 200;
+  // 2 MB in total, ages from 0 to 999 seconds
+  auto received_at = [now](unsigned i) -> unsigned long { return now - (i * 7919) % 1000; };
+  for (unsigned i = 0; i < ITEMS; i++) {
+    _cache->add_item(std::make_shared<TestItem>(location(i), received_at(i), size));
+  }
+  _cache->check_file_expiry_and_cache_size();
+
+  auto items = _cache->item_map();
+  EXPECT_EQ(items.size(), 1024U * 1024 / size);
+  auto oldest_kept = static_cast<unsigned long>(now);
+  for (const auto& item : items) {
+    oldest_kept = std::min(oldest_kept, item.second->received_at());
+  }
+  for (unsigned i = 0; i < ITEMS; i++) {
+    if (items.count(location(i)) == 0) {
+      ASSERT_LE(received_at(i), oldest_kept) << location(i);
+    }
+  }
+}
+
+TEST_F(CacheManagementTest, RetainedItemsCountAgainstSizeLimit) {
+  configure(1, 30);
+  auto now = time(nullptr);
+  constexpr uint32_t size = 400 * 1024;
+  // the DVR window alone exceeds the size limit, its oldest segments go first
+  _cache->add_item(std::make_shared<TestItem>("retained_0.m4s", now - 3600, size, true));
+  _cache->add_item(std::make_shared<TestItem>("retained_1.m4s", now - 1800, size, true));
+  _cache->add_item(std::make_shared<TestItem>("retained_2.m4s", now - 60, size, true));
+  _cache->add_item(std::make_shared<TestItem>("live.m4s", now, size));
+  _cache->check_file_expiry_and_cache_size();
+
+  EXPECT_EQ(_cache->item("retained_0.m4s"), nullptr);
+  EXPECT_EQ(_cache->item("retained_1.m4s"), nullptr);
+  EXPECT_NE(_cache->item("retained_2.m4s"), nullptr);
+  EXPECT_NE(_cache->item("live.m4s"), nullptr);
+}
+
+TEST_F(CacheManagementTest, UnchangedCacheIsKept) {
+  configure(512, 30);
+  auto now = time(nullptr);
+  for (unsigned i = 0; i < ITEMS; i++) {
+    _cache->add_item(std::make_shared<TestItem>(location(i), now, 1000));
+  }
+  _cache->check_file_expiry_and_cache_size();
+  _cache->check_file_expiry_and_cache_size();
+  EXPECT_EQ(_cache->item_map().size(), ITEMS);
+}
@@ -0,0 +1,94 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include <string>
+#include <libconfig.h++>
+#include <boost/asio.hpp>
+#include <gtest/gtest.h>
+
+#include "ContentStream.h"
+#include "CacheManagement.h"
+
+using MBMS_RT::ContentStream;
+
+namespace {
+  const char* const SDP =
+    "v=0\n"
+    "o=5GMAG 1700000000 1 IN IP4 10.10.10.1\n"
+    "s=5G-MAG Sample Service 1080p\n"
+    "t=0 0\n"
+    "c=IN IP4 238.1.1.111/255\n"
+    "m=application 40101 FLUTE/UDP 0\n"
+    "a=flute-tsi:17\n"
+    "a=flute-ch:1\n"
+    "a=source-filter: incl IN IP4 238.1.1.111 10.10.10.1\n";
+
+  class ContentStreamSdp : public ::testing::Test {
+    protected:
+      auto make_stream() -> std::shared_ptr<ContentStream> {
+        return std::make_shared<ContentStream>("http://localhost/watchfolder/hls-1080p.m3u8", "lo", _io_service,
+            _cache, MBMS_RT::DeliveryProtocol::HLS, _cfg);
+      }
+
+      libconfig::Config _cfg;
+      boost::asio::io_service _io_service;
+      MBMS_RT::CacheManagement _cache{_cfg, _io_service};
+  };
+}
+
+TEST_F(ContentStreamSdp, ConfiguresFluteSession) {
+  auto stream = make_stream();
+  ASSERT_TRUE(stream->configure_5gbc_delivery_from_sdp(SDP));
+  EXPECT_EQ(stream->flute_info(), "FLUTE/UDP: 238.1.1.111:40101, TSI 17");
+}
+
+TEST_F(ContentStreamSdp, AcceptsCrlfLineEndings) {
+  std::string crlf;
+  for (const char* c = SDP; *c != '\0'; c++) {
+    if (*c == '\n') crlf += '\r';
+    crlf += *c;
+  }
+  auto stream = make_stream();
+  ASSERT_TRUE(stream->configure_5gbc_delivery_from_sdp(crlf));
+  EXPECT_EQ(stream->flute_info(), "FLUTE/UDP: 238.1.1.111:40101, TSI 17");
+}
+
+TEST_F(ContentStreamSdp, MediaLineWithoutFormat) {
+  auto stream = make_stream();
+  ASSERT_TRUE(stream->configure_5gbc_delivery_from_sdp("c=IN IP4 238.1.1.95\nm=application 40085 FLUTE/UDP\n"));
+  EXPECT_EQ(stream->flute_info(), "FLUTE/UDP: 238.1.1.95:40085, TSI 0");
+}
+
+TEST_F(ContentStreamSdp, RejectsIncompleteSession) {
+  auto stream = make_stream();
+  EXPECT_FALSE(stream->configure_5gbc_delivery_from_sdp("v=0\nm=application 40101 FLUTE/UDP 0\na=flute-tsi:1\n"));
+  EXPECT_FALSE(make_stream()->configure_5gbc_delivery_from_sdp("v=0\nc=IN IP4 238.1.1.111\n"));
+  EXPECT_FALSE(make_stream()->configure_5gbc_delivery_from_sdp(""));
+}
+
+TEST_F(ContentStreamSdp, SameConfigurationComparesTheSession) {
+  auto a = make_stream();
+  auto b = make_stream();
+  ASSERT_TRUE(a->configure_5gbc_delivery_from_sdp(SDP));
+  ASSERT_TRUE(b->configure_5gbc_delivery_from_sdp(SDP));
+  EXPECT_TRUE(a->same_configuration(*b));
+
+  auto c = make_stream();
+  ASSERT_TRUE(c->configure_5gbc_delivery_from_sdp(std::string(SDP) + "a=flute-tsi:18\n"));
+  EXPECT_FALSE(a->same_configuration(*c));
+}
@@ -0,0 +1,139 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "HlsMediaPlaylist.h"
+#include "Fixtures.h"
+
+using MBMS_RT::HlsMediaPlaylist;
+
+namespace {
+  const char* const VOD_PLAYLIST =
+    "#EXTM3U\n"
+    "#EXT-X-VERSION:7\n"
+    "#EXT-X-TARGETDURATION:4\n"
+    "#EXT-X-PLAYLIST-TYPE:VOD\n"
+    "#EXT-X-MEDIA-SEQUENCE:7\n"
+    "#EXT-X-MAP:URI=\"init.mp4\"\n"
+    "#EXTINF:4.000,first\n"
+    "segment-7.m4s\n"
+    "#EXT-X-BYTERANGE:1000@0\n"
+    "#EXTINF:3.500,\n"
+    "segment-8.m4s\n"
+    "#EXT-X-ENDLIST\n";
+}
+
+TEST(HlsMediaPlaylist, ParsesSegments) {
+  HlsMediaPlaylist playlist(VOD_PLAYLIST);
+  EXPECT_EQ(playlist.version(), 7);
+  EXPECT_EQ(playlist.target_duration(), 4);
+  EXPECT_EQ(playlist.playlist_type(), "VOD");
+  EXPECT_TRUE(playlist.ended());
+
+  const auto& segments = playlist.segments();
+  ASSERT_EQ(segments.size(), 2U);
+  EXPECT_EQ(segments[0].uri, "segment-7.m4s");
+  EXPECT_EQ(segments[0].seq, 7);
+  EXPECT_DOUBLE_EQ(segments[0].extinf, 4.0);
+  EXPECT_EQ(segments[0].title, "first");
+  EXPECT_EQ(segments[0].map, "URI=\"init.mp4\"");
+  EXPECT_EQ(segments[0].byterange.length, 0U);
+  EXPECT_EQ(segments[1].seq, 8);
+  EXPECT_DOUBLE_EQ(segments[1].extinf, 3.5);
+  EXPECT_EQ(segments[1].map, "URI=\"init.mp4\"");
+  EXPECT_EQ(segments[1].byterange.length, 1000U);
+  EXPECT_EQ(segments[1].byterange.offset, 0);
+}
+
+TEST(HlsMediaPlaylist, ParsesLowLatencyTags) {
+  HlsMediaPlaylist playlist(MBMS_RT::Bench::hls_media_playlist(10, 2));
+  EXPECT_DOUBLE_EQ(playlist.part_target(), 0.5);
+  EXPECT_TRUE(playlist.server_control().can_block_reload);
+  EXPECT_DOUBLE_EQ(playlist.server_control().part_hold_back, 1.5);
+  EXPECT_DOUBLE_EQ(playlist.server_control().can_skip_until, 12.0);
+  EXPECT_EQ(playlist.discontinuity_sequence(), 3);
+
+  const auto& segments = playlist.segments();
+  ASSERT_EQ(segments.size(), 10U);
+  EXPECT_EQ(segments.front().seq, 100000);
+  EXPECT_EQ(segments.front().program_date_time, "2023-11-14T22:13:20.000Z");
+  EXPECT_EQ(segments.front().key,
+      "METHOD=SAMPLE-AES,URI=\"skd://key-1\",KEYFORMAT=\"com.apple.streamingkeydelivery\"");
+  EXPECT_TRUE(segments[7].parts.empty());
+  ASSERT_EQ(segments[8].parts.size(), 4U);
+  EXPECT_EQ(segments[8].parts[0].uri, "video-1080p-100008.0.m4s");
+  EXPECT_TRUE(segments[8].parts[0].independent);
+  EXPECT_FALSE(segments[8].parts[1].independent);
+  EXPECT_DOUBLE_EQ(segments[8].parts[1].duration, 0.5);
+
+  ASSERT_EQ(playlist.pending_parts().size(), 1U);
+  EXPECT_EQ(playlist.pending_parts()[0].uri, "video-1080p-100010.0.m4s");
+  EXPECT_EQ(playlist.preload_hint().type, "PART");
+  EXPECT_EQ(playlist.preload_hint().uri, "video-1080p-100010.1.m4s");
+  ASSERT_EQ(playlist.rendition_reports().size(), 1U);
+  EXPECT_EQ(playlist.rendition_reports()[0].uri, "../720p/index.m3u8");
+  EXPECT_EQ(playlist.rendition_reports()[0].last_msn, 100010);
+  EXPECT_EQ(playlist.rendition_reports()[0].last_part, 0);
+}
+
+TEST(HlsMediaPlaylist, ThousandsOfSegments) {
+  HlsMediaPlaylist playlist(MBMS_RT::Bench::hls_media_playlist(5000));
+  const auto& segments = playlist.segments();
+  ASSERT_EQ(segments.size(), 5000U);
+  for (size_t i = 0; i < segments.size(); i++) {
+    ASSERT_EQ(segments[i].seq, static_cast<int>(100000 + i));
+    ASSERT_EQ(segments[i].discontinuity, i > 0 && i % 500 == 0) << "segment " << i;
+  }
+  EXPECT_EQ(segments.back().uri, "video-1080p-104999.m4s");
+}
+
+TEST(HlsMediaPlaylist, RoundTrip) {
+  HlsMediaPlaylist playlist(MBMS_RT::Bench::hls_media_playlist(1200));
+  std::vector<size_t> offsets;
+  auto out = playlist.to_string(&offsets);
+  ASSERT_EQ(offsets.size(), playlist.segments().size());
+  EXPECT_EQ(out.compare(offsets[600], 22, "#EXT-X-PROGRAM-DATE-TI"), 0);
+
+  HlsMediaPlaylist parsed(out);
+  ASSERT_EQ(parsed.segments().size(), playlist.segments().size());
+  for (size_t i = 0; i < parsed.segments().size(); i++) {
+    const auto& a = playlist.segments()[i];
+    const auto& b = parsed.segments()[i];
+    ASSERT_EQ(a.uri, b.uri);
+    ASSERT_EQ(a.seq, b.seq);
+    ASSERT_DOUBLE_EQ(a.extinf, b.extinf);
+    ASSERT_EQ(a.discontinuity, b.discontinuity);
+    ASSERT_EQ(a.program_date_time, b.program_date_time);
+    ASSERT_EQ(a.key, b.key);
+    ASSERT_EQ(a.map, b.map);
+    ASSERT_EQ(a.parts.size(), b.parts.size());
+  }
+  EXPECT_EQ(parsed.pending_parts().size(), playlist.pending_parts().size());
+  EXPECT_EQ(parsed.preload_hint().uri, playlist.preload_hint().uri);
+  EXPECT_EQ(parsed.rendition_reports().size(), playlist.rendition_reports().size());
+  EXPECT_EQ(parsed.to_string(), out);
+}
+
+TEST(HlsMediaPlaylist, RejectsInvalidContent) {
+  EXPECT_THROW(HlsMediaPlaylist("not a playlist\n"), std::runtime_error);
+  EXPECT_THROW(HlsMediaPlaylist(""), std::runtime_error);
+}
@@ -0,0 +1,92 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include <string>
+#include <gtest/gtest.h>
+
+#include "HlsPrimaryPlaylist.h"
+
+using MBMS_RT::HlsPrimaryPlaylist;
+
+namespace {
+  // parse_parameters() is private, its results are checked through the streams of a parsed playlist
+  auto parse_stream(const std::string& attributes) -> HlsPrimaryPlaylist::Stream {
+    HlsPrimaryPlaylist playlist("#EXTM3U\n#EXT-X-STREAM-INF:" + attributes + "\nvideo/index.m3u8\n", "");
+    EXPECT_EQ(playlist.streams().size(), 1U);
+    return playlist.streams().empty() ? HlsPrimaryPlaylist::Stream{} : playlist.streams()[0];
+  }
+}
+
+TEST(HlsPrimaryPlaylist, ParsesAttributes) {
+  auto stream = parse_stream("BANDWIDTH=5000000,RESOLUTION=1920x1080,FRAME-RATE=50.000,CODECS=\"avc1.640028\"");
+  EXPECT_EQ(stream.uri, "video/index.m3u8");
+  EXPECT_EQ(stream.bandwidth, 5000000U);
+  EXPECT_EQ(stream.resolution, "1920x1080");
+  EXPECT_DOUBLE_EQ(stream.frame_rate, 50.0);
+  EXPECT_EQ(stream.codecs, "avc1.640028");
+}
+
+TEST(HlsPrimaryPlaylist, QuotedValuesContainCommas) {
+  auto stream = parse_stream("CODECS=\"avc1.4d401f,mp4a.40.2\",BANDWIDTH=2000000,RESOLUTION=1280x720");
+  EXPECT_EQ(stream.codecs, "avc1.4d401f,mp4a.40.2");
+  EXPECT_EQ(stream.bandwidth, 2000000U);
+  EXPECT_EQ(stream.resolution, "1280x720");
+}
+
+TEST(HlsPrimaryPlaylist, IgnoresUnknownAttributes) {
+  auto stream = parse_stream("AVERAGE-BANDWIDTH=900000,BANDWIDTH=1000000,AUDIO=\"aac\",HDCP-LEVEL=NONE");
+  EXPECT_EQ(stream.bandwidth, 1000000U);
+  EXPECT_TRUE(stream.resolution.empty());
+  EXPECT_TRUE(stream.codecs.empty());
+}
+
+TEST(HlsPrimaryPlaylist, AttributesApplyToTheNextUriOnly) {
+  HlsPrimaryPlaylist playlist(
+      "#EXTM3U\n"
+      "#EXT-X-VERSION:3\n"
+      "#EXT-X-STREAM-INF:BANDWIDTH=5000000,RESOLUTION=1920x1080\n"
+      "1080p/index.m3u8\n"
+      "\n"
+      "2160p/index.m3u8\n", "watchfolder/");
+  ASSERT_EQ(playlist.streams().size(), 2U);
+  EXPECT_EQ(playlist.streams()[0].uri, "watchfolder/1080p/index.m3u8");
+  EXPECT_EQ(playlist.streams()[0].bandwidth, 5000000U);
+  EXPECT_EQ(playlist.streams()[1].uri, "watchfolder/2160p/index.m3u8");
+  EXPECT_EQ(playlist.streams()[1].bandwidth, 0U);
+  EXPECT_TRUE(playlist.streams()[1].resolution.empty());
+}
+
+TEST(HlsPrimaryPlaylist, RoundTrip) {
+  HlsPrimaryPlaylist playlist;
+  playlist.add_stream({"/1080p/index.m3u8", "1920x1080", "avc1.640028,mp4a.40.2", 5000000, 50});
+  playlist.add_stream({"/720p/index.m3u8", "1280x720", "avc1.4d401f", 2000000, 25});
+
+  HlsPrimaryPlaylist parsed(playlist.to_string(), "");
+  ASSERT_EQ(parsed.streams().size(), 2U);
+  for (size_t i = 0; i < 2; i++) {
+    EXPECT_EQ(parsed.streams()[i].uri, playlist.streams()[i].uri);
+    EXPECT_EQ(parsed.streams()[i].resolution, playlist.streams()[i].resolution);
+    EXPECT_EQ(parsed.streams()[i].codecs, playlist.streams()[i].codecs);
+    EXPECT_EQ(parsed.streams()[i].bandwidth, playlist.streams()[i].bandwidth);
+    EXPECT_DOUBLE_EQ(parsed.streams()[i].frame_rate, playlist.streams()[i].frame_rate);
+  }
+}
+
+TEST(HlsPrimaryPlaylist, RejectsMissingHeader) {
+  EXPECT_ANY_THROW(HlsPrimaryPlaylist("#EXT-X-VERSION:3\nvideo/index.m3u8\n", ""));
+}
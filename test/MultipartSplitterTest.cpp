@@ -0,0 +1,100 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include <string>
+#include <gtest/gtest.h>
+
+#include "MultipartSplitter.h"
+#include "TestData.h"
+
+using MBMS_RT::MultipartSplitter;
+
+namespace {
+  void expect_bootstrap_parts(const MultipartSplitter& splitter, const std::string& content) {
+    ASSERT_TRUE(splitter.complete());
+    const auto& parts = splitter.parts();
+    ASSERT_EQ(parts.size(), 7U);
+    EXPECT_EQ(parts[0].content_type.in(content), "application/mbms-envelope+xml");
+    EXPECT_EQ(parts[0].content_location.in(content), "envelope.xml");
+    EXPECT_EQ(parts[1].content_location.in(content), "http://localhost/watchfolder/bundle.xml");
+    EXPECT_EQ(parts[6].content_type.in(content), "application/sdp");
+    EXPECT_EQ(parts[6].content_location.in(content), "http://localhost/watchfolder/hls-720p.sdp");
+    for (const auto& part : parts) {
+      auto body = part.body.in(content);
+      EXPECT_FALSE(body.empty());
+      EXPECT_NE(body.front(), '\n');
+      EXPECT_NE(body.back(), '\n');
+      EXPECT_NE(body.back(), '\r');
+    }
+    EXPECT_EQ(parts[2].body.in(content).substr(0, 7), "#EXTM3U");
+    EXPECT_FALSE(splitter.requires_decoding(content));
+  }
+}
+
+TEST(MultipartSplitter, SplitsBootstrap) {
+  auto content = MBMS_RT::Test::read_fixture("bootstrap.multipart");
+  MultipartSplitter splitter;
+  splitter.feed(content);
+  expect_bootstrap_parts(splitter, content);
+}
+
+TEST(MultipartSplitter, SplitsBootstrapFedIncrementally) {
+  // as while the bootstrap file is being decompressed
+  auto content = MBMS_RT::Test::read_fixture("bootstrap.multipart");
+  for (size_t chunk : {1, 7, 64, 1000}) {
+    SCOPED_TRACE(chunk);
+    MultipartSplitter splitter;
+    for (size_t length = chunk; length < content.size(); length += chunk) {
+      splitter.feed(std::string_view(content).substr(0, length));
+    }
+    splitter.feed(content);
+    expect_bootstrap_parts(splitter, content);
+  }
+}
+
+TEST(MultipartSplitter, SplitsCrlfBootstrap) {
+  auto lf = MBMS_RT::Test::read_fixture("bootstrap.multipart");
+  std::string content;
+  for (char c : lf) {
+    if (c == '\n') content += '\r';
+    content += c;
+  }
+  MultipartSplitter splitter;
+  splitter.feed(content);
+  expect_bootstrap_parts(splitter, content);
+}
+
+TEST(MultipartSplitter, DetectsTransferEncoding) {
+  std::string content =
+    "Content-Type: multipart/related; boundary=b\n\n"
+    "--b\nContent-Type: application/sdp\nContent-Location: a.sdp\nContent-Transfer-Encoding: base64\n\n"
+    "dj0w\n--b--\n";
+  MultipartSplitter splitter;
+  splitter.feed(content);
+  ASSERT_TRUE(splitter.complete());
+  ASSERT_EQ(splitter.parts().size(), 1U);
+  EXPECT_TRUE(splitter.requires_decoding(content));
+}
+
+TEST(MultipartSplitter, RejectsNonMultipart) {
+  std::string content = "Content-Type: application/sdp\n\nv=0\n";
+  MultipartSplitter splitter;
+  splitter.feed(content);
+  EXPECT_TRUE(splitter.failed());
+  EXPECT_FALSE(splitter.complete());
+}
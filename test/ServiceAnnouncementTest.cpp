@@ -0,0 +1,144 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include <map>
+#include <memory>
+#include <string>
+#include <libconfig.h++>
+#include <boost/asio.hpp>
+#include <gtest/gtest.h>
+
+#include "ServiceAnnouncement.h"
+#include "CacheManagement.h"
+#include "FluteCapture.h"
+#include "TestData.h"
+
+using MBMS_RT::ServiceAnnouncement;
+
+namespace {
+  const char* const SERVICE_ID = "urn:5gmag:sample:service:1";
+
+  class ServiceAnnouncementTest : public ::testing::Test {
+    protected:
+      ServiceAnnouncementTest() {
+        // Content streams subscribe to the (idle) capture replay instead of joining their multicast groups
+        _cfg.readString("mw = { capture = { replay = { enabled = true; }; }; };");
+        MBMS_RT::FluteCapture::instance().configure(_cfg);
+        _sa = std::make_unique<ServiceAnnouncement>(_cfg, "", "", 0, "lo", _io_service, _strand, _cache, false,
+            [this](const std::string& service_id) -> std::shared_ptr<MBMS_RT::Service> {
+              auto it = _services.find(service_id);
+              return it == _services.end() ? nullptr : it->second;
+            },
+            [this](const std::string& service_id, std::shared_ptr<MBMS_RT::Service> service) {
+              _set_service_calls++;
+              if (service) {
+                _services[service_id] = std::move(service);
+              } else {
+                _services.erase(service_id);
+              }
+            });
+      }
+
+      libconfig::Config _cfg;
+      boost::asio::io_service _io_service;
+      boost::asio::io_service::strand _strand{_io_service};
+      MBMS_RT::CacheManagement _cache{_cfg, _io_service};
+      std::map<std::string, std::shared_ptr<MBMS_RT::Service>> _services;
+      unsigned _set_service_calls = 0;
+      std::unique_ptr<ServiceAnnouncement> _sa;
+  };
+}
+
+TEST_F(ServiceAnnouncementTest, ParsesItems) {
+  _sa->parse_bootstrap(MBMS_RT::Test::read_fixture("bootstrap.multipart"));
+
+  const auto& items = _sa->items();
+  ASSERT_EQ(items.size(), 7U);
+  const auto& bundle = items.at("http://localhost/watchfolder/bundle.xml");
+  EXPECT_EQ(bundle.content_type, "application/mbms-user-service-description+xml");
+  EXPECT_EQ(bundle.version, 1U);
+  EXPECT_EQ(bundle.content.rfind("<?xml", 0), 0U);
+  EXPECT_EQ(items.at("http://localhost/watchfolder/hls-720p.sdp").content_type, "application/sdp");
+  EXPECT_EQ(items.at("envelope.xml").version, 0U);
+}
+
+TEST_F(ServiceAnnouncementTest, SetsUpServiceWithStreams) {
+  _sa->parse_bootstrap(MBMS_RT::Test::read_fixture("bootstrap.multipart"));
+
+  ASSERT_EQ(_services.size(), 1U);
+  auto service = _services.at(SERVICE_ID);
+  EXPECT_EQ(service->delivery_protocol(), MBMS_RT::DeliveryProtocol::HLS);
+  EXPECT_EQ(service->names().at("en"), "5G-MAG Sample Service");
+  EXPECT_EQ(service->names().at("de"), "5G-MAG Beispieldienst");
+  EXPECT_NE(_cache.item("watchfolder/manifest.m3u8"), nullptr);
+
+  const auto& streams = service->content_streams();
+  ASSERT_EQ(streams.size(), 2U);
+  auto hd = streams.at("watchfolder/1080p/index.m3u8");
+  EXPECT_EQ(hd->flute_info(), "FLUTE/UDP: 238.1.1.111:40101, TSI 1");
+  EXPECT_EQ(hd->resolution(), "1920x1080");
+  EXPECT_EQ(hd->codecs(), "avc1.640028,mp4a.40.2");
+  auto sd = streams.at("watchfolder/720p/index.m3u8");
+  EXPECT_EQ(sd->flute_info(), "FLUTE/UDP: 238.1.1.112:40102, TSI 2");
+  EXPECT_EQ(sd->resolution(), "1280x720");
+}
+
+TEST_F(ServiceAnnouncementTest, KeepsStreamsOfUnchangedAnnouncement) {
+  auto bootstrap = MBMS_RT::Test::read_fixture("bootstrap.multipart");
+  _sa->parse_bootstrap(bootstrap);
+  auto hd = _services.at(SERVICE_ID)->content_streams().at("watchfolder/1080p/index.m3u8");
+
+  _sa->parse_bootstrap(bootstrap);
+  _sa->refresh();
+  EXPECT_EQ(_set_service_calls, 1U);
+  EXPECT_EQ(_services.at(SERVICE_ID)->content_streams().at("watchfolder/1080p/index.m3u8"), hd);
+}
+
+TEST_F(ServiceAnnouncementTest, UpdatesChangedSession) {
+  auto bootstrap = MBMS_RT::Test::read_fixture("bootstrap.multipart");
+  _sa->parse_bootstrap(bootstrap);
+  auto service = _services.at(SERVICE_ID);
+  auto sd = service->content_streams().at("watchfolder/720p/index.m3u8");
+
+  auto pos = bootstrap.find("a=flute-tsi:2");
+  ASSERT_NE(pos, std::string::npos);
+  bootstrap.replace(pos, 13, "a=flute-tsi:3");
+  _sa->parse_bootstrap(bootstrap);
+
+  ASSERT_EQ(_services.at(SERVICE_ID), service);
+  auto updated = service->content_streams().at("watchfolder/720p/index.m3u8");
+  EXPECT_NE(updated, sd);
+  EXPECT_EQ(updated->flute_info(), "FLUTE/UDP: 238.1.1.112:40102, TSI 3");
+}
+
+TEST_F(ServiceAnnouncementTest, RemovesServiceThatIsNoLongerAnnounced) {
+  auto bootstrap = MBMS_RT::Test::read_fixture("bootstrap.multipart");
+  _sa->parse_bootstrap(bootstrap);
+  ASSERT_EQ(_services.count(SERVICE_ID), 1U);
+
+  // drop the USD bundle
+  auto start = bootstrap.find("----boundary_at_1700000000_0\nContent-Type: application/mbms-user-service-description+xml");
+  auto end = bootstrap.find("----boundary_at_1700000000_0", start + 1);
+  ASSERT_NE(start, std::string::npos);
+  ASSERT_NE(end, std::string::npos);
+  bootstrap.erase(start, end - start);
+  _sa->parse_bootstrap(bootstrap);
+
+  EXPECT_EQ(_services.count(SERVICE_ID), 0U);
+  EXPECT_EQ(_sa->items().count("http://localhost/watchfolder/bundle.xml"), 0U);
+}
@@ -0,0 +1,38 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace MBMS_RT::Test {
+  /**
+   * Reads a file from test/fixtures
+   */
+  inline auto read_fixture(const std::string& name) -> std::string {
+    std::ifstream file(std::string(MW_TEST_FIXTURES) + "/" + name, std::ios::binary);
+    if (!file) {
+      throw std::runtime_error("Cannot open test fixture " + name);
+    }
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+  }
+}
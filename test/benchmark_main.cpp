@@ -0,0 +1,165 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+// Runs the microbenchmarks and compares the real time of each benchmark with its stored baseline. With repetitions,
+// the median is compared. Fails if a benchmark is slower than its baseline by more than the threshold.
+//
+//   mw-microbench --baseline=test/baselines.txt [--threshold=0.25] [--update-baseline] [benchmark options]
+//
+// Baselines depend on the machine. Record them with --update-baseline on the machine that runs ctest.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+namespace {
+  class BaselineReporter : public benchmark::ConsoleReporter {
+    public:
+      void ReportRuns(const std::vector<Run>& runs) override {
+        for (const auto& run : runs) {
+          if (run.error_occurred) {
+            continue;
+          }
+          auto ns = run.GetAdjustedRealTime() * 1e9 / benchmark::GetTimeUnitMultiplier(run.time_unit);
+          if (run.run_type == Run::RT_Aggregate) {
+            if (run.aggregate_name == "median") {
+              _medians[run.run_name.str()] = ns;
+            }
+          } else {
+            _results[run.run_name.str()] = ns;
+          }
+        }
+        ConsoleReporter::ReportRuns(runs);
+      }
+
+      // real time per iteration in ns
+      auto results() const -> std::map<std::string, double> {
+        auto results = _results;
+        for (const auto& median : _medians) {
+          results[median.first] = median.second;
+        }
+        return results;
+      }
+
+    private:
+      std::map<std::string, double> _results;
+      std::map<std::string, double> _medians;
+  };
+
+  auto read_baselines(const std::string& path) -> std::map<std::string, double> {
+    std::map<std::string, double> baselines;
+    std::ifstream file(path);
+    for (std::string line; std::getline(file, line);) {
+      if (line.empty() || line[0] == '#') {
+        continue;
+      }
+      std::istringstream iss(line);
+      std::string name;
+      double ns = 0;
+      if (iss >> name >> ns) {
+        baselines[name] = ns;
+      }
+    }
+    return baselines;
+  }
+
+  auto write_baselines(const std::string& path, const std::map<std::string, double>& baselines) -> bool {
+    std::ofstream file(path);
+    file << "# Real time per iteration in ns, recorded with mw-microbench --update-baseline\n";
+    for (const auto& baseline : baselines) {
+      file << baseline.first << " " << static_cast<uint64_t>(baseline.second + 0.5) << "\n";
+    }
+    return static_cast<bool>(file);
+  }
+}
+
+int main(int argc, char** argv) {
+  std::string baseline_path;
+  double threshold = 0.25;
+  bool update = false;
+
+  // remove our options before Google Benchmark checks for unrecognized arguments
+  int args = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--baseline=", 11) == 0) {
+      baseline_path = argv[i] + 11;
+    } else if (strncmp(argv[i], "--threshold=", 12) == 0) {
+      threshold = atof(argv[i] + 12);
+    } else if (strcmp(argv[i], "--update-baseline") == 0) {
+      update = true;
+    } else {
+      argv[args++] = argv[i];
+    }
+  }
+  argc = args;
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  BaselineReporter reporter;
+  benchmark::RunSpecifiedBenchmarks(&reporter);
+  benchmark::Shutdown();
+
+  if (baseline_path.empty()) {
+    return 0;
+  }
+  auto baselines = read_baselines(baseline_path);
+  auto results = reporter.results();
+
+  if (update) {
+    for (const auto& result : results) {
+      baselines[result.first] = result.second;
+    }
+    if (!write_baselines(baseline_path, baselines)) {
+      fprintf(stderr, "Cannot write baselines to %s\n", baseline_path.c_str());
+      return 1;
+    }
+    printf("Recorded %zu baselines in %s\n", results.size(), baseline_path.c_str());
+    return 0;
+  }
+
+  unsigned regressions = 0;
+  printf("\n%-45s %12s %12s %8s\n", "Benchmark", "Baseline", "Current", "Change");
+  for (const auto& result : results) {
+    auto baseline = baselines.find(result.first);
+    if (baseline == baselines.end() || baseline->second <= 0) {
+      printf("%-45s %12s %10.0fns %8s\n", result.first.c_str(), "-", result.second, "-");
+      continue;
+    }
+    auto change = result.second / baseline->second - 1;
+    bool regression = change > threshold;
+    printf("%-45s %10.0fns %10.0fns %+7.1f%%%s\n", result.first.c_str(), baseline->second, result.second,
+        change * 100, regression ? "  REGRESSION" : "");
+    if (regression) {
+      regressions++;
+    }
+  }
+  if (regressions > 0) {
+    printf("\n%u benchmarks are more than %.0f%% slower than their baseline\n", regressions, threshold * 100);
+    return 1;
+  }
+  return 0;
+}
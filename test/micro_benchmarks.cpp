@@ -0,0 +1,129 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+// Microbenchmarks of the hot paths of service announcement and cache handling. They are run by ctest together
+// with the playlist benchmarks in bench/playlist_parse.cpp and compared with the stored baselines (see
+// benchmark_main.cpp).
+
+#include <ctime>
+#include <memory>
+#include <string>
+#include <libconfig.h++>
+#include <boost/asio.hpp>
+#include <benchmark/benchmark.h>
+
+#include "HlsPrimaryPlaylist.h"
+#include "MultipartSplitter.h"
+#include "ContentStream.h"
+#include "CacheManagement.h"
+#include "ServiceAnnouncement.h"
+#include "FluteCapture.h"
+#include "TestData.h"
+
+namespace {
+  class BenchItem : public MBMS_RT::CacheItem {
+    public:
+      BenchItem(const std::string& content_location, unsigned long received_at)
+        : CacheItem(content_location, received_at) {}
+
+      ItemType item_type() const override { return ItemType::Segment; };
+      char* buffer() const override { return nullptr; };
+      uint32_t content_length() const override { return 50000; };
+      MBMS_RT::ItemSource item_source() const override { return MBMS_RT::ItemSource::Broadcast; };
+  };
+
+  void BM_HlsPrimaryPlaylistParse(benchmark::State& state) {
+    std::string content = "#EXTM3U\n#EXT-X-VERSION:3\n";
+    for (int i = 0; i < state.range(0); i++) {
+      content += "#EXT-X-STREAM-INF:BANDWIDTH=" + std::to_string(1000000 * (i + 1)) +
+        ",AVERAGE-BANDWIDTH=900000,RESOLUTION=1920x1080,FRAME-RATE=50.000,CODECS=\"avc1.640028,mp4a.40.2\","
+        "AUDIO=\"aac\"\nvariant-" + std::to_string(i) + "/index.m3u8\n";
+    }
+    for (auto _ : state) {
+      MBMS_RT::HlsPrimaryPlaylist playlist(content, "watchfolder/");
+      benchmark::DoNotOptimize(playlist.streams().data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+  }
+  BENCHMARK(BM_HlsPrimaryPlaylistParse)->Arg(1)->Arg(8);
+
+  void BM_MultipartSplit(benchmark::State& state) {
+    auto content = MBMS_RT::Test::read_fixture("bootstrap.multipart");
+    MBMS_RT::MultipartSplitter splitter;
+    for (auto _ : state) {
+      splitter.reset();
+      splitter.feed(content);
+      benchmark::DoNotOptimize(splitter.parts().data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * content.size()));
+  }
+  BENCHMARK(BM_MultipartSplit);
+
+  void BM_ContentStreamSdp(benchmark::State& state) {
+    libconfig::Config cfg;
+    boost::asio::io_service io_service;
+    MBMS_RT::CacheManagement cache(cfg, io_service);
+    const std::string sdp = "v=0\r\no=5GMAG 1700000000 1 IN IP4 10.10.10.1\r\ns=5G-MAG Sample Service 1080p\r\n"
+      "t=0 0\r\nc=IN IP4 238.1.1.111/255\r\nm=application 40101 FLUTE/UDP 0\r\na=flute-tsi:1\r\na=flute-ch:1\r\n"
+      "a=source-filter: incl IN IP4 238.1.1.111 10.10.10.1\r\n";
+    for (auto _ : state) {
+      MBMS_RT::ContentStream stream("http://localhost/watchfolder/hls-1080p.m3u8", "lo", io_service, cache,
+          MBMS_RT::DeliveryProtocol::HLS, cfg);
+      benchmark::DoNotOptimize(stream.configure_5gbc_delivery_from_sdp(sdp));
+    }
+  }
+  BENCHMARK(BM_ContentStreamSdp);
+
+  void BM_CacheExpiryCheck(benchmark::State& state) {
+    libconfig::Config cfg;
+    boost::asio::io_service io_service;
+    MBMS_RT::CacheManagement cache(cfg, io_service);
+    // nothing expires and everything fits (the default limit is 512 MB), every check scans all items
+    auto now = time(nullptr);
+    for (int i = 0; i < state.range(0); i++) {
+      cache.add_item(std::make_shared<BenchItem>("watchfolder/1080p/segment-" + std::to_string(i) + ".m4s",
+            now - i % 20));
+    }
+    for (auto _ : state) {
+      cache.check_file_expiry_and_cache_size();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+  }
+  BENCHMARK(BM_CacheExpiryCheck)->Arg(1000)->Arg(10000);
+
+  void BM_ServiceAnnouncementParse(benchmark::State& state) {
+    libconfig::Config cfg;
+    cfg.readString("mw = { capture = { replay = { enabled = true; }; }; };");
+    MBMS_RT::FluteCapture::instance().configure(cfg);
+    boost::asio::io_service io_service;
+    boost::asio::io_service::strand strand(io_service);
+    MBMS_RT::CacheManagement cache(cfg, io_service);
+    std::shared_ptr<MBMS_RT::Service> service;
+    MBMS_RT::ServiceAnnouncement sa(cfg, "", "", 0, "lo", io_service, strand, cache, false,
+        [&service](const std::string&) { return service; },
+        [&service](const std::string&, std::shared_ptr<MBMS_RT::Service> s) { service = std::move(s); });
+    auto content = MBMS_RT::Test::read_fixture("bootstrap.multipart");
+    sa.parse_bootstrap(content);
+    for (auto _ : state) {
+      // all items are parsed again, the running streams are kept
+      sa.refresh();
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * content.size()));
+  }
+  BENCHMARK(BM_ServiceAnnouncementParse);
+}